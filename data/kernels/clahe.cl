@@ -0,0 +1,153 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma OPENCL EXTENSION cl_khr_local_int32_base_atomics : enable
+
+#include "common.h"
+#include "colorspace.cl"
+
+/*
+ * tiled mode of the local contrast (rlce) module, see process_tiled() in src/iop/clahe.c for the host version.
+ */
+
+#define BINS 256
+
+float
+clahe_luminance(const float4 pixel)
+{
+  const float pmax = clamp(fmax(pixel.x, fmax(pixel.y, pixel.z)), 0.0f, 1.0f);
+  const float pmin = clamp(fmin(pixel.x, fmin(pixel.y, pixel.z)), 0.0f, 1.0f);
+  return (pmax + pmin) * 0.5f;
+}
+
+int
+clahe_bin(const float4 pixel)
+{
+  return (int)(clahe_luminance(pixel) * (float)BINS + 0.5f);
+}
+
+/* one work group per tile: histogram in local memory, then the first work item clips it and writes the
+ * normalized cdf of the tile to map[tile * (BINS + 1) + bin] */
+kernel void
+clahe_histogram(read_only image2d_t in, global float *map, const int width, const int height, const int tile,
+                const int nx, const int ox, const int oy, const float slope)
+{
+  local int hist[BINS + 1];
+  local int clippedhist[BINS + 1];
+
+  const int lid = get_local_id(0);
+  const int lsz = get_local_size(0);
+  const int t = get_group_id(0);
+  // the grid starts ox, oy pixels before the buffer, see tile_offset() in clahe.c
+  const int xMin = max((t % nx) * tile - ox, 0);
+  const int yMin = max((t / nx) * tile - oy, 0);
+  const int w = min((t % nx + 1) * tile - ox, width) - xMin;
+  const int h = min((t / nx + 1) * tile - oy, height) - yMin;
+
+  for(int b = lid; b <= BINS; b += lsz) hist[b] = 0;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for(int k = lid; k < w * h; k += lsz)
+  {
+    const int y = k / w;
+    const int x = k - y * w;
+    const float4 pixel = read_imagef(in, sampleri, (int2)(xMin + x, yMin + y));
+    atomic_inc(hist + clahe_bin(pixel));
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  if(lid != 0) return;
+
+  /* clip histogram and redistribute clipped entries */
+  const int limit = (int)(slope * (w * h) / BINS + 0.5f);
+  for(int b = 0; b <= BINS; b++) clippedhist[b] = hist[b];
+  int ce = 0, ceb = 0;
+  do
+  {
+    ceb = ce;
+    ce = 0;
+    for(int b = 0; b <= BINS; b++)
+    {
+      const int d = clippedhist[b] - limit;
+      if(d > 0)
+      {
+        ce += d;
+        clippedhist[b] = limit;
+      }
+    }
+
+    const int d = (int)(ce / (float)(BINS + 1));
+    const int m = ce % (BINS + 1);
+    for(int b = 0; b <= BINS; b++) clippedhist[b] += d;
+
+    if(m != 0)
+    {
+      const int s = (int)(BINS / (float)m);
+      for(int b = 0; b <= BINS; b += s) ++clippedhist[b];
+    }
+  } while(ce != ceb);
+
+  /* build cdf of clipped histogram */
+  int hMin = BINS;
+  for(int b = 0; b < hMin; b++)
+    if(clippedhist[b] != 0) hMin = b;
+
+  int cdfMax = 0;
+  for(int b = hMin; b <= BINS; b++) cdfMax += clippedhist[b];
+  const int cdfMin = clippedhist[hMin];
+
+  global float *tmap = map + t * (BINS + 1);
+  int cdf = 0;
+  for(int b = 0; b <= BINS; b++)
+  {
+    if(b >= hMin) cdf += clippedhist[b];
+    tmap[b] = cdfMax > cdfMin ? (cdf - cdfMin) / (float)(cdfMax - cdfMin) : b / (float)BINS;
+  }
+}
+
+/* bilinear interpolation between the mappings of the four closest tile centers */
+kernel void
+clahe_apply(read_only image2d_t in, write_only image2d_t out, global const float *map, const int width,
+            const int height, const int tile, const int nx, const int ny, const int ox, const int oy)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  const int v = clahe_bin(pixel);
+
+  const float fx = clamp((x + ox + 0.5f) / tile - 0.5f, 0.0f, (float)(nx - 1));
+  const float fy = clamp((y + oy + 0.5f) / tile - 0.5f, 0.0f, (float)(ny - 1));
+  const int x0 = (int)fx, x1 = min(x0 + 1, nx - 1);
+  const int y0 = (int)fy, y1 = min(y0 + 1, ny - 1);
+  const float wx = fx - x0, wy = fy - y0;
+
+  const float m00 = map[(y0 * nx + x0) * (BINS + 1) + v];
+  const float m01 = map[(y0 * nx + x1) * (BINS + 1) + v];
+  const float m10 = map[(y1 * nx + x0) * (BINS + 1) + v];
+  const float m11 = map[(y1 * nx + x1) * (BINS + 1) + v];
+  const float top = m00 + wx * (m01 - m00);
+  const float bottom = m10 + wx * (m11 - m10);
+
+  float4 hsl = RGB_2_HSL(pixel);
+  hsl.z = top + wy * (bottom - top);
+
+  write_imagef(out, (int2)(x, y), HSL_2_RGB(hsl));
+}
@@ -706,6 +706,24 @@ float thinplate(const float4 x, const float4 y)
   return r2 * fastlog(max(1e-8f, r2));
 }
 
+float4
+colorchecker_spline(const float4 ipixel, const int num_patches, global float4 *params)
+{
+  global float4 *source_Lab = params;
+  global float4 *coeff_Lab = params + num_patches;
+  global float4 *poly_Lab = params + 2 * num_patches;
+
+  float4 opixel = poly_Lab[0] + poly_Lab[1] * ipixel.x + poly_Lab[2] * ipixel.y + poly_Lab[3] * ipixel.z;
+
+  for(int k = 0; k < num_patches; k++)
+  {
+    const float phi = thinplate(ipixel, source_Lab[k]);
+    opixel += coeff_Lab[k] * phi;
+  }
+
+  return opixel;
+}
+
 kernel void
 colorchecker (read_only image2d_t in, write_only image2d_t out, const int width, const int height,
               const int num_patches, global float4 *params)
@@ -715,21 +733,62 @@ colorchecker (read_only image2d_t in, write_only image2d_t out, const int width,
 
   if(x >= width || y >= height) return;
 
-  global float4 *source_Lab = params;
-  global float4 *coeff_Lab = params + num_patches;
-  global float4 *poly_Lab = params + 2 * num_patches;
+  float4 ipixel = read_imagef(in, sampleri, (int2)(x, y));
+
+  const float w = ipixel.w;
+
+  float4 opixel = colorchecker_spline(ipixel, num_patches, params);
+
+  opixel.w = w;
+
+  write_imagef (out, (int2)(x, y), opixel);
+}
+
+/* the spline baked into a lut of n^3 nodes over L [0, 100], a and b [-128, 128], interpolated tetrahedrally.
+ * see lut_tetrahedron() in src/iop/colorchecker.c */
+kernel void
+colorchecker_lut (read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+                  const int num_patches, global float4 *params, global const float4 *lut, const int n)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
 
   float4 ipixel = read_imagef(in, sampleri, (int2)(x, y));
 
   const float w = ipixel.w;
 
-  float4 opixel = poly_Lab[0] + poly_Lab[1] * ipixel.x + poly_Lab[2] * ipixel.y + poly_Lab[3] * ipixel.z;
+  const float4 g = (ipixel - (float4)(0.0f, -128.0f, -128.0f, 0.0f))
+                   * (float4)((n - 1) / 100.0f, (n - 1) / 256.0f, (n - 1) / 256.0f, 0.0f);
 
-  for(int k = 0; k < num_patches; k++)
+  float4 opixel;
+  if(g.x >= 0.0f && g.x <= n - 1 && g.y >= 0.0f && g.y <= n - 1 && g.z >= 0.0f && g.z <= n - 1)
   {
-    const float phi = thinplate(ipixel, source_Lab[k]);
-    opixel += coeff_Lab[k] * phi;
+    const int4 c = min(convert_int4(g), (int4)(n - 2));
+    const float4 f = g - convert_float4(c);
+    const int sL = n * n, sa = n, sb = 1;
+
+    int v1, v2;
+    float f1, f2, f3;
+    if(f.x >= f.y)
+    {
+      if(f.y >= f.z)      { v1 = sL; v2 = sL + sa; f1 = f.x; f2 = f.y; f3 = f.z; }
+      else if(f.x >= f.z) { v1 = sL; v2 = sL + sb; f1 = f.x; f2 = f.z; f3 = f.y; }
+      else                { v1 = sb; v2 = sL + sb; f1 = f.z; f2 = f.x; f3 = f.y; }
+    }
+    else
+    {
+      if(f.z > f.y)       { v1 = sb; v2 = sa + sb; f1 = f.z; f2 = f.y; f3 = f.x; }
+      else if(f.z > f.x)  { v1 = sa; v2 = sa + sb; f1 = f.y; f2 = f.z; f3 = f.x; }
+      else                { v1 = sa; v2 = sL + sa; f1 = f.y; f2 = f.x; f3 = f.z; }
+    }
+
+    global const float4 *c000 = lut + c.x * sL + c.y * sa + c.z * sb;
+    opixel = (1.0f - f1) * c000[0] + (f1 - f2) * c000[v1] + (f2 - f3) * c000[v2] + f3 * c000[sL + sa + sb];
   }
+  else
+    opixel = colorchecker_spline(ipixel, num_patches, params);
 
   opixel.w = w;
 
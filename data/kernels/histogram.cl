@@ -0,0 +1,71 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma OPENCL EXTENSION cl_khr_global_int32_base_atomics : enable
+#pragma OPENCL EXTENSION cl_khr_local_int32_base_atomics : enable
+
+#include "common.h"
+
+/*
+ * per module histogram, see dt_histogram_helper() in src/common/histogram.c for the host version.
+ *
+ * every work group accumulates into its own histogram in local memory, striding over the
+ * (cropped) image, and adds its non-empty bins to the global result at the end. the bins
+ * are interleaved the same way as on the host: hist[4 * bin + channel].
+ *
+ * bin = clamp((pixel + shift) * scale, 0, bins - 1), rounded to nearest if rnd is set
+ * (rgb, Lab) and truncated otherwise (raw), like the host codepaths.
+ */
+kernel void
+histogram_collect(read_only image2d_t in, global unsigned int *hist, const int crop_x, const int crop_y,
+                  const int width, const int height, const int bins, const int channels,
+                  const float4 shift, const float4 scale, const int rnd, local unsigned int *lhist)
+{
+  const int lid = get_local_id(0);
+  const int lsz = get_local_size(0);
+
+  for(int k = lid; k < 4 * bins; k += lsz) lhist[k] = 0;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  const int npixels = width * height;
+  const float maxbin = bins - 1;
+
+  for(int p = get_global_id(0); p < npixels; p += get_global_size(0))
+  {
+    const int y = p / width;
+    const int x = p - y * width;
+    const float4 pixel = read_imagef(in, sampleri, (int2)(crop_x + x, crop_y + y));
+    const float4 f = clamp((pixel + shift) * scale, 0.0f, maxbin);
+    const int4 i = rnd ? convert_int4_sat_rte(f) : convert_int4_sat_rtz(f);
+
+    atomic_inc(lhist + 4 * i.x);
+    if(channels > 1)
+    {
+      atomic_inc(lhist + 4 * i.y + 1);
+      atomic_inc(lhist + 4 * i.z + 2);
+    }
+  }
+
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for(int k = lid; k < 4 * bins; k += lsz)
+  {
+    const unsigned int count = lhist[k];
+    if(count) atomic_add(hist + k, count);
+  }
+}
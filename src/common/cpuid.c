@@ -53,10 +53,19 @@ dt_cpu_flags_t dt_detect_cpu_features()
                  : "=a"(ax), "=c"(cx), "=d"(dx)                                                              \
                  : "0"(cmd))
 
+// same, but for the structured extended feature leaves which need ecx as subleaf and report in ebx
+#define cpuid_count(cmd, sub) \
+  __asm volatile("push %%" R_BX "\n"                                                                         \
+                 "cpuid\n"                                                                                   \
+                 "mov %%" R_BX ", %1\n"                                                                      \
+                 "pop %%" R_BX "\n"                                                                          \
+                 : "=a"(ax), "=S"(bx), "=c"(cx), "=d"(dx)                                                    \
+                 : "0"(cmd), "2"(sub))
+
 #ifdef __x86_64__
-  guint64 ax, cx, dx, tmp;
+  guint64 ax, bx, cx, dx, tmp;
 #else
-  guint32 ax, cx, dx, tmp;
+  guint32 ax, bx, cx, dx, tmp;
 #endif
 
   static dt_cpu_flags_t cpuflags = -1;
@@ -86,6 +95,7 @@ dt_cpu_flags_t dt_detect_cpu_features()
       /* Get the standard level */
       cpuid(0x00000000);
 
+      const guint32 max_level = ax;
       if(ax)
       {
         /* Request for standard features */
@@ -100,6 +110,24 @@ dt_cpu_flags_t dt_detect_cpu_features()
         if(cx & 0x00000200) cpuflags |= CPU_FLAG_SSSE3;
         if(cx & 0x00040000) cpuflags |= CPU_FLAG_SSE4_1;
         if(cx & 0x00080000) cpuflags |= CPU_FLAG_SSE4_2;
+
+        /* AVX needs the OS to save the ymm registers: osxsave and the xcr0 bits for xmm and ymm */
+        if((cx & 0x10000000) && (cx & 0x08000000))
+        {
+          guint32 xcr0_lo, xcr0_hi;
+          __asm volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+          if((xcr0_lo & 0x6) == 0x6)
+          {
+            cpuflags |= CPU_FLAG_AVX;
+
+            if(max_level >= 7)
+            {
+              /* Request for structured extended features */
+              cpuid_count(0x00000007, 0);
+              if(bx & 0x00000020) cpuflags |= CPU_FLAG_AVX2;
+            }
+          }
+        }
       }
 
       /* Are there extensions? */
@@ -134,12 +162,14 @@ dt_cpu_flags_t dt_detect_cpu_features()
     report("SSE4.1", CPU_FLAG_SSE4_1);
     report("SSE4.2", CPU_FLAG_SSE4_2);
     report("AVX", CPU_FLAG_AVX);
+    report("AVX2", CPU_FLAG_AVX2);
 #undef report
   }
 #endif
 
   return cpuflags;
 
+#undef cpuid_count
 #undef cpuid
 }
 #else
@@ -45,12 +45,14 @@
 #include "common/image.h"
 #include "common/image_cache.h"
 #include "common/imageio_module.h"
+#include "common/interpolation.h"
 #include "common/l10n.h"
 #include "common/mipmap_cache.h"
 #include "common/noiseprofiles.h"
 #include "common/opencl.h"
 #include "common/points.h"
 #include "common/resource_limits.h"
+#include "common/threadpool.h"
 #include "common/undo.h"
 #include "control/conf.h"
 #include "control/control.h"
@@ -75,6 +77,9 @@
 #include <sys/param.h>
 #include <sys/types.h>
 #include <unistd.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 #include <locale.h>
 
 #if defined(__SSE__)
@@ -295,15 +300,22 @@ static void dt_codepaths_init()
   {
 #ifdef HAVE_BUILTIN_CPU_SUPPORTS
     darktable.codepath.SSE2 = (__builtin_cpu_supports("sse") && __builtin_cpu_supports("sse2"));
+#ifdef HAVE_AVX2_CODEPATHS
+    darktable.codepath.AVX2 = __builtin_cpu_supports("avx2");
+#endif
 #else
     dt_cpu_flags_t flags = dt_detect_cpu_features();
     darktable.codepath.SSE2 = ((flags & (CPU_FLAG_SSE)) && (flags & (CPU_FLAG_SSE2)));
+#ifdef HAVE_AVX2_CODEPATHS
+    darktable.codepath.AVX2 = !!(flags & (CPU_FLAG_AVX2));
+#endif
 #endif
   }
 
   // second, apply overrides from conf
   // NOTE: all intrinsics sets can only be overridden to OFF
   if(!dt_conf_get_bool("codepaths/sse2")) darktable.codepath.SSE2 = 0;
+  if(!dt_conf_get_bool("codepaths/avx2") || !darktable.codepath.SSE2) darktable.codepath.AVX2 = 0;
 
   // last: do we have any intrinsics sets enabled?
   darktable.codepath._no_intrinsics = !(darktable.codepath.SSE2);
@@ -330,6 +342,23 @@ static void dt_codepaths_init()
   }
 }
 
+// startup trace, printed with -d perf: wall time of each phase of dt_init() since the previous one.
+static void _init_trace(double *wtime, const char *phase)
+{
+  const double now = dt_get_wtime();
+  dt_print(DT_DEBUG_PERF, "[init] %s took %.3f secs\n", phase, now - *wtime);
+  *wtime = now;
+}
+
+static void *_colorspaces_init_thread(void *arg)
+{
+  dt_pthread_setname("colorspaces");
+  const double start = dt_get_wtime();
+  darktable.color_profiles = dt_colorspaces_init();
+  *(double *)arg = dt_get_wtime() - start;
+  return NULL;
+}
+
 int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load_data, lua_State *L)
 {
   double start_wtime = dt_get_wtime();
@@ -498,6 +527,9 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
 #else
                "  SSE2 optimized codepath disabled\n"
 #endif
+#ifdef HAVE_AVX2_CODEPATHS
+               "  AVX2 optimized codepaths (runtime dispatched) built\n"
+#endif
 #ifdef _OPENMP
                "  OpenMP support enabled\n"
 #else
@@ -719,6 +751,9 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
     dt_print_mem_usage();
   }
 
+  double trace_wtime = start_wtime;
+  _init_trace(&trace_wtime, "command line");
+
   if(init_gui)
   {
     // I doubt that connecting to dbus for darktable-cli makes sense
@@ -761,6 +796,8 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   // set the interface language and prepare selection for prefs
   darktable.l10n = dt_l10n_init(init_gui);
 
+  _init_trace(&trace_wtime, "config");
+
   // we need this REALLY early so that error messages can be shown, however after gtk_disable_setlocale
   if(init_gui)
   {
@@ -792,16 +829,37 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
         // make sure to set this, otherwise the user will be nagged until he eventually agrees
         dt_conf_set_int("performance_configuration_version_completed", DT_CURRENT_PERFORMANCE_CONFIGURE_VERSION);
     }
+
+    _init_trace(&trace_wtime, "gtk");
   }
 
   // detect cpu features and decide which codepaths to enable
   dt_codepaths_init();
 
-  // get the list of color profiles
-  darktable.color_profiles = dt_colorspaces_init();
+  // how to place large buffers
+  gchar *alloc_mode = dt_conf_get_string("memory/large_buffers");
+  if(!g_strcmp0(alloc_mode, "huge pages"))
+    darktable.alloc_mode = DT_ALLOC_HUGE_PAGES;
+  else if(!g_strcmp0(alloc_mode, "huge pages, first touch"))
+    darktable.alloc_mode = DT_ALLOC_FIRST_TOUCH;
+  else
+    darktable.alloc_mode = DT_ALLOC_DEFAULT;
+  g_free(alloc_mode);
+
+  // get the list of color profiles. that doesn't need the database, so it runs while the database is opened.
+  pthread_t colorspaces_thread;
+  double colorspaces_time = 0.0;
+  const int colorspaces_async = !dt_pthread_create(&colorspaces_thread, _colorspaces_init_thread, &colorspaces_time);
+  if(!colorspaces_async) darktable.color_profiles = dt_colorspaces_init();
 
   // initialize the database
   darktable.db = dt_database_init(dbfilename_from_command, load_data);
+
+  if(colorspaces_async) pthread_join(colorspaces_thread, NULL);
+  dt_print(DT_DEBUG_PERF, "[init] color profiles took %.3f secs%s\n", colorspaces_time,
+           colorspaces_async ? " in parallel" : "");
+  _init_trace(&trace_wtime, "database");
+
   if(darktable.db == NULL)
   {
     printf("ERROR : cannot open database\n");
@@ -862,6 +920,8 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
     dt_pthread_mutex_init(&darktable.control->run_mutex, NULL);
   }
 
+  _init_trace(&trace_wtime, "control");
+
   // initialize collection query
   darktable.collection = dt_collection_new(NULL);
 
@@ -884,15 +944,30 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   dt_set_signal_handlers();
 #endif
 
+  _init_trace(&trace_wtime, "collection, pwstorage");
+
+  // without gui (darktable-cli) the benchmark which picks the scheduling profile is left to the next start with gui
   darktable.opencl = (dt_opencl_t *)calloc(1, sizeof(dt_opencl_t));
 #ifdef HAVE_OPENCL
-  dt_opencl_init(darktable.opencl, exclude_opencl, print_statistics);
+  dt_opencl_init(darktable.opencl, exclude_opencl, print_statistics, init_gui);
 #endif
+  _init_trace(&trace_wtime, "opencl");
+
+  // workers for dt_parallel_for(), the thread that starts a loop is the last one
+#ifdef _OPENMP
+  dt_threadpool_init(darktable.num_openmp_threads - 1);
+#else
+  dt_threadpool_init(g_get_num_processors() - 1);
+#endif
+  // whatever the gui thread hands out is waited for by the user
+  if(init_gui) dt_threadpool_set_priority(DT_TASK_INTERACTIVE);
 
   darktable.points = (dt_points_t *)calloc(1, sizeof(dt_points_t));
   dt_points_init(darktable.points, dt_get_num_threads());
 
-  darktable.noiseprofile_parser = dt_noiseprofile_init(noiseprofiles_from_command);
+  // maps the noise profiles compiled on an earlier run. if they need to be compiled from json, the gui does that
+  // in the background as it will need them soon, darktable-cli does it when an image asks for them.
+  dt_noiseprofile_init(noiseprofiles_from_command, init_gui);
 
   // must come before mipmap_cache, because that one will need to access
   // image dimensions stored in here:
@@ -902,6 +977,8 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   darktable.mipmap_cache = (dt_mipmap_cache_t *)calloc(1, sizeof(dt_mipmap_cache_t));
   dt_mipmap_cache_init(darktable.mipmap_cache);
 
+  _init_trace(&trace_wtime, "caches");
+
   // The GUI must be initialized before the views, because the init()
   // functions of the views depend on darktable.control->accels_* to register
   // their keyboard accelerators
@@ -911,21 +988,25 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
     darktable.gui = (dt_gui_gtk_t *)calloc(1, sizeof(dt_gui_gtk_t));
     if(dt_gui_gtk_init(darktable.gui)) return 1;
     dt_bauhaus_init();
+    _init_trace(&trace_wtime, "gui");
   }
   else
     darktable.gui = NULL;
 
   darktable.view_manager = (dt_view_manager_t *)calloc(1, sizeof(dt_view_manager_t));
   dt_view_manager_init(darktable.view_manager);
+  _init_trace(&trace_wtime, "views");
 
   // check whether we were able to load darkroom view. if we failed, we'll crash everywhere later on.
   if(!darktable.develop) return 1;
 
   darktable.imageio = (dt_imageio_t *)calloc(1, sizeof(dt_imageio_t));
   dt_imageio_init(darktable.imageio);
+  _init_trace(&trace_wtime, "imageio modules");
 
   // load the darkroom mode plugins once:
   dt_iop_load_modules_so();
+  _init_trace(&trace_wtime, "processing modules");
 
   if(init_gui)
   {
@@ -961,6 +1042,8 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
 
     // initialize undo struct
     darktable.undo = dt_undo_init();
+
+    _init_trace(&trace_wtime, "libs, view gui, keys");
   }
 
   if(darktable.unmuted & DT_DEBUG_MEMORY)
@@ -974,6 +1057,7 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
 /* init lua last, since it's user made stuff it must be in the real environment */
 #ifdef USE_LUA
   dt_lua_init(darktable.lua_state.state, lua_command);
+  _init_trace(&trace_wtime, "lua");
 #endif
 
   if(init_gui)
@@ -1034,7 +1118,7 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
     dt_control_crawler_show_image_list(changed_xmp_files);
   }
 
-  dt_print(DT_DEBUG_CONTROL, "[init] startup took %f seconds\n", dt_get_wtime() - start_wtime);
+  dt_print(DT_DEBUG_CONTROL | DT_DEBUG_PERF, "[init] startup took %f seconds\n", dt_get_wtime() - start_wtime);
 
   return 0;
 }
@@ -1086,9 +1170,12 @@ void dt_cleanup()
   free(darktable.conf);
   dt_points_cleanup(darktable.points);
   free(darktable.points);
+  dt_noiseprofile_cleanup();
   dt_iop_unload_modules_so();
   dt_opencl_cleanup(darktable.opencl);
   free(darktable.opencl);
+  dt_interpolation_cleanup_plan_cache();
+  dt_threadpool_cleanup();
 #ifdef HAVE_GPHOTO2
   dt_camctl_destroy((dt_camctl_t *)darktable.camctl);
 #endif
@@ -1142,6 +1229,35 @@ void dt_gettime(char *datetime, size_t datetime_len)
   dt_gettime_t(datetime, datetime_len, time(NULL));
 }
 
+#define DT_HUGE_PAGE_SIZE ((size_t)2 << 20)
+#define DT_PAGE_SIZE ((size_t)4096)
+
+// set while the thread runs a pixelpipe, see dt_alloc_set_pipe_thread()
+static __thread int _alloc_pipe_thread = 0;
+
+int dt_alloc_set_pipe_thread(const int pipe_thread)
+{
+  const int previous = _alloc_pipe_thread;
+  _alloc_pipe_thread = pipe_thread;
+  return previous;
+}
+
+#if defined(_OPENMP) && !defined(_WIN32)
+// modules mostly split their rows over the threads with schedule(static), which gives every thread one
+// contiguous part of the buffer. touching the pages the same way puts them on the numa node of the thread that
+// will work on them, instead of wherever the thread filling the buffer happens to run.
+static void _alloc_first_touch(char *const ptr, const size_t size)
+{
+  // elsewhere the buffer isn't worked on by an openmp team, and starting one would only cost. from a parallel
+  // region this would run on one thread only.
+  if(!_alloc_pipe_thread || omp_in_parallel()) return;
+
+  const size_t pages = (size + DT_PAGE_SIZE - 1) / DT_PAGE_SIZE;
+#pragma omp parallel for default(none) schedule(static)
+  for(size_t k = 0; k < pages; k++) ptr[k * DT_PAGE_SIZE] = 0;
+}
+#endif
+
 void *dt_alloc_align(size_t alignment, size_t size)
 {
 #if defined(__FreeBSD_version) && __FreeBSD_version < 700013
@@ -1150,7 +1266,18 @@ void *dt_alloc_align(size_t alignment, size_t size)
   return _aligned_malloc(size, alignment);
 #else
   void *ptr = NULL;
+  const int large = darktable.alloc_mode != DT_ALLOC_DEFAULT && size >= DT_ALLOC_LARGE;
+  if(large) alignment = MAX(alignment, DT_HUGE_PAGE_SIZE);
   if(posix_memalign(&ptr, alignment, size)) return NULL;
+  if(large)
+  {
+#if defined(MADV_HUGEPAGE)
+    madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+#ifdef _OPENMP
+    if(darktable.alloc_mode == DT_ALLOC_FIRST_TOUCH) _alloc_first_touch(ptr, size);
+#endif
+  }
   return ptr;
 #endif
 }
@@ -188,19 +188,30 @@ typedef enum dt_debug_thread_t
 typedef struct dt_codepath_t
 {
   unsigned int SSE2 : 1;
+  unsigned int AVX2 : 1; // only used for explicitly dispatched kernels, implies SSE2
   unsigned int _no_intrinsics : 1;
   unsigned int OPENMP_SIMD : 1; // always stays the last one
 } dt_codepath_t;
 
+// what dt_alloc_align() does with buffers of DT_ALLOC_LARGE bytes or more, see memory/large_buffers
+typedef enum dt_alloc_mode_t
+{
+  DT_ALLOC_DEFAULT = 0,
+  DT_ALLOC_HUGE_PAGES = 1, // aligned to and advised for transparent huge pages
+  DT_ALLOC_FIRST_TOUCH = 2 // the same, and the pages get placed by the threads that will work on them
+} dt_alloc_mode_t;
+
+#define DT_ALLOC_LARGE ((size_t)8 << 20)
+
 typedef struct darktable_t
 {
   dt_codepath_t codepath;
   int32_t num_openmp_threads;
+  dt_alloc_mode_t alloc_mode;
 
   int32_t unmuted;
   GList *iop;
   GList *capabilities;
-  JsonParser *noiseprofile_parser;
   struct dt_conf_t *conf;
   struct dt_develop_t *develop;
   struct dt_lib_t *lib;
@@ -252,7 +263,11 @@ void dt_cleanup();
 void dt_print(dt_debug_thread_t thread, const char *msg, ...) __attribute__((format(printf, 2, 3)));
 void dt_gettime_t(char *datetime, size_t datetime_len, time_t t);
 void dt_gettime(char *datetime, size_t datetime_len);
+/** aligned memory, free with dt_free_align(). large buffers are placed as set in darktable.alloc_mode. */
 void *dt_alloc_align(size_t alignment, size_t size);
+/** DT_ALLOC_FIRST_TOUCH only applies to the threads running a pixelpipe, which mark themselves with this.
+ * returns the previous state. */
+int dt_alloc_set_pipe_thread(const int pipe_thread);
 #ifdef _WIN32
 void dt_free_align(void *mem);
 #else
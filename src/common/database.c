@@ -54,6 +54,10 @@ typedef struct dt_database_t
   sqlite3 *handle;
 
   gchar *error_message, *error_dbfilename;
+
+  /* all threads share the connection, so only one of them can be in a transaction */
+  GRecMutex transaction_lock;
+  int transaction_depth; // of the thread holding transaction_lock
 } dt_database_t;
 
 
@@ -1568,6 +1572,7 @@ start:
 
   /* create database */
   dt_database_t *db = (dt_database_t *)g_malloc0(sizeof(dt_database_t));
+  g_rec_mutex_init(&db->transaction_lock);
   db->dbfilename_data = g_strdup(dbfilename_data);
   db->dbfilename_library = g_strdup(dbfilename_library);
 
@@ -1876,11 +1881,26 @@ void dt_database_destroy(const dt_database_t *db)
   }
   g_free(db->dbfilename_data);
   g_free(db->dbfilename_library);
+  g_rec_mutex_clear(&((dt_database_t *)db)->transaction_lock);
   g_free((dt_database_t *)db);
 
   sqlite3_shutdown();
 }
 
+void dt_database_start_transaction(const dt_database_t *db)
+{
+  dt_database_t *d = (dt_database_t *)db;
+  g_rec_mutex_lock(&d->transaction_lock);
+  if(d->transaction_depth++ == 0) DT_DEBUG_SQLITE3_EXEC(d->handle, "BEGIN", NULL, NULL, NULL);
+}
+
+void dt_database_release_transaction(const dt_database_t *db)
+{
+  dt_database_t *d = (dt_database_t *)db;
+  if(--d->transaction_depth == 0) DT_DEBUG_SQLITE3_EXEC(d->handle, "COMMIT", NULL, NULL, NULL);
+  g_rec_mutex_unlock(&d->transaction_lock);
+}
+
 sqlite3 *dt_database_get(const dt_database_t *db)
 {
   return db ? db->handle : NULL;
@@ -28,6 +28,14 @@ struct dt_database_t *dt_database_init(const char *alternative, const gboolean l
 void dt_database_destroy(const struct dt_database_t *);
 /** get handle */
 struct sqlite3 *dt_database_get(const struct dt_database_t *);
+/** BEGIN and COMMIT for code that can run in any thread. a thread starting a transaction while another one has
+ * one open waits for it to be released, nested ones become part of the outermost one. all code writing in
+ * batches has to go through these, a raw BEGIN fails while another thread holds a transaction.
+ * the connection is shared: plain statements from other threads don't wait, their writes become part of the
+ * open transaction and are committed or lost together with it. only the schema upgrades in dt_database_init()
+ * use BEGIN directly, nothing else can reach the database at that point. */
+void dt_database_start_transaction(const struct dt_database_t *db);
+void dt_database_release_transaction(const struct dt_database_t *db);
 /** Returns database path */
 const gchar *dt_database_get_path(const struct dt_database_t *db);
 /** test if database was already locked by another instance */
@@ -46,6 +46,8 @@ dwt_params_t *dt_dwt_init(float *image, const int width, const int height, const
   p->user_data = user_data;
   p->preview_scale = preview_scale;
   p->use_sse = use_sse;
+  p->cache = NULL;
+  p->cache_hash = 0;
 
   return p;
 }
@@ -57,6 +59,54 @@ void dt_dwt_free(dwt_params_t *p)
   free(p);
 }
 
+#define DWT_CACHE_MAX_SCALES 32
+
+struct dt_dwt_cache_t
+{
+  // key
+  uint64_t hash;
+  int width;
+  int height;
+  int ch;
+  float preview_scale;
+
+  // low pass images after scales 0..computed, the first one is the image itself. NULL if the cache is empty.
+  // the detail scales are the differences of two of them, so they don't need to be kept.
+  int computed;
+  float *lowpass[DWT_CACHE_MAX_SCALES + 1];
+
+  // buffers of a previous image of the same size, reused to avoid page faults on fresh allocations
+  int pooled;
+  float *pool[DWT_CACHE_MAX_SCALES + 1];
+};
+
+dt_dwt_cache_t *dt_dwt_cache_new(void)
+{
+  return (dt_dwt_cache_t *)calloc(1, sizeof(dt_dwt_cache_t));
+}
+
+static void _dwt_cache_clear(dt_dwt_cache_t *c)
+{
+  if(c->lowpass[0])
+    for(int i = 0; i <= c->computed; i++) dt_free_align(c->lowpass[i]);
+  for(int i = 0; i < c->pooled; i++) dt_free_align(c->pool[i]);
+  memset(c, 0, sizeof(dt_dwt_cache_t));
+}
+
+static float *_dwt_cache_alloc(dt_dwt_cache_t *c, const size_t size)
+{
+  if(c->pooled) return c->pool[--c->pooled];
+  return dt_alloc_align(64, size * sizeof(float));
+}
+
+void dt_dwt_cache_free(dt_dwt_cache_t *c)
+{
+  if(!c) return;
+
+  _dwt_cache_clear(c);
+  free(c);
+}
+
 static int _get_max_scale(const int width, const int height, const float preview_scale)
 {
   int maxscale = 0;
@@ -105,6 +155,14 @@ int dt_dwt_first_scale_visible(dwt_params_t *p)
   return _first_scale_visible(p->scales, p->preview_scale);
 }
 
+#ifdef HAVE_AVX2_CODEPATHS
+// runtime dispatched variants, compiled with -mavx2 in dwt_avx2.c
+void dwt_hat_transform_row_avx2(float *temp, const float *const base, const int size, const int sc);
+void dwt_hat_transform_col_avx2(float *const out, const float *const center, const float *const up,
+                                const float *const down, const size_t n);
+void dwt_subtract_layer_avx2(float *const bl, float *const bh, const size_t n);
+#endif
+
 #define INDEX_WT_IMAGE(index, num_channels, channel) (((index) * (num_channels)) + (channel))
 #define INDEX_WT_IMAGE_SSE(index, num_channels) ((index) * (num_channels))
 
@@ -149,6 +207,14 @@ static void dwt_hat_transform_sse(float *temp, const float *const base, const in
 static void dwt_hat_transform(float *temp, const float *const base, const int st, const int size, int sc,
                               dwt_params_t *const p)
 {
+#ifdef HAVE_AVX2_CODEPATHS
+  if(p->ch == 4 && p->use_sse && st == 1 && darktable.codepath.AVX2)
+  {
+    sc = (int)(sc * p->preview_scale);
+    dwt_hat_transform_row_avx2(temp, base, size, MIN(sc, size));
+    return;
+  }
+#endif
 #if defined(__SSE__)
   if(p->ch == 4 && p->use_sse)
   {
@@ -188,6 +254,55 @@ static void dwt_hat_transform(float *temp, const float *const base, const int st
   }
 }
 
+/* vertical hat transform of one row: out = 2 * center + up + down, with up and down the rows sc above and below */
+static void dwt_hat_transform_col(float *const out, const float *const center, const float *const up,
+                                  const float *const down, const size_t n, dwt_params_t *const p)
+{
+#ifdef HAVE_AVX2_CODEPATHS
+  if(p->use_sse && darktable.codepath.AVX2)
+  {
+    dwt_hat_transform_col_avx2(out, center, up, down, n);
+    return;
+  }
+#endif
+
+  const float hat_mult = 2.f;
+  for(size_t i = 0; i < n; i++) out[i] = hat_mult * center[i] + up[i] + down[i];
+}
+
+/* low pass of one scale, not yet divided by 16: bl = hat(bh) along both axes.
+ * the columns are done first, a whole row at a time from bh to bl, then the rows in place on bl going through
+ * temp, which needs room for one row per thread. */
+static void dwt_hat_transform_image(float *const bl, const float *const bh, float *const temp, const int lev,
+                                    dwt_params_t *const p)
+{
+  const size_t rowsize = (size_t)p->width * p->ch;
+  const int height = p->height;
+  const int sc = MIN((int)((1 << lev) * p->preview_scale), height);
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int row = 0; row < height; row++)
+  {
+    // same boundary handling as dwt_hat_transform()
+    const int up = (row < sc) ? sc - row : row - sc;
+    const int down = (row + sc < height) ? row + sc : 2 * height - 2 - (row + sc);
+    dwt_hat_transform_col(bl + row * rowsize, bh + row * rowsize, bh + up * rowsize, bh + down * rowsize, rowsize,
+                          p);
+  }
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int row = 0; row < height; row++)
+  {
+    float *const t = temp + dt_get_thread_num() * rowsize;
+    dwt_hat_transform(t, bl + row * rowsize, 1, p->width, 1 << lev, p);
+    memcpy(bl + row * rowsize, t, rowsize * sizeof(float));
+  }
+}
+
 #if defined(__SSE__)
 static void dwt_add_layer_sse(float *const img, float *layers, dwt_params_t *const p, const int n_scale)
 {
@@ -246,6 +361,13 @@ static void dwt_subtract_layer_sse(float *bl, float *bh, dwt_params_t *const p)
 
 static void dwt_subtract_layer(float *bl, float *bh, dwt_params_t *const p)
 {
+#ifdef HAVE_AVX2_CODEPATHS
+  if(p->use_sse && darktable.codepath.AVX2)
+  {
+    dwt_subtract_layer_avx2(bl, bh, (size_t)p->width * p->height * p->ch);
+    return;
+  }
+#endif
 #if defined(__SSE__)
   if(p->ch == 4 && p->use_sse)
   {
@@ -268,6 +390,83 @@ static void dwt_subtract_layer(float *bl, float *bh, dwt_params_t *const p)
   }
 }
 
+/* the low pass image of the next scale from the one of this scale, without touching the latter */
+static void dwt_scale_lowpass(float *bl, dwt_params_t *const p)
+{
+  const float lpass_mult = (1.f / 16.f);
+  const size_t size = (size_t)p->width * p->height * p->ch;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(bl) schedule(static)
+#endif
+  for(size_t i = 0; i < size; i++) bl[i] = bl[i] * lpass_mult;
+}
+
+/* detail scale between two cached low pass images */
+static void dwt_layer_difference(float *layer, const float *bh, const float *bl, dwt_params_t *const p)
+{
+  const size_t size = (size_t)p->width * p->height * p->ch;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(layer, bh, bl) schedule(static)
+#endif
+  for(size_t i = 0; i < size; i++) layer[i] = bh[i] - bl[i];
+}
+
+/* make the cache hold the decomposition of img, which p->cache_hash identifies. returns 0 if it can't be used. */
+static int _dwt_cache_lookup(dt_dwt_cache_t *c, const float *const img, dwt_params_t *const p)
+{
+  if(p->scales > DWT_CACHE_MAX_SCALES) return 0;
+
+  const size_t size = (size_t)p->width * p->height * p->ch;
+
+  if(c->lowpass[0] && c->hash == p->cache_hash && c->width == p->width && c->height == p->height
+     && c->ch == p->ch && c->preview_scale == p->preview_scale)
+    return 1;
+
+  if(c->lowpass[0] && c->width == p->width && c->height == p->height && c->ch == p->ch)
+  {
+    // same size, keep the buffers
+    for(int i = 0; i <= c->computed; i++)
+    {
+      c->pool[c->pooled++] = c->lowpass[i];
+      c->lowpass[i] = NULL;
+    }
+    c->computed = 0;
+  }
+  else
+    _dwt_cache_clear(c);
+
+  c->lowpass[0] = _dwt_cache_alloc(c, size);
+  if(c->lowpass[0] == NULL) return 0;
+  memcpy(c->lowpass[0], img, size * sizeof(float));
+
+  c->hash = p->cache_hash;
+  c->width = p->width;
+  c->height = p->height;
+  c->ch = p->ch;
+  c->preview_scale = p->preview_scale;
+  return 1;
+}
+
+/* make sure the low pass image after scale lev + 1 is cached. scales are requested in order, so only the next one
+ * is ever missing. */
+static int _dwt_cache_scale(dt_dwt_cache_t *c, const int lev, float *const temp, dwt_params_t *const p)
+{
+  if(lev < c->computed) return 1;
+
+  if(lev >= DWT_CACHE_MAX_SCALES) return 0;
+
+  float *lowpass = _dwt_cache_alloc(c, (size_t)p->width * p->height * p->ch);
+  if(lowpass == NULL) return 0;
+
+  dwt_hat_transform_image(lowpass, c->lowpass[lev], temp, lev, p);
+  dwt_scale_lowpass(lowpass, p);
+
+  c->lowpass[++c->computed] = lowpass;
+  return 1;
+}
+
 /* actual decomposing algorithm */
 static void dwt_wavelet_decompose(float *img, dwt_params_t *const p, _dwt_layer_func layer_func)
 {
@@ -278,11 +477,15 @@ static void dwt_wavelet_decompose(float *img, dwt_params_t *const p, _dwt_layer_
   float *buffer[2] = { 0, 0 };
   int bcontinue = 1;
   const int size = p->width * p->height * p->ch;
+  dt_dwt_cache_t *cache = p->cache;
 
   if(layer_func) layer_func(img, p, 0);
 
   if(p->scales <= 0) goto cleanup;
 
+  // with a cache the scales are copied to buffer[1] before layer_func gets them
+  if(cache && !_dwt_cache_lookup(cache, img, p)) cache = NULL;
+
   /* image buffers */
   buffer[0] = img;
   /* temporary storage */
@@ -294,14 +497,13 @@ static void dwt_wavelet_decompose(float *img, dwt_params_t *const p, _dwt_layer_
   }
   memset(buffer[1], 0, size * sizeof(float));
 
-  // setup a temp buffer
-  temp = dt_alloc_align(64, MAX(p->width, p->height) * p->ch * sizeof(float));
+  // setup a temp buffer, one row per thread
+  temp = dt_alloc_align(64, (size_t)p->width * p->ch * dt_get_num_threads() * sizeof(float));
   if(temp == NULL)
   {
     printf("not enough memory for wavelet decomposition");
     goto cleanup;
   }
-  memset(temp, 0, MAX(p->width, p->height) * p->ch * sizeof(float));
 
   // buffer to reconstruct the image
   layers = dt_alloc_align(64, p->width * p->height * p->ch * sizeof(float));
@@ -328,25 +530,24 @@ static void dwt_wavelet_decompose(float *img, dwt_params_t *const p, _dwt_layer_
   hpass = 0;
   for(unsigned int lev = 0; lev < p->scales && bcontinue; lev++)
   {
-    lpass = (1 - (lev & 1));
-
-    for(int row = 0; row < p->height; row++)
-    {
-      dwt_hat_transform(temp, buffer[hpass] + (row * p->width * p->ch), 1, p->width, 1 << lev, p);
-      memcpy(&(buffer[lpass][row * p->width * p->ch]), temp, p->width * p->ch * sizeof(float));
-    }
-
-    for(int col = 0; col < p->width; col++)
+    if(cache)
     {
-      dwt_hat_transform(temp, buffer[lpass] + col * p->ch, p->width, p->height, 1 << lev, p);
-      for(int row = 0; row < p->height; row++)
+      if(!_dwt_cache_scale(cache, lev, temp, p))
       {
-        for(int c = 0; c < p->ch; c++)
-          buffer[lpass][INDEX_WT_IMAGE(row * p->width + col, p->ch, c)] = temp[INDEX_WT_IMAGE(row, p->ch, c)];
+        printf("not enough memory for wavelet decomposition");
+        goto cleanup;
       }
+      // a scale computed now and one cached by an earlier run come out the same
+      hpass = 1;
+      dwt_layer_difference(buffer[hpass], cache->lowpass[lev], cache->lowpass[lev + 1], p);
     }
+    else
+    {
+      lpass = (1 - (lev & 1));
 
-    dwt_subtract_layer(buffer[lpass], buffer[hpass], p);
+      dwt_hat_transform_image(buffer[lpass], buffer[hpass], temp, lev, p);
+      dwt_subtract_layer(buffer[lpass], buffer[hpass], p);
+    }
 
     // no merge scales or we didn't reach the merge scale from yet
     if(p->merge_from_scale == 0 || p->merge_from_scale > lev + 1)
@@ -394,6 +595,13 @@ static void dwt_wavelet_decompose(float *img, dwt_params_t *const p, _dwt_layer_
   // all scales have been processed
   if(bcontinue)
   {
+    if(cache)
+    {
+      // the residual is kept as it is, also when a previous run went to more scales
+      hpass = 1;
+      memcpy(buffer[hpass], cache->lowpass[p->scales], size * sizeof(float));
+    }
+
     // allow to process residual image
     if(layer_func) layer_func(buffer[hpass], p, p->scales + 1);
 
@@ -19,6 +19,11 @@
 #ifndef DT_DEVELOP_DWT_H
 #define DT_DEVELOP_DWT_H
 
+#include <stdint.h>
+
+/* detail scales of the last image decomposed with it, see dt_dwt_cache_new() */
+typedef struct dt_dwt_cache_t dt_dwt_cache_t;
+
 /* structure returned by dt_dwt_init() to be used when calling dwt_decompose() */
 typedef struct dwt_params_t
 {
@@ -32,6 +37,8 @@ typedef struct dwt_params_t
   void *user_data;
   float preview_scale;
   int use_sse;
+  dt_dwt_cache_t *cache;
+  uint64_t cache_hash; // identifies the image after layer_func on scale 0, set along with cache
 } dwt_params_t;
 
 /* function prototype for the layer_func on dwt_decompose() call */
@@ -55,6 +62,20 @@ dwt_params_t *dt_dwt_init(float *image, const int width, const int height, const
 /* free resources used by dwt_decompose() */
 void dt_dwt_free(dwt_params_t *p);
 
+/* returns an empty cache to be set as dwt_params_t.cache, free it with dt_dwt_cache_free()
+ * the cache keeps the low pass images of every scale of the last decomposition, keyed by dwt_params_t.cache_hash,
+ * which the caller sets to something that identifies the image after layer_func has been called on scale 0, like
+ * the pipe hash of the module's input. when the next dwt_decompose() has the same key only the scales that were
+ * not computed before are transformed. the detail scales are always taken as the difference of two cached low
+ * pass images before being handed to layer_func, so the result doesn't depend on what was cached. scales are
+ * computed on demand, so previewing a single detail scale stops at that scale. this costs one image per cached
+ * scale, so it's meant for interactive pipes.
+ */
+dt_dwt_cache_t *dt_dwt_cache_new(void);
+
+/* free the cache and all cached scales */
+void dt_dwt_cache_free(dt_dwt_cache_t *c);
+
 /* returns the maximum number of scales that dwt_decompose() will accept for the current image size */
 int dwt_get_max_scale(dwt_params_t *p);
 
@@ -0,0 +1,100 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// this file is compiled with -mavx2. nothing in here may be called unless
+// darktable.codepath.AVX2 is set, see dwt_hat_transform() and friends in dwt.c.
+
+#include <immintrin.h>
+#include <stddef.h>
+
+void dwt_hat_transform_row_avx2(float *temp, const float *const base, const int size, const int sc);
+void dwt_hat_transform_col_avx2(float *const out, const float *const center, const float *const up,
+                                const float *const down, const size_t n);
+void dwt_subtract_layer_avx2(float *const bl, float *const bh, const size_t n);
+
+static inline __m128 hat4(const float *const center, const float *const left, const float *const right)
+{
+  return _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.f), _mm_load_ps(center)), _mm_load_ps(left)),
+                    _mm_load_ps(right));
+}
+
+/** hat transform of one line of 4 channel pixels, see dwt_hat_transform_sse() in dwt.c. away from the mirrored
+ * borders the neighbours of two adjacent pixels are adjacent too, so two pixels go into one vector. */
+void dwt_hat_transform_row_avx2(float *temp, const float *const base, const int size, const int sc)
+{
+  const __m256 hat_mult = _mm256_set1_ps(2.f);
+  int i = 0;
+
+  for(; i < sc; i++, temp += 4) _mm_store_ps(temp, hat4(base + 4 * i, base + 4 * (sc - i), base + 4 * (i + sc)));
+
+  for(; i + 1 + sc < size; i += 2, temp += 8)
+  {
+    const __m256 center = _mm256_loadu_ps(base + 4 * i);
+    const __m256 left = _mm256_loadu_ps(base + 4 * (i - sc));
+    const __m256 right = _mm256_loadu_ps(base + 4 * (i + sc));
+    _mm256_storeu_ps(temp, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(hat_mult, center), left), right));
+  }
+
+  for(; i + sc < size; i++, temp += 4) _mm_store_ps(temp, hat4(base + 4 * i, base + 4 * (i - sc), base + 4 * (i + sc)));
+
+  for(; i < size; i++, temp += 4)
+    _mm_store_ps(temp, hat4(base + 4 * i, base + 4 * (i - sc), base + 4 * (2 * size - 2 - (i + sc))));
+}
+
+/** vertical hat transform of one row, out = 2 * center + up + down over n floats. */
+void dwt_hat_transform_col_avx2(float *const out, const float *const center, const float *const up,
+                                const float *const down, const size_t n)
+{
+  const __m256 hat_mult = _mm256_set1_ps(2.f);
+  size_t i = 0;
+
+  for(; i + 8 <= n; i += 8)
+  {
+    const __m256 c = _mm256_loadu_ps(center + i);
+    _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(hat_mult, c), _mm256_loadu_ps(up + i)),
+                                            _mm256_loadu_ps(down + i)));
+  }
+  for(; i < n; i++) out[i] = 2.f * center[i] + up[i] + down[i];
+}
+
+/** bl = bl / 16, bh = bh - bl over n floats. */
+void dwt_subtract_layer_avx2(float *const bl, float *const bh, const size_t n)
+{
+  const __m256 lpass_mult = _mm256_set1_ps(1.f / 16.f);
+  const size_t n8 = n & ~(size_t)7;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(size_t i = 0; i < n8; i += 8)
+  {
+    // rounding errors introduced here (division by 16)
+    const __m256 l = _mm256_mul_ps(_mm256_load_ps(bl + i), lpass_mult);
+    _mm256_store_ps(bl + i, l);
+    _mm256_store_ps(bh + i, _mm256_sub_ps(_mm256_load_ps(bh + i), l));
+  }
+  for(size_t i = n8; i < n; i++)
+  {
+    bl[i] = bl[i] * (1.f / 16.f);
+    bh[i] -= bl[i];
+  }
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -2101,36 +2101,96 @@ static void add_mask_entries_to_db(int imgid, GHashTable *mask_entries, int mask
   add_mask_entry_to_db(imgid, entry);
 }
 
-// need a write lock on *img (non-const) to write stars (and soon color labels).
-int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_only)
+// a parsed sidecar, everything that can be done without the database
+struct dt_exif_xmp_t
+{
+  std::unique_ptr<Exiv2::Image> image;
+  char *filename;
+  int version;
+  bool is_a_dt_xmp;
+  GList *history_entries;
+  GHashTable *mask_entries;
+};
+
+void dt_exif_xmp_free(dt_exif_xmp_t *xmp)
+{
+  if(!xmp) return;
+  g_list_free_full(xmp->history_entries, free_history_entry);
+  if(xmp->mask_entries) g_hash_table_destroy(xmp->mask_entries);
+  g_free(xmp->filename);
+  delete xmp;
+}
+
+dt_exif_xmp_t *dt_exif_xmp_parse(const char *filename)
 {
   // exclude pfm to avoid stupid errors on the console
   const char *c = filename + strlen(filename) - 4;
-  if(c >= filename && !strcmp(c, ".pfm")) return 1;
+  if(c >= filename && !strcmp(c, ".pfm")) return NULL;
+
+  dt_exif_xmp_t *xmp = new dt_exif_xmp_t();
+  xmp->filename = g_strdup(filename);
   try
   {
     // read xmp sidecar
-    std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(filename)));
-    assert(image.get() != 0);
-    read_metadata_threadsafe(image);
-    Exiv2::XmpData &xmpData = image->xmpData();
-
-    sqlite3_stmt *stmt;
+    xmp->image = std::unique_ptr<Exiv2::Image>(Exiv2::ImageFactory::open(WIDEN(filename)));
+    assert(xmp->image.get() != 0);
+    read_metadata_threadsafe(xmp->image);
+    Exiv2::XmpData &xmpData = xmp->image->xmpData();
 
     Exiv2::XmpData::iterator pos;
-
-    int version = 0;
     if((pos = xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.xmp_version"))) != xmpData.end())
-      version = pos->toLong();
+      xmp->version = pos->toLong();
+
+    // otherwise we ignore title, description, ... from non-dt xmp files :(
+    size_t ns_pos = xmp->image->xmpPacket().find("xmlns:darktable=\"http://darktable.sf.net/\"");
+    xmp->is_a_dt_xmp = (ns_pos != std::string::npos);
 
-    if(!history_only)
+    // read the masks from the file first so we can add them to the db while reading history entries
+    xmp->mask_entries = read_masks(xmpData, filename);
+
+    if(xmp->version < 2)
     {
-      // otherwise we ignore title, description, ... from non-dt xmp files :(
-      size_t ns_pos = image->xmpPacket().find("xmlns:darktable=\"http://darktable.sf.net/\"");
-      bool is_a_dt_xmp = (ns_pos != std::string::npos);
-      dt_exif_read_xmp_data(img, xmpData, is_a_dt_xmp ? version : -1, false);
+      std::string &xmpPacket = xmp->image->xmpPacket();
+      xmp->history_entries = read_history_v1(xmpPacket, filename, 0);
+      if(!xmp->history_entries) // didn't work? try super old version with rdf:Bag
+        xmp->history_entries = read_history_v1(xmpPacket, filename, 1);
     }
+    else if(xmp->version == 2)
+      xmp->history_entries = read_history_v2(xmpData, filename);
+  }
+  catch(Exiv2::AnyError &e)
+  {
+    // actually nobody's interested in that if the file doesn't exist:
+    // std::string s(e.what());
+    // std::cerr << "[exiv2] " << filename << ": " << s << std::endl;
+    dt_exif_xmp_free(xmp);
+    return NULL;
+  }
+  return xmp;
+}
 
+static void reset_mask_entry(gpointer key, gpointer value, gpointer user_data)
+{
+  ((mask_entry_t *)value)->already_added = FALSE;
+}
+
+// need a write lock on *img (non-const) to write stars (and soon color labels).
+int dt_exif_xmp_apply(dt_exif_xmp_t *xmp, dt_image_t *img, const int history_only)
+{
+  sqlite3_stmt *stmt = NULL;
+  gboolean all_ok = TRUE;
+  int num = 0;
+
+  // a savepoint inside the transaction, so that a broken file can be rolled back also when this is part of a
+  // bigger one
+  dt_database_start_transaction(darktable.db);
+  sqlite3_exec(dt_database_get(darktable.db), "SAVEPOINT xmp_apply", NULL, NULL, NULL);
+  try
+  {
+    Exiv2::XmpData &xmpData = xmp->image->xmpData();
+    Exiv2::XmpData::iterator pos;
+
+    if(!history_only) dt_exif_read_xmp_data(img, xmpData, xmp->is_a_dt_xmp ? xmp->version : -1, false);
 
     // convert legacy flip bits (will not be written anymore, convert to flip history item here):
     if((pos = xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.raw_params"))) != xmpData.end())
@@ -2161,6 +2221,16 @@ int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_on
     // when we are reading the xmp data it doesn't make sense to flag the image as removed
     img->flags &= ~DT_IMAGE_REMOVE;
 
+    if(xmp->version > 2)
+    {
+      std::cerr << "error: Xmp schema version " << xmp->version << " in " << xmp->filename << " not supported"
+                << std::endl;
+      all_ok = FALSE;
+      goto end;
+    }
+
+    // the same parsed file may be applied to several images
+    g_hash_table_foreach(xmp->mask_entries, reset_mask_entry, NULL);
 
     // masks
     // clean all old masks for this image
@@ -2169,39 +2239,13 @@ int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_on
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->id);
     sqlite3_step(stmt);
     sqlite3_finalize(stmt);
-
-    // read the masks from the file first so we can add them to the db while reading history entries
-    GHashTable *mask_entries = read_masks(xmpData, filename);
+    stmt = NULL;
 
     // now add all masks that are not used for cloning. keeping them might be useful.
     // TODO: make this configurable? or remove it altogether?
-    sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
-    g_hash_table_foreach(mask_entries, add_non_clone_mask_entries_to_db, &img->id);
-    sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+    g_hash_table_foreach(xmp->mask_entries, add_non_clone_mask_entries_to_db, &img->id);
 
     // history
-    int num = 0;
-    gboolean all_ok = TRUE;
-    GList *history_entries = NULL;
-
-    if(version < 2)
-    {
-      std::string &xmpPacket = image->xmpPacket();
-      history_entries = read_history_v1(xmpPacket, filename, 0);
-      if(!history_entries) // didn't work? try super old version with rdf:Bag
-        history_entries = read_history_v1(xmpPacket, filename, 1);
-    }
-    else if(version == 2)
-      history_entries = read_history_v2(xmpData, filename);
-    else
-    {
-      std::cerr << "error: Xmp schema version " << version << " in " << filename << " not supported" << std::endl;
-      g_hash_table_destroy(mask_entries);
-      return 1;
-    }
-
-    sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
-
     DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.history WHERE imgid = ?1", -1,
                                 &stmt, NULL);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->id);
@@ -2214,13 +2258,14 @@ int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_on
     }
 
     sqlite3_finalize(stmt);
+    stmt = NULL;
 
     DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                                 "INSERT INTO main.history (imgid, num, module, operation, op_params, enabled, "
                                 "blendop_params, blendop_version, multi_priority, multi_name) "
                                 "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10)", -1, &stmt, NULL);
 
-    for(GList *iter = history_entries; iter; iter = g_list_next(iter))
+    for(GList *iter = xmp->history_entries; iter; iter = g_list_next(iter))
     {
       history_entry_t *entry = (history_entry_t *)iter->data;
 //       print_history_entry(entry);
@@ -2237,7 +2282,7 @@ int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_on
 
         // check what mask entries belong to this iop and add them to the db
         const dt_develop_blend_params_t *blendop_params = (dt_develop_blend_params_t *)entry->blendop_params;
-        add_mask_entries_to_db(img->id, mask_entries, blendop_params->mask_id);
+        add_mask_entries_to_db(img->id, xmp->mask_entries, blendop_params->mask_id);
       }
       else
       {
@@ -2267,6 +2312,7 @@ int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_on
       num++;
     }
     sqlite3_finalize(stmt);
+    stmt = NULL;
 
     // we shouldn't change history_end when no history was read!
     if((pos = xmpData.findKey(Exiv2::XmpKey("Xmp.darktable.history_end"))) != xmpData.end() && num > 0)
@@ -2303,30 +2349,36 @@ int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_on
 
 end:
     sqlite3_finalize(stmt);
-
-    g_list_free_full(history_entries, free_history_entry);
-    g_hash_table_destroy(mask_entries);
-
-    if(all_ok)
-    {
-      sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
-    }
-    else
-    {
-      std::cerr << "[exif] error reading history from '" << filename << "'" << std::endl;
-      sqlite3_exec(dt_database_get(darktable.db), "ROLLBACK TRANSACTION", NULL, NULL, NULL);
-      return 1;
-    }
-
+    stmt = NULL;
   }
   catch(Exiv2::AnyError &e)
   {
-    // actually nobody's interested in that if the file doesn't exist:
-    // std::string s(e.what());
-    // std::cerr << "[exiv2] " << filename << ": " << s << std::endl;
-    return 1;
+    sqlite3_finalize(stmt);
+    all_ok = FALSE;
   }
-  return 0;
+
+  if(all_ok)
+  {
+    sqlite3_exec(dt_database_get(darktable.db), "RELEASE xmp_apply", NULL, NULL, NULL);
+  }
+  else
+  {
+    std::cerr << "[exif] error reading history from '" << xmp->filename << "'" << std::endl;
+    sqlite3_exec(dt_database_get(darktable.db), "ROLLBACK TO xmp_apply", NULL, NULL, NULL);
+    sqlite3_exec(dt_database_get(darktable.db), "RELEASE xmp_apply", NULL, NULL, NULL);
+  }
+  dt_database_release_transaction(darktable.db);
+  return all_ok ? 0 : 1;
+}
+
+// need a write lock on *img (non-const) to write stars (and soon color labels).
+int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_only)
+{
+  dt_exif_xmp_t *xmp = dt_exif_xmp_parse(filename);
+  if(!xmp) return 1;
+  const int res = dt_exif_xmp_apply(xmp, img, history_only);
+  dt_exif_xmp_free(xmp);
+  return res;
 }
 
 // helper to create an xmp data thing. throws exiv2 exceptions if stuff goes wrong.
@@ -53,6 +53,18 @@ char *dt_exif_xmp_read_string(const int imgid);
 /** read xmp sidecar file. */
 int dt_exif_xmp_read(dt_image_t *img, const char *filename, const int history_only);
 
+/** a sidecar file that has been read and decoded, but not written to the database yet. */
+typedef struct dt_exif_xmp_t dt_exif_xmp_t;
+
+/** read and decode xmp sidecar file, doesn't touch the database so it can run in parallel. NULL on error. */
+dt_exif_xmp_t *dt_exif_xmp_parse(const char *filename);
+
+/** write a parsed sidecar to img and the database, the same as dt_exif_xmp_read(). it's wrapped in a savepoint
+ * and can be part of an outer transaction. */
+int dt_exif_xmp_apply(dt_exif_xmp_t *xmp, dt_image_t *img, const int history_only);
+
+void dt_exif_xmp_free(dt_exif_xmp_t *xmp);
+
 /** fetch largest exif thumbnail jpg bytestream into buffer*/
 int dt_exif_get_thumbnail(const char *path, uint8_t **buffer, size_t *size, char **mime_type);
 
@@ -0,0 +1,622 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/guided_filter.h"
+#include "common/darktable.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <xmmintrin.h>
+#endif
+
+// columns are filtered in strips of this many floats, so the vertical passes read whole cache lines and
+// vectorize across the strip instead of gathering single columns
+#define BOX_STRIP 16
+
+// histogram resolution of one refinement step of dt_select_nth()
+#define SELECT_BINS 4096
+// below this many candidates dt_select_nth() just sorts
+#define SELECT_SORT 1024
+
+//----------------------------------------------------------------------
+// box mean
+//----------------------------------------------------------------------
+
+// running sum along a line of n pixels with ch interleaved channels. out and in must not overlap.
+static inline void box_mean_line(float *const out, const float *const in, const int n, const int ch, const int w)
+{
+  float m[16] = { 0.0f };
+  float n_box = 0.0f;
+  for(int i = 0, i_end = MIN(w + 1, n); i < i_end; i++)
+  {
+    for(int c = 0; c < ch; c++) m[c] += in[(size_t)i * ch + c];
+    n_box++;
+  }
+  for(int i = 0; i < n; i++)
+  {
+    for(int c = 0; c < ch; c++) out[(size_t)i * ch + c] = m[c] / n_box;
+    if(i - w >= 0)
+    {
+      for(int c = 0; c < ch; c++) m[c] -= in[(size_t)(i - w) * ch + c];
+      n_box--;
+    }
+    if(i + w + 1 < n)
+    {
+      for(int c = 0; c < ch; c++) m[c] += in[(size_t)(i + w + 1) * ch + c];
+      n_box++;
+    }
+  }
+}
+
+// the same down a strip of lanes columns starting at buf, rows are stride floats apart
+static inline void box_mean_strip(float *const buf, const size_t stride, const int height, const int lanes,
+                                  const int w, float *const scratch)
+{
+  for(int j = 0; j < height; j++) memcpy(scratch + (size_t)j * lanes, buf + j * stride, sizeof(float) * lanes);
+
+  float m[BOX_STRIP] = { 0.0f };
+  float n_box = 0.0f;
+  for(int j = 0, j_end = MIN(w + 1, height); j < j_end; j++)
+  {
+    for(int c = 0; c < lanes; c++) m[c] += scratch[(size_t)j * lanes + c];
+    n_box++;
+  }
+  for(int j = 0; j < height; j++)
+  {
+    for(int c = 0; c < lanes; c++) buf[j * stride + c] = m[c] / n_box;
+    if(j - w >= 0)
+    {
+      for(int c = 0; c < lanes; c++) m[c] -= scratch[(size_t)(j - w) * lanes + c];
+      n_box--;
+    }
+    if(j + w + 1 < height)
+    {
+      for(int c = 0; c < lanes; c++) m[c] += scratch[(size_t)(j + w + 1) * lanes + c];
+      n_box++;
+    }
+  }
+}
+
+#if defined(__SSE2__)
+static inline void box_mean_strip_sse(float *const buf, const size_t stride, const int height, const int w,
+                                      float *const scratch)
+{
+  for(int j = 0; j < height; j++)
+  {
+    const float *const in = buf + j * stride;
+    float *const s = scratch + (size_t)j * BOX_STRIP;
+    for(int c = 0; c < BOX_STRIP; c += 4) _mm_store_ps(s + c, _mm_loadu_ps(in + c));
+  }
+
+  __m128 m[BOX_STRIP / 4];
+  for(int c = 0; c < BOX_STRIP / 4; c++) m[c] = _mm_setzero_ps();
+  float n_box = 0.0f;
+  for(int j = 0, j_end = MIN(w + 1, height); j < j_end; j++)
+  {
+    for(int c = 0; c < BOX_STRIP / 4; c++)
+      m[c] = _mm_add_ps(m[c], _mm_load_ps(scratch + (size_t)j * BOX_STRIP + 4 * c));
+    n_box++;
+  }
+  for(int j = 0; j < height; j++)
+  {
+    const __m128 n = _mm_set1_ps(n_box);
+    for(int c = 0; c < BOX_STRIP / 4; c++) _mm_storeu_ps(buf + j * stride + 4 * c, _mm_div_ps(m[c], n));
+    if(j - w >= 0)
+    {
+      const float *const s = scratch + (size_t)(j - w) * BOX_STRIP;
+      for(int c = 0; c < BOX_STRIP / 4; c++) m[c] = _mm_sub_ps(m[c], _mm_load_ps(s + 4 * c));
+      n_box--;
+    }
+    if(j + w + 1 < height)
+    {
+      const float *const s = scratch + (size_t)(j + w + 1) * BOX_STRIP;
+      for(int c = 0; c < BOX_STRIP / 4; c++) m[c] = _mm_add_ps(m[c], _mm_load_ps(s + 4 * c));
+      n_box++;
+    }
+  }
+}
+#endif
+
+void dt_box_mean(float *const buf, const int height, const int width, const int ch, const int w)
+{
+  const size_t stride = (size_t)width * ch;
+  const int strips = (stride + BOX_STRIP - 1) / BOX_STRIP;
+
+#ifdef _OPENMP
+#pragma omp parallel default(none)
+#endif
+  {
+    float *const line = dt_alloc_align(64, sizeof(float) * stride);
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+    for(int j = 0; j < height; j++)
+    {
+      float *const row = buf + j * stride;
+      memcpy(line, row, sizeof(float) * stride);
+      // constant channel counts let the compiler unroll the channel loops
+      if(ch == 1)
+        box_mean_line(row, line, width, 1, w);
+      else if(ch == 4)
+        box_mean_line(row, line, width, 4, w);
+      else
+        box_mean_line(row, line, width, ch, w);
+    }
+    dt_free_align(line);
+  }
+
+#ifdef _OPENMP
+#pragma omp parallel default(none)
+#endif
+  {
+    float *const scratch = dt_alloc_align(64, sizeof(float) * BOX_STRIP * height);
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+    for(int s = 0; s < strips; s++)
+    {
+      const size_t x = (size_t)s * BOX_STRIP;
+      const int lanes = MIN(BOX_STRIP, stride - x);
+#if defined(__SSE2__)
+      if(lanes == BOX_STRIP)
+        box_mean_strip_sse(buf + x, stride, height, w, scratch);
+      else
+#endif
+        box_mean_strip(buf + x, stride, height, lanes, w, scratch);
+    }
+    dt_free_align(scratch);
+  }
+}
+
+//----------------------------------------------------------------------
+// morphology
+//----------------------------------------------------------------------
+
+// plain comparisons instead of fminf()/fmaxf(), which are library calls unless finite math is assumed
+static inline float morph_op(const float a, const float b, const int is_max)
+{
+  return is_max ? (a > b ? a : b) : (a < b ? a : b);
+}
+
+// van Herk/Gil-Werman: the input, padded by w neutral elements on both sides, is cut into blocks of 2w+1.
+// with g the running extremum from the start of each block and h the one from its end, every window is
+// covered by the tail of one block and the head of the next, so each output costs three comparisons.
+// lanes independent lines are processed side by side, line i of element j is at in[j * in_stride + i].
+static inline void vhgw_line(float *const out, const size_t out_stride, const float *const in,
+                             const size_t in_stride, const int n, const int lanes, const int w, const int is_max,
+                             float *const p, float *const g, float *const h)
+{
+  const int k = 2 * w + 1;
+  const int np = (n + 2 * w + k - 1) / k * k;
+  const float neutral = is_max ? -INFINITY : INFINITY;
+
+  for(int j = 0; j < w; j++)
+    for(int c = 0; c < lanes; c++) p[(size_t)j * lanes + c] = neutral;
+  for(int j = 0; j < n; j++)
+    for(int c = 0; c < lanes; c++) p[(size_t)(j + w) * lanes + c] = in[j * in_stride + c];
+  for(int j = n + w; j < np; j++)
+    for(int c = 0; c < lanes; c++) p[(size_t)j * lanes + c] = neutral;
+
+  for(int b = 0; b < np; b += k)
+  {
+    for(int c = 0; c < lanes; c++) g[(size_t)b * lanes + c] = p[(size_t)b * lanes + c];
+    for(int j = b + 1; j < b + k; j++)
+      for(int c = 0; c < lanes; c++)
+        g[(size_t)j * lanes + c] = morph_op(g[(size_t)(j - 1) * lanes + c], p[(size_t)j * lanes + c], is_max);
+    const int e = b + k - 1;
+    for(int c = 0; c < lanes; c++) h[(size_t)e * lanes + c] = p[(size_t)e * lanes + c];
+    for(int j = e - 1; j >= b; j--)
+      for(int c = 0; c < lanes; c++)
+        h[(size_t)j * lanes + c] = morph_op(h[(size_t)(j + 1) * lanes + c], p[(size_t)j * lanes + c], is_max);
+  }
+
+  for(int i = 0; i < n; i++)
+    for(int c = 0; c < lanes; c++)
+      out[i * out_stride + c] = morph_op(h[(size_t)i * lanes + c], g[(size_t)(i + 2 * w) * lanes + c], is_max);
+}
+
+static void box_morph(float *const buf, const int height, const int width, const int w, const int is_max)
+{
+  if(w <= 0) return;
+  // enough for the padded lines in either direction
+  const size_t len = (size_t)MAX(width, height) + 4 * w + 1;
+  const int strips = (width + BOX_STRIP - 1) / BOX_STRIP;
+
+#ifdef _OPENMP
+#pragma omp parallel default(none)
+#endif
+  {
+    float *const p = dt_alloc_align(64, sizeof(float) * 3 * len);
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+    for(int j = 0; j < height; j++)
+    {
+      float *const row = buf + (size_t)j * width;
+      if(is_max)
+        vhgw_line(row, 1, row, 1, width, 1, w, 1, p, p + len, p + 2 * len);
+      else
+        vhgw_line(row, 1, row, 1, width, 1, w, 0, p, p + len, p + 2 * len);
+    }
+    dt_free_align(p);
+  }
+
+#ifdef _OPENMP
+#pragma omp parallel default(none)
+#endif
+  {
+    float *const p = dt_alloc_align(64, sizeof(float) * 3 * BOX_STRIP * len);
+    float *const g = p + BOX_STRIP * len;
+    float *const h = g + BOX_STRIP * len;
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+    for(int s = 0; s < strips; s++)
+    {
+      const int x = s * BOX_STRIP;
+      const int lanes = MIN(BOX_STRIP, width - x);
+      float *const col = buf + x;
+      // full strips with a constant lane count, so the inner loops become vector min/max
+      if(lanes == BOX_STRIP && is_max)
+        vhgw_line(col, width, col, width, height, BOX_STRIP, w, 1, p, g, h);
+      else if(lanes == BOX_STRIP)
+        vhgw_line(col, width, col, width, height, BOX_STRIP, w, 0, p, g, h);
+      else
+        vhgw_line(col, width, col, width, height, lanes, w, is_max, p, g, h);
+    }
+    dt_free_align(p);
+  }
+}
+
+void dt_box_min(float *const buf, const int height, const int width, const int w)
+{
+  box_morph(buf, height, width, w, 0);
+}
+
+void dt_box_max(float *const buf, const int height, const int width, const int w)
+{
+  box_morph(buf, height, width, w, 1);
+}
+
+//----------------------------------------------------------------------
+// guided filter
+//----------------------------------------------------------------------
+
+// channels of the first box mean pass, padded to 16 floats per pixel
+enum
+{
+  GF_R, GF_G, GF_B, GF_P,
+  GF_RR, GF_RG, GF_RB, GF_GG, GF_GB, GF_BB,
+  GF_RP, GF_GP, GF_BP,
+  GF_CHANNELS = 16
+};
+
+typedef struct gf_tile_t
+{
+  int left, right, lower, upper;
+} gf_tile_t;
+
+// all local statistics of guide and input go through one interleaved box mean, and the coefficients of the
+// linear model through a second one, instead of one full pass per statistic
+// the unfiltered input for a tile there's no memory to filter
+static void guided_filter_tile_copy(const float *const in, float *const out, const int img_width,
+                                    const gf_tile_t target)
+{
+  for(int j = target.lower; j < target.upper; j++)
+  {
+    const size_t l = target.left + (size_t)j * img_width;
+    memcpy(out + l, in + l, sizeof(float) * (target.right - target.left));
+  }
+}
+
+static void guided_filter_tile(const float *const guide, const int ch, const float *const in, float *const out,
+                               const int img_width, const int img_height, const gf_tile_t target, const int w,
+                               const float eps)
+{
+  // to process the current tile also input data from the borders
+  // (of size 2*w) of the neighbouring tiles is required
+  const gf_tile_t source = { MAX(target.left - 2 * w, 0), MIN(target.right + 2 * w, img_width),
+                             MAX(target.lower - 2 * w, 0), MIN(target.upper + 2 * w, img_height) };
+  const int width = source.right - source.left;
+  const int height = source.upper - source.lower;
+  const size_t size = (size_t)width * height;
+
+  float *const mean = dt_alloc_align(64, sizeof(float) * GF_CHANNELS * size);
+  if(!mean)
+  {
+    guided_filter_tile_copy(in, out, img_width, target);
+    return;
+  }
+  for(int j = source.lower; j < source.upper; j++)
+  {
+    float *m = mean + (size_t)GF_CHANNELS * (j - source.lower) * width;
+    size_t l = source.left + (size_t)j * img_width;
+    for(int i = source.left; i < source.right; i++, l++, m += GF_CHANNELS)
+    {
+      const float *pixel = guide + l * ch;
+      const float r = pixel[0], g = pixel[1], b = pixel[2], p = in[l];
+      m[GF_R] = r;
+      m[GF_G] = g;
+      m[GF_B] = b;
+      m[GF_P] = p;
+      m[GF_RR] = r * r;
+      m[GF_RG] = r * g;
+      m[GF_RB] = r * b;
+      m[GF_GG] = g * g;
+      m[GF_GB] = g * b;
+      m[GF_BB] = b * b;
+      m[GF_RP] = r * p;
+      m[GF_GP] = g * p;
+      m[GF_BP] = b * p;
+      m[13] = m[14] = m[15] = 0.0f;
+    }
+  }
+  dt_box_mean(mean, height, width, GF_CHANNELS, w);
+
+  // coefficients a_r, a_g, a_b and b of the local linear model
+  float *const ab = dt_alloc_align(64, sizeof(float) * 4 * size);
+  if(!ab)
+  {
+    dt_free_align(mean);
+    guided_filter_tile_copy(in, out, img_width, target);
+    return;
+  }
+  for(size_t i = 0; i < size; i++)
+  {
+    const float *const m = mean + GF_CHANNELS * i;
+    float *const a = ab + 4 * i;
+    // solve linear system of equations of size 3x3 via Cramer's rule
+    float Sigma[3][3]; // symmetric coefficient matrix
+    Sigma[0][0] = m[GF_RR] - (m[GF_R] * m[GF_R] - eps);
+    Sigma[0][1] = m[GF_RG] - m[GF_R] * m[GF_G];
+    Sigma[0][2] = m[GF_RB] - m[GF_R] * m[GF_B];
+    Sigma[1][1] = m[GF_GG] - (m[GF_G] * m[GF_G] - eps);
+    Sigma[1][2] = m[GF_GB] - m[GF_G] * m[GF_B];
+    Sigma[2][2] = m[GF_BB] - (m[GF_B] * m[GF_B] - eps);
+    float cov[3];
+    cov[0] = m[GF_RP] - m[GF_R] * m[GF_P];
+    cov[1] = m[GF_GP] - m[GF_G] * m[GF_P];
+    cov[2] = m[GF_BP] - m[GF_B] * m[GF_P];
+    const float det0 = Sigma[0][0] * (Sigma[1][1] * Sigma[2][2] - Sigma[1][2] * Sigma[1][2])
+                       - Sigma[0][1] * (Sigma[0][1] * Sigma[2][2] - Sigma[0][2] * Sigma[1][2])
+                       + Sigma[0][2] * (Sigma[0][1] * Sigma[1][2] - Sigma[0][2] * Sigma[1][1]);
+    if(fabsf(det0) > 4.f * FLT_EPSILON)
+    {
+      const float det1 = cov[0] * (Sigma[1][1] * Sigma[2][2] - Sigma[1][2] * Sigma[1][2])
+                         - Sigma[0][1] * (cov[1] * Sigma[2][2] - cov[2] * Sigma[1][2])
+                         + Sigma[0][2] * (cov[1] * Sigma[1][2] - cov[2] * Sigma[1][1]);
+      const float det2 = Sigma[0][0] * (cov[1] * Sigma[2][2] - cov[2] * Sigma[1][2])
+                         - cov[0] * (Sigma[0][1] * Sigma[2][2] - Sigma[0][2] * Sigma[1][2])
+                         + Sigma[0][2] * (Sigma[0][1] * cov[2] - Sigma[0][2] * cov[1]);
+      const float det3 = Sigma[0][0] * (Sigma[1][1] * cov[2] - Sigma[1][2] * cov[1])
+                         - Sigma[0][1] * (Sigma[0][1] * cov[2] - Sigma[0][2] * cov[1])
+                         + cov[0] * (Sigma[0][1] * Sigma[1][2] - Sigma[0][2] * Sigma[1][1]);
+      a[0] = det1 / det0;
+      a[1] = det2 / det0;
+      a[2] = det3 / det0;
+    }
+    else
+    {
+      // linear system is singular
+      a[0] = a[1] = a[2] = 0.0f;
+    }
+    a[3] = m[GF_P] - a[0] * m[GF_R] - a[1] * m[GF_G] - a[2] * m[GF_B];
+  }
+  dt_free_align(mean);
+  dt_box_mean(ab, height, width, 4, w);
+
+  // finally calculate results for the current tile
+  for(int j = target.lower; j < target.upper; j++)
+  {
+    // index of the left most target pixel in the current row
+    size_t l = target.left + (size_t)j * img_width;
+    // and of the same pixel in the coefficients, which include the borders of the neighbouring tiles
+    const float *a = ab + 4 * ((target.left - source.left) + (size_t)(j - source.lower) * width);
+    for(int i = target.left; i < target.right; i++, l++, a += 4)
+    {
+      const float *pixel = guide + l * ch;
+      out[l] = a[0] * pixel[0] + a[1] * pixel[1] + a[2] * pixel[2] + a[3];
+    }
+  }
+  dt_free_align(ab);
+}
+
+void dt_guided_filter(const float *const guide, const int ch, const float *const in, float *const out,
+                      const int width, const int height, const int w, const float eps)
+{
+  // tiles keep the memory for the local statistics bounded
+  const int tile_width = MAX(512 - 4 * w, 128);
+#ifdef _OPENMP
+// use dynamic load ballancing as tiles may have varying size
+#pragma omp parallel for default(none) schedule(dynamic) collapse(2)
+#endif
+  for(int j = 0; j < height; j += tile_width)
+  {
+    for(int i = 0; i < width; i += tile_width)
+    {
+      const gf_tile_t target = { i, MIN(i + tile_width, width), j, MIN(j + tile_width, height) };
+      guided_filter_tile(guide, ch, in, out, width, height, target, w, eps);
+    }
+  }
+}
+
+//----------------------------------------------------------------------
+// selection
+//----------------------------------------------------------------------
+
+static inline int select_bin(const float v, const float lo, const float scale)
+{
+  const float f = (v - lo) * scale;
+  // also sends NaN to the first bin
+  return f > 0.0f ? MIN((int)f, SELECT_BINS - 1) : 0;
+}
+
+static int select_cmp(const void *a, const void *b)
+{
+  const float fa = *(const float *)a, fb = *(const float *)b;
+  return (fa > fb) - (fa < fb);
+}
+
+// orders floats like their unsigned keys, negative ones below positive ones
+static inline uint32_t select_key(const float v)
+{
+  uint32_t u;
+  memcpy(&u, &v, sizeof(u));
+  return (u & 0x80000000u) ? ~u : u | 0x80000000u;
+}
+
+static inline float select_value(const uint32_t key)
+{
+  const uint32_t u = (key & 0x80000000u) ? key & 0x7fffffffu : ~key;
+  float v;
+  memcpy(&v, &u, sizeof(v));
+  return v;
+}
+
+// the rank-th smallest of data without any memory: bisects the keys, counting the values below each guess. 32
+// passes over data, only used when there's no memory for the histograms or the sort.
+static float select_nth_counting(const float *const data, const size_t n, const size_t rank)
+{
+  uint32_t lo = 0, hi = UINT32_MAX;
+  while(lo < hi)
+  {
+    const uint32_t mid = lo + (hi - lo) / 2;
+    size_t count = 0;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static) reduction(+ : count)
+#endif
+    for(size_t i = 0; i < n; i++) count += select_key(data[i]) <= mid;
+    if(count > rank)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return select_value(lo);
+}
+
+float dt_select_nth(const float *const data, const size_t n, const size_t nth)
+{
+  if(n == 0) return NAN;
+  size_t rank = MIN(nth, n - 1);
+
+  float lo = INFINITY, hi = -INFINITY;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static) reduction(min : lo) reduction(max : hi)
+#endif
+  for(size_t i = 0; i < n; i++)
+  {
+    lo = data[i] < lo ? data[i] : lo;
+    hi = data[i] > hi ? data[i] : hi;
+  }
+
+  // zoom in on the bin containing rank until few enough candidates are left to sort them
+  const float *src = data;
+  float *subset = NULL;
+  size_t m = n;
+  size_t *hist = malloc(sizeof(size_t) * SELECT_BINS);
+  for(int level = 0; hist && level < 4 && m > SELECT_SORT && hi > lo; level++)
+  {
+    const float scale = SELECT_BINS / (hi - lo);
+    if(!isfinite(scale) || !isfinite(lo)) break;
+
+    memset(hist, 0, sizeof(size_t) * SELECT_BINS);
+#ifdef _OPENMP
+#pragma omp parallel default(none) shared(src, m, hist, lo)
+#endif
+    {
+      // without its own bins a thread counts straight into the shared ones
+      size_t *local = calloc(SELECT_BINS, sizeof(size_t));
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+      for(size_t i = 0; i < m; i++)
+      {
+        const int b = select_bin(src[i], lo, scale);
+        if(local)
+          local[b]++;
+        else
+        {
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
+          hist[b]++;
+        }
+      }
+      if(local)
+      {
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+        for(int b = 0; b < SELECT_BINS; b++) hist[b] += local[b];
+        free(local);
+      }
+    }
+
+    int bin = 0;
+    while(rank >= hist[bin])
+    {
+      rank -= hist[bin];
+      bin++;
+    }
+
+    float *next = malloc(sizeof(float) * hist[bin]);
+    if(!next) break;
+    size_t k = 0;
+    float nlo = INFINITY, nhi = -INFINITY;
+    for(size_t i = 0; i < m; i++)
+      if(select_bin(src[i], lo, scale) == bin)
+      {
+        next[k++] = src[i];
+        nlo = src[i] < nlo ? src[i] : nlo;
+        nhi = src[i] > nhi ? src[i] : nhi;
+      }
+    free(subset);
+    src = subset = next;
+    m = k;
+    lo = nlo;
+    hi = nhi;
+  }
+  free(hist);
+
+  float result;
+  if(!(hi > lo) && isfinite(lo))
+    result = lo; // all candidates are equal
+  else
+  {
+    float *sorted = subset ? subset : malloc(sizeof(float) * m);
+    if(!sorted)
+      result = select_nth_counting(src, m, rank);
+    else
+    {
+      if(!subset) memcpy(sorted, src, sizeof(float) * m);
+      qsort(sorted, m, sizeof(float), select_cmp);
+      result = sorted[rank];
+      if(!subset) free(sorted);
+    }
+  }
+  free(subset);
+  return result;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
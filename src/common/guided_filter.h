@@ -0,0 +1,50 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+/** box filters, morphology and the guided filter of K. He et al., "Guided Image Filtering", ECCV 2010.
+ *
+ * all filters work in place on row-major float buffers and take a window of (2*w+1) x (2*w+1) pixels,
+ * truncated at the image borders. the running time per pixel does not depend on w. they parallelize
+ * internally and run single threaded when called from inside an OpenMP parallel region. */
+
+/** moving average of an image with ch (at most 16) interleaved channels. */
+void dt_box_mean(float *const buf, const int height, const int width, const int ch, const int w);
+
+/** moving minimum (erosion) of a single channel image, van Herk/Gil-Werman. */
+void dt_box_min(float *const buf, const int height, const int width, const int w);
+
+/** moving maximum (dilation) of a single channel image, van Herk/Gil-Werman. */
+void dt_box_max(float *const buf, const int height, const int width, const int w);
+
+/** edge preserving smoothing of the single channel image in, steered by the rgb image guide with ch floats
+ * per pixel. eps regularizes the local linear model, larger values give smoother results. */
+void dt_guided_filter(const float *const guide, const int ch, const float *const in, float *const out,
+                      const int width, const int height, const int w, const float eps);
+
+/** returns the value that would be at position nth if data were sorted, like std::nth_element but without
+ * touching data. narrows down the range with histograms, so it's linear in n. without memory for those it
+ * counts instead, which takes 32 passes over data. */
+float dt_select_nth(const float *const data, const size_t n, const size_t nth);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
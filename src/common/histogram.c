@@ -27,6 +27,9 @@
 #include "common/darktable.h"
 #include "common/histogram.h"
 #include "develop/imageop.h"
+#ifdef HAVE_OPENCL
+#include "common/opencl.h"
+#endif
 
 #define S(V, params) ((params->mul) * ((float)V))
 #define P(V, params) (CLAMP((V), 0, (params->bins_count - 1)))
@@ -76,12 +79,13 @@ inline void dt_histogram_helper_cs_RAW_uint16(const dt_dev_histogram_collection_
 
 //------------------------------------------------------------------------------
 
-inline static void __attribute__((__unused__)) histogram_helper_cs_rgb_helper_process_pixel_float(
+inline static void histogram_helper_cs_rgb_helper_process_pixel_float(
     const dt_dev_histogram_collection_params_t *const histogram_params, const float *pixel, uint32_t *histogram)
 {
-  const uint32_t R = PS(pixel[0], histogram_params);
-  const uint32_t G = PS(pixel[1], histogram_params);
-  const uint32_t B = PS(pixel[2], histogram_params);
+  // rounded like _mm_cvtps_epi32() in the sse version and the opencl kernel
+  const uint32_t R = lrintf(PS(pixel[0], histogram_params));
+  const uint32_t G = lrintf(PS(pixel[1], histogram_params));
+  const uint32_t B = lrintf(PS(pixel[2], histogram_params));
   histogram[4 * R]++;
   histogram[4 * G + 1]++;
   histogram[4 * B + 2]++;
@@ -119,32 +123,36 @@ inline static void histogram_helper_cs_rgb(const dt_dev_histogram_collection_par
   const dt_histogram_roi_t *roi = histogram_params->roi;
   float *in = (float *)pixel + 4 * (roi->width * j + roi->crop_x);
 
-  // process aligned pixels with SSE
   for(int i = 0; i < roi->width - roi->crop_width - roi->crop_x; i++, in += 4)
-  {
-    if(darktable.codepath.OPENMP_SIMD)
-      histogram_helper_cs_rgb_helper_process_pixel_float(histogram_params, in, histogram);
+    histogram_helper_cs_rgb_helper_process_pixel_float(histogram_params, in, histogram);
+}
+
 #if defined(__SSE2__)
-    else if(darktable.codepath.SSE2)
-      histogram_helper_cs_rgb_helper_process_pixel_m128(histogram_params, in, histogram);
-#endif
-    else
-      dt_unreachable_codepath();
-  }
+inline static void histogram_helper_cs_rgb_sse(const dt_dev_histogram_collection_params_t *const histogram_params,
+                                               const void *pixel, uint32_t *histogram, int j)
+{
+  const dt_histogram_roi_t *roi = histogram_params->roi;
+  float *in = (float *)pixel + 4 * (roi->width * j + roi->crop_x);
+
+  // process aligned pixels with SSE
+  for(int i = 0; i < roi->width - roi->crop_width - roi->crop_x; i++, in += 4)
+    histogram_helper_cs_rgb_helper_process_pixel_m128(histogram_params, in, histogram);
 }
+#endif
 
 //------------------------------------------------------------------------------
 
-inline static void __attribute__((__unused__)) histogram_helper_cs_Lab_helper_process_pixel_float(
+inline static void histogram_helper_cs_Lab_helper_process_pixel_float(
     const dt_dev_histogram_collection_params_t *const histogram_params, const float *pixel, uint32_t *histogram)
 {
   const float Lv = pixel[0];
   const float av = pixel[1];
   const float bv = pixel[2];
   const float max = histogram_params->bins_count - 1;
-  const uint32_t L = CLAMP(histogram_params->mul / 100.0f * (Lv), 0, max);
-  const uint32_t a = CLAMP(histogram_params->mul / 256.0f * (av + 128.0f), 0, max);
-  const uint32_t b = CLAMP(histogram_params->mul / 256.0f * (bv + 128.0f), 0, max);
+  // rounded like _mm_cvtps_epi32() in the sse version and the opencl kernel
+  const uint32_t L = lrintf(CLAMP(histogram_params->mul / 100.0f * (Lv), 0, max));
+  const uint32_t a = lrintf(CLAMP(histogram_params->mul / 256.0f * (av + 128.0f), 0, max));
+  const uint32_t b = lrintf(CLAMP(histogram_params->mul / 256.0f * (bv + 128.0f), 0, max));
   histogram[4 * L]++;
   histogram[4 * a + 1]++;
   histogram[4 * b + 2]++;
@@ -186,19 +194,22 @@ inline static void histogram_helper_cs_Lab(const dt_dev_histogram_collection_par
   const dt_histogram_roi_t *roi = histogram_params->roi;
   float *in = (float *)pixel + 4 * (roi->width * j + roi->crop_x);
 
-  // process aligned pixels with SSE
   for(int i = 0; i < roi->width - roi->crop_width - roi->crop_x; i++, in += 4)
-  {
-    if(darktable.codepath.OPENMP_SIMD)
-      histogram_helper_cs_Lab_helper_process_pixel_float(histogram_params, in, histogram);
+    histogram_helper_cs_Lab_helper_process_pixel_float(histogram_params, in, histogram);
+}
+
 #if defined(__SSE2__)
-    else if(darktable.codepath.SSE2)
-      histogram_helper_cs_Lab_helper_process_pixel_m128(histogram_params, in, histogram);
-#endif
-    else
-      dt_unreachable_codepath();
-  }
+inline static void histogram_helper_cs_Lab_sse(const dt_dev_histogram_collection_params_t *const histogram_params,
+                                               const void *pixel, uint32_t *histogram, int j)
+{
+  const dt_histogram_roi_t *roi = histogram_params->roi;
+  float *in = (float *)pixel + 4 * (roi->width * j + roi->crop_x);
+
+  // process aligned pixels with SSE
+  for(int i = 0; i < roi->width - roi->crop_width - roi->crop_x; i++, in += 4)
+    histogram_helper_cs_Lab_helper_process_pixel_m128(histogram_params, in, histogram);
 }
+#endif
 
 //==============================================================================
 
@@ -210,7 +221,11 @@ void dt_histogram_worker(dt_dev_histogram_collection_params_t *const histogram_p
 
   const size_t bins_total = (size_t)4 * histogram_params->bins_count;
   const size_t buf_size = bins_total * sizeof(uint32_t);
-  void *partial_hists = calloc(nthreads, buf_size);
+  // give every thread its own cache lines, the bins are hammered with increments
+  const size_t slice = (bins_total + 15) & ~(size_t)15;
+  uint32_t *partial_hists = dt_alloc_align(64, nthreads * slice * sizeof(uint32_t));
+  if(!partial_hists) return;
+  memset(partial_hists, 0, nthreads * slice * sizeof(uint32_t));
 
   if(histogram_params->mul == 0) histogram_params->mul = (double)(histogram_params->bins_count - 1);
 
@@ -221,7 +236,7 @@ void dt_histogram_worker(dt_dev_histogram_collection_params_t *const histogram_p
 #endif
   for(int j = roi->crop_y; j < roi->height - roi->crop_height; j++)
   {
-    uint32_t *thread_hist = (uint32_t *)partial_hists + bins_total * omp_get_thread_num();
+    uint32_t *thread_hist = partial_hists + slice * omp_get_thread_num();
     Worker(histogram_params, pixel, thread_hist, j);
   }
 
@@ -235,7 +250,7 @@ void dt_histogram_worker(dt_dev_histogram_collection_params_t *const histogram_p
   {
     for(size_t n = 0; n < nthreads; n++)
     {
-      const uint32_t *thread_hist = (uint32_t *)partial_hists + bins_total * n;
+      const uint32_t *thread_hist = partial_hists + slice * n;
       hist[k] += thread_hist[k];
     }
   }
@@ -243,7 +258,7 @@ void dt_histogram_worker(dt_dev_histogram_collection_params_t *const histogram_p
   *histogram = realloc(*histogram, buf_size);
   memmove(*histogram, partial_hists, buf_size);
 #endif
-  free(partial_hists);
+  dt_free_align(partial_hists);
 
   histogram_stats->bins_count = histogram_params->bins_count;
   histogram_stats->pixels = (roi->width - roi->crop_width - roi->crop_x)
@@ -264,13 +279,27 @@ void dt_histogram_helper(dt_dev_histogram_collection_params_t *histogram_params,
       break;
 
     case iop_cs_rgb:
-      dt_histogram_worker(histogram_params, histogram_stats, pixel, histogram, histogram_helper_cs_rgb);
+      if(darktable.codepath.OPENMP_SIMD)
+        dt_histogram_worker(histogram_params, histogram_stats, pixel, histogram, histogram_helper_cs_rgb);
+#if defined(__SSE2__)
+      else if(darktable.codepath.SSE2)
+        dt_histogram_worker(histogram_params, histogram_stats, pixel, histogram, histogram_helper_cs_rgb_sse);
+#endif
+      else
+        dt_unreachable_codepath();
       histogram_stats->ch = 3u;
       break;
 
     case iop_cs_Lab:
     default:
-      dt_histogram_worker(histogram_params, histogram_stats, pixel, histogram, histogram_helper_cs_Lab);
+      if(darktable.codepath.OPENMP_SIMD)
+        dt_histogram_worker(histogram_params, histogram_stats, pixel, histogram, histogram_helper_cs_Lab);
+#if defined(__SSE2__)
+      else if(darktable.codepath.SSE2)
+        dt_histogram_worker(histogram_params, histogram_stats, pixel, histogram, histogram_helper_cs_Lab_sse);
+#endif
+      else
+        dt_unreachable_codepath();
       histogram_stats->ch = 3u;
       break;
   }
@@ -316,6 +345,122 @@ void dt_histogram_max_helper(const dt_dev_histogram_stats_t *const histogram_sta
   }
 }
 
+#ifdef HAVE_OPENCL
+dt_histogram_cl_global_t *dt_histogram_init_cl_global()
+{
+  dt_histogram_cl_global_t *g = (dt_histogram_cl_global_t *)malloc(sizeof(dt_histogram_cl_global_t));
+
+  const int program = 23; // histogram.cl, from programs.conf
+  g->kernel_histogram_collect = dt_opencl_create_kernel(program, "histogram_collect");
+  return g;
+}
+
+void dt_histogram_free_cl_global(dt_histogram_cl_global_t *g)
+{
+  if(!g) return;
+
+  // destroy kernels
+  dt_opencl_free_kernel(g->kernel_histogram_collect);
+  free(g);
+}
+
+int dt_histogram_helper_cl(const int devid, dt_dev_histogram_collection_params_t *histogram_params,
+                           dt_dev_histogram_stats_t *histogram_stats, dt_iop_colorspace_type_t cst,
+                           cl_mem img, uint32_t **histogram)
+{
+  if(!darktable.opencl->device_histogram || darktable.opencl->avoid_atomics || !darktable.opencl->histogram)
+    return FALSE;
+
+  const int kernel = darktable.opencl->histogram->kernel_histogram_collect;
+  const dt_histogram_roi_t *const roi = histogram_params->roi;
+  const int bins = histogram_params->bins_count;
+  const size_t buf_size = (size_t)4 * bins * sizeof(uint32_t);
+
+  if(histogram_params->mul == 0) histogram_params->mul = (double)(bins - 1);
+  const float mul = histogram_params->mul;
+
+  // same mapping as the host codepaths: raw is truncated, rgb and Lab are rounded
+  int channels = 3, rnd = 1;
+  float shift[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+  float scale[4] = { mul, mul, mul, mul };
+  switch(cst)
+  {
+    case iop_cs_RAW:
+      channels = 1;
+      rnd = 0;
+      break;
+    case iop_cs_rgb:
+      break;
+    case iop_cs_Lab:
+    default:
+      shift[1] = shift[2] = 128.0f;
+      scale[0] = mul / 100.0f;
+      scale[1] = scale[2] = mul / 256.0f;
+      break;
+  }
+
+  const int crop_x = roi->crop_x;
+  const int crop_y = roi->crop_y;
+  const int width = roi->width - roi->crop_width - roi->crop_x;
+  const int height = roi->height - roi->crop_height - roi->crop_y;
+  if(width <= 0 || height <= 0) return FALSE;
+
+  // one dimensional work groups, each with its own bins in local memory
+  dt_opencl_local_buffer_t locopt
+    = (dt_opencl_local_buffer_t){ .xoffset = 0, .xfactor = 1, .yoffset = 0, .yfactor = 1,
+                                  .cellsize = 0, .overhead = buf_size,
+                                  .sizex = 256, .sizey = 1 };
+  if(!dt_opencl_local_buffer_opt(devid, kernel, &locopt)) return FALSE;
+
+  // enough groups to fill the device; every work item strides over the image
+  const size_t groups = MIN(64, ((size_t)width * height + locopt.sizex - 1) / locopt.sizex);
+  size_t sizes[3] = { groups * locopt.sizex, 1, 1 };
+  size_t local[3] = { locopt.sizex, 1, 1 };
+
+  uint32_t *hist = calloc(4 * bins, sizeof(uint32_t));
+  cl_mem dev_hist = dt_opencl_alloc_device_buffer(devid, buf_size);
+  cl_int err = -999;
+  if(!hist || !dev_hist) goto error;
+
+  err = dt_opencl_write_buffer_to_device(devid, hist, dev_hist, 0, buf_size, CL_TRUE);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_set_kernel_arg(devid, kernel, 0, sizeof(cl_mem), (void *)&img);
+  dt_opencl_set_kernel_arg(devid, kernel, 1, sizeof(cl_mem), (void *)&dev_hist);
+  dt_opencl_set_kernel_arg(devid, kernel, 2, sizeof(int), (void *)&crop_x);
+  dt_opencl_set_kernel_arg(devid, kernel, 3, sizeof(int), (void *)&crop_y);
+  dt_opencl_set_kernel_arg(devid, kernel, 4, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, kernel, 5, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, kernel, 6, sizeof(int), (void *)&bins);
+  dt_opencl_set_kernel_arg(devid, kernel, 7, sizeof(int), (void *)&channels);
+  dt_opencl_set_kernel_arg(devid, kernel, 8, 4 * sizeof(float), (void *)shift);
+  dt_opencl_set_kernel_arg(devid, kernel, 9, 4 * sizeof(float), (void *)scale);
+  dt_opencl_set_kernel_arg(devid, kernel, 10, sizeof(int), (void *)&rnd);
+  dt_opencl_set_kernel_arg(devid, kernel, 11, buf_size, NULL);
+  err = dt_opencl_enqueue_kernel_2d_with_local(devid, kernel, sizes, local);
+  if(err != CL_SUCCESS) goto error;
+
+  // only the bins travel back to the host
+  err = dt_opencl_read_buffer_from_device(devid, hist, dev_hist, 0, buf_size, CL_TRUE);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_release_mem_object(dev_hist);
+  free(*histogram);
+  *histogram = hist;
+
+  histogram_stats->bins_count = bins;
+  histogram_stats->pixels = width * height;
+  histogram_stats->ch = channels;
+  return TRUE;
+
+error:
+  dt_opencl_release_mem_object(dev_hist);
+  free(hist);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_histogram] couldn't collect histogram on device: %d\n", err);
+  return FALSE;
+}
+#endif
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
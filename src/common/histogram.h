@@ -52,6 +52,23 @@ void dt_histogram_helper(dt_dev_histogram_collection_params_t *histogram_params,
 void dt_histogram_max_helper(const dt_dev_histogram_stats_t *const histogram_stats,
                              dt_iop_colorspace_type_t cst, uint32_t **histogram, uint32_t *histogram_max);
 
+#ifdef HAVE_OPENCL
+typedef struct dt_histogram_cl_global_t
+{
+  int kernel_histogram_collect;
+} dt_histogram_cl_global_t;
+
+dt_histogram_cl_global_t *dt_histogram_init_cl_global(void);
+void dt_histogram_free_cl_global(dt_histogram_cl_global_t *g);
+
+/** same as dt_histogram_helper(), but on an image that lives on the opencl device. only the bins are
+ * copied back to the host. returns FALSE if the histogram could not be collected on the device, the
+ * caller has to fall back to dt_histogram_helper() then. */
+int dt_histogram_helper_cl(const int devid, dt_dev_histogram_collection_params_t *histogram_params,
+                           dt_dev_histogram_stats_t *histogram_stats, dt_iop_colorspace_type_t cst,
+                           cl_mem img, uint32_t **histogram);
+#endif
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
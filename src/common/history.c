@@ -371,52 +371,126 @@ void dt_history_delete_on_selection()
   sqlite3_finalize(stmt);
 }
 
-int dt_history_load_and_apply(int imgid, gchar *filename, int history_only)
+static int _history_apply_xmp(dt_exif_xmp_t *xmp, const int imgid, const int history_only)
 {
-  int res = 0;
   dt_image_t *img = dt_image_cache_get(darktable.image_cache, imgid, 'w');
-  if(img)
+  if(!img) return 0;
+
+  if(dt_exif_xmp_apply(xmp, img, history_only))
   {
-    if(dt_exif_xmp_read(img, filename, history_only)) return 1;
+    dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
+    return 1;
+  }
 
-    /* if current image in develop reload history */
-    if(dt_dev_is_current_image(darktable.develop, imgid)) dt_dev_reload_history_items(darktable.develop);
+  dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_SAFE);
+  dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
+  return 0;
+}
 
-    dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_SAFE);
-    dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
+// after the transaction, reading the history in develop can start one of its own
+static void _history_reload_current(GList *imgs)
+{
+  for(GList *l = imgs; l; l = g_list_next(l))
+    if(dt_dev_is_current_image(darktable.develop, GPOINTER_TO_INT(l->data)))
+    {
+      dt_dev_reload_history_items(darktable.develop);
+      return;
+    }
+}
+
+int dt_history_load_and_apply(int imgid, gchar *filename, int history_only)
+{
+  dt_exif_xmp_t *xmp = dt_exif_xmp_parse(filename);
+  if(!xmp) return 1;
+  const int res = _history_apply_xmp(xmp, imgid, history_only);
+  dt_exif_xmp_free(xmp);
+
+  /* if current image in develop reload history */
+  if(!res && dt_dev_is_current_image(darktable.develop, imgid)) dt_dev_reload_history_items(darktable.develop);
+  return res;
+}
+
+int dt_history_load_and_apply_list(GList *imgs, GList *filenames, int history_only)
+{
+  const int n = MIN(g_list_length(imgs), g_list_length(filenames));
+  if(n == 0) return 0;
+
+  int *ids = (int *)malloc(n * sizeof(int));
+  const char **files = (const char **)malloc(n * sizeof(char *));
+  dt_exif_xmp_t **xmps = (dt_exif_xmp_t **)calloc(n, sizeof(dt_exif_xmp_t *));
+  if(!ids || !files || !xmps)
+  {
+    free(xmps);
+    free(files);
+    free(ids);
+    // one file after the other then
+    int res = 0;
+    GList *f_iter = filenames;
+    for(GList *i_iter = imgs; i_iter && f_iter; i_iter = g_list_next(i_iter), f_iter = g_list_next(f_iter))
+      if(dt_history_load_and_apply(GPOINTER_TO_INT(i_iter->data), (gchar *)f_iter->data, history_only)) res = 1;
+    return res;
+  }
+  GList *i_iter = imgs, *f_iter = filenames;
+  for(int k = 0; k < n; k++, i_iter = g_list_next(i_iter), f_iter = g_list_next(f_iter))
+  {
+    ids[k] = GPOINTER_TO_INT(i_iter->data);
+    files[k] = (const char *)f_iter->data;
+  }
+
+  // exiv2 reads one file at a time, but the history and masks are decoded in parallel
+  const double start = dt_get_wtime();
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(files, xmps) schedule(dynamic)
+#endif
+  for(int k = 0; k < n; k++) xmps[k] = dt_exif_xmp_parse(files[k]);
+  const double parsed = dt_get_wtime();
+
+  int res = 0;
+  dt_database_start_transaction(darktable.db);
+  for(int k = 0; k < n; k++)
+  {
+    if(!xmps[k] || _history_apply_xmp(xmps[k], ids[k], history_only)) res = 1;
+    dt_exif_xmp_free(xmps[k]);
   }
+  dt_database_release_transaction(darktable.db);
+  dt_print(DT_DEBUG_PERF, "[history] %d xmp files: parsing took %.3f secs, writing %.3f secs\n", n,
+           parsed - start, dt_get_wtime() - parsed);
+  _history_reload_current(imgs);
+
+  free(xmps);
+  free(files);
+  free(ids);
   return res;
 }
 
 int dt_history_load_and_apply_on_selection(gchar *filename)
 {
+  dt_exif_xmp_t *xmp = dt_exif_xmp_parse(filename);
+  if(!xmp) return 1;
+
   int res = 0;
+  GList *imgs = NULL;
   sqlite3_stmt *stmt;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT imgid FROM main.selected_images",
                               -1, &stmt, NULL);
-  while(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    int imgid = sqlite3_column_int(stmt, 0);
-    if(dt_history_load_and_apply(imgid, filename, 1)) res = 1;
-  }
+  while(sqlite3_step(stmt) == SQLITE_ROW) imgs = g_list_prepend(imgs, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
   sqlite3_finalize(stmt);
+
+  dt_database_start_transaction(darktable.db);
+  for(GList *l = imgs; l; l = g_list_next(l))
+    if(_history_apply_xmp(xmp, GPOINTER_TO_INT(l->data), 1)) res = 1;
+  dt_database_release_transaction(darktable.db);
+  dt_exif_xmp_free(xmp);
+
+  _history_reload_current(imgs);
+  g_list_free(imgs);
   return res;
 }
 
-int dt_history_copy_and_paste_on_image(int32_t imgid, int32_t dest_imgid, gboolean merge, GList *ops)
+// the database part of pasting, sidecar and thumbnail are left to the caller
+static void _history_copy_and_paste_on_image(int32_t imgid, int32_t dest_imgid, gboolean merge, GList *ops)
 {
   sqlite3_stmt *stmt;
-  if(imgid == dest_imgid) return 1;
-
-  if(imgid == -1)
-  {
-    dt_control_log(_("you need to copy history from an image before you paste it onto another"));
-    return 1;
-  }
-
-  // be sure the current history is written before pasting some other history data
-  const dt_view_t *cv = dt_view_manager_get_current_view(darktable.view_manager);
-  if(cv->view((dt_view_t *)cv) == DT_VIEW_DARKROOM) dt_dev_write_history(darktable.develop);
 
   /* if merge onto history stack, lets find history offest in destination image */
   int32_t offs = 0;
@@ -564,7 +638,10 @@ int dt_history_copy_and_paste_on_image(int32_t imgid, int32_t dest_imgid, gboole
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dest_imgid);
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
+}
 
+static void _history_pasted(int32_t dest_imgid)
+{
   /* if current image in develop reload history */
   if(dt_dev_is_current_image(darktable.develop, dest_imgid))
   {
@@ -576,6 +653,27 @@ int dt_history_copy_and_paste_on_image(int32_t imgid, int32_t dest_imgid, gboole
   dt_image_synch_xmp(dest_imgid);
 
   dt_mipmap_cache_remove(darktable.mipmap_cache, dest_imgid);
+}
+
+int dt_history_copy_and_paste_on_image(int32_t imgid, int32_t dest_imgid, gboolean merge, GList *ops)
+{
+  if(imgid == dest_imgid) return 1;
+
+  if(imgid == -1)
+  {
+    dt_control_log(_("you need to copy history from an image before you paste it onto another"));
+    return 1;
+  }
+
+  // be sure the current history is written before pasting some other history data
+  const dt_view_t *cv = dt_view_manager_get_current_view(darktable.view_manager);
+  if(cv->view((dt_view_t *)cv) == DT_VIEW_DARKROOM) dt_dev_write_history(darktable.develop);
+
+  dt_database_start_transaction(darktable.db);
+  _history_copy_and_paste_on_image(imgid, dest_imgid, merge, ops);
+  dt_database_release_transaction(darktable.db);
+
+  _history_pasted(dest_imgid);
 
   return 0;
 }
@@ -666,28 +764,32 @@ int dt_history_copy_and_paste_on_selection(int32_t imgid, gboolean merge, GList
 {
   if(imgid < 0) return 1;
 
-  int res = 0;
+  GList *imgs = NULL;
   sqlite3_stmt *stmt;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "SELECT imgid FROM main.selected_images WHERE imgid != ?1", -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  if(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    do
-    {
-      /* get imgid of selected image */
-      int32_t dest_imgid = sqlite3_column_int(stmt, 0);
+  while(sqlite3_step(stmt) == SQLITE_ROW) imgs = g_list_prepend(imgs, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+  sqlite3_finalize(stmt);
 
-      /* paste history stack onto image id */
-      dt_history_copy_and_paste_on_image(imgid, dest_imgid, merge, ops);
+  if(!imgs) return 1;
+  imgs = g_list_reverse(imgs);
 
-    } while(sqlite3_step(stmt) == SQLITE_ROW);
-  }
-  else
-    res = 1;
+  // be sure the current history is written before pasting some other history data
+  const dt_view_t *cv = dt_view_manager_get_current_view(darktable.view_manager);
+  if(cv->view((dt_view_t *)cv) == DT_VIEW_DARKROOM) dt_dev_write_history(darktable.develop);
 
-  sqlite3_finalize(stmt);
-  return res;
+  /* all images in one transaction. sidecars and thumbnails are done after it, dropping a thumbnail can wait
+     for a job which needs the database itself. */
+  dt_database_start_transaction(darktable.db);
+  for(GList *l = imgs; l; l = g_list_next(l))
+    _history_copy_and_paste_on_image(imgid, GPOINTER_TO_INT(l->data), merge, ops);
+  dt_database_release_transaction(darktable.db);
+
+  for(GList *l = imgs; l; l = g_list_next(l)) _history_pasted(GPOINTER_TO_INT(l->data));
+
+  g_list_free(imgs);
+  return 0;
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -42,6 +42,10 @@ int dt_history_load_and_apply_on_selection(gchar *filename);
 /** load a dt file and applies to specified image */
 int dt_history_load_and_apply(int imgid, gchar *filename, int history_only);
 
+/** load dt files and apply each to the image at the same position in imgs. the files are read in parallel and
+ * written to the database in one transaction. */
+int dt_history_load_and_apply_list(GList *imgs, GList *filenames, int history_only);
+
 /** delete historystack of selected images */
 void dt_history_delete_on_selection();
 
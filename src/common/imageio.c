@@ -657,6 +657,9 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
     {
       dt_style_item_t *s = (dt_style_item_t *)iter->data;
 
+      // the module might not have been instantiated if neither history nor defaults use it
+      dt_iop_get_or_load_module(&dev, s->operation);
+
       for(GList *module = dev.iop; module; module = g_list_next(module))
       {
         dt_iop_module_t *m = (dt_iop_module_t *)module->data;
@@ -716,6 +719,12 @@ int dt_imageio_export_with_flags(const uint32_t imgid, const char *filename,
 
   dt_dev_pixelpipe_set_icc(&pipe, icc_type, icc_filename, icc_intent);
   dt_dev_pixelpipe_set_input(&pipe, &dev, (float *)buf.buf, buf.width, buf.height, buf.iscale);
+  if(filter)
+  {
+    // disable_after/before need the module in the pipe even if it's switched off
+    if(!strncmp(filter, "pre:", 4)) dt_iop_get_or_load_module(&dev, filter + 4);
+    if(!strncmp(filter, "post:", 5)) dt_iop_get_or_load_module(&dev, filter + 5);
+  }
   dt_dev_pixelpipe_create_nodes(&pipe, &dev);
   dt_dev_pixelpipe_synch_all(&pipe, &dev);
 
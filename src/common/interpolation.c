@@ -18,11 +18,13 @@
 
 #include "common/interpolation.h"
 #include "common/darktable.h"
+#include "common/threadpool.h"
 #include "control/conf.h"
 
 #include <assert.h>
 #include <glib.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <math.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -1350,178 +1352,317 @@ static int prepare_resampling_plan(const struct dt_interpolation *itor, int in,
   return 0;
 }
 
-static void dt_interpolation_resample_plain(const struct dt_interpolation *itor, float *out,
-                                            const dt_iop_roi_t *const roi_out, const int32_t out_stride,
-                                            const float *const in, const dt_iop_roi_t *const roi_in,
-                                            const int32_t in_stride)
+/* --------------------------------------------------------------------------
+ * Resampling plan cache
+ * ------------------------------------------------------------------------*/
+
+/* A plan only depends on the interpolator, the extents, the offsets and the
+ * scale. The pixelpipes keep asking for the very same ones (same view, same
+ * preview size, same export size), so keep the most recently used plans
+ * around instead of recomputing all the kernel taps on every call. */
+
+#define RESAMPLING_PLAN_CACHE_SIZE 16
+
+typedef struct dt_resampling_plan_t
 {
-  int *hindex = NULL;
-  int *hlength = NULL;
-  float *hkernel = NULL;
-  int *vindex = NULL;
-  int *vlength = NULL;
-  float *vkernel = NULL;
-  int *vmeta = NULL;
+  // cache key
+  enum dt_interpolation_type itor;
+  int in;
+  int in_x0;
+  int out;
+  int out_x0;
+  float scale;
+
+  // the plan, see prepare_resampling_plan(). length is the only allocation
+  int *length;
+  float *kernel;
+  int *index;
+  int *meta;
+  int maxtaps;
+
+  // one reference per user plus one for the cache itself
+  int refs;
+  uint64_t used;
+} dt_resampling_plan_t;
+
+static struct
+{
+  GMutex lock; // statically allocated, no need to init
+  uint64_t clock;
+  dt_resampling_plan_t *plan[RESAMPLING_PLAN_CACHE_SIZE];
+} plan_cache;
 
-  int r;
+// plan_cache.lock has to be held
+static void unref_resampling_plan_locked(dt_resampling_plan_t *plan)
+{
+  if(--plan->refs > 0) return;
+  dt_free_align(plan->length);
+  free(plan);
+}
 
-  debug_info("resampling %p (%dx%d@%dx%d scale %f) -> %p (%dx%d@%dx%d scale %f)\n", in, roi_in->width,
-             roi_in->height, roi_in->x, roi_in->y, roi_in->scale, out, roi_out->width, roi_out->height,
-             roi_out->x, roi_out->y, roi_out->scale);
+static void release_resampling_plan(dt_resampling_plan_t *plan)
+{
+  if(!plan) return;
+  g_mutex_lock(&plan_cache.lock);
+  unref_resampling_plan_locked(plan);
+  g_mutex_unlock(&plan_cache.lock);
+}
 
-  // Fast code path for 1:1 copy, only cropping area can change
-  if(roi_out->scale == 1.f)
+// plan_cache.lock has to be held. returns a new reference or NULL
+static dt_resampling_plan_t *lookup_resampling_plan_locked(const struct dt_interpolation *itor, const int in,
+                                                           const int in_x0, const int out, const int out_x0,
+                                                           const float scale)
+{
+  for(int k = 0; k < RESAMPLING_PLAN_CACHE_SIZE; k++)
   {
-    const int x0 = roi_out->x * 4 * sizeof(float);
-    const int l = roi_out->width * 4 * sizeof(float);
-#if DEBUG_RESAMPLING_TIMING
-    int64_t ts_resampling = getts();
-#endif
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(out)
-#endif
-    for(int y = 0; y < roi_out->height; y++)
+    dt_resampling_plan_t *plan = plan_cache.plan[k];
+    if(plan && plan->itor == itor->id && plan->in == in && plan->in_x0 == in_x0 && plan->out == out
+       && plan->out_x0 == out_x0 && plan->scale == scale)
     {
-      float *i = (float *)((char *)in + (size_t)in_stride * (y + roi_out->y) + x0);
-      float *o = (float *)((char *)out + (size_t)out_stride * y);
-      memcpy(o, i, l);
+      plan->refs++;
+      plan->used = ++plan_cache.clock;
+      return plan;
     }
-#if DEBUG_RESAMPLING_TIMING
-    ts_resampling = getts() - ts_resampling;
-    fprintf(stderr, "resampling %p plan:0us resampling:%" PRId64 "us\n", in, ts_resampling);
-#endif
-    // All done, so easy case
-    return;
   }
+  return NULL;
+}
 
-// Generic non 1:1 case... much more complicated :D
-#if DEBUG_RESAMPLING_TIMING
-  int64_t ts_plan = getts();
-#endif
+/** Returns a (possibly shared) resampling plan, including meta data. It
+ * must not be modified and has to be given back with
+ * release_resampling_plan(). Returns NULL on allocation failure. */
+static dt_resampling_plan_t *get_resampling_plan(const struct dt_interpolation *itor, const int in,
+                                                 const int in_x0, const int out, const int out_x0,
+                                                 const float scale)
+{
+  g_mutex_lock(&plan_cache.lock);
+  dt_resampling_plan_t *plan = lookup_resampling_plan_locked(itor, in, in_x0, out, out_x0, scale);
+  g_mutex_unlock(&plan_cache.lock);
+  if(plan) return plan;
+
+  // build it outside of the lock, this is the expensive part
+  plan = calloc(1, sizeof(dt_resampling_plan_t));
+  if(!plan) return NULL;
+  plan->itor = itor->id;
+  plan->in = in;
+  plan->in_x0 = in_x0;
+  plan->out = out;
+  plan->out_x0 = out_x0;
+  plan->scale = scale;
+  plan->refs = 1;
+  if(prepare_resampling_plan(itor, in, in_x0, out, out_x0, scale, &plan->length, &plan->kernel, &plan->index,
+                             &plan->meta)
+     || !plan->length)
+  {
+    dt_free_align(plan->length);
+    free(plan);
+    return NULL;
+  }
+  for(int k = 0; k < out; k++) plan->maxtaps = MAX(plan->maxtaps, plan->length[k]);
 
-  // Prepare resampling plans once and for all
-  r = prepare_resampling_plan(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale,
-                              &hlength, &hkernel, &hindex, NULL);
-  if(r)
+  g_mutex_lock(&plan_cache.lock);
+  // somebody else might have been faster
+  dt_resampling_plan_t *cached = lookup_resampling_plan_locked(itor, in, in_x0, out, out_x0, scale);
+  if(cached)
   {
-    goto exit;
+    unref_resampling_plan_locked(plan);
+    plan = cached;
   }
+  else
+  {
+    // replace an empty or the least recently used slot
+    int slot = 0;
+    for(int k = 0; k < RESAMPLING_PLAN_CACHE_SIZE; k++)
+    {
+      if(!plan_cache.plan[k])
+      {
+        slot = k;
+        break;
+      }
+      if(plan_cache.plan[k]->used < plan_cache.plan[slot]->used) slot = k;
+    }
+    if(plan_cache.plan[slot]) unref_resampling_plan_locked(plan_cache.plan[slot]);
+    plan->refs++;
+    plan->used = ++plan_cache.clock;
+    plan_cache.plan[slot] = plan;
+  }
+  g_mutex_unlock(&plan_cache.lock);
+  return plan;
+}
 
-  r = prepare_resampling_plan(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale,
-                              &vlength, &vkernel, &vindex, &vmeta);
-  if(r)
+void dt_interpolation_cleanup_plan_cache(void)
+{
+  g_mutex_lock(&plan_cache.lock);
+  for(int k = 0; k < RESAMPLING_PLAN_CACHE_SIZE; k++)
   {
-    goto exit;
+    if(plan_cache.plan[k]) unref_resampling_plan_locked(plan_cache.plan[k]);
+    plan_cache.plan[k] = NULL;
   }
+  g_mutex_unlock(&plan_cache.lock);
+}
 
-#if DEBUG_RESAMPLING_TIMING
-  ts_plan = getts() - ts_plan;
-#endif
+/* --------------------------------------------------------------------------
+ * Separable resampling
+ * ------------------------------------------------------------------------*/
 
-#if DEBUG_RESAMPLING_TIMING
-  int64_t ts_resampling = getts();
+/* The image is resampled in two passes: the horizontal one goes over every
+ * input line needed by a band of output lines and stores the result
+ * transposed, ie. all input lines of one output column are contiguous. The
+ * vertical pass then only reads short contiguous runs per output pixel.
+ * Compared to applying the 2D kernel directly this saves the horizontal
+ * convolution being redone for every output line an input line contributes
+ * to. */
+
+// soft limit for the intermediate buffer of one band of output lines
+#define RESAMPLING_BAND_BYTES ((size_t)32 << 20)
+
+/** Horizontal pass over one input line. Output column ox goes to
+ * tmp[4 * pitch * ox], the plan is walked sequentially. */
+typedef void (*dt_resample_hrow_t)(float *const tmp, const size_t pitch, const float *const in, const int width,
+                                   const int *length, const float *kernel, const int *index);
+
+/** Vertical pass for one output line. length/kernel/index point to the taps
+ * of this line, indexes are relative to the first line y0 held by tmp. */
+typedef void (*dt_resample_vrow_t)(float *const out, const int width, const float *const tmp, const size_t pitch,
+                                   const int y0, const int length, const float *const kernel,
+                                   const int *const index);
+
+#ifdef HAVE_AVX2_CODEPATHS
+// runtime dispatched variants, compiled with -mavx2 in interpolation_avx2.c
+void dt_interpolation_resample_hrow_avx2(float *const tmp, const size_t pitch, const float *const in,
+                                         const int width, const int *length, const float *kernel,
+                                         const int *index);
+void dt_interpolation_resample_vrow_avx2(float *const out, const int width, const float *const tmp,
+                                         const size_t pitch, const int y0, const int length,
+                                         const float *const kernel, const int *const index);
 #endif
 
-// Process each output line
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(out, hindex, hlength, hkernel, vindex, vlength, vkernel, vmeta)
-#endif
-  for(int oy = 0; oy < roi_out->height; oy++)
+static void resample_hrow_plain(float *const tmp, const size_t pitch, const float *const in, const int width,
+                                const int *length, const float *kernel, const int *index)
+{
+  for(int ox = 0; ox < width; ox++)
   {
-    // Initialize column resampling indexes
-    int vlidx = vmeta[3 * oy + 0]; // V(ertical) L(ength) I(n)d(e)x
-    int vkidx = vmeta[3 * oy + 1]; // V(ertical) K(ernel) I(n)d(e)x
-    int viidx = vmeta[3 * oy + 2]; // V(ertical) I(ndex) I(n)d(e)x
-
-    // Initialize row resampling indexes
-    int hlidx = 0; // H(orizontal) L(ength) I(n)d(e)x
-    int hkidx = 0; // H(orizontal) K(ernel) I(n)d(e)x
-    int hiidx = 0; // H(orizontal) I(ndex) I(n)d(e)x
-
-    // Number of lines contributing to the output line
-    int vl = vlength[vlidx++]; // V(ertical) L(ength)
-
-    // Process each output column
-    for(int ox = 0; ox < roi_out->width; ox++)
+    const int hl = *length++;
+    float hs[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    for(int ix = 0; ix < hl; ix++)
     {
-      debug_extra("output %p [% 4d % 4d]\n", out, ox, oy);
-
-      // This will hold the resulting pixel
-      float vs[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
-
-      // Number of horizontal samples contributing to the output
-      int hl = hlength[hlidx++]; // H(orizontal) L(ength)
-
-      for(int iy = 0; iy < vl; iy++)
-      {
-        // This is our input line
-        const float *i = (float *)((char *)in + (size_t)in_stride * vindex[viidx++]);
-
-        float vhs[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
-
-        for(int ix = 0; ix < hl; ix++)
-        {
-          // Apply the precomputed filter kernel
-          size_t baseidx = (size_t)hindex[hiidx++] * 4;
-          const float htap = hkernel[hkidx++];
-          for(int c = 0; c < 3; c++) vhs[c] += i[baseidx + c] * htap;
-        }
-
-        // Accumulate contribution from this line
-        const float vtap = vkernel[vkidx++];
-        for(int c = 0; c < 3; c++) vs[c] += vhs[c] * vtap;
-
-        // Reset horizontal resampling context
-        hkidx -= hl;
-        hiidx -= hl;
-      }
-
-      // Output pixel is ready
-      float *o = (float *)((char *)out + (size_t)oy * out_stride + (size_t)ox * 4 * sizeof(float));
-      for(int c = 0; c < 3; c++) o[c] = vs[c];
-
-      // Reset vertical resampling context
-      viidx -= vl;
-      vkidx -= vl;
+      const float *i = in + (size_t)4 * *index++;
+      const float htap = *kernel++;
+      for(int c = 0; c < 4; c++) hs[c] += i[c] * htap;
+    }
+    float *t = tmp + 4 * pitch * ox;
+    for(int c = 0; c < 4; c++) t[c] = hs[c];
+  }
+}
 
-      // Progress in horizontal context
-      hiidx += hl;
-      hkidx += hl;
+static void resample_vrow_plain(float *const out, const int width, const float *const tmp, const size_t pitch,
+                                const int y0, const int length, const float *const kernel,
+                                const int *const index)
+{
+  for(int ox = 0; ox < width; ox++)
+  {
+    const float *t = tmp + 4 * pitch * ox;
+    float vs[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    for(int iy = 0; iy < length; iy++)
+    {
+      const float *i = t + (size_t)4 * (index[iy] - y0);
+      const float vtap = kernel[iy];
+      for(int c = 0; c < 4; c++) vs[c] += i[c] * vtap;
     }
+    for(int c = 0; c < 4; c++) out[4 * ox + c] = vs[c];
+  }
+}
 
-    // Progress in vertical context
-    viidx += vl;
-    vkidx += vl;
+#if defined(__SSE2__)
+static void resample_hrow_sse(float *const tmp, const size_t pitch, const float *const in, const int width,
+                              const int *length, const float *kernel, const int *index)
+{
+  for(int ox = 0; ox < width; ox++)
+  {
+    const int hl = *length++;
+    __m128 hs = _mm_setzero_ps();
+    for(int ix = 0; ix < hl; ix++)
+    {
+      const __m128 i = _mm_load_ps(in + (size_t)4 * *index++);
+      hs = _mm_add_ps(hs, _mm_mul_ps(i, _mm_set1_ps(*kernel++)));
+    }
+    _mm_store_ps(tmp + 4 * pitch * ox, hs);
   }
+}
 
-#if DEBUG_RESAMPLING_TIMING
-  ts_resampling = getts() - ts_resampling;
-  fprintf(stderr, "resampling %p plan:%" PRId64 "us resampling:%" PRId64 "us\n", in, ts_plan, ts_resampling);
+static void resample_vrow_sse(float *const out, const int width, const float *const tmp, const size_t pitch,
+                              const int y0, const int length, const float *const kernel, const int *const index)
+{
+  for(int ox = 0; ox < width; ox++)
+  {
+    const float *t = tmp + 4 * pitch * ox;
+    __m128 vs = _mm_setzero_ps();
+    for(int iy = 0; iy < length; iy++)
+    {
+      const __m128 i = _mm_load_ps(t + (size_t)4 * (index[iy] - y0));
+      vs = _mm_add_ps(vs, _mm_mul_ps(i, _mm_set1_ps(kernel[iy])));
+    }
+    // output is not read again any time soon
+    _mm_stream_ps(out + 4 * ox, vs);
+  }
+  _mm_sfence();
+}
 #endif
 
-exit:
-  /* Free the resampling plans. It's nasty to optimize allocs like that, but
-   * it simplifies the code :-D. The length array is in fact the only memory
-   * allocated. */
-  dt_free_align(hlength);
-  dt_free_align(vlength);
+// one band of resample_separable(), for dt_parallel_for()
+typedef struct dt_resample_band_t
+{
+  float *out;
+  const float *in;
+  int32_t out_stride, in_stride;
+  int width, rows, y0;
+  float *tmp;
+  const dt_resampling_plan_t *hplan, *vplan;
+  dt_resample_hrow_t hrow;
+  dt_resample_vrow_t vrow;
+} dt_resample_band_t;
+
+static void resample_band_hrows(const size_t r0, const size_t r1, void *data)
+{
+  const dt_resample_band_t *const b = (const dt_resample_band_t *)data;
+  for(size_t r = r0; r < r1; r++)
+  {
+    const float *i = (const float *)((const char *)b->in + (size_t)b->in_stride * (b->y0 + r));
+    b->hrow(b->tmp + 4 * r, b->rows, i, b->width, b->hplan->length, b->hplan->kernel, b->hplan->index);
+  }
 }
 
-#if defined(__SSE2__)
-static void dt_interpolation_resample_sse(const struct dt_interpolation *itor, float *out,
-                                          const dt_iop_roi_t *const roi_out, const int32_t out_stride,
-                                          const float *const in, const dt_iop_roi_t *const roi_in,
-                                          const int32_t in_stride)
+static void resample_band_vrows(const size_t oy0, const size_t oy1, void *data)
+{
+  const dt_resample_band_t *const b = (const dt_resample_band_t *)data;
+  const dt_resampling_plan_t *const vplan = b->vplan;
+  for(size_t oy = oy0; oy < oy1; oy++)
+  {
+    float *o = (float *)((char *)b->out + (size_t)b->out_stride * oy);
+    b->vrow(o, b->width, b->tmp, b->rows, b->y0, vplan->length[oy], vplan->kernel + vplan->meta[3 * oy + 1],
+            vplan->index + vplan->meta[3 * oy + 2]);
+  }
+}
+
+static void resample_copy_rows(const size_t y0, const size_t y1, void *data)
 {
-  int *hindex = NULL;
-  int *hlength = NULL;
-  float *hkernel = NULL;
-  int *vindex = NULL;
-  int *vlength = NULL;
-  float *vkernel = NULL;
-  int *vmeta = NULL;
+  const dt_resample_band_t *const b = (const dt_resample_band_t *)data;
+  for(size_t y = y0; y < y1; y++)
+  {
+    const char *i = (const char *)b->in + (size_t)b->in_stride * (y + b->y0);
+    char *o = (char *)b->out + (size_t)b->out_stride * y;
+    memcpy(o, i, (size_t)b->width * 4 * sizeof(float));
+  }
+}
 
-  int r;
+static void resample_separable(const struct dt_interpolation *itor, float *out,
+                               const dt_iop_roi_t *const roi_out, const int32_t out_stride,
+                               const float *const in, const dt_iop_roi_t *const roi_in, const int32_t in_stride,
+                               dt_resample_hrow_t hrow, dt_resample_vrow_t vrow)
+{
+  dt_resampling_plan_t *hplan = NULL;
+  dt_resampling_plan_t *vplan = NULL;
+  int *bands = NULL;
+  float *tmp = NULL;
 
   debug_info("resampling %p (%dx%d@%dx%d scale %f) -> %p (%dx%d@%dx%d scale %f)\n", in, roi_in->width,
              roi_in->height, roi_in->x, roi_in->y, roi_in->scale, out, roi_out->width, roi_out->height,
@@ -1531,19 +1672,13 @@ static void dt_interpolation_resample_sse(const struct dt_interpolation *itor, f
   if(roi_out->scale == 1.f)
   {
     const int x0 = roi_out->x * 4 * sizeof(float);
-    const int l = roi_out->width * 4 * sizeof(float);
 #if DEBUG_RESAMPLING_TIMING
     int64_t ts_resampling = getts();
 #endif
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(out)
-#endif
-    for(int y = 0; y < roi_out->height; y++)
-    {
-      float *i = (float *)((char *)in + (size_t)in_stride * (y + roi_out->y) + x0);
-      float *o = (float *)((char *)out + (size_t)out_stride * y);
-      memcpy(o, i, l);
-    }
+    dt_resample_band_t copy = { .out = out, .in = (const float *)((const char *)in + x0),
+                                .out_stride = out_stride, .in_stride = in_stride,
+                                .width = roi_out->width, .y0 = roi_out->y };
+    dt_parallel_for(0, roi_out->height, 0, resample_copy_rows, &copy);
 #if DEBUG_RESAMPLING_TIMING
     ts_resampling = getts() - ts_resampling;
     fprintf(stderr, "resampling %p plan:0us resampling:%" PRId64 "us\n", in, ts_resampling);
@@ -1557,118 +1692,75 @@ static void dt_interpolation_resample_sse(const struct dt_interpolation *itor, f
   int64_t ts_plan = getts();
 #endif
 
-  // Prepare resampling plans once and for all
-  r = prepare_resampling_plan(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale,
-                              &hlength, &hkernel, &hindex, NULL);
-  if(r)
-  {
-    goto exit;
-  }
+  hplan = get_resampling_plan(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale);
+  vplan = get_resampling_plan(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale);
+  if(!hplan || !vplan) goto exit;
 
-  r = prepare_resampling_plan(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale,
-                              &vlength, &vkernel, &vindex, &vmeta);
-  if(r)
+  const int width = roi_out->width;
+  const int height = roi_out->height;
+
+  // split the output into bands whose horizontally resampled input lines
+  // roughly fit into RESAMPLING_BAND_BYTES, but keep enough lines per band
+  // for all threads
+  const size_t line_bytes = (size_t)4 * sizeof(float) * width;
+  const int budget = MAX(1, (int)(RESAMPLING_BAND_BYTES / line_bytes) - vplan->maxtaps);
+  const int band = CLAMP((int)(budget * roi_out->scale), MIN(16, height), height);
+  const int nbands = (height + band - 1) / band;
+
+  // first and last input line of every band
+  bands = malloc(sizeof(int) * 2 * nbands);
+  if(!bands) goto exit;
+  int maxrows = 0;
+  for(int b = 0; b < nbands; b++)
   {
-    goto exit;
+    int y0 = INT_MAX, y1 = -1;
+    for(int oy = b * band; oy < MIN(height, (b + 1) * band); oy++)
+    {
+      const int *index = vplan->index + vplan->meta[3 * oy + 2];
+      for(int iy = 0; iy < vplan->length[oy]; iy++)
+      {
+        y0 = MIN(y0, index[iy]);
+        y1 = MAX(y1, index[iy]);
+      }
+    }
+    bands[2 * b + 0] = y0;
+    bands[2 * b + 1] = y1;
+    maxrows = MAX(maxrows, y1 - y0 + 1);
   }
 
-#if DEBUG_RESAMPLING_TIMING
-  ts_plan = getts() - ts_plan;
-#endif
+  tmp = dt_alloc_align(64, line_bytes * maxrows);
+  if(!tmp) goto exit;
 
 #if DEBUG_RESAMPLING_TIMING
+  ts_plan = getts() - ts_plan;
   int64_t ts_resampling = getts();
 #endif
 
-// Process each output line
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(out, hindex, hlength, hkernel, vindex, vlength, vkernel, vmeta)
-#endif
-  for(int oy = 0; oy < roi_out->height; oy++)
+  for(int b = 0; b < nbands; b++)
   {
-    // Initialize column resampling indexes
-    int vlidx = vmeta[3 * oy + 0]; // V(ertical) L(ength) I(n)d(e)x
-    int vkidx = vmeta[3 * oy + 1]; // V(ertical) K(ernel) I(n)d(e)x
-    int viidx = vmeta[3 * oy + 2]; // V(ertical) I(ndex) I(n)d(e)x
-
-    // Initialize row resampling indexes
-    int hlidx = 0; // H(orizontal) L(ength) I(n)d(e)x
-    int hkidx = 0; // H(orizontal) K(ernel) I(n)d(e)x
-    int hiidx = 0; // H(orizontal) I(ndex) I(n)d(e)x
-
-    // Number of lines contributing to the output line
-    int vl = vlength[vlidx++]; // V(ertical) L(ength)
-
-    // Process each output column
-    for(int ox = 0; ox < roi_out->width; ox++)
-    {
-      debug_extra("output %p [% 4d % 4d]\n", out, ox, oy);
-
-      // This will hold the resulting pixel
-      __m128 vs = _mm_setzero_ps();
-
-      // Number of horizontal samples contributing to the output
-      int hl = hlength[hlidx++]; // H(orizontal) L(ength)
-
-      for(int iy = 0; iy < vl; iy++)
-      {
-        // This is our input line
-        const float *i = (float *)((char *)in + (size_t)in_stride * vindex[viidx++]);
-
-        __m128 vhs = _mm_setzero_ps();
-
-        for(int ix = 0; ix < hl; ix++)
-        {
-          // Apply the precomputed filter kernel
-          size_t baseidx = (size_t)hindex[hiidx++] * 4;
-          float htap = hkernel[hkidx++];
-          __m128 vhtap = _mm_set_ps1(htap);
-          vhs = _mm_add_ps(vhs, _mm_mul_ps(*(__m128 *)&i[baseidx], vhtap));
-        }
-
-        // Accumulate contribution from this line
-        float vtap = vkernel[vkidx++];
-        __m128 vvtap = _mm_set_ps1(vtap);
-        vs = _mm_add_ps(vs, _mm_mul_ps(vhs, vvtap));
-
-        // Reset horizontal resampling context
-        hkidx -= hl;
-        hiidx -= hl;
-      }
-
-      // Output pixel is ready
-      float *o = (float *)((char *)out + (size_t)oy * out_stride + (size_t)ox * 4 * sizeof(float));
-      _mm_stream_ps(o, vs);
-
-      // Reset vertical resampling context
-      viidx -= vl;
-      vkidx -= vl;
-
-      // Progress in horizontal context
-      hiidx += hl;
-      hkidx += hl;
-    }
-
-    // Progress in vertical context
-//     viidx += vl;
-//     vkidx += vl;
+    const int y0 = bands[2 * b + 0];
+    const int rows = bands[2 * b + 1] - y0 + 1;
+    const int oy0 = b * band;
+    const int oy1 = MIN(height, oy0 + band);
+
+    dt_resample_band_t band_args = { .out = out, .in = in, .out_stride = out_stride, .in_stride = in_stride,
+                                     .width = width, .rows = rows, .y0 = y0, .tmp = tmp, .hplan = hplan,
+                                     .vplan = vplan, .hrow = hrow, .vrow = vrow };
+    dt_parallel_for(0, rows, 0, resample_band_hrows, &band_args);
+    dt_parallel_for(oy0, oy1, 0, resample_band_vrows, &band_args);
   }
 
-  _mm_sfence();
-
 #if DEBUG_RESAMPLING_TIMING
   ts_resampling = getts() - ts_resampling;
   fprintf(stderr, "resampling %p plan:%" PRId64 "us resampling:%" PRId64 "us\n", in, ts_plan, ts_resampling);
 #endif
 
 exit:
-  /* Free the resampling plans. It's nasty to optimize allocs like that, but
-   * it simplifies the code :-D. The length array is in fact the only memory
-   * allocated. */
-  dt_free_align(hlength);
-  dt_free_align(vlength);
+  dt_free_align(tmp);
+  free(bands);
+  release_resampling_plan(hplan);
+  release_resampling_plan(vplan);
 }
-#endif
 
 /** Applies resampling (re-scaling) on *full* input and output buffers.
  *  roi_in and roi_out define the part of the buffers that is affected.
@@ -1679,10 +1771,17 @@ void dt_interpolation_resample(const struct dt_interpolation *itor, float *out,
                                const int32_t in_stride)
 {
   if(darktable.codepath.OPENMP_SIMD)
-    return dt_interpolation_resample_plain(itor, out, roi_out, out_stride, in, roi_in, in_stride);
+    return resample_separable(itor, out, roi_out, out_stride, in, roi_in, in_stride, resample_hrow_plain,
+                              resample_vrow_plain);
+#ifdef HAVE_AVX2_CODEPATHS
+  else if(darktable.codepath.AVX2)
+    return resample_separable(itor, out, roi_out, out_stride, in, roi_in, in_stride,
+                              dt_interpolation_resample_hrow_avx2, dt_interpolation_resample_vrow_avx2);
+#endif
 #if defined(__SSE2__)
   else if(darktable.codepath.SSE2)
-    return dt_interpolation_resample_sse(itor, out, roi_out, out_stride, in, roi_in, in_stride);
+    return resample_separable(itor, out, roi_out, out_stride, in, roi_in, in_stride, resample_hrow_sse,
+                              resample_vrow_sse);
 #endif
   else
     dt_unreachable_codepath();
@@ -1744,16 +1843,9 @@ int dt_interpolation_resample_cl(const struct dt_interpolation *itor, int devid,
                                  const dt_iop_roi_t *const roi_out, cl_mem dev_in,
                                  const dt_iop_roi_t *const roi_in)
 {
-  int *hindex = NULL;
-  int *hlength = NULL;
-  float *hkernel = NULL;
-  int *hmeta = NULL;
-  int *vindex = NULL;
-  int *vlength = NULL;
-  float *vkernel = NULL;
-  int *vmeta = NULL;
-
-  int r;
+  dt_resampling_plan_t *hplan = NULL;
+  dt_resampling_plan_t *vplan = NULL;
+
   cl_int err = -999;
 
   cl_mem dev_hindex = NULL;
@@ -1796,24 +1888,23 @@ int dt_interpolation_resample_cl(const struct dt_interpolation *itor, int devid,
   int64_t ts_plan = getts();
 #endif
 
-  // Prepare resampling plans once and for all
-  r = prepare_resampling_plan(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale,
-                              &hlength, &hkernel, &hindex, &hmeta);
-  if(r)
-  {
-    goto error;
-  }
-
-  r = prepare_resampling_plan(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale,
-                              &vlength, &vkernel, &vindex, &vmeta);
-  if(r)
+  // Resampling plans are shared with the cpu path, see get_resampling_plan()
+  hplan = get_resampling_plan(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale);
+  vplan = get_resampling_plan(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale);
+  if(!hplan || !vplan)
   {
     goto error;
   }
 
-  int hmaxtaps = -1, vmaxtaps = -1;
-  for(int k = 0; k < roi_out->width; k++) hmaxtaps = MAX(hmaxtaps, hlength[k]);
-  for(int k = 0; k < roi_out->height; k++) vmaxtaps = MAX(vmaxtaps, vlength[k]);
+  int *hindex = hplan->index;
+  int *hlength = hplan->length;
+  float *hkernel = hplan->kernel;
+  int *hmeta = hplan->meta;
+  int *vindex = vplan->index;
+  int *vlength = vplan->length;
+  float *vkernel = vplan->kernel;
+  int *vmeta = vplan->meta;
+  int hmaxtaps = hplan->maxtaps, vmaxtaps = vplan->maxtaps;
 
 #if DEBUG_RESAMPLING_TIMING
   ts_plan = getts() - ts_plan;
@@ -1922,8 +2013,8 @@ int dt_interpolation_resample_cl(const struct dt_interpolation *itor, int devid,
   dt_opencl_release_mem_object(dev_vlength);
   dt_opencl_release_mem_object(dev_vkernel);
   dt_opencl_release_mem_object(dev_vmeta);
-  dt_free_align(hlength);
-  dt_free_align(vlength);
+  release_resampling_plan(hplan);
+  release_resampling_plan(vplan);
   return CL_SUCCESS;
 
 error:
@@ -1935,8 +2026,8 @@ error:
   dt_opencl_release_mem_object(dev_vlength);
   dt_opencl_release_mem_object(dev_vkernel);
   dt_opencl_release_mem_object(dev_vmeta);
-  dt_free_align(hlength);
-  dt_free_align(vlength);
+  release_resampling_plan(hplan);
+  release_resampling_plan(vplan);
   dt_print(DT_DEBUG_OPENCL, "[opencl_resampling] couldn't enqueue kernel! %d\n", err);
   return err;
 }
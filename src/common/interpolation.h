@@ -142,6 +142,10 @@ void dt_interpolation_resample_roi(const struct dt_interpolation *itor, float *o
                                    const float *const in, const dt_iop_roi_t *const roi_in,
                                    const int32_t in_stride);
 
+/** Frees the resampling plans cached by dt_interpolation_resample() and
+ * dt_interpolation_resample_cl(). */
+void dt_interpolation_cleanup_plan_cache(void);
+
 #ifdef HAVE_OPENCL
 typedef struct dt_interpolation_cl_global_t
 {
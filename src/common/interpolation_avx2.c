@@ -0,0 +1,111 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// this file is compiled with -mavx2. nothing in here may be called unless
+// darktable.codepath.AVX2 is set, see dt_interpolation_resample() in interpolation.c.
+
+#include <immintrin.h>
+#include <stddef.h>
+
+void dt_interpolation_resample_hrow_avx2(float *const tmp, const size_t pitch, const float *const in,
+                                         const int width, const int *length, const float *kernel,
+                                         const int *index);
+void dt_interpolation_resample_vrow_avx2(float *const out, const int width, const float *const tmp,
+                                         const size_t pitch, const int y0, const int length,
+                                         const float *const kernel, const int *const index);
+
+static inline __m256 load2_ps(const float *const lo, const float *const hi)
+{
+  return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_load_ps(lo)), _mm_load_ps(hi), 1);
+}
+
+static inline __m256 set2_ps(const float lo, const float hi)
+{
+  return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(lo)), _mm_set1_ps(hi), 1);
+}
+
+/** horizontal pass over one input line, see resample_hrow_sse() in interpolation.c. the taps of one output
+ * pixel are processed two pixels per vector, with two accumulators to hide the add latency. */
+void dt_interpolation_resample_hrow_avx2(float *const tmp, const size_t pitch, const float *const in,
+                                         const int width, const int *length, const float *kernel,
+                                         const int *index)
+{
+  for(int ox = 0; ox < width; ox++)
+  {
+    const int hl = *length++;
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    int ix = 0;
+    for(; ix + 4 <= hl; ix += 4, index += 4, kernel += 4)
+    {
+      const __m256 p0 = load2_ps(in + (size_t)4 * index[0], in + (size_t)4 * index[1]);
+      const __m256 p1 = load2_ps(in + (size_t)4 * index[2], in + (size_t)4 * index[3]);
+      acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(p0, set2_ps(kernel[0], kernel[1])));
+      acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(p1, set2_ps(kernel[2], kernel[3])));
+    }
+    for(; ix + 2 <= hl; ix += 2, index += 2, kernel += 2)
+    {
+      const __m256 p0 = load2_ps(in + (size_t)4 * index[0], in + (size_t)4 * index[1]);
+      acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(p0, set2_ps(kernel[0], kernel[1])));
+    }
+    acc0 = _mm256_add_ps(acc0, acc1);
+    __m128 hs = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+    for(; ix < hl; ix++)
+      hs = _mm_add_ps(hs, _mm_mul_ps(_mm_load_ps(in + (size_t)4 * *index++), _mm_set1_ps(*kernel++)));
+    _mm_store_ps(tmp + 4 * pitch * ox, hs);
+  }
+}
+
+/** vertical pass for one output line, see resample_vrow_sse() in interpolation.c. all output pixels of a
+ * line share the same taps, so four of them are done at once. */
+void dt_interpolation_resample_vrow_avx2(float *const out, const int width, const float *const tmp,
+                                         const size_t pitch, const int y0, const int length,
+                                         const float *const kernel, const int *const index)
+{
+  int ox = 0;
+  for(; ox + 4 <= width; ox += 4)
+  {
+    const float *t0 = tmp + 4 * pitch * ox;
+    const float *t1 = t0 + 4 * pitch;
+    const float *t2 = t1 + 4 * pitch;
+    const float *t3 = t2 + 4 * pitch;
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    for(int iy = 0; iy < length; iy++)
+    {
+      const size_t r = (size_t)4 * (index[iy] - y0);
+      const __m256 vtap = _mm256_set1_ps(kernel[iy]);
+      acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(load2_ps(t0 + r, t1 + r), vtap));
+      acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(load2_ps(t2 + r, t3 + r), vtap));
+    }
+    _mm256_storeu_ps(out + 4 * ox, acc0);
+    _mm256_storeu_ps(out + 4 * ox + 8, acc1);
+  }
+  for(; ox < width; ox++)
+  {
+    const float *t = tmp + 4 * pitch * ox;
+    __m128 vs = _mm_setzero_ps();
+    for(int iy = 0; iy < length; iy++)
+      vs = _mm_add_ps(vs, _mm_mul_ps(_mm_load_ps(t + (size_t)4 * (index[iy] - y0)), _mm_set1_ps(kernel[iy])));
+    _mm_storeu_ps(out + 4 * ox, vs);
+  }
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
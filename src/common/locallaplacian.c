@@ -81,30 +81,38 @@ static inline float ll_expand_gaussian(
   }
 }
 
-// helper to fill in one pixel boundary by copying it
+// helper to fill in one pixel boundary by copying it, for buffers with ch floats per pixel
 static inline void ll_fill_boundary1(
     float *const input,
     const int wd,
-    const int ht)
+    const int ht,
+    const int ch)
 {
-  for(int j=1;j<ht-1;j++) input[j*wd] = input[j*wd+1];
-  for(int j=1;j<ht-1;j++) input[j*wd+wd-1] = input[j*wd+wd-2];
-  memcpy(input,    input+wd, sizeof(float)*wd);
-  memcpy(input+wd*(ht-1), input+wd*(ht-2), sizeof(float)*wd);
+  const size_t px = sizeof(float) * ch;
+  for(int j=1;j<ht-1;j++) memcpy(input+(size_t)ch*j*wd, input+(size_t)ch*(j*wd+1), px);
+  for(int j=1;j<ht-1;j++) memcpy(input+(size_t)ch*(j*wd+wd-1), input+(size_t)ch*(j*wd+wd-2), px);
+  memcpy(input,    input+(size_t)ch*wd, px*wd);
+  memcpy(input+(size_t)ch*wd*(ht-1), input+(size_t)ch*wd*(ht-2), px*wd);
 }
 
-// helper to fill in two pixels boundary by copying it
+// helper to fill in two pixels boundary by copying it, for buffers with ch floats per pixel
 static inline void ll_fill_boundary2(
     float *const input,
     const int wd,
-    const int ht)
+    const int ht,
+    const int ch)
 {
-  for(int j=1;j<ht-1;j++) input[j*wd] = input[j*wd+1];
-  if(wd & 1) for(int j=1;j<ht-1;j++) input[j*wd+wd-1] = input[j*wd+wd-2];
-  else       for(int j=1;j<ht-1;j++) input[j*wd+wd-1] = input[j*wd+wd-2] = input[j*wd+wd-3];
-  memcpy(input, input+wd, sizeof(float)*wd);
-  if(!(ht & 1)) memcpy(input+wd*(ht-2), input+wd*(ht-3), sizeof(float)*wd);
-  memcpy(input+wd*(ht-1), input+wd*(ht-2), sizeof(float)*wd);
+  const size_t px = sizeof(float) * ch;
+  for(int j=1;j<ht-1;j++) memcpy(input+(size_t)ch*j*wd, input+(size_t)ch*(j*wd+1), px);
+  for(int j=1;j<ht-1;j++)
+  {
+    float *const row = input+(size_t)ch*j*wd;
+    if(!(wd & 1)) memcpy(row+(size_t)ch*(wd-2), row+(size_t)ch*(wd-3), px);
+    memcpy(row+(size_t)ch*(wd-1), row+(size_t)ch*(wd-2), px);
+  }
+  memcpy(input, input+(size_t)ch*wd, px*wd);
+  if(!(ht & 1)) memcpy(input+(size_t)ch*wd*(ht-2), input+(size_t)ch*wd*(ht-3), px*wd);
+  memcpy(input+(size_t)ch*wd*(ht-1), input+(size_t)ch*wd*(ht-2), px*wd);
 }
 
 static inline void gauss_expand(
@@ -119,7 +127,7 @@ static inline void gauss_expand(
   for(int j=1;j<((ht-1)&~1);j++)  // even ht: two px boundary. odd ht: one px.
     for(int i=1;i<((wd-1)&~1);i++)
       fine[j*wd+i] = ll_expand_gaussian(input, i, j, wd, ht);
-  ll_fill_boundary2(fine, wd, ht);
+  ll_fill_boundary2(fine, wd, ht, 1);
 }
 
 #if defined(__SSE2__)
@@ -205,7 +213,7 @@ static inline void gauss_reduce_sse2(
       out[i] = (6*row2[i] + 4*(row1[i] + row3[i]) + row0[i] + row4[i])*(1.0f/256.0f);
   }
   dt_free_align(ringbuf);
-  ll_fill_boundary1(coarse, cw, ch);
+  ll_fill_boundary1(coarse, cw, ch, 1);
 }
 #endif
 
@@ -229,7 +237,89 @@ static inline void gauss_reduce(
   for(int j=1;j<ch-1;j++) for(int i=1;i<cw-1;i++)
     for(int jj=-2;jj<=2;jj++) for(int ii=-2;ii<=2;ii++)
       coarse[j*cw+i] += input[(2*j+jj)*wd+2*i+ii] * w[ii+2] * w[jj+2];
-  ll_fill_boundary1(coarse, cw, ch);
+  ll_fill_boundary1(coarse, cw, ch, 1);
+}
+
+// same as ll_expand_gaussian, but for all four channels of an rgba buffer at once
+static inline void ll_expand_gaussian4(
+    const float *const coarse,
+    const int i,
+    const int j,
+    const int wd,
+    const int ht,
+    float *const out)
+{
+  const int cw = (wd-1)/2+1;
+  const float *const c = coarse + 4*((j/2)*cw+i/2);
+  const int r = 4*cw;
+  switch((i&1) + 2*(j&1))
+  {
+    case 0: // both are even, 3x3 stencil
+      for(int k=0;k<4;k++) out[k] = 4./256. * (
+          6.0f*(c[k-r] + c[k-4] + 6.0f*c[k] + c[k+4] + c[k+r])
+          + c[k-r-4] + c[k-r+4] + c[k+r-4] + c[k+r+4]);
+      break;
+    case 1: // i is odd, 2x3 stencil
+      for(int k=0;k<4;k++) out[k] = 4./256. * (
+          24.0f*(c[k] + c[k+4]) +
+          4.0f*(c[k-r] + c[k-r+4] + c[k+r] + c[k+r+4]));
+      break;
+    case 2: // j is odd, 3x2 stencil
+      for(int k=0;k<4;k++) out[k] = 4./256. * (
+          24.0f*(c[k] + c[k+r]) +
+          4.0f*(c[k-4] + c[k+4] + c[k+r-4] + c[k+r+4]));
+      break;
+    default: // case 3: // both are odd, 2x2 stencil
+      for(int k=0;k<4;k++) out[k] = .25f * (c[k] + c[k+4] + c[k+r] + c[k+r+4]);
+      break;
+  }
+}
+
+void local_laplacian_expand4(
+    const float *const coarse, // coarse input
+    float *const fine,         // upsampled, blurry output
+    const int wd,              // fine res
+    const int ht)
+{
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int j=1;j<((ht-1)&~1);j++)  // even ht: two px boundary. odd ht: one px.
+    for(int i=1;i<((wd-1)&~1);i++)
+      ll_expand_gaussian4(coarse, i, j, wd, ht, fine+4*((size_t)j*wd+i));
+  ll_fill_boundary2(fine, wd, ht, 4);
+}
+
+void local_laplacian_reduce4(
+    const float *const input, // fine input buffer
+    float *const coarse,      // coarse scale, blurred input buf
+    const int wd,             // fine res
+    const int ht)
+{
+  // blur with the same 1 4 6 4 1 kernel as the sse version above, only computing coarse pixels
+  const int cw = (wd-1)/2+1, ch = (ht-1)/2+1;
+  const float w[5] = {1./16., 4./16., 6./16., 4./16., 1./16.};
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none)
+#endif
+  for(int j=1;j<ch-1;j++)
+  {
+    float *const out = coarse + 4*(size_t)j*cw;
+    for(int i=1;i<cw-1;i++)
+    {
+      float sum[4] = {0.0f};
+      for(int jj=-2;jj<=2;jj++)
+      {
+        const float *const in = input + 4*((size_t)(2*j+jj)*wd + 2*i);
+        float row[4] = {0.0f};
+        for(int ii=-2;ii<=2;ii++)
+          for(int k=0;k<4;k++) row[k] += in[4*ii+k] * w[ii+2];
+        for(int k=0;k<4;k++) sum[k] += row[k] * w[jj+2];
+      }
+      for(int k=0;k<4;k++) out[4*i+k] = sum[k];
+    }
+  }
+  ll_fill_boundary1(coarse, cw, ch, 4);
 }
 
 // allocate output buffer with monochrome brightness channel from input, padded
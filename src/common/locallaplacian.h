@@ -80,6 +80,21 @@ size_t local_laplacian_singlebuffer_size(const int width,       // width of inpu
                                          const int height);     // height of input image
 
 
+// gaussian pyramid helpers for buffers with four floats per pixel, as used by exposure fusion in basecurve.
+// reduce blurs the fine buffer (wd x ht) and writes it decimated to ((wd-1)/2+1) x ((ht-1)/2+1), expand
+// upsamples such a coarse buffer back to wd x ht. both need wd and ht to be at least 5.
+void local_laplacian_reduce4(
+    const float *const input,   // fine input buffer
+    float *const coarse,        // coarse scale, blurred input buf
+    const int wd,               // fine res
+    const int ht);
+
+void local_laplacian_expand4(
+    const float *const coarse,  // coarse input
+    float *const fine,          // upsampled, blurry output
+    const int wd,               // fine res
+    const int ht);
+
 #if defined(__SSE2__)
 void local_laplacian_sse2(
     const float *const input,   // input buffer in some Labx or yuvx format
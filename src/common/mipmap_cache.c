@@ -25,6 +25,7 @@
 #include "common/imageio.h"
 #include "common/imageio_jpeg.h"
 #include "common/imageio_module.h"
+#include "common/raw_cache.h"
 #include "control/conf.h"
 #include "control/jobs.h"
 #include "develop/imageop_math.h"
@@ -760,7 +761,13 @@ void dt_mipmap_cache_get_with_caller(
         buf->width = buf->height = 0;
         buf->iscale = 0.0f;
         buf->color_space = DT_COLORSPACE_NONE; // TODO: does the full buffer need to know this?
-        dt_imageio_retval_t ret = dt_imageio_open(&buffered_image, filename, buf); // TODO: color_space?
+        const gboolean raw_cache = dt_raw_cache_enabled();
+        dt_imageio_retval_t ret = raw_cache ? dt_raw_cache_read(&buffered_image, filename, buf) : !DT_IMAGEIO_OK;
+        if(ret != DT_IMAGEIO_OK && ret != DT_IMAGEIO_CACHE_FULL)
+        {
+          ret = dt_imageio_open(&buffered_image, filename, buf); // TODO: color_space?
+          if(ret == DT_IMAGEIO_OK && raw_cache) dt_raw_cache_write(&buffered_image, filename, buf);
+        }
         // might have been reallocated:
         ASAN_UNPOISON_MEMORY_REGION(entry->data, dt_mipmap_buffer_dsc_size);
         dsc = (struct dt_mipmap_buffer_dsc *)buf->cache_entry->data;
@@ -21,6 +21,9 @@
 #include "common/file_location.h"
 #include "control/control.h"
 
+#include <json-glib/json-glib.h>
+#include <string.h>
+
 // bump this when the noiseprofiles are getting a differen layout or meaning (raw-raw data, ...)
 #define DT_NOISE_PROFILE_VERSION 0
 
@@ -28,33 +31,317 @@ const dt_noiseprofile_t dt_noiseprofile_generic = {N_("generic poissonian"), "",
 
 static gboolean dt_noiseprofile_verify(JsonParser *parser);
 
-JsonParser *dt_noiseprofile_init(const char *alternative)
+// the json file is compiled into a flat table the first time it's seen and that is written to the user cache
+// dir. later starts just map it: a header, the models sorted by model name, their profiles sorted by iso and the
+// strings they point into. bump the version when any of these structs change.
+#define DT_NOISE_PROFILE_DB_VERSION 2
+
+typedef struct _db_header_t
 {
-  GError *error = NULL;
-  char filename[PATH_MAX] = { 0 };
+  char magic[8];
+  int32_t version;
+  int32_t n_models;
+  int64_t json_size; // of the json file this was compiled from
+  uint8_t json_md5[16]; // and its contents. timestamps can stay the same when the file is replaced.
+  int32_t n_profiles;
+  int32_t strings_size;
+} _db_header_t;
+
+typedef struct _db_model_t
+{
+  int32_t maker, model; // offsets into the strings
+  int32_t first, count; // range in the profiles
+} _db_model_t;
 
-  if(alternative == NULL)
+typedef struct _db_profile_t
+{
+  int32_t name;
+  int32_t iso;
+  float a[3];
+  float b[3];
+} _db_profile_t;
+
+static const char _db_magic[8] = "dtnoise";
+
+static inline const _db_model_t *_db_models(const _db_header_t *h)
+{
+  return (const _db_model_t *)((const char *)h + sizeof(_db_header_t));
+}
+
+static inline const _db_profile_t *_db_profiles(const _db_header_t *h)
+{
+  return (const _db_profile_t *)(_db_models(h) + h->n_models);
+}
+
+static inline const char *_db_strings(const _db_header_t *h)
+{
+  return (const char *)(_db_profiles(h) + h->n_profiles);
+}
+
+static inline size_t _db_size(const _db_header_t *h)
+{
+  return sizeof(_db_header_t) + h->n_models * sizeof(_db_model_t) + h->n_profiles * sizeof(_db_profile_t)
+         + h->strings_size;
+}
+
+// the profiles are read when they are needed, or in the background right after startup, unless there is a
+// cached table. see dt_noiseprofile_init() and _noiseprofile_db().
+static struct
+{
+  dt_pthread_mutex_t lock;
+  char *filename; // set until the profiles have been read
+  pthread_t thread;
+  gboolean loading;
+  GMappedFile *mapped;  // the cached table
+  char *compiled;       // or the one compiled from json in this session
+  const _db_header_t *db;
+} _noiseprofiles;
+
+static gchar *_db_cache_filename(const char *filename)
+{
+  char cachedir[PATH_MAX] = { 0 };
+  dt_loc_get_user_cache_dir(cachedir, sizeof(cachedir));
+  gchar *hash = g_compute_checksum_for_string(G_CHECKSUM_MD5, filename, -1);
+  gchar *name = g_strdup_printf("noiseprofiles-%s.bin", hash);
+  gchar *cachefile = g_build_filename(cachedir, name, NULL);
+  g_free(name);
+  g_free(hash);
+  return cachefile;
+}
+
+static void _db_json_md5(const char *json, const size_t json_size, uint8_t md5[16])
+{
+  GChecksum *checksum = g_checksum_new(G_CHECKSUM_MD5);
+  g_checksum_update(checksum, (const guchar *)json, json_size);
+  gsize len = 16;
+  g_checksum_get_digest(checksum, md5, &len);
+  g_checksum_free(checksum);
+}
+
+// checks that h is a table for the json file with this size and md5 that can be used without further bounds
+// checks
+static gboolean _db_valid(const _db_header_t *h, const size_t length, const size_t json_size,
+                          const uint8_t json_md5[16])
+{
+  if(length < sizeof(_db_header_t) || memcmp(h->magic, _db_magic, sizeof(_db_magic))
+     || h->version != DT_NOISE_PROFILE_DB_VERSION || h->json_size != (int64_t)json_size
+     || memcmp(h->json_md5, json_md5, sizeof(h->json_md5)))
+    return FALSE;
+  if(h->n_models < 0 || h->n_profiles < 0 || h->strings_size <= 0 || length != _db_size(h)) return FALSE;
+
+  const char *strings = _db_strings(h);
+  if(strings[h->strings_size - 1] != '\0') return FALSE;
+
+  const _db_model_t *models = _db_models(h);
+  for(int i = 0; i < h->n_models; i++)
+    if(models[i].maker < 0 || models[i].maker >= h->strings_size || models[i].model < 0
+       || models[i].model >= h->strings_size || models[i].first < 0 || models[i].count < 0
+       || models[i].count > h->n_profiles - models[i].first)
+      return FALSE;
+
+  const _db_profile_t *profiles = _db_profiles(h);
+  for(int i = 0; i < h->n_profiles; i++)
+    if(profiles[i].name < 0 || profiles[i].name >= h->strings_size) return FALSE;
+
+  return TRUE;
+}
+
+static gboolean _db_map(const char *filename)
+{
+  // hashing the json is a lot cheaper than parsing it
+  GMappedFile *json = g_mapped_file_new(filename, FALSE, NULL);
+  if(!json) return FALSE;
+  const size_t json_size = g_mapped_file_get_length(json);
+  uint8_t json_md5[16];
+  _db_json_md5(g_mapped_file_get_contents(json), json_size, json_md5);
+  g_mapped_file_unref(json);
+
+  gchar *cachefile = _db_cache_filename(filename);
+  GMappedFile *mapped = g_mapped_file_new(cachefile, FALSE, NULL);
+  g_free(cachefile);
+  if(!mapped) return FALSE;
+
+  const _db_header_t *h = (const _db_header_t *)g_mapped_file_get_contents(mapped);
+  if(!h || !_db_valid(h, g_mapped_file_get_length(mapped), json_size, json_md5))
   {
-    // TODO: shall we look for profiles in the user config dir?
-    char datadir[PATH_MAX] = { 0 };
-    dt_loc_get_datadir(datadir, sizeof(datadir));
-    snprintf(filename, sizeof(filename), "%s/%s", datadir, "noiseprofiles.json");
+    g_mapped_file_unref(mapped);
+    return FALSE;
   }
-  else
-    snprintf(filename, sizeof(filename), "%s", alternative);
+
+  _noiseprofiles.mapped = mapped;
+  _noiseprofiles.db = h;
+  return TRUE;
+}
+
+static gint32 _db_add_string(GString *strings, const char *str)
+{
+  const gint32 offset = strings->len;
+  g_string_append_len(strings, str ? str : "", (str ? strlen(str) : 0) + 1);
+  return offset;
+}
+
+// by model name, and in file order for the same name. models without profiles come first then.
+static int _db_model_cmp(const void *a, const void *b, void *data)
+{
+  const _db_model_t *ma = (const _db_model_t *)a;
+  const _db_model_t *mb = (const _db_model_t *)b;
+  const char *strings = (const char *)data;
+  const int c = strcmp(strings + ma->model, strings + mb->model);
+  if(c) return c;
+  if(ma->first != mb->first) return ma->first - mb->first;
+  return ma->count - mb->count;
+}
+
+// flattens the verified json into the table layout. the buffer is g_malloc()ed.
+static char *_db_compile(JsonParser *parser, const size_t json_size, const uint8_t json_md5[16], size_t *size)
+{
+  GArray *models = g_array_new(FALSE, FALSE, sizeof(_db_model_t));
+  GArray *profiles = g_array_new(FALSE, FALSE, sizeof(_db_profile_t));
+  GString *strings = g_string_new(NULL);
+  _db_add_string(strings, "");
+
+  JsonReader *reader = json_reader_new(json_parser_get_root(parser));
+  json_reader_read_member(reader, "noiseprofiles");
+  const int n_makers = json_reader_count_elements(reader);
+  for(int i = 0; i < n_makers; i++)
+  {
+    json_reader_read_element(reader, i);
+    json_reader_read_member(reader, "maker");
+    const gint32 maker = _db_add_string(strings, json_reader_get_string_value(reader));
+    json_reader_end_member(reader);
+
+    json_reader_read_member(reader, "models");
+    const int n_models = json_reader_count_elements(reader);
+    for(int j = 0; j < n_models; j++)
+    {
+      json_reader_read_element(reader, j);
+      _db_model_t m = { .maker = maker, .first = profiles->len };
+      json_reader_read_member(reader, "model");
+      m.model = _db_add_string(strings, json_reader_get_string_value(reader));
+      json_reader_end_member(reader);
+
+      json_reader_read_member(reader, "profiles");
+      const int n_profiles = json_reader_count_elements(reader);
+      for(int k = 0; k < n_profiles; k++)
+      {
+        json_reader_read_element(reader, k);
+
+        // do we want to skip this entry?
+        gboolean skip = FALSE;
+        if(json_reader_read_member(reader, "skip")) skip = json_reader_get_boolean_value(reader);
+        json_reader_end_member(reader);
+        if(skip)
+        {
+          json_reader_end_element(reader);
+          continue;
+        }
+
+        _db_profile_t p = { 0 };
+        json_reader_read_member(reader, "name");
+        p.name = _db_add_string(strings, json_reader_get_string_value(reader));
+        json_reader_end_member(reader);
+
+        json_reader_read_member(reader, "iso");
+        p.iso = json_reader_get_double_value(reader);
+        json_reader_end_member(reader);
+
+        json_reader_read_member(reader, "a");
+        for(int c = 0; c < 3; c++)
+        {
+          json_reader_read_element(reader, c);
+          p.a[c] = json_reader_get_double_value(reader);
+          json_reader_end_element(reader);
+        }
+        json_reader_end_member(reader);
+
+        json_reader_read_member(reader, "b");
+        for(int c = 0; c < 3; c++)
+        {
+          json_reader_read_element(reader, c);
+          p.b[c] = json_reader_get_double_value(reader);
+          json_reader_end_element(reader);
+        }
+        json_reader_end_member(reader);
+
+        json_reader_end_element(reader);
+
+        // keep them sorted by iso, stable for equal ones
+        g_array_append_val(profiles, p);
+        _db_profile_t *pp = (_db_profile_t *)profiles->data;
+        for(int l = profiles->len - 1; l > m.first && pp[l - 1].iso > pp[l].iso; l--)
+        {
+          const _db_profile_t t = pp[l];
+          pp[l] = pp[l - 1];
+          pp[l - 1] = t;
+        }
+      } // profiles
+      json_reader_end_member(reader);
+
+      m.count = profiles->len - m.first;
+      g_array_append_val(models, m);
+      json_reader_end_element(reader);
+    } // models
+    json_reader_end_member(reader);
+    json_reader_end_element(reader);
+  } // makers
+  json_reader_end_member(reader);
+  g_object_unref(reader);
+
+  g_qsort_with_data(models->data, models->len, sizeof(_db_model_t), _db_model_cmp, strings->str);
+
+  _db_header_t h = { { 0 } };
+  memcpy(h.magic, _db_magic, sizeof(_db_magic));
+  h.version = DT_NOISE_PROFILE_DB_VERSION;
+  h.n_models = models->len;
+  h.n_profiles = profiles->len;
+  h.strings_size = strings->len;
+  h.json_size = json_size;
+  memcpy(h.json_md5, json_md5, sizeof(h.json_md5));
+
+  *size = _db_size(&h);
+  char *buf = g_malloc(*size);
+  char *b = buf;
+  memcpy(b, &h, sizeof(h));
+  b += sizeof(h);
+  memcpy(b, models->data, models->len * sizeof(_db_model_t));
+  b += models->len * sizeof(_db_model_t);
+  memcpy(b, profiles->data, profiles->len * sizeof(_db_profile_t));
+  b += profiles->len * sizeof(_db_profile_t);
+  memcpy(b, strings->str, strings->len);
+
+  g_array_free(models, TRUE);
+  g_array_free(profiles, TRUE);
+  g_string_free(strings, TRUE);
+  return buf;
+}
+
+static void _noiseprofile_load(const char *filename)
+{
+  GError *error = NULL;
 
   dt_print(DT_DEBUG_CONTROL, "[noiseprofile] loading noiseprofiles from `%s'\n", filename);
-  if(!g_file_test(filename, G_FILE_TEST_EXISTS)) return NULL;
+  GMappedFile *json = g_mapped_file_new(filename, FALSE, &error);
+  if(!json)
+  {
+    fprintf(stderr, "[noiseprofile] error: can't read `%s'\n%s\n", filename, error->message);
+    g_error_free(error);
+    return;
+  }
+  const char *contents = g_mapped_file_get_contents(json);
+  const size_t json_size = g_mapped_file_get_length(json);
+  uint8_t json_md5[16];
+  _db_json_md5(contents, json_size, json_md5);
 
-  // TODO: shall we cache the content? for now this looks fast enough(TM)
   JsonParser *parser = json_parser_new();
-  if(!json_parser_load_from_file(parser, filename, &error))
+  if(!json_parser_load_from_data(parser, contents ? contents : "", json_size, &error))
   {
     fprintf(stderr, "[noiseprofile] error: parsing json from `%s' failed\n%s\n", filename, error->message);
     g_error_free(error);
     g_object_unref(parser);
-    return NULL;
+    g_mapped_file_unref(json);
+    return;
   }
+  g_mapped_file_unref(json);
 
   // run over the file once to verify that it is sane
   if(!dt_noiseprofile_verify(parser))
@@ -62,10 +349,96 @@ JsonParser *dt_noiseprofile_init(const char *alternative)
     dt_control_log(_("noiseprofile file `%s' is not valid"), filename);
     fprintf(stderr, "[noiseprofile] error: `%s' is not a valid noiseprofile file. run with -d control for details\n", filename);
     g_object_unref(parser);
-    return NULL;
+    return;
+  }
+
+  size_t size = 0;
+  _noiseprofiles.compiled = _db_compile(parser, json_size, json_md5, &size);
+  _noiseprofiles.db = (const _db_header_t *)_noiseprofiles.compiled;
+  g_object_unref(parser);
+
+  // the next start can map this instead
+  gchar *cachefile = _db_cache_filename(filename);
+  if(!g_file_set_contents(cachefile, _noiseprofiles.compiled, size, &error))
+  {
+    dt_print(DT_DEBUG_CONTROL, "[noiseprofile] can't write `%s': %s\n", cachefile, error->message);
+    g_error_free(error);
+  }
+  g_free(cachefile);
+}
+
+static void *_noiseprofile_load_thread(void *arg)
+{
+  dt_pthread_setname("noiseprofiles");
+  const double start = dt_get_wtime();
+  _noiseprofile_load(_noiseprofiles.filename);
+  dt_print(DT_DEBUG_PERF, "[noiseprofile] compiling took %.3f secs in the background\n", dt_get_wtime() - start);
+  return NULL;
+}
+
+void dt_noiseprofile_init(const char *alternative, const gboolean background)
+{
+  dt_pthread_mutex_init(&_noiseprofiles.lock, NULL);
+  _noiseprofiles.mapped = NULL;
+  _noiseprofiles.compiled = NULL;
+  _noiseprofiles.db = NULL;
+
+  if(alternative == NULL)
+  {
+    // TODO: shall we look for profiles in the user config dir?
+    char datadir[PATH_MAX] = { 0 };
+    dt_loc_get_datadir(datadir, sizeof(datadir));
+    _noiseprofiles.filename = g_build_filename(datadir, "noiseprofiles.json", NULL);
+  }
+  else
+    _noiseprofiles.filename = g_strdup(alternative);
+
+  // an up to date table from an earlier run is all we need
+  const double start = dt_get_wtime();
+  if(_db_map(_noiseprofiles.filename))
+  {
+    dt_print(DT_DEBUG_PERF, "[noiseprofile] mapping %d profiles took %.3f secs\n", _noiseprofiles.db->n_profiles,
+             dt_get_wtime() - start);
+    g_free(_noiseprofiles.filename);
+    _noiseprofiles.filename = NULL;
+    _noiseprofiles.loading = FALSE;
+    return;
+  }
+
+  _noiseprofiles.loading
+      = background && !dt_pthread_create(&_noiseprofiles.thread, _noiseprofile_load_thread, NULL);
+}
+
+// waits for the background thread, or reads the file now if that didn't happen yet
+static const _db_header_t *_noiseprofile_db()
+{
+  dt_pthread_mutex_lock(&_noiseprofiles.lock);
+  if(_noiseprofiles.loading)
+  {
+    pthread_join(_noiseprofiles.thread, NULL);
+    _noiseprofiles.loading = FALSE;
   }
+  else if(_noiseprofiles.filename)
+    _noiseprofile_load(_noiseprofiles.filename);
+  g_free(_noiseprofiles.filename);
+  _noiseprofiles.filename = NULL;
+  dt_pthread_mutex_unlock(&_noiseprofiles.lock);
+
+  return _noiseprofiles.db;
+}
 
-  return parser;
+void dt_noiseprofile_cleanup()
+{
+  if(_noiseprofiles.loading) pthread_join(_noiseprofiles.thread, NULL);
+  _noiseprofiles.loading = FALSE;
+  g_free(_noiseprofiles.filename);
+  _noiseprofiles.filename = NULL;
+  if(_noiseprofiles.mapped) g_mapped_file_unref(_noiseprofiles.mapped);
+  _noiseprofiles.mapped = NULL;
+  g_free(_noiseprofiles.compiled);
+  _noiseprofiles.compiled = NULL;
+  _noiseprofiles.db = NULL;
+  dt_pthread_mutex_destroy(&_noiseprofiles.lock);
 }
 
 int is_member(gchar** names, char* name)
@@ -79,14 +452,6 @@ int is_member(gchar** names, char* name)
   return 0;
 }
 
-static gint _sort_by_iso(gconstpointer a, gconstpointer b)
-{
-  const dt_noiseprofile_t *profile_a = (dt_noiseprofile_t *)a;
-  const dt_noiseprofile_t *profile_b = (dt_noiseprofile_t *)b;
-
-  return profile_a->iso - profile_b->iso;
-}
-
 #define _ERROR(...)     {\
                           dt_print(DT_DEBUG_CONTROL, "[noiseprofile] error: " );\
                           dt_print(DT_DEBUG_CONTROL, __VA_ARGS__);\
@@ -226,140 +591,54 @@ end:
 
 GList *dt_noiseprofile_get_matching(const dt_image_t *cimg)
 {
-  JsonParser *parser = darktable.noiseprofile_parser;
-  JsonReader *reader = NULL;
+  const _db_header_t *db = _noiseprofile_db();
   GList *result = NULL;
 
-  if(!parser) goto end;
+  if(!db) return NULL;
 
   dt_print(DT_DEBUG_CONTROL, "[noiseprofile] looking for maker `%s', model `%s'\n", cimg->camera_maker, cimg->camera_model);
 
-  JsonNode *root = json_parser_get_root(parser);
+  const _db_model_t *models = _db_models(db);
+  const _db_profile_t *profiles = _db_profiles(db);
+  const char *strings = _db_strings(db);
 
-  reader = json_reader_new(root);
-
-  json_reader_read_member(reader, "noiseprofiles");
-
-  // go through all makers
-  const int n_makers = json_reader_count_elements(reader);
-  dt_print(DT_DEBUG_CONTROL, "[noiseprofile] found %d makers\n", n_makers);
-  for(int i = 0; i < n_makers; i++)
+  // first model with that name
+  int lo = 0, hi = db->n_models;
+  while(lo < hi)
   {
-    json_reader_read_element(reader, i);
+    const int mid = lo + (hi - lo) / 2;
+    if(strcmp(strings + models[mid].model, cimg->camera_model) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
 
-    json_reader_read_member(reader, "maker");
+  // the maker in the file only has to be part of the one in the exif data
+  for(int i = lo; i < db->n_models && !strcmp(strings + models[i].model, cimg->camera_model); i++)
+  {
+    const _db_model_t *m = models + i;
+    if(!g_strstr_len(cimg->camera_maker, -1, strings + m->maker)) continue;
 
-    if(g_strstr_len(cimg->camera_maker, -1, json_reader_get_string_value(reader)))
+    dt_print(DT_DEBUG_CONTROL, "[noiseprofile] found `%s' as `%s', %d profiles\n", cimg->camera_maker,
+             strings + m->maker, m->count);
+    for(int k = m->first + m->count - 1; k >= m->first; k--)
     {
-      dt_print(DT_DEBUG_CONTROL, "[noiseprofile] found `%s' as `%s'\n", cimg->camera_maker, json_reader_get_string_value(reader));
-      // go through all models and check those
-      json_reader_end_member(reader);
-
-      json_reader_read_member(reader, "models");
-
-      const int n_models = json_reader_count_elements(reader);
-      dt_print(DT_DEBUG_CONTROL, "[noiseprofile] found %d models\n", n_models);
-      for(int j = 0; j < n_models; j++)
+      const _db_profile_t *p = profiles + k;
+      dt_noiseprofile_t *new_profile = (dt_noiseprofile_t *)malloc(sizeof(dt_noiseprofile_t));
+      new_profile->name = g_strdup(strings + p->name);
+      new_profile->maker = g_strdup(cimg->camera_maker);
+      new_profile->model = g_strdup(cimg->camera_model);
+      new_profile->iso = p->iso;
+      for(int c = 0; c < 3; c++)
       {
-        json_reader_read_element(reader, j);
-
-        json_reader_read_member(reader, "model");
-
-        if(!g_strcmp0(cimg->camera_model, json_reader_get_string_value(reader)))
-        {
-          dt_print(DT_DEBUG_CONTROL, "[noiseprofile] found %s\n", cimg->camera_model);
-          // we got a match, return at most bufsize elements
-          json_reader_end_member(reader);
-
-          json_reader_read_member(reader, "profiles");
-
-          const int n_profiles = json_reader_count_elements(reader);
-          dt_print(DT_DEBUG_CONTROL, "[noiseprofile] found %d profiles\n", n_profiles);
-          for(int k = 0; k < n_profiles; k++)
-          {
-            dt_noiseprofile_t tmp_profile = { 0 };
-
-            json_reader_read_element(reader, k);
-
-            gchar** member_names = json_reader_list_members(reader);
-
-            // do we want to skip this entry?
-            if(is_member(member_names, "skip"))
-            {
-              json_reader_read_member(reader, "skip");
-              gboolean skip = json_reader_get_boolean_value(reader);
-              json_reader_end_member(reader);
-              if(skip)
-              {
-                json_reader_end_element(reader);
-                g_strfreev(member_names);
-                continue;
-              }
-            }
-
-            // maker
-            tmp_profile.maker = g_strdup(cimg->camera_maker);
-
-            // model
-            tmp_profile.model = g_strdup(cimg->camera_model);
-
-            // name
-            json_reader_read_member(reader, "name");
-            tmp_profile.name = g_strdup(json_reader_get_string_value(reader));
-            json_reader_end_member(reader);
-
-            // iso
-            json_reader_read_member(reader, "iso");
-            tmp_profile.iso = json_reader_get_double_value(reader);
-            json_reader_end_member(reader);
-
-            // a
-            json_reader_read_member(reader, "a");
-            for(int a = 0; a < 3; a++)
-            {
-              json_reader_read_element(reader, a);
-              tmp_profile.a[a] = json_reader_get_double_value(reader);
-              json_reader_end_element(reader);
-            }
-            json_reader_end_member(reader);
-
-            // b
-            json_reader_read_member(reader, "b");
-            for(int b = 0; b < 3; b++)
-            {
-              json_reader_read_element(reader, b);
-              tmp_profile.b[b] = json_reader_get_double_value(reader);
-              json_reader_end_element(reader);
-            }
-            json_reader_end_member(reader);
-
-            json_reader_end_element(reader);
-
-            // everything worked out, add tmp_profile to result
-            dt_noiseprofile_t *new_profile = (dt_noiseprofile_t *)malloc(sizeof(dt_noiseprofile_t));
-            *new_profile = tmp_profile;
-            result = g_list_append(result, new_profile);
-
-            g_strfreev(member_names);
-          } // profiles
-
-          goto end;
-        }
-
-        json_reader_end_member(reader);
-        json_reader_end_element(reader);
-      } // models
+        new_profile->a[c] = p->a[c];
+        new_profile->b[c] = p->b[c];
+      }
+      result = g_list_prepend(result, new_profile);
     }
+    break;
+  }
 
-    json_reader_end_member(reader);
-    json_reader_end_element(reader);
-  } // makers
-
-  json_reader_end_member(reader);
-
-end:
-  if(reader) g_object_unref(reader);
-  if(result) result = g_list_sort(result, _sort_by_iso);
   return result;
 }
 
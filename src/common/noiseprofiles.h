@@ -21,7 +21,6 @@
 
 #include "common/image.h"
 #include <glib.h>
-#include <json-glib/json-glib.h>
 
 typedef struct dt_noiseprofile_t
 {
@@ -36,8 +35,10 @@ dt_noiseprofile_t;
 
 extern const dt_noiseprofile_t dt_noiseprofile_generic;
 
-/** read the noiseprofile file once on startup (kind of)*/
-JsonParser *dt_noiseprofile_init(const char *alternative);
+/** map the table compiled from the noiseprofile file on an earlier run. if there is none or the file changed
+ * since then, it's compiled again on first use, or right away in a background thread if background is set. */
+void dt_noiseprofile_init(const char *alternative, const gboolean background);
+void dt_noiseprofile_cleanup();
 
 /*
  * returns the noiseprofiles matching the image's exif data.
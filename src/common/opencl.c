@@ -28,6 +28,7 @@
 #include "common/interpolation.h"
 #include "common/dwt.h"
 #include "common/heal.h"
+#include "common/histogram.h"
 #include "common/nvidia_gpus.h"
 #include "common/opencl_drivers_blacklist.h"
 #include "control/conf.h"
@@ -62,6 +63,11 @@ static dt_opencl_scheduling_profile_t dt_opencl_get_scheduling_profile(void);
 static void dt_opencl_apply_scheduling_profile(dt_opencl_scheduling_profile_t profile);
 /** set opencl specific synchronization timeout */
 static void dt_opencl_set_synchronization_timeout(int value);
+/** whether the cached binary of a program is up to date */
+static gboolean _opencl_program_cached(const int dev, const char *filename, const char *binname,
+                                       char **includemd5);
+/** load and build a program */
+static int _opencl_program_prepare(const int dev, const int prog, const gboolean cached_only);
 
 
 int dt_opencl_get_device_info(dt_opencl_t *cl, cl_device_id device, cl_device_info param_name, void **param_value,
@@ -137,6 +143,11 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
   memset(cl->dev[dev].program, 0x0, sizeof(cl_program) * DT_OPENCL_MAX_PROGRAMS);
   memset(cl->dev[dev].program_used, 0x0, sizeof(int) * DT_OPENCL_MAX_PROGRAMS);
   memset(cl->dev[dev].kernel, 0x0, sizeof(cl_kernel) * DT_OPENCL_MAX_KERNELS);
+  memset(cl->dev[dev].program_file, 0x0, sizeof(char *) * DT_OPENCL_MAX_PROGRAMS);
+  memset(cl->dev[dev].program_bin, 0x0, sizeof(char *) * DT_OPENCL_MAX_PROGRAMS);
+  memset(cl->dev[dev].kernel_name, 0x0, sizeof(char *) * DT_OPENCL_MAX_KERNELS);
+  memset(cl->dev[dev].includemd5, 0x0, sizeof(char *) * DT_OPENCL_MAX_INCLUDES);
+  cl->dev[dev].cachedir = NULL;
   memset(cl->dev[dev].kernel_used, 0x0, sizeof(int) * DT_OPENCL_MAX_KERNELS);
   cl->dev[dev].eventlist = NULL;
   cl->dev[dev].eventtags = NULL;
@@ -331,6 +342,7 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
   }
 
   dt_pthread_mutex_init(&cl->dev[dev].lock, NULL);
+  dt_pthread_mutex_init(&cl->dev[dev].program_lock, NULL);
 
   cl->dev[dev].context = (cl->dlocl->symbols->dt_clCreateContext)(0, 1, &devid, NULL, NULL, &err);
   if(err != CL_SUCCESS)
@@ -397,11 +409,13 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
   escapedkerneldir = NULL;
 
   const char *clincludes[DT_OPENCL_MAX_INCLUDES] = { "colorspace.cl", "common.h", NULL };
-  char *includemd5[DT_OPENCL_MAX_INCLUDES] = { NULL };
-  dt_opencl_md5sum(clincludes, includemd5);
+  dt_opencl_md5sum(clincludes, cl->dev[dev].includemd5);
+  cl->dev[dev].cachedir = strdup(cachedir);
 
-  // now load all darktable cl kernels.
-  // TODO: compile as a job?
+  // now collect all darktable cl programs. the ones with an up to date cached binary are loaded when one of
+  // their kernels is used first. the others get compiled right away, in parallel, while the locale is still "C".
+  int compile[DT_OPENCL_MAX_PROGRAMS];
+  int num_compile = 0, num_deferred = 0;
   tstart = dt_get_wtime();
   FILE *f = g_fopen(filename, "rb");
   if(f)
@@ -448,28 +462,47 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
         continue;
       }
 
-      snprintf(filename, sizeof(filename), "%s" G_DIR_SEPARATOR_S "kernels" G_DIR_SEPARATOR_S "%s", dtpath, programname);
-      snprintf(binname, sizeof(binname), "%s" G_DIR_SEPARATOR_S "%s.bin", cachedir, programname);
-      dt_print(DT_DEBUG_OPENCL, "[opencl_init] compiling program `%s' ..\n", programname);
-      int loaded_cached;
-      char md5sum[33];
-      if(dt_opencl_load_program(dev, prog, filename, binname, cachedir, md5sum, includemd5, &loaded_cached)
-         && dt_opencl_build_program(dev, prog, binname, cachedir, md5sum, loaded_cached) != CL_SUCCESS)
+      if(prog >= DT_OPENCL_MAX_PROGRAMS || cl->dev[dev].program_file[prog])
       {
-        dt_print(DT_DEBUG_OPENCL, "[opencl_init] failed to compile program `%s'!\n", programname);
-        fclose(f);
+        dt_print(DT_DEBUG_OPENCL, "[opencl_init] invalid or duplicate program number %d of `%s'; ignoring it!\n",
+                 prog, programname);
         g_strfreev(tokens);
-        res = 1;
-        goto end;
+        continue;
       }
 
+      snprintf(filename, sizeof(filename), "%s" G_DIR_SEPARATOR_S "kernels" G_DIR_SEPARATOR_S "%s", dtpath, programname);
+      snprintf(binname, sizeof(binname), "%s" G_DIR_SEPARATOR_S "%s.bin", cachedir, programname);
+      cl->dev[dev].program_file[prog] = strdup(filename);
+      cl->dev[dev].program_bin[prog] = strdup(binname);
+
+      if(_opencl_program_cached(dev, filename, binname, cl->dev[dev].includemd5))
+        num_deferred++;
+      else
+        compile[num_compile++] = prog;
+
       g_strfreev(tokens);
     }
 
     fclose(f);
+
+    int failed = 0;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(compile, num_compile) reduction(+ : failed) schedule(dynamic)
+#endif
+    for(int p = 0; p < num_compile; p++)
+      if(_opencl_program_prepare(dev, compile[p], FALSE) != CL_SUCCESS) failed++;
+
     tend = dt_get_wtime();
     tdiff = tend - tstart;
-    dt_print(DT_DEBUG_OPENCL, "[opencl_init] kernel loading time: %2.4lf \n", tdiff);
+    dt_print(DT_DEBUG_OPENCL, "[opencl_init] kernel loading time: %2.4lf, compiled %d programs, %d more are "
+                              "loaded from cache on first use\n",
+             tdiff, num_compile, num_deferred);
+
+    if(failed)
+    {
+      res = 1;
+      goto end;
+    }
   }
   else
   {
@@ -477,8 +510,6 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
     res = 1;
     goto end;
   }
-  for(int n = 0; n < DT_OPENCL_MAX_INCLUDES; n++) g_free(includemd5[n]);
-
   res = 0;
 
 end:
@@ -493,7 +524,8 @@ end:
   return res;
 }
 
-void dt_opencl_init(dt_opencl_t *cl, const gboolean exclude_opencl, const gboolean print_statistics)
+void dt_opencl_init(dt_opencl_t *cl, const gboolean exclude_opencl, const gboolean print_statistics,
+                    const gboolean benchmark)
 {
   char *str;
   dt_pthread_mutex_init(&cl->lock, NULL);
@@ -516,6 +548,7 @@ void dt_opencl_init(dt_opencl_t *cl, const gboolean exclude_opencl, const gboole
   cl->use_events = (handles != 0);
 
   cl->avoid_atomics = dt_conf_get_bool("opencl_avoid_atomics");
+  cl->device_histogram = dt_conf_get_bool("opencl_device_histogram");
   cl->async_pixelpipe = dt_conf_get_bool("opencl_async_pixelpipe");
   cl->synch_cache = dt_conf_get_bool("opencl_synch_cache");
   cl->micro_nap = dt_conf_get_int("opencl_micro_nap");
@@ -572,6 +605,8 @@ void dt_opencl_init(dt_opencl_t *cl, const gboolean exclude_opencl, const gboole
 
   dt_print(DT_DEBUG_OPENCL, "[opencl_init] opencl_avoid_atomics: %d\n",
            dt_conf_get_bool("opencl_avoid_atomics"));
+  dt_print(DT_DEBUG_OPENCL, "[opencl_init] opencl_device_histogram: %d\n",
+           dt_conf_get_bool("opencl_device_histogram"));
 
 
   dt_print(DT_DEBUG_OPENCL, "[opencl_init] \n");
@@ -722,13 +757,15 @@ finally:
     cl->local_laplacian = dt_local_laplacian_init_cl_global();
     cl->dwt = dt_dwt_init_cl_global();
     cl->heal = dt_heal_init_cl_global();
+    cl->histogram = dt_histogram_init_cl_global();
 
     char checksum[64];
     snprintf(checksum, sizeof(checksum), "%u", cl->crc);
     char *oldchecksum = dt_conf_get_string("opencl_checksum");
 
-    // check if the configuration (OpenCL device setup) has changed, indicated by checksum != oldchecksum
-    if(strcmp(oldchecksum, checksum) != 0)
+    // check if the configuration (OpenCL device setup) has changed, indicated by checksum != oldchecksum.
+    // if we may not benchmark now the checksum stays as it is, so the next run which may will do it.
+    if(benchmark && strcmp(oldchecksum, checksum) != 0)
     {
       // store new checksum value in config
       dt_conf_set_string("opencl_checksum", checksum);
@@ -785,10 +822,21 @@ finally:
     for(int i = 0; cl->dev && i < cl->num_devs; i++)
     {
       dt_pthread_mutex_destroy(&cl->dev[i].lock);
+      dt_pthread_mutex_destroy(&cl->dev[i].program_lock);
       for(int k = 0; k < DT_OPENCL_MAX_KERNELS; k++)
-        if(cl->dev[i].kernel_used[k]) (cl->dlocl->symbols->dt_clReleaseKernel)(cl->dev[i].kernel[k]);
+      {
+        if(cl->dev[i].kernel_used[k] && cl->dev[i].kernel[k])
+          (cl->dlocl->symbols->dt_clReleaseKernel)(cl->dev[i].kernel[k]);
+        free(cl->dev[i].kernel_name[k]);
+      }
       for(int k = 0; k < DT_OPENCL_MAX_PROGRAMS; k++)
+      {
         if(cl->dev[i].program_used[k]) (cl->dlocl->symbols->dt_clReleaseProgram)(cl->dev[i].program[k]);
+        free(cl->dev[i].program_file[k]);
+        free(cl->dev[i].program_bin[k]);
+      }
+      for(int n = 0; n < DT_OPENCL_MAX_INCLUDES; n++) g_free(cl->dev[i].includemd5[n]);
+      free(cl->dev[i].cachedir);
       (cl->dlocl->symbols->dt_clReleaseCommandQueue)(cl->dev[i].cmd_queue);
       (cl->dlocl->symbols->dt_clReleaseContext)(cl->dev[i].context);
       if(cl->use_events)
@@ -825,14 +873,26 @@ void dt_opencl_cleanup(dt_opencl_t *cl)
     dt_interpolation_free_cl_global(cl->interpolation);
     dt_dwt_free_cl_global(cl->dwt);
     dt_heal_free_cl_global(cl->heal);
+    dt_histogram_free_cl_global(cl->histogram);
 
     for(int i = 0; i < cl->num_devs; i++)
     {
       dt_pthread_mutex_destroy(&cl->dev[i].lock);
+      dt_pthread_mutex_destroy(&cl->dev[i].program_lock);
       for(int k = 0; k < DT_OPENCL_MAX_KERNELS; k++)
-        if(cl->dev[i].kernel_used[k]) (cl->dlocl->symbols->dt_clReleaseKernel)(cl->dev[i].kernel[k]);
+      {
+        if(cl->dev[i].kernel_used[k] && cl->dev[i].kernel[k])
+          (cl->dlocl->symbols->dt_clReleaseKernel)(cl->dev[i].kernel[k]);
+        free(cl->dev[i].kernel_name[k]);
+      }
       for(int k = 0; k < DT_OPENCL_MAX_PROGRAMS; k++)
+      {
         if(cl->dev[i].program_used[k]) (cl->dlocl->symbols->dt_clReleaseProgram)(cl->dev[i].program[k]);
+        free(cl->dev[i].program_file[k]);
+        free(cl->dev[i].program_bin[k]);
+      }
+      for(int n = 0; n < DT_OPENCL_MAX_INCLUDES; n++) g_free(cl->dev[i].includemd5[n]);
+      free(cl->dev[i].cachedir);
       (cl->dlocl->symbols->dt_clReleaseCommandQueue)(cl->dev[i].cmd_queue);
       (cl->dlocl->symbols->dt_clReleaseContext)(cl->dev[i].context);
 
@@ -1505,32 +1565,16 @@ void dt_opencl_md5sum(const char **files, char **md5sums)
 }
 
 
-int dt_opencl_load_program(const int dev, const int prog, const char *filename, const char *binname,
-                           const char *cachedir, char *md5sum, char **includemd5, int *loaded_cached)
+/** reads the source of a program and computes the md5sum its cached binary goes by: source, driver and platform
+ * version, compiler options and includes. returns the nul terminated source or NULL. */
+static char *_opencl_program_source(const int dev, const char *filename, char *md5sum, char **includemd5,
+                                    size_t *size)
 {
-  cl_int err;
   dt_opencl_t *cl = darktable.opencl;
-
-  struct stat filestat, cachedstat;
-  *loaded_cached = 0;
-
-  if(prog < 0 || prog >= DT_OPENCL_MAX_PROGRAMS)
-  {
-    dt_print(DT_DEBUG_OPENCL, "[opencl_load_source] invalid program number `%d' of file `%s'!\n", prog,
-             filename);
-    return 0;
-  }
-
-  if(cl->dev[dev].program_used[prog])
-  {
-    dt_print(DT_DEBUG_OPENCL,
-             "[opencl_load_source] program number `%d' already in use when loading file `%s'!\n", prog,
-             filename);
-    return 0;
-  }
+  struct stat filestat;
 
   FILE *f = fopen_stat(filename, &filestat);
-  if(!f) return 0;
+  if(!f) return NULL;
 
   size_t filesize = filestat.st_size;
   char *file = (char *)malloc(filesize + 2048);
@@ -1540,7 +1584,7 @@ int dt_opencl_load_program(const int dev, const int prog, const char *filename,
   {
     free(file);
     dt_print(DT_DEBUG_OPENCL, "[opencl_load_source] could not read all of file `%s'!\n", filename);
-    return 0;
+    return NULL;
   }
 
   char *start = file + filesize;
@@ -1573,6 +1617,58 @@ int dt_opencl_load_program(const int dev, const int prog, const char *filename,
   g_free(source_md5);
 
   file[filesize] = '\0';
+  *size = filesize;
+  return file;
+}
+
+/** whether the cached binary of a program is up to date, see dt_opencl_load_program(). */
+static gboolean _opencl_program_cached(const int dev, const char *filename, const char *binname,
+                                       char **includemd5)
+{
+  char md5sum[33];
+  size_t filesize;
+  char *file = _opencl_program_source(dev, filename, md5sum, includemd5, &filesize);
+  if(!file) return FALSE;
+  free(file);
+
+#if defined(_WIN32)
+  char dup[PATH_MAX] = { 0 };
+  snprintf(dup, sizeof(dup), "%s.%s", binname, md5sum);
+  return g_file_test(dup, G_FILE_TEST_IS_REGULAR);
+#else
+  char linkedfile[PATH_MAX] = { 0 };
+  const ssize_t linkedfile_len = readlink(binname, linkedfile, sizeof(linkedfile) - 1);
+  return linkedfile_len > 0 && strncmp(linkedfile, md5sum, 33) == 0 && g_file_test(binname, G_FILE_TEST_IS_REGULAR);
+#endif
+}
+
+int dt_opencl_load_program(const int dev, const int prog, const char *filename, const char *binname,
+                           const char *cachedir, char *md5sum, char **includemd5, int *loaded_cached)
+{
+  cl_int err;
+  dt_opencl_t *cl = darktable.opencl;
+
+  struct stat cachedstat;
+  *loaded_cached = 0;
+
+  if(prog < 0 || prog >= DT_OPENCL_MAX_PROGRAMS)
+  {
+    dt_print(DT_DEBUG_OPENCL, "[opencl_load_source] invalid program number `%d' of file `%s'!\n", prog,
+             filename);
+    return 0;
+  }
+
+  if(cl->dev[dev].program_used[prog])
+  {
+    dt_print(DT_DEBUG_OPENCL,
+             "[opencl_load_source] program number `%d' already in use when loading file `%s'!\n", prog,
+             filename);
+    return 0;
+  }
+
+  size_t filesize;
+  char *file = _opencl_program_source(dev, filename, md5sum, includemd5, &filesize);
+  if(!file) return 0;
 
   char linkedfile[PATH_MAX] = { 0 };
   ssize_t linkedfile_len = 0;
@@ -1604,7 +1700,7 @@ int dt_opencl_load_program(const int dev, const int prog, const char *filename,
         size_t cached_filesize = cachedstat.st_size;
 
         unsigned char *cached_content = (unsigned char *)malloc(cached_filesize + 1);
-        rd = fread(cached_content, sizeof(char), cached_filesize, cached);
+        const size_t rd = fread(cached_content, sizeof(char), cached_filesize, cached);
         if(rd != cached_filesize)
         {
           dt_print(DT_DEBUG_OPENCL, "[opencl_load_program] could not read all of file `%s'!\n", binname);
@@ -1773,23 +1869,20 @@ int dt_opencl_build_program(const int dev, const int prog, const char *binname,
           if(bytes_written != binary_sizes[i]) goto ret;
           fclose(f);
 
-          // create link (e.g. basic.cl.bin -> f1430102c53867c162bb60af6c163328)
-          char cwd[PATH_MAX] = { 0 };
-          if(!getcwd(cwd, sizeof(cwd))) goto ret;
-          if(chdir(cachedir) != 0) goto ret;
-          char dup[PATH_MAX] = { 0 };
-          g_strlcpy(dup, binname, sizeof(dup));
-          char *bname = basename(dup);
+          // create link (e.g. basic.cl.bin -> f1430102c53867c162bb60af6c163328). programs get built in
+          // parallel, so no chdir() into cachedir: a relative link target resolves against the link's directory.
 #if defined(_WIN32)
           //CreateSymbolicLink in Windows requires admin privileges, which we don't want/need
           //store has using a simple filerename
+          char dup[PATH_MAX] = { 0 };
+          g_strlcpy(dup, binname, sizeof(dup));
+          char *bname = basename(dup);
           char finalfilename[PATH_MAX] = { 0 };
           snprintf(finalfilename, sizeof(finalfilename), "%s" G_DIR_SEPARATOR_S "%s.%s", cachedir, bname, md5sum);
           rename(link_dest, finalfilename);
 #else
-          if(symlink(md5sum, bname) != 0) goto ret;
+          if(symlink(md5sum, binname) != 0) goto ret;
 #endif //!defined(_WIN32)
-          if(chdir(cwd) != 0) goto ret;
         }
 
     ret:
@@ -1802,6 +1895,94 @@ int dt_opencl_build_program(const int dev, const int prog, const char *binname,
   }
 }
 
+static int _opencl_program_prepare(const int dev, const int prog, const gboolean cached_only)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  dt_opencl_device_t *device = &cl->dev[dev];
+  const double start = dt_get_wtime();
+  int loaded_cached = 0;
+  char md5sum[33];
+  cl_int err = CL_SUCCESS;
+
+  if(dt_opencl_load_program(dev, prog, device->program_file[prog], device->program_bin[prog], device->cachedir,
+                            md5sum, device->includemd5, &loaded_cached))
+  {
+    // compiling from source after startup would happen in the user's locale, see dt_opencl_init(). leave it to
+    // the next start, dt_opencl_load_program() already dropped the stale binary.
+    if(cached_only && !loaded_cached)
+      err = CL_INVALID_BINARY;
+    else
+      err = dt_opencl_build_program(dev, prog, device->program_bin[prog], device->cachedir, md5sum,
+                                    loaded_cached);
+
+    if(err != CL_SUCCESS)
+    {
+      dt_print(DT_DEBUG_OPENCL, "[opencl_program] failed to %s program `%s'!\n",
+               loaded_cached ? "load" : "compile", device->program_file[prog]);
+      (cl->dlocl->symbols->dt_clReleaseProgram)(device->program[prog]);
+      device->program_used[prog] = 0;
+      if(loaded_cached)
+      {
+        // the binary was accepted but doesn't build. drop it and its link like dt_opencl_load_program() does
+        // for one it can't load, otherwise _opencl_program_cached() would keep deferring it on every start.
+        char link_dest[PATH_MAX] = { 0 };
+        snprintf(link_dest, sizeof(link_dest), "%s" G_DIR_SEPARATOR_S "%s", device->cachedir, md5sum);
+        g_unlink(link_dest);
+#if defined(_WIN32)
+        snprintf(link_dest, sizeof(link_dest), "%s.%s", device->program_bin[prog], md5sum);
+        g_unlink(link_dest);
+#endif
+        g_unlink(device->program_bin[prog]);
+      }
+    }
+  }
+
+  dt_print(DT_DEBUG_OPENCL | DT_DEBUG_PERF, "[opencl_program] %s `%s' for device %d in %.3f secs\n",
+           loaded_cached ? "loaded" : "compiled", device->program_file[prog], dev, dt_get_wtime() - start);
+
+  return err;
+}
+
+/** returns the kernel, loading its program and creating it on first use. */
+static cl_kernel _opencl_kernel(const int dev, const int kernel)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  dt_opencl_device_t *device = &cl->dev[dev];
+  if(device->kernel[kernel]) return device->kernel[kernel];
+
+  dt_pthread_mutex_lock(&device->program_lock);
+  if(!device->kernel[kernel] && device->kernel_used[kernel] && device->kernel_name[kernel])
+  {
+    const int prog = device->kernel_prog[kernel];
+    if(!device->program_used[prog] && device->program_file[prog])
+    {
+      _opencl_program_prepare(dev, prog, TRUE);
+      if(!device->program_used[prog])
+      {
+        // don't try again
+        free(device->program_file[prog]);
+        device->program_file[prog] = NULL;
+      }
+    }
+
+    cl_int err = CL_INVALID_PROGRAM;
+    if(device->program_used[prog])
+      device->kernel[kernel]
+          = (cl->dlocl->symbols->dt_clCreateKernel)(device->program[prog], device->kernel_name[kernel], &err);
+    if(err != CL_SUCCESS)
+    {
+      dt_print(DT_DEBUG_OPENCL, "[opencl_create_kernel] could not create kernel `%s' for device %d! (%d)\n",
+               device->kernel_name[kernel], dev, err);
+      device->kernel[kernel] = NULL;
+      free(device->kernel_name[kernel]);
+      device->kernel_name[kernel] = NULL;
+    }
+  }
+  dt_pthread_mutex_unlock(&device->program_lock);
+
+  return device->kernel[kernel];
+}
+
 int dt_opencl_create_kernel(const int prog, const char *name)
 {
   dt_opencl_t *cl = darktable.opencl;
@@ -1816,12 +1997,22 @@ int dt_opencl_create_kernel(const int prog, const char *name)
       if(!cl->dev[dev].kernel_used[k])
       {
         cl->dev[dev].kernel_used[k] = 1;
+        cl->dev[dev].kernel_prog[k] = prog;
+        cl->dev[dev].kernel_name[k] = strdup(name);
+        cl->dev[dev].kernel[k] = NULL;
+
+        // kernels of programs which will be loaded on first use are created then, too
+        if(!cl->dev[dev].program_used[prog] && cl->dev[dev].program_file[prog]) break;
+
         cl->dev[dev].kernel[k]
             = (cl->dlocl->symbols->dt_clCreateKernel)(cl->dev[dev].program[prog], name, &err);
         if(err != CL_SUCCESS)
         {
           dt_print(DT_DEBUG_OPENCL, "[opencl_create_kernel] could not create kernel `%s'! (%d)\n", name, err);
           cl->dev[dev].kernel_used[k] = 0;
+          cl->dev[dev].kernel[k] = NULL;
+          free(cl->dev[dev].kernel_name[k]);
+          cl->dev[dev].kernel_name[k] = NULL;
           goto error;
         }
         else
@@ -1829,8 +2020,8 @@ int dt_opencl_create_kernel(const int prog, const char *name)
       }
     if(k < DT_OPENCL_MAX_KERNELS)
     {
-      dt_print(DT_DEBUG_OPENCL, "[opencl_create_kernel] successfully loaded kernel `%s' (%d) for device %d\n",
-               name, k, dev);
+      dt_print(DT_DEBUG_OPENCL, "[opencl_create_kernel] successfully %s kernel `%s' (%d) for device %d\n",
+               cl->dev[dev].kernel[k] ? "loaded" : "registered", name, k, dev);
     }
     else
     {
@@ -1854,7 +2045,10 @@ void dt_opencl_free_kernel(const int kernel)
   for(int dev = 0; dev < cl->num_devs; dev++)
   {
     cl->dev[dev].kernel_used[kernel] = 0;
-    (cl->dlocl->symbols->dt_clReleaseKernel)(cl->dev[dev].kernel[kernel]);
+    if(cl->dev[dev].kernel[kernel]) (cl->dlocl->symbols->dt_clReleaseKernel)(cl->dev[dev].kernel[kernel]);
+    cl->dev[dev].kernel[kernel] = NULL;
+    free(cl->dev[dev].kernel_name[kernel]);
+    cl->dev[dev].kernel_name[kernel] = NULL;
   }
   dt_pthread_mutex_unlock(&cl->lock);
 }
@@ -1894,8 +2088,10 @@ int dt_opencl_get_kernel_work_group_size(const int dev, const int kernel, size_t
   dt_opencl_t *cl = darktable.opencl;
   if(!cl->inited || dev < 0) return -1;
   if(kernel < 0 || kernel >= DT_OPENCL_MAX_KERNELS) return -1;
+  cl_kernel k = _opencl_kernel(dev, kernel);
+  if(!k) return CL_INVALID_KERNEL;
 
-  return (cl->dlocl->symbols->dt_clGetKernelWorkGroupInfo)(cl->dev[dev].kernel[kernel], cl->dev[dev].devid,
+  return (cl->dlocl->symbols->dt_clGetKernelWorkGroupInfo)(k, cl->dev[dev].devid,
                                                            CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t),
                                                            kernelworkgroupsize, NULL);
 }
@@ -1907,7 +2103,9 @@ int dt_opencl_set_kernel_arg(const int dev, const int kernel, const int num, con
   dt_opencl_t *cl = darktable.opencl;
   if(!cl->inited || dev < 0) return -1;
   if(kernel < 0 || kernel >= DT_OPENCL_MAX_KERNELS) return -1;
-  return (cl->dlocl->symbols->dt_clSetKernelArg)(cl->dev[dev].kernel[kernel], num, size, arg);
+  cl_kernel k = _opencl_kernel(dev, kernel);
+  if(!k) return CL_INVALID_KERNEL;
+  return (cl->dlocl->symbols->dt_clSetKernelArg)(k, num, size, arg);
 }
 
 int dt_opencl_enqueue_kernel_2d(const int dev, const int kernel, const size_t *sizes)
@@ -1922,13 +2120,14 @@ int dt_opencl_enqueue_kernel_2d_with_local(const int dev, const int kernel, cons
   dt_opencl_t *cl = darktable.opencl;
   if(!cl->inited || dev < 0) return -1;
   if(kernel < 0 || kernel >= DT_OPENCL_MAX_KERNELS) return -1;
+  cl_kernel k = _opencl_kernel(dev, kernel);
+  if(!k) return CL_INVALID_KERNEL;
   int err;
   char buf[256];
   buf[0] = '\0';
-  (cl->dlocl->symbols->dt_clGetKernelInfo)(cl->dev[dev].kernel[kernel], CL_KERNEL_FUNCTION_NAME, 256, buf,
-                                           NULL);
+  (cl->dlocl->symbols->dt_clGetKernelInfo)(k, CL_KERNEL_FUNCTION_NAME, 256, buf, NULL);
   cl_event *eventp = dt_opencl_events_get_slot(dev, buf);
-  err = (cl->dlocl->symbols->dt_clEnqueueNDRangeKernel)(cl->dev[dev].cmd_queue, cl->dev[dev].kernel[kernel],
+  err = (cl->dlocl->symbols->dt_clEnqueueNDRangeKernel)(cl->dev[dev].cmd_queue, k,
                                                         2, NULL, sizes, local, 0, NULL, eventp);
   // if (err == CL_SUCCESS) err = dt_opencl_finish(dev);
   return err;
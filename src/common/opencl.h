@@ -90,6 +90,15 @@ typedef struct dt_opencl_device_t
   cl_kernel kernel[DT_OPENCL_MAX_KERNELS];
   int program_used[DT_OPENCL_MAX_PROGRAMS];
   int kernel_used[DT_OPENCL_MAX_KERNELS];
+  // programs with an up to date cached binary are only loaded once one of their kernels is used. until then
+  // kernel[] is NULL and these say where to find them.
+  char *program_file[DT_OPENCL_MAX_PROGRAMS];
+  char *program_bin[DT_OPENCL_MAX_PROGRAMS];
+  char *kernel_name[DT_OPENCL_MAX_KERNELS];
+  int kernel_prog[DT_OPENCL_MAX_KERNELS];
+  char *cachedir;
+  char *includemd5[DT_OPENCL_MAX_INCLUDES];
+  dt_pthread_mutex_t program_lock;
   cl_event *eventlist;
   dt_opencl_eventtag_t *eventtags;
   int numevents;
@@ -114,6 +123,7 @@ struct dt_bilateral_cl_global_t;
 struct dt_local_laplacian_cl_global_t;
 struct dt_dwt_cl_global_t; // wavelet decompose
 struct dt_heal_cl_global_t; // healing
+struct dt_histogram_cl_global_t; // per module histograms
 
 /**
  * main struct, stored in darktable.opencl.
@@ -124,6 +134,7 @@ typedef struct dt_opencl_t
   dt_pthread_mutex_t lock;
   int inited;
   int avoid_atomics;
+  int device_histogram;
   int use_events;
   int async_pixelpipe;
   int number_event_handles;
@@ -165,6 +176,9 @@ typedef struct dt_opencl_t
   
   // global kernels for heal filter.
   struct dt_heal_cl_global_t *heal;
+
+  // global kernels for collecting module histograms.
+  struct dt_histogram_cl_global_t *histogram;
 } dt_opencl_t;
 
 /** description of memory requirements of local buffer
@@ -188,8 +202,10 @@ typedef struct dt_opencl_local_buffer_t
 int dt_opencl_get_device_info(dt_opencl_t *cl, cl_device_id device, cl_device_info param_name, void **param_value,
                               size_t *param_value_size);
 
-/** inits the opencl subsystem. */
-void dt_opencl_init(dt_opencl_t *cl, const gboolean exclude_opencl, const gboolean print_statistics);
+/** inits the opencl subsystem. benchmark allows timing the devices against the cpu after the device setup
+ * changed, to pick a scheduling profile. */
+void dt_opencl_init(dt_opencl_t *cl, const gboolean exclude_opencl, const gboolean print_statistics,
+                    const gboolean benchmark);
 
 /** cleans up the opencl subsystem. */
 void dt_opencl_cleanup(dt_opencl_t *cl);
@@ -380,7 +396,8 @@ typedef struct dt_opencl_t
   int stopped;
   int error_count;
 } dt_opencl_t;
-static inline void dt_opencl_init(dt_opencl_t *cl, const gboolean exclude_opencl, const gboolean print_statistics)
+static inline void dt_opencl_init(dt_opencl_t *cl, const gboolean exclude_opencl, const gboolean print_statistics,
+                                  const gboolean benchmark)
 {
   cl->inited = 0;
   cl->enabled = 0;
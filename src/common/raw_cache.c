@@ -0,0 +1,406 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/raw_cache.h"
+#include "common/darktable.h"
+#include "common/exif.h"
+#include "common/file_location.h"
+#include "control/conf.h"
+#include "control/jobs.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#define DT_RAW_CACHE_MAGIC "dtrawc"
+#define DT_RAW_CACHE_VERSION 1
+#define DT_RAW_CACHE_SUFFIX ".dtraw"
+
+// flags owned by the raw loader, everything else in img->flags is left alone on a cache hit
+#define DT_RAW_CACHE_FLAGS (DT_IMAGE_LDR | DT_IMAGE_RAW | DT_IMAGE_HDR | DT_IMAGE_4BAYER)
+
+typedef struct dt_raw_cache_header_t
+{
+  char magic[8];
+  int32_t version;
+  int32_t header_size;
+
+  // guard against hash collisions
+  int64_t src_size;
+  int64_t src_mtime;
+
+  // what dt_imageio_open_rawspeed() puts into the image struct
+  int32_t width, height;
+  int32_t crop_x, crop_y, crop_width, crop_height;
+  int32_t flags;
+  uint16_t raw_black_level;
+  uint16_t raw_black_level_separate[4];
+  uint32_t raw_white_point;
+  uint32_t fuji_rotation_pos;
+  float pixel_aspect_ratio;
+  float wb_coeffs[4];
+  dt_iop_buffer_dsc_t buf_dsc;
+  char camera_maker[64];
+  char camera_model[64];
+  char camera_alias[64];
+  char camera_legacy_makermodel[128];
+
+  uint64_t raw_size;    // bytes of sensor data
+  uint64_t packed_size; // bytes of zlib stream following the header
+} dt_raw_cache_header_t;
+
+typedef struct dt_raw_cache_job_t
+{
+  char path[PATH_MAX];
+  dt_raw_cache_header_t header;
+  void *data;
+} dt_raw_cache_job_t;
+
+// serializes writers, so eviction doesn't race with another job renaming its file into place
+static GMutex raw_cache_write_lock;
+
+gboolean dt_raw_cache_enabled(void)
+{
+  return dt_conf_get_bool("cache_raw_decode");
+}
+
+static void _cache_dir(char *dir, size_t bufsize)
+{
+  char cachedir[PATH_MAX] = { 0 };
+  dt_loc_get_user_cache_dir(cachedir, sizeof(cachedir));
+  snprintf(dir, bufsize, "%s" G_DIR_SEPARATOR_S "rawcache", cachedir);
+}
+
+// the key covers the darktable version as well: a rawspeed update can change crops, black levels or the
+// cfa description, and that should not be hidden behind stale entries.
+static gboolean _entry_path(const char *filename, char *path, size_t bufsize, int64_t *size, int64_t *mtime)
+{
+  GStatBuf st;
+  if(g_stat(filename, &st)) return FALSE;
+  *size = st.st_size;
+  *mtime = st.st_mtime;
+
+  gchar *key = g_strdup_printf("%s|%" G_GINT64_FORMAT "|%" G_GINT64_FORMAT "|%s", filename, *size, *mtime,
+                               darktable_package_version);
+  gchar *sum = g_compute_checksum_for_string(G_CHECKSUM_SHA1, key, -1);
+  char dir[PATH_MAX] = { 0 };
+  _cache_dir(dir, sizeof(dir));
+  snprintf(path, bufsize, "%s" G_DIR_SEPARATOR_S "%s" DT_RAW_CACHE_SUFFIX, dir, sum);
+  g_free(sum);
+  g_free(key);
+  return TRUE;
+}
+
+// neighbouring sites of the same colour are close in value, so uint16 data is stored as the difference to the
+// pixel two columns to the left, and every row is split into byte planes. that roughly halves the size of
+// the zlib stream and makes deflate a lot faster. rows are independent, so both directions run in parallel.
+static void _pack(uint8_t *const out, const void *const in, const int width, const int height, const int bpp)
+{
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int j = 0; j < height; j++)
+  {
+    uint8_t *const o = out + (size_t)j * width * bpp;
+    if(bpp == sizeof(uint16_t))
+    {
+      const uint16_t *const row = (const uint16_t *)in + (size_t)j * width;
+      for(int i = 0; i < width; i++)
+      {
+        const uint16_t d = i < 2 ? row[i] : (uint16_t)(row[i] - row[i - 2]);
+        o[i] = d & 0xff;
+        o[width + i] = d >> 8;
+      }
+    }
+    else
+    {
+      const uint8_t *const row = (const uint8_t *)in + (size_t)j * width * bpp;
+      for(int i = 0; i < width; i++)
+        for(int b = 0; b < bpp; b++) o[(size_t)b * width + i] = row[(size_t)i * bpp + b];
+    }
+  }
+}
+
+static void _unpack(void *const out, const uint8_t *const in, const int width, const int height, const int bpp)
+{
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int j = 0; j < height; j++)
+  {
+    const uint8_t *const p = in + (size_t)j * width * bpp;
+    if(bpp == sizeof(uint16_t))
+    {
+      uint16_t *const row = (uint16_t *)out + (size_t)j * width;
+      for(int i = 0; i < width; i++)
+      {
+        const uint16_t d = p[i] | (uint16_t)p[width + i] << 8;
+        row[i] = i < 2 ? d : (uint16_t)(row[i - 2] + d);
+      }
+    }
+    else
+    {
+      uint8_t *const row = (uint8_t *)out + (size_t)j * width * bpp;
+      for(int i = 0; i < width; i++)
+        for(int b = 0; b < bpp; b++) row[(size_t)i * bpp + b] = p[(size_t)b * width + i];
+    }
+  }
+}
+
+static gboolean _cacheable(const dt_image_t *img)
+{
+  return img->loader == LOADER_RAWSPEED && img->buf_dsc.filters != 0u && img->buf_dsc.channels == 1
+         && (img->buf_dsc.datatype == TYPE_UINT16 || img->buf_dsc.datatype == TYPE_FLOAT);
+}
+
+dt_imageio_retval_t dt_raw_cache_read(dt_image_t *img, const char *filename, dt_mipmap_buffer_t *buf)
+{
+  char path[PATH_MAX] = { 0 };
+  int64_t src_size, src_mtime;
+  if(!_entry_path(filename, path, sizeof(path), &src_size, &src_mtime)) return DT_IMAGEIO_FILE_NOT_FOUND;
+
+  FILE *f = g_fopen(path, "rb");
+  if(!f) return DT_IMAGEIO_FILE_NOT_FOUND;
+
+  dt_imageio_retval_t ret = DT_IMAGEIO_FILE_CORRUPTED;
+  uint8_t *packed = NULL, *raw = NULL;
+  dt_raw_cache_header_t h;
+  if(fread(&h, sizeof(h), 1, f) != 1) goto error;
+  if(memcmp(h.magic, DT_RAW_CACHE_MAGIC, sizeof(DT_RAW_CACHE_MAGIC)) || h.version != DT_RAW_CACHE_VERSION
+     || h.header_size != sizeof(h) || h.src_size != src_size || h.src_mtime != src_mtime)
+    goto error;
+
+  const int bpp = h.buf_dsc.datatype == TYPE_UINT16 ? sizeof(uint16_t) : sizeof(float);
+  if(h.width <= 0 || h.height <= 0 || h.raw_size != (uint64_t)h.width * h.height * bpp) goto error;
+
+  packed = malloc(h.packed_size);
+  raw = malloc(h.raw_size);
+  if(!packed || !raw || fread(packed, 1, h.packed_size, f) != h.packed_size) goto error;
+  uLongf raw_size = h.raw_size;
+  if(uncompress(raw, &raw_size, packed, h.packed_size) != Z_OK || raw_size != h.raw_size) goto error;
+  free(packed);
+  packed = NULL;
+
+  // same order as the rawspeed loader, exif first so it can't overwrite what we restore
+  if(!img->exif_inited) (void)dt_exif_read(img, filename);
+
+  g_strlcpy(img->camera_maker, h.camera_maker, sizeof(img->camera_maker));
+  g_strlcpy(img->camera_model, h.camera_model, sizeof(img->camera_model));
+  g_strlcpy(img->camera_alias, h.camera_alias, sizeof(img->camera_alias));
+  dt_image_refresh_makermodel(img);
+  g_strlcpy(img->camera_legacy_makermodel, h.camera_legacy_makermodel, sizeof(img->camera_legacy_makermodel));
+
+  img->width = h.width;
+  img->height = h.height;
+  img->crop_x = h.crop_x;
+  img->crop_y = h.crop_y;
+  img->crop_width = h.crop_width;
+  img->crop_height = h.crop_height;
+  img->flags = (img->flags & ~DT_RAW_CACHE_FLAGS) | (h.flags & DT_RAW_CACHE_FLAGS);
+  img->raw_black_level = h.raw_black_level;
+  for(int k = 0; k < 4; k++) img->raw_black_level_separate[k] = h.raw_black_level_separate[k];
+  img->raw_white_point = h.raw_white_point;
+  img->fuji_rotation_pos = h.fuji_rotation_pos;
+  img->pixel_aspect_ratio = h.pixel_aspect_ratio;
+  for(int k = 0; k < 4; k++) img->wb_coeffs[k] = h.wb_coeffs[k];
+  img->buf_dsc = h.buf_dsc;
+
+  void *out = dt_mipmap_cache_alloc(buf, img);
+  if(!out)
+  {
+    ret = DT_IMAGEIO_CACHE_FULL;
+    goto error;
+  }
+  _unpack(out, raw, h.width, h.height, bpp);
+  img->loader = LOADER_RAWSPEED;
+  ret = DT_IMAGEIO_OK;
+
+  // least recently used is judged by mtime
+  g_utime(path, NULL);
+
+  dt_print(DT_DEBUG_CACHE, "[raw_cache] hit for `%s'\n", filename);
+
+error:
+  fclose(f);
+  free(packed);
+  free(raw);
+  if(ret == DT_IMAGEIO_FILE_CORRUPTED) g_unlink(path);
+  return ret;
+}
+
+typedef struct _entry_t
+{
+  gchar *path;
+  int64_t size;
+  int64_t mtime;
+} _entry_t;
+
+static gint _sort_by_mtime(gconstpointer a, gconstpointer b)
+{
+  const _entry_t *ea = (const _entry_t *)a;
+  const _entry_t *eb = (const _entry_t *)b;
+  return (ea->mtime > eb->mtime) - (ea->mtime < eb->mtime);
+}
+
+static void _free_entry(gpointer data)
+{
+  _entry_t *e = (_entry_t *)data;
+  g_free(e->path);
+  g_free(e);
+}
+
+// called with raw_cache_write_lock held
+static void _evict(const char *dir)
+{
+  const int64_t quota = (int64_t)MAX(dt_conf_get_int("cache_raw_decode_size"), 0) << 20;
+  GDir *d = g_dir_open(dir, 0, NULL);
+  if(!d) return;
+
+  GList *entries = NULL;
+  int64_t total = 0;
+  const gchar *name;
+  while((name = g_dir_read_name(d)))
+  {
+    if(!g_str_has_suffix(name, DT_RAW_CACHE_SUFFIX)) continue;
+    gchar *path = g_build_filename(dir, name, NULL);
+    GStatBuf st;
+    if(g_stat(path, &st))
+    {
+      g_free(path);
+      continue;
+    }
+    _entry_t *e = g_malloc(sizeof(_entry_t));
+    e->path = path;
+    e->size = st.st_size;
+    e->mtime = st.st_mtime;
+    total += e->size;
+    entries = g_list_prepend(entries, e);
+  }
+  g_dir_close(d);
+
+  entries = g_list_sort(entries, _sort_by_mtime);
+  for(GList *iter = entries; iter && total > quota; iter = g_list_next(iter))
+  {
+    _entry_t *e = (_entry_t *)iter->data;
+    if(!g_unlink(e->path)) total -= e->size;
+  }
+  g_list_free_full(entries, _free_entry);
+}
+
+static int32_t _write_job_run(dt_job_t *job)
+{
+  dt_raw_cache_job_t *params = dt_control_job_get_params(job);
+  dt_raw_cache_header_t *h = &params->header;
+  const int bpp = h->buf_dsc.datatype == TYPE_UINT16 ? sizeof(uint16_t) : sizeof(float);
+
+  uint8_t *raw = malloc(h->raw_size);
+  uLongf packed_size = compressBound(h->raw_size);
+  uint8_t *packed = malloc(packed_size);
+  if(!raw || !packed) goto done;
+
+  _pack(raw, params->data, h->width, h->height, bpp);
+  free(params->data);
+  params->data = NULL;
+  if(compress2(packed, &packed_size, raw, h->raw_size, Z_BEST_SPEED) != Z_OK) goto done;
+  h->packed_size = packed_size;
+
+  char dir[PATH_MAX] = { 0 };
+  _cache_dir(dir, sizeof(dir));
+  if(g_mkdir_with_parents(dir, 0750)) goto done;
+
+  g_mutex_lock(&raw_cache_write_lock);
+  // write to a temporary name first, readers must never see half an entry
+  gchar *tmp = g_strdup_printf("%s.tmp", params->path);
+  FILE *f = g_fopen(tmp, "wb");
+  if(f)
+  {
+    const gboolean ok = fwrite(h, sizeof(*h), 1, f) == 1 && fwrite(packed, 1, packed_size, f) == packed_size;
+    if(fclose(f) || !ok || g_rename(tmp, params->path))
+      g_unlink(tmp);
+    else
+      _evict(dir);
+  }
+  g_free(tmp);
+  g_mutex_unlock(&raw_cache_write_lock);
+
+done:
+  free(raw);
+  free(packed);
+  return 0;
+}
+
+static void _write_job_cleanup(void *data)
+{
+  dt_raw_cache_job_t *params = (dt_raw_cache_job_t *)data;
+  free(params->data);
+  free(params);
+}
+
+void dt_raw_cache_write(const dt_image_t *img, const char *filename, const dt_mipmap_buffer_t *buf)
+{
+  if(!buf->buf || !_cacheable(img)) return;
+
+  dt_raw_cache_job_t *params = calloc(1, sizeof(dt_raw_cache_job_t));
+  if(!params) return;
+  dt_raw_cache_header_t *h = &params->header;
+  if(!_entry_path(filename, params->path, sizeof(params->path), &h->src_size, &h->src_mtime)) goto error;
+
+  memcpy(h->magic, DT_RAW_CACHE_MAGIC, sizeof(DT_RAW_CACHE_MAGIC));
+  h->version = DT_RAW_CACHE_VERSION;
+  h->header_size = sizeof(*h);
+  h->width = img->width;
+  h->height = img->height;
+  h->crop_x = img->crop_x;
+  h->crop_y = img->crop_y;
+  h->crop_width = img->crop_width;
+  h->crop_height = img->crop_height;
+  h->flags = img->flags & DT_RAW_CACHE_FLAGS;
+  h->raw_black_level = img->raw_black_level;
+  for(int k = 0; k < 4; k++) h->raw_black_level_separate[k] = img->raw_black_level_separate[k];
+  h->raw_white_point = img->raw_white_point;
+  h->fuji_rotation_pos = img->fuji_rotation_pos;
+  h->pixel_aspect_ratio = img->pixel_aspect_ratio;
+  for(int k = 0; k < 4; k++) h->wb_coeffs[k] = img->wb_coeffs[k];
+  h->buf_dsc = img->buf_dsc;
+  g_strlcpy(h->camera_maker, img->camera_maker, sizeof(h->camera_maker));
+  g_strlcpy(h->camera_model, img->camera_model, sizeof(h->camera_model));
+  g_strlcpy(h->camera_alias, img->camera_alias, sizeof(h->camera_alias));
+  g_strlcpy(h->camera_legacy_makermodel, img->camera_legacy_makermodel, sizeof(h->camera_legacy_makermodel));
+  h->raw_size = (size_t)img->width * img->height * dt_iop_buffer_dsc_to_bpp(&img->buf_dsc);
+
+  // the mipmap buffer goes back to the cache as soon as we return, the job works on its own copy
+  params->data = malloc(h->raw_size);
+  if(!params->data) goto error;
+  memcpy(params->data, buf->buf, h->raw_size);
+
+  dt_job_t *job = dt_control_job_create(&_write_job_run, "write raw cache");
+  if(!job) goto error;
+  dt_control_job_set_params(job, params, _write_job_cleanup);
+  dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG, job);
+  return;
+
+error:
+  _write_job_cleanup(params);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,41 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/image.h"
+#include "common/mipmap_cache.h"
+
+/** on-disk cache of decoded sensor data, so reopening a raw in the darkroom doesn't have to go through
+ * rawspeed again. entries live in ~/.cache/darktable/rawcache/, are keyed by path, size and mtime of the
+ * source file and are evicted least recently used first once cache_raw_decode_size is exceeded. */
+
+/** whether the cache is switched on in the preferences. */
+gboolean dt_raw_cache_enabled(void);
+
+/** fill the full size buffer from the cache. on success the image struct gets everything the rawspeed loader
+ * would have set, and DT_IMAGEIO_OK is returned. anything else means the caller has to load the file. */
+dt_imageio_retval_t dt_raw_cache_read(dt_image_t *img, const char *filename, dt_mipmap_buffer_t *buf);
+
+/** store a freshly decoded full size buffer. the data is copied and written by a background job, images not
+ * loaded by rawspeed or not mosaiced are ignored. */
+void dt_raw_cache_write(const dt_image_t *img, const char *filename, const dt_mipmap_buffer_t *buf);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
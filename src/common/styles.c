@@ -37,6 +37,9 @@
 #include <stdio.h>
 #include <string.h>
 
+// images whose history is written in one transaction when applying a style in the background
+#define DT_STYLES_APPLY_BATCH 50
+
 typedef struct
 {
   GString *name;
@@ -471,7 +474,7 @@ gboolean dt_styles_create_from_image(const char *name, const char *description,
 
 void dt_styles_apply_to_selection(const char *name, gboolean duplicate)
 {
-  gboolean selected = FALSE;
+  GList *imgs = NULL;
 
   /* write current history changes so nothing gets lost, do that only in the darkroom as there is nothing to
      be
@@ -483,15 +486,27 @@ void dt_styles_apply_to_selection(const char *name, gboolean duplicate)
   sqlite3_stmt *stmt;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT imgid FROM main.selected_images",
                               -1, &stmt, NULL);
-  while(sqlite3_step(stmt) == SQLITE_ROW)
+  while(sqlite3_step(stmt) == SQLITE_ROW) imgs = g_list_prepend(imgs, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+  sqlite3_finalize(stmt);
+
+  if(!imgs)
   {
-    int imgid = sqlite3_column_int(stmt, 0);
-    dt_styles_apply_to_image(name, duplicate, imgid);
-    selected = TRUE;
+    dt_control_log(_("no image selected!"));
+    return;
   }
-  sqlite3_finalize(stmt);
 
-  if(!selected) dt_control_log(_("no image selected!"));
+  /* the image in the darkroom gets its history reloaded, which has to happen here and not in the job */
+  if(!duplicate)
+    for(GList *l = imgs; l; l = g_list_next(l))
+      if(dt_dev_is_current_image(darktable.develop, GPOINTER_TO_INT(l->data)))
+      {
+        dt_styles_apply_to_image(name, duplicate, GPOINTER_TO_INT(l->data));
+        imgs = g_list_delete_link(imgs, l);
+        break;
+      }
+
+  dt_styles_apply_to_list(name, imgs, duplicate);
+  g_list_free(imgs);
 }
 
 void dt_styles_create_from_selection()
@@ -512,103 +527,246 @@ void dt_styles_create_from_selection()
   if(!selected) dt_control_log(_("no image selected!"));
 }
 
-void dt_styles_apply_to_image(const char *name, gboolean duplicate, int32_t imgid)
+/* what applying a style needs for every image, prepared once for a batch of them */
+typedef struct _style_apply_t
 {
-  int id = 0;
-  sqlite3_stmt *stmt;
-  int32_t newimgid;
+  int id;
+  gboolean duplicate;
+  guint style_tagid, changed_tagid;
+  sqlite3_stmt *trim, *offset, *clear, *fill, *insert, *history_end;
+} _style_apply_t;
 
-  if((id = dt_styles_get_id_by_name(name)) != 0)
-  {
-    /* check if we should make a duplicate before applying style */
-    if(duplicate)
-    {
-      newimgid = dt_image_duplicate(imgid);
-      if(newimgid != -1) dt_history_copy_and_paste_on_image(imgid, newimgid, FALSE, NULL);
-    }
-    else
-      newimgid = imgid;
+static gboolean _style_apply_init(_style_apply_t *a, const char *name, const gboolean duplicate)
+{
+  memset(a, 0, sizeof(_style_apply_t));
+  if((a->id = dt_styles_get_id_by_name(name)) == 0) return FALSE;
+  a->duplicate = duplicate;
 
-    /* merge onto history stack, let's find history offest in destination image */
-    /* first trim the stack to get rid of whatever is above the selected entry */
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "DELETE FROM main.history WHERE imgid = ?1 AND num >= (SELECT history_end "
-                                "FROM main.images WHERE id = imgid)", -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, newimgid);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+  gchar ntag[512] = { 0 };
+  g_snprintf(ntag, sizeof(ntag), "darktable|style|%s", name);
+  if(!dt_tag_new(ntag, &a->style_tagid)) a->style_tagid = 0;
+  if(!dt_tag_new("darktable|changed", &a->changed_tagid)) a->changed_tagid = 0;
 
-    /* in sqlite ROWID starts at 1, while our num column starts at 0 */
-    int32_t offs = -1;
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "SELECT IFNULL(MAX(num), -1) FROM main.history WHERE imgid = ?1", -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, newimgid);
-    if(sqlite3_step(stmt) == SQLITE_ROW) offs = sqlite3_column_int(stmt, 0);
-    sqlite3_finalize(stmt);
+  /* merge onto history stack, let's find history offest in destination image */
+  /* first trim the stack to get rid of whatever is above the selected entry */
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "DELETE FROM main.history WHERE imgid = ?1 AND num >= (SELECT history_end "
+                              "FROM main.images WHERE id = imgid)", -1, &a->trim, NULL);
 
-    /* delete all items from the temp styles_items, this table is used only to get a ROWNUM of the results */
-    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.style_items", NULL, NULL, NULL);
+  /* in sqlite ROWID starts at 1, while our num column starts at 0 */
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT IFNULL(MAX(num), -1) FROM main.history WHERE imgid = ?1", -1, &a->offset,
+                              NULL);
 
-    /* copy history items from styles onto temp table */
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "INSERT INTO memory.style_items SELECT * FROM "
-                                                               "data.style_items WHERE styleid=?1 ORDER BY "
-                                                               "num DESC",
-                                -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+  /* the temp styles_items is used only to get a ROWNUM of the results. merging multi instances changes it, so
+     it's filled again for every image */
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM memory.style_items", -1, &a->clear,
+                              NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "INSERT INTO memory.style_items SELECT * FROM "
+                                                             "data.style_items WHERE styleid=?1 ORDER BY "
+                                                             "num DESC",
+                              -1, &a->fill, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(a->fill, 1, a->id);
 
-    // rebuild multi-priority
-    if(!duplicate) dt_history_rebuild_multi_priority_merge(newimgid);
+  /* copy the style items into the history */
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "INSERT INTO main.history "
+                              "(imgid,num,module,operation,op_params,enabled,blendop_params,blendop_"
+                              "version,multi_priority,multi_name) SELECT "
+                              "?1,?2+rowid,module,operation,op_params,enabled,blendop_params,blendop_"
+                              "version,multi_priority,multi_name FROM memory.style_items",
+                              -1, &a->insert, NULL);
+
+  /* always make the whole stack active */
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "UPDATE main.images SET history_end = (SELECT MAX(num) + 1 FROM main.history "
+                              "WHERE imgid = ?1) WHERE id = ?1",
+                              -1, &a->history_end, NULL);
+  return TRUE;
+}
 
-    /* copy the style items into the history */
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "INSERT INTO main.history "
-                                "(imgid,num,module,operation,op_params,enabled,blendop_params,blendop_"
-                                "version,multi_priority,multi_name) SELECT "
-                                "?1,?2+rowid,module,operation,op_params,enabled,blendop_params,blendop_"
-                                "version,multi_priority,multi_name FROM memory.style_items",
-                                -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, newimgid);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, offs);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+static void _style_apply_cleanup(_style_apply_t *a)
+{
+  sqlite3_finalize(a->trim);
+  sqlite3_finalize(a->offset);
+  sqlite3_finalize(a->clear);
+  sqlite3_finalize(a->fill);
+  sqlite3_finalize(a->insert);
+  sqlite3_finalize(a->history_end);
+}
 
-    /* always make the whole stack active */
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "UPDATE main.images SET history_end = (SELECT MAX(num) + 1 FROM main.history "
-                                "WHERE imgid = ?1) WHERE id = ?1",
-                                -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, newimgid);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+/* the duplicate a style goes to if asked for one, -1 if that failed. not inside a transaction, creating it
+   shifts image positions in one of its own. */
+static int32_t _style_target(const _style_apply_t *a, const int32_t imgid)
+{
+  if(!a->duplicate) return imgid;
+  const int32_t newimgid = dt_image_duplicate(imgid);
+  if(newimgid != -1) dt_history_copy_and_paste_on_image(imgid, newimgid, FALSE, NULL);
+  return newimgid;
+}
+
+/* the history part of applying a style to newimgid, from _style_target() */
+static void _style_apply(_style_apply_t *a, const int32_t newimgid)
+{
+  DT_DEBUG_SQLITE3_BIND_INT(a->trim, 1, newimgid);
+  sqlite3_step(a->trim);
+  sqlite3_reset(a->trim);
+
+  int32_t offs = -1;
+  DT_DEBUG_SQLITE3_BIND_INT(a->offset, 1, newimgid);
+  if(sqlite3_step(a->offset) == SQLITE_ROW) offs = sqlite3_column_int(a->offset, 0);
+  sqlite3_reset(a->offset);
+
+  sqlite3_step(a->clear);
+  sqlite3_reset(a->clear);
+  sqlite3_step(a->fill);
+  sqlite3_reset(a->fill);
+
+  // rebuild multi-priority
+  if(!a->duplicate) dt_history_rebuild_multi_priority_merge(newimgid);
+
+  DT_DEBUG_SQLITE3_BIND_INT(a->insert, 1, newimgid);
+  DT_DEBUG_SQLITE3_BIND_INT(a->insert, 2, offs);
+  sqlite3_step(a->insert);
+  sqlite3_reset(a->insert);
+
+  DT_DEBUG_SQLITE3_BIND_INT(a->history_end, 1, newimgid);
+  sqlite3_step(a->history_end);
+  sqlite3_reset(a->history_end);
+}
+
+void dt_styles_apply_to_image(const char *name, gboolean duplicate, int32_t imgid)
+{
+  _style_apply_t a;
+  if(!_style_apply_init(&a, name, duplicate)) return;
+  const int32_t newimgid = _style_target(&a, imgid);
+  if(newimgid != -1) _style_apply(&a, newimgid);
+  _style_apply_cleanup(&a);
+  if(newimgid == -1) return;
+
+  /* add tag */
+  if(a.style_tagid) dt_tag_attach(a.style_tagid, newimgid);
+  if(a.changed_tagid) dt_tag_attach(a.changed_tagid, newimgid);
+
+  /* if current image in develop reload history */
+  if(dt_dev_is_current_image(darktable.develop, newimgid))
+  {
+    dt_dev_reload_history_items(darktable.develop);
+    dt_dev_modulegroups_set(darktable.develop, dt_dev_modulegroups_get(darktable.develop));
+  }
+
+  /* update xmp file */
+  dt_image_synch_xmp(newimgid);
+
+  /* remove old obsolete thumbnails */
+  dt_mipmap_cache_remove(darktable.mipmap_cache, newimgid);
+
+  /* if we have created a duplicate, reset collected images */
+  if(duplicate) dt_control_signal_raise(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED);
+
+  /* redraw center view to update visible mipmaps */
+  dt_control_queue_redraw_center();
+}
 
-    /* add tag */
-    guint tagid = 0;
-    gchar ntag[512] = { 0 };
-    g_snprintf(ntag, sizeof(ntag), "darktable|style|%s", name);
-    if(dt_tag_new(ntag, &tagid)) dt_tag_attach(tagid, newimgid);
-    if(dt_tag_new("darktable|changed", &tagid)) dt_tag_attach(tagid, newimgid);
+typedef struct _styles_apply_job_t
+{
+  gchar *name;
+  gboolean duplicate;
+  GList *imgs;
+} _styles_apply_job_t;
 
-    /* if current image in develop reload history */
-    if(dt_dev_is_current_image(darktable.develop, newimgid))
+static int32_t _styles_apply_job_run(dt_job_t *job)
+{
+  _styles_apply_job_t *params = dt_control_job_get_params(job);
+  const guint total = g_list_length(params->imgs);
+  double fraction = 0;
+  char message[512] = { 0 };
+  snprintf(message, sizeof(message), ngettext("applying style to %d image", "applying style to %d images", total),
+           total);
+  dt_control_job_set_progress_message(job, message);
+
+  _style_apply_t a;
+  if(!_style_apply_init(&a, params->name, params->duplicate)) return 1;
+
+  /* duplicates first, they can't be made inside our transaction */
+  GList *targets = NULL;
+  for(GList *l = params->imgs; l && dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED; l = g_list_next(l))
+  {
+    const int32_t newimgid = _style_target(&a, GPOINTER_TO_INT(l->data));
+    if(newimgid != -1) targets = g_list_prepend(targets, GINT_TO_POINTER(newimgid));
+    if(params->duplicate)
     {
-      dt_dev_reload_history_items(darktable.develop);
-      dt_dev_modulegroups_set(darktable.develop, dt_dev_modulegroups_get(darktable.develop));
+      fraction += 0.25 / total;
+      dt_control_job_set_progress(job, fraction);
     }
+  }
+  targets = g_list_reverse(targets);
 
-    /* update xmp file */
-    dt_image_synch_xmp(newimgid);
+  /* the history rows go in a few transactions. the connection is shared with the gui, which has to wait for
+     ours to finish before it can start one of its own, so they are kept short. */
+  const guint ntargets = g_list_length(targets);
+  GList *done = NULL;
+  for(GList *l = targets; l && dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED;)
+  {
+    dt_database_start_transaction(darktable.db);
+    for(int k = 0; l && k < DT_STYLES_APPLY_BATCH; k++, l = g_list_next(l))
+    {
+      _style_apply(&a, GPOINTER_TO_INT(l->data));
+      done = g_list_prepend(done, l->data);
+      fraction += (params->duplicate ? 0.25 : 0.5) / ntargets;
+    }
+    dt_database_release_transaction(darktable.db);
+    dt_control_job_set_progress(job, fraction);
+  }
+  _style_apply_cleanup(&a);
+  g_list_free(targets);
 
-    /* remove old obsolete thumbnails */
-    dt_mipmap_cache_remove(darktable.mipmap_cache, newimgid);
+  /* tagging updates the collection, so after the transaction */
+  if(a.style_tagid) dt_tag_attach_images(a.style_tagid, done);
+  if(a.changed_tagid) dt_tag_attach_images(a.changed_tagid, done);
 
-    /* if we have created a duplicate, reset collected images */
-    if(duplicate) dt_control_signal_raise(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED);
+  /* sidecars and thumbnails of whatever made it into the database, even if cancelled */
+  const guint written = g_list_length(done);
+  for(GList *l = done; l; l = g_list_next(l))
+  {
+    dt_image_synch_xmp(GPOINTER_TO_INT(l->data));
+    dt_mipmap_cache_remove(darktable.mipmap_cache, GPOINTER_TO_INT(l->data));
+    fraction += 0.5 / written;
+    dt_control_job_set_progress(job, fraction);
+  }
+  g_list_free(done);
 
-    /* redraw center view to update visible mipmaps */
-    dt_control_queue_redraw_center();
+  if(params->duplicate) dt_control_signal_raise(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED);
+  dt_control_queue_redraw_center();
+  return 0;
+}
+
+static void _styles_apply_job_cleanup(void *p)
+{
+  _styles_apply_job_t *params = (_styles_apply_job_t *)p;
+  g_free(params->name);
+  g_list_free(params->imgs);
+  free(params);
+}
+
+void dt_styles_apply_to_list(const char *name, GList *list, gboolean duplicate)
+{
+  if(!list) return;
+
+  dt_job_t *job = dt_control_job_create(&_styles_apply_job_run, "apply style");
+  if(!job) return;
+  _styles_apply_job_t *params = (_styles_apply_job_t *)calloc(1, sizeof(_styles_apply_job_t));
+  if(!params)
+  {
+    dt_control_job_dispose(job);
+    return;
   }
+  params->name = g_strdup(name);
+  params->duplicate = duplicate;
+  params->imgs = g_list_copy(list);
+  dt_control_job_add_progress(job, _("apply style"), TRUE);
+  dt_control_job_set_params(job, params, _styles_apply_job_cleanup);
+  dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_FG, job);
 }
 
 void dt_styles_delete_by_name(const char *name)
@@ -71,6 +71,10 @@ void dt_styles_apply_to_selection(const char *name, gboolean duplicate);
 /** applies the style to image by imgid*/
 void dt_styles_apply_to_image(const char *name, gboolean dulpicate, int32_t imgid);
 
+/** applies the style to all images in list in a background job. the history of all of them is written in one
+ * transaction, sidecar files and thumbnails are updated after that. */
+void dt_styles_apply_to_list(const char *name, GList *list, gboolean duplicate);
+
 /** delete a style by name */
 void dt_styles_delete_by_name(const char *name);
 
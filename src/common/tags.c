@@ -242,6 +242,30 @@ void dt_tag_attach_list(GList *tags, gint imgid)
   dt_collection_update_query(darktable.collection);
 }
 
+void dt_tag_attach_images(guint tagid, GList *imgs)
+{
+  if(!imgs) return;
+
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "INSERT OR REPLACE INTO main.tagged_images (imgid, tagid) VALUES (?1, ?2)", -1,
+                              &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, tagid);
+  dt_database_start_transaction(darktable.db);
+  for(GList *l = imgs; l; l = g_list_next(l))
+  {
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, GPOINTER_TO_INT(l->data));
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+  }
+  dt_database_release_transaction(darktable.db);
+  sqlite3_finalize(stmt);
+
+  dt_tag_update_used_tags();
+
+  dt_collection_update_query(darktable.collection);
+}
+
 void dt_tag_attach_string_list(const gchar *tags, gint imgid)
 {
   gchar **tokens = g_strsplit(tags, ",", 0);
@@ -65,6 +65,10 @@ void dt_tag_attach(guint tagid, gint imgid);
  * image id to attach tag to, if < 0 selected images are used. \note If tag not exists it's created.*/
 void dt_tag_attach_list(GList *tags, gint imgid);
 
+/** attach a tag on a list of images. \param[in] tagid id of tag to attach. \param[in] imgs a list of image
+ * ids. used tags and the collection are updated once for all of them. */
+void dt_tag_attach_images(guint tagid, GList *imgs);
+
 /** attach a list of tags on selected images. \param[in] tags a comma separated string of tags. \param[in]
  * imgid the image id to attach tag to, if < 0 selected images are used. \note If tag not exists it's
  * created.*/
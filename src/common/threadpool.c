@@ -0,0 +1,249 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/threadpool.h"
+#include "common/darktable.h"
+#include "common/dtpthread.h"
+#include <glib.h>
+#include <stdlib.h>
+
+// a parallel loop or a single task, the latter is one piece [0, 1)
+typedef struct _pool_job_t
+{
+  dt_parallel_for_t fn;
+  dt_task_t task;
+  void *data;
+  size_t next, end, grain; // next piece to hand out
+  dt_task_group_t *group;
+  dt_task_priority_t priority;
+  int owned; // malloc()ed, freed when its piece is done
+} _pool_job_t;
+
+typedef struct _pool_t
+{
+  dt_pthread_mutex_t lock;
+  pthread_cond_t work; // pieces queued or shutting down
+  pthread_cond_t done; // a group has no pending pieces left
+  GQueue queue[DT_TASK_PRIORITIES]; // jobs with pieces nobody has taken yet
+  pthread_t *thread;
+  int num_threads;
+  int shutdown;
+} _pool_t;
+
+static _pool_t _pool = { 0 };
+
+static __thread dt_task_priority_t _priority = DT_TASK_BACKGROUND;
+
+// hands out the next piece of job, lock held
+static void _take(_pool_job_t *job, size_t *begin, size_t *end)
+{
+  *begin = job->next;
+  *end = MIN(job->end, job->next + job->grain);
+  job->next = *end;
+  if(job->next == job->end) g_queue_remove(&_pool.queue[job->priority], job);
+}
+
+static void _run(_pool_job_t *job, const size_t begin, const size_t end)
+{
+  const dt_task_priority_t old = _priority;
+  _priority = job->priority;
+  if(job->fn)
+    job->fn(begin, end, job->data);
+  else
+    job->task(job->data);
+  _priority = old;
+}
+
+// lock held. the one waiting for the group can't see pending drop before the lock is given back, so a job on its
+// stack is still there.
+static void _finish(_pool_job_t *job)
+{
+  dt_task_group_t *group = job->group;
+  if(job->owned) free(job);
+  if(--group->pending == 0) pthread_cond_broadcast(&_pool.done);
+}
+
+static _pool_job_t *_find(const dt_task_group_t *group)
+{
+  for(int p = DT_TASK_PRIORITIES - 1; p >= 0; p--)
+    for(GList *l = _pool.queue[p].head; l; l = g_list_next(l))
+      if(((_pool_job_t *)l->data)->group == group) return (_pool_job_t *)l->data;
+  return NULL;
+}
+
+// lock held. only helps with the group's own pieces, the others it waits for are being worked on already and
+// don't depend on anything further up.
+static void _wait(dt_task_group_t *group)
+{
+  while(group->pending)
+  {
+    _pool_job_t *job = _find(group);
+    if(!job)
+    {
+      dt_pthread_cond_wait(&_pool.done, &_pool.lock);
+      continue;
+    }
+    size_t begin, end;
+    _take(job, &begin, &end);
+    dt_pthread_mutex_unlock(&_pool.lock);
+    _run(job, begin, end);
+    dt_pthread_mutex_lock(&_pool.lock);
+    _finish(job);
+  }
+}
+
+static void *_worker(void *arg)
+{
+  dt_pthread_setname("pool");
+#ifdef _OPENMP
+  // whatever is left in OpenMP inside a piece shouldn't start a team per worker
+  omp_set_num_threads(1);
+#endif
+
+  dt_pthread_mutex_lock(&_pool.lock);
+  while(!_pool.shutdown)
+  {
+    _pool_job_t *job = NULL;
+    for(int p = DT_TASK_PRIORITIES - 1; p >= 0 && !job; p--) job = g_queue_peek_head(&_pool.queue[p]);
+    if(!job)
+    {
+      dt_pthread_cond_wait(&_pool.work, &_pool.lock);
+      continue;
+    }
+    size_t begin, end;
+    _take(job, &begin, &end);
+    dt_pthread_mutex_unlock(&_pool.lock);
+    _run(job, begin, end);
+    dt_pthread_mutex_lock(&_pool.lock);
+    _finish(job);
+  }
+  dt_pthread_mutex_unlock(&_pool.lock);
+  return NULL;
+}
+
+void dt_threadpool_init(const int threads)
+{
+  dt_pthread_mutex_init(&_pool.lock, NULL);
+  pthread_cond_init(&_pool.work, NULL);
+  pthread_cond_init(&_pool.done, NULL);
+  for(int p = 0; p < DT_TASK_PRIORITIES; p++) g_queue_init(&_pool.queue[p]);
+  _pool.shutdown = 0;
+  _pool.num_threads = 0;
+  _pool.thread = (pthread_t *)calloc(MAX(threads, 1), sizeof(pthread_t));
+  if(!_pool.thread) return;
+
+  for(int k = 0; k < threads; k++)
+  {
+    if(dt_pthread_create(&_pool.thread[k], _worker, NULL)) break;
+    _pool.num_threads++;
+  }
+  dt_print(DT_DEBUG_PERF, "[threadpool] %d workers\n", _pool.num_threads);
+}
+
+void dt_threadpool_cleanup()
+{
+  if(!_pool.thread) return;
+
+  dt_pthread_mutex_lock(&_pool.lock);
+  _pool.shutdown = 1;
+  pthread_cond_broadcast(&_pool.work);
+  dt_pthread_mutex_unlock(&_pool.lock);
+  for(int k = 0; k < _pool.num_threads; k++) pthread_join(_pool.thread[k], NULL);
+
+  free(_pool.thread);
+  _pool.thread = NULL;
+  _pool.num_threads = 0;
+  pthread_cond_destroy(&_pool.work);
+  pthread_cond_destroy(&_pool.done);
+  dt_pthread_mutex_destroy(&_pool.lock);
+}
+
+dt_task_priority_t dt_threadpool_set_priority(const dt_task_priority_t priority)
+{
+  const dt_task_priority_t old = _priority;
+  _priority = priority;
+  return old;
+}
+
+void dt_parallel_for(const size_t begin, const size_t end, const size_t grain, dt_parallel_for_t fn, void *data)
+{
+  if(end <= begin) return;
+  const size_t n = end - begin;
+  int threads = _pool.num_threads + 1;
+#ifdef _OPENMP
+  // the same share of the cores an openmp team started here would get, see dt_dev_pixelpipe_process()
+  threads = MIN(threads, omp_get_max_threads());
+#endif
+  // a few pieces per thread, so one that got interrupted by other work doesn't hold up the rest
+  const size_t piece = grain ? grain : MAX(n / (4 * threads), 1);
+
+  if(threads == 1 || n <= piece)
+  {
+    fn(begin, end, data);
+    return;
+  }
+
+  dt_task_group_t group = DT_TASK_GROUP_INIT;
+  _pool_job_t job = { .fn = fn, .data = data, .next = begin, .end = end, .grain = piece, .group = &group,
+                      .priority = _priority };
+  const size_t pieces = (n + piece - 1) / piece;
+
+  dt_pthread_mutex_lock(&_pool.lock);
+  group.pending = pieces;
+  g_queue_push_tail(&_pool.queue[job.priority], &job);
+  // this thread takes one piece itself
+  for(size_t k = 1; k < MIN(pieces, (size_t)threads); k++) pthread_cond_signal(&_pool.work);
+  _wait(&group);
+  dt_pthread_mutex_unlock(&_pool.lock);
+}
+
+void dt_task_group_run(dt_task_group_t *group, dt_task_t fn, void *data)
+{
+  _pool_job_t *job = _pool.num_threads ? (_pool_job_t *)calloc(1, sizeof(_pool_job_t)) : NULL;
+  if(!job)
+  {
+    fn(data);
+    return;
+  }
+  job->task = fn;
+  job->data = data;
+  job->next = 0;
+  job->end = job->grain = 1;
+  job->group = group;
+  job->priority = _priority;
+  job->owned = 1;
+
+  dt_pthread_mutex_lock(&_pool.lock);
+  group->pending++;
+  g_queue_push_tail(&_pool.queue[job->priority], job);
+  pthread_cond_signal(&_pool.work);
+  dt_pthread_mutex_unlock(&_pool.lock);
+}
+
+void dt_task_group_wait(dt_task_group_t *group)
+{
+  if(_pool.num_threads == 0) return;
+
+  dt_pthread_mutex_lock(&_pool.lock);
+  _wait(group);
+  dt_pthread_mutex_unlock(&_pool.lock);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
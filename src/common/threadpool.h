@@ -0,0 +1,74 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * one set of worker threads shared by all pipes and jobs. two loops running at the same time don't start more
+ * threads than there are cores, the workers take pieces of both, and pieces of interactive work (the darkroom
+ * pipes, the gui) are always picked before those of background work (thumbnails, export). a loop wakes at most
+ * as many workers as an openmp team started by the same thread would have, so the pipes' share of the cores
+ * holds for both.
+ *
+ * the thread that starts a loop or waits for a group works on it too and only returns once all of it is done,
+ * so loops can be nested and called from anywhere, also from inside the pieces of another loop.
+ */
+
+typedef enum dt_task_priority_t
+{
+  DT_TASK_BACKGROUND = 0, // what every thread starts with
+  DT_TASK_INTERACTIVE = 1,
+  DT_TASK_PRIORITIES
+} dt_task_priority_t;
+
+/** body of a parallel loop, does the iterations [begin, end). */
+typedef void (*dt_parallel_for_t)(const size_t begin, const size_t end, void *data);
+
+typedef void (*dt_task_t)(void *data);
+
+/** tasks that can be waited for together, put it on the stack as DT_TASK_GROUP_INIT. */
+typedef struct dt_task_group_t
+{
+  size_t pending; // pieces not done yet, guarded by the pool
+} dt_task_group_t;
+
+#define DT_TASK_GROUP_INIT { 0 }
+
+/** starts the given number of workers. with none, everything runs in the thread that asks for it. */
+void dt_threadpool_init(const int threads);
+void dt_threadpool_cleanup();
+
+/** priority of the work the calling thread hands out from now on, returns the one it had. pieces run with the
+ * priority of the work they belong to, so that's inherited by nested loops. */
+dt_task_priority_t dt_threadpool_set_priority(const dt_task_priority_t priority);
+
+/** calls fn on pieces of [begin, end) with grain iterations each, 0 picks a grain that gives every thread a
+ * few pieces. returns when all of them are done. */
+void dt_parallel_for(const size_t begin, const size_t end, const size_t grain, dt_parallel_for_t fn, void *data);
+
+/** queues fn(data) as part of group. */
+void dt_task_group_run(dt_task_group_t *group, dt_task_t fn, void *data);
+
+/** returns when all tasks of group are done, running those no worker has started yet. */
+void dt_task_group_wait(dt_task_group_t *group);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -54,6 +54,61 @@ typedef struct dt_control_crawler_result_t
 } dt_control_crawler_result_t;
 
 
+// names compared the way case insensitive file systems (and the normalizing ones of macOS) do. NULL if name
+// isn't valid utf-8.
+static gchar *_crawler_fold(const char *name)
+{
+  gchar *normalized = g_utf8_normalize(name, -1, G_NORMALIZE_DEFAULT);
+  if(!normalized) return NULL;
+  gchar *folded = g_utf8_casefold(normalized, -1);
+  g_free(normalized);
+  return folded;
+}
+
+#define _CRAWLER_EXACT GINT_TO_POINTER(1)
+#define _CRAWLER_FOLDED GINT_TO_POINTER(2)
+
+// the names of all files in a directory, so that looking for sidecars and extra files doesn't need a stat() per
+// candidate. the folded names are in there as well, see _crawler_exists(). NULL if it can't be read.
+static GHashTable *_crawler_list_dir(const char *folder)
+{
+  GDir *dir = g_dir_open(folder, 0, NULL);
+  if(!dir) return NULL;
+  GHashTable *files = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  const gchar *name;
+  while((name = g_dir_read_name(dir)))
+  {
+    g_hash_table_insert(files, g_strdup(name), _CRAWLER_EXACT);
+    gchar *folded = _crawler_fold(name);
+    if(folded && !g_hash_table_contains(files, folded))
+      g_hash_table_insert(files, folded, _CRAWLER_FOLDED);
+    else
+      g_free(folded);
+  }
+  g_dir_close(dir);
+  return files;
+}
+
+// whether path exists, looked up in the listing of its folder if there is one. the name might only match in a
+// different case or normalization, which depends on the file system. ask it then.
+static gboolean _crawler_exists(GHashTable *files, const char *path)
+{
+  if(!files) return g_file_test(path, G_FILE_TEST_EXISTS);
+  gchar *name = g_path_get_basename(path);
+  gboolean exists = g_hash_table_lookup(files, name) == _CRAWLER_EXACT;
+  if(!exists)
+  {
+    gchar *folded = _crawler_fold(name);
+    if(!folded || g_hash_table_contains(files, folded)) exists = g_file_test(path, G_FILE_TEST_EXISTS);
+    g_free(folded);
+  }
+  g_free(name);
+  return exists;
+}
+
+#undef _CRAWLER_EXACT
+#undef _CRAWLER_FOLDED
+
 GList *dt_control_crawler_run()
 {
   sqlite3_stmt *stmt, *inner_stmt;
@@ -61,14 +116,19 @@ GList *dt_control_crawler_run()
   gboolean look_for_xmp = dt_conf_get_bool("write_sidecar_files");
 
   sqlite3_prepare_v2(dt_database_get(darktable.db),
-                     "SELECT i.id, write_timestamp, version, folder || '" G_DIR_SEPARATOR_S "' || filename, flags "
+                     "SELECT i.id, write_timestamp, version, folder || '" G_DIR_SEPARATOR_S "' || filename, flags, "
+                     "f.id, folder "
                      "FROM main.images i, main.film_rolls f ON i.film_id = f.id ORDER BY f.id, filename",
                      -1, &stmt, NULL);
   sqlite3_prepare_v2(dt_database_get(darktable.db), "UPDATE main.images SET flags = ?1 WHERE id = ?2", -1,
                      &inner_stmt, NULL);
 
   // let's wrap this into a transaction, it might make it a little faster.
-  sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
+  dt_database_start_transaction(darktable.db);
+
+  // images come sorted by film roll, so one listing of the folder serves all of its images
+  int film_id = -1;
+  GHashTable *files = NULL;
 
   while(sqlite3_step(stmt) == SQLITE_ROW)
   {
@@ -78,6 +138,13 @@ GList *dt_control_crawler_run()
     gchar *image_path = (gchar *)sqlite3_column_text(stmt, 3);
     int flags = sqlite3_column_int(stmt, 4);
 
+    if(sqlite3_column_int(stmt, 5) != film_id)
+    {
+      film_id = sqlite3_column_int(stmt, 5);
+      if(files) g_hash_table_destroy(files);
+      files = _crawler_list_dir((const char *)sqlite3_column_text(stmt, 6));
+    }
+
     // no need to look for xmp files if none get written anyway.
     if(look_for_xmp)
     {
@@ -94,7 +161,8 @@ GList *dt_control_crawler_run()
       xmp_path[len] = '\0';
 
       struct stat statbuf;
-      if(stat(xmp_path, &statbuf) == -1) continue; // TODO: shall we report these?
+      if(!_crawler_exists(files, xmp_path) || stat(xmp_path, &statbuf) == -1)
+        continue; // TODO: shall we report these?
 
       // step 1: check if the xmp is newer than our db entry
       // FIXME: allow for a few seconds difference?
@@ -127,27 +195,27 @@ GList *dt_control_crawler_run()
     extra_path[len] = 't';
     extra_path[len + 1] = 'x';
     extra_path[len + 2] = 't';
-    gboolean has_txt = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+    gboolean has_txt = _crawler_exists(files, extra_path);
 
     if(!has_txt)
     {
       extra_path[len] = 'T';
       extra_path[len + 1] = 'X';
       extra_path[len + 2] = 'T';
-      has_txt = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+      has_txt = _crawler_exists(files, extra_path);
     }
 
     extra_path[len] = 'w';
     extra_path[len + 1] = 'a';
     extra_path[len + 2] = 'v';
-    gboolean has_wav = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+    gboolean has_wav = _crawler_exists(files, extra_path);
 
     if(!has_wav)
     {
       extra_path[len] = 'W';
       extra_path[len + 1] = 'A';
       extra_path[len + 2] = 'V';
-      has_wav = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+      has_wav = _crawler_exists(files, extra_path);
     }
 
     // TODO: decide if we want to remove the flag for images that lost their extra file. currently we do (the
@@ -173,8 +241,9 @@ GList *dt_control_crawler_run()
     g_free(extra_path);
   }
 
-  sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+  dt_database_release_transaction(darktable.db);
 
+  if(files) g_hash_table_destroy(files);
   sqlite3_finalize(stmt);
   sqlite3_finalize(inner_stmt);
 
@@ -246,6 +315,7 @@ static void _select_all_callback(GtkToggleButton *togglebutton, gpointer user_da
 static void _reload_button_clicked(GtkButton *button, gpointer user_data)
 {
   dt_control_crawler_gui_t *gui = (dt_control_crawler_gui_t *)user_data;
+  GList *imgs = NULL, *xmps = NULL;
 
   GtkTreeIter iter;
   gboolean valid = gtk_tree_model_get_iter_first(gui->model, &iter);
@@ -258,12 +328,22 @@ static void _reload_button_clicked(GtkButton *button, gpointer user_data)
                        DT_CONTROL_CRAWLER_COL_ID, &id, DT_CONTROL_CRAWLER_COL_XMP_PATH, &xmp_path, -1);
     if(selected)
     {
-      dt_history_load_and_apply(id, xmp_path, 0);
+      imgs = g_list_prepend(imgs, GINT_TO_POINTER(id));
+      xmps = g_list_prepend(xmps, xmp_path);
       valid = gtk_list_store_remove(GTK_LIST_STORE(gui->model), &iter);
     }
     else
+    {
+      g_free(xmp_path);
       valid = gtk_tree_model_iter_next(gui->model, &iter);
+    }
   }
+
+  // all of them at once, that is a lot faster than one by one
+  dt_history_load_and_apply_list(imgs, xmps, 0);
+  g_list_free(imgs);
+  g_list_free_full(xmps, g_free);
+
   // we also want to disable the "select all" thing
   _clear_select_all(gui);
 }
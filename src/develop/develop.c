@@ -948,7 +948,7 @@ static void auto_apply_presets(dt_develop_t *dev)
                                     "UPDATE memory.history SET num=?1 WHERE rowid=?2", -1, &stmt, NULL);
 
         // let's wrap this into a transaction, it might make it a little faster.
-        sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
+        dt_database_start_transaction(darktable.db);
         for(GList *r = rowids; r; r = g_list_next(r))
         {
           DT_DEBUG_SQLITE3_CLEAR_BINDINGS(stmt);
@@ -961,7 +961,7 @@ static void auto_apply_presets(dt_develop_t *dev)
           v++;
         }
 
-        sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+        dt_database_release_transaction(darktable.db);
 
         g_list_free(rowids);
         sqlite3_finalize(stmt);
@@ -308,6 +308,8 @@ int dt_iop_load_module_so(void *m, const char *libname, const char *op)
     module->distort_transform = default_distort_transform;
   if(!g_module_symbol(module->module, "distort_backtransform", (gpointer) & (module->distort_backtransform)))
     module->distort_backtransform = default_distort_backtransform;
+  if(!g_module_symbol(module->module, "fuse_raw", (gpointer) & (module->fuse_raw)))
+    module->fuse_raw = NULL;
 
   if(!g_module_symbol(module->module, "modify_roi_in", (gpointer) & (module->modify_roi_in)))
     module->modify_roi_in = dt_iop_modify_roi_in;
@@ -423,6 +425,7 @@ int dt_iop_load_module_by_so(dt_iop_module_t *module, dt_iop_module_so_t *so, dt
   module->process_tiling_cl = so->process_tiling_cl;
   module->distort_transform = so->distort_transform;
   module->distort_backtransform = so->distort_backtransform;
+  module->fuse_raw = so->fuse_raw;
   module->modify_roi_in = so->modify_roi_in;
   module->modify_roi_out = so->modify_roi_out;
   module->legacy_params = so->legacy_params;
@@ -1397,8 +1400,103 @@ static void dt_iop_init_module_so(void *m)
   }
 }
 
+// develop contexts without gui (export, thumbnails, darktable-cli) only instantiate the modules an image can
+// actually use: the ones its history refers to and the ones which come up enabled by default. the latter are
+// remembered here per kind of image once one image of that kind had all modules loaded. the sets only ever
+// grow, so a module once found enabled is never left out again.
+// preferences don't reach default_enabled: auto applied presets end up in the history, which is read anyway.
+static dt_pthread_mutex_t _lazy_lock;
+static GHashTable *_lazy_enabled = NULL; // key -> set of dt_iop_module_so_t *
+
+// everything reload_defaults() looks at to decide on default_enabled: raw/ldr/hdr and the sensor layout
+// (demosaic, highlights, temperature, rawprepare), the exif maker and model (monochrome raws in temperature),
+// the white point (normalized float raws in rawprepare), fuji rotation (rotatepixels) and the pixel aspect
+// ratio (scalepixels). a module deciding on anything else has to be added here.
+static gchar *_lazy_key(const dt_image_t *img)
+{
+  return g_strdup_printf("%s|%s|%s|%s|%d|%d|%d|%u|%u|%u|%g", img->camera_maker, img->camera_model,
+                         img->exif_maker, img->exif_model,
+                         img->flags & (DT_IMAGE_LDR | DT_IMAGE_RAW | DT_IMAGE_HDR | DT_IMAGE_4BAYER),
+                         img->buf_dsc.channels, img->buf_dsc.datatype, img->buf_dsc.filters, img->raw_white_point,
+                         img->fuji_rotation_pos, img->pixel_aspect_ratio);
+}
+
+// returns the set of modules to load for dev, or NULL to load all of them
+static GHashTable *_lazy_wanted_modules(dt_develop_t *dev)
+{
+  const dt_image_t *img = &dev->image_storage;
+
+  // auto presets go into the history on the first load, after the modules are there. load all then.
+  if(dev->gui_attached || img->id <= 0 || !(img->flags & DT_IMAGE_AUTO_PRESETS_APPLIED)) return NULL;
+
+  GHashTable *wanted = NULL;
+  gchar *key = _lazy_key(img);
+  dt_pthread_mutex_lock(&_lazy_lock);
+  GHashTable *enabled = g_hash_table_lookup(_lazy_enabled, key);
+  if(enabled)
+  {
+    wanted = g_hash_table_new(NULL, NULL);
+    GHashTableIter it;
+    gpointer so;
+    g_hash_table_iter_init(&it, enabled);
+    while(g_hash_table_iter_next(&it, &so, NULL)) g_hash_table_add(wanted, so);
+  }
+  dt_pthread_mutex_unlock(&_lazy_lock);
+  g_free(key);
+
+  if(!wanted) return NULL;
+
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT DISTINCT operation FROM main.history WHERE imgid = ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->id);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const char *op = (const char *)sqlite3_column_text(stmt, 0);
+    for(GList *iop = darktable.iop; op && iop; iop = g_list_next(iop))
+    {
+      dt_iop_module_so_t *so = (dt_iop_module_so_t *)iop->data;
+      if(!strcmp(so->op, op))
+      {
+        g_hash_table_add(wanted, so);
+        break;
+      }
+    }
+  }
+  sqlite3_finalize(stmt);
+
+  return wanted;
+}
+
+// after all modules were loaded without gui: remember which ones this kind of image has on by default
+static void _lazy_remember(const dt_develop_t *dev, GList *modules)
+{
+  const dt_image_t *img = &dev->image_storage;
+  if(dev->gui_attached || img->id <= 0) return;
+
+  gchar *key = _lazy_key(img);
+  dt_pthread_mutex_lock(&_lazy_lock);
+  GHashTable *enabled = g_hash_table_lookup(_lazy_enabled, key);
+  if(!enabled)
+  {
+    enabled = g_hash_table_new(NULL, NULL);
+    g_hash_table_insert(_lazy_enabled, key, enabled);
+  }
+  else
+    g_free(key);
+  for(GList *m = modules; m; m = g_list_next(m))
+  {
+    const dt_iop_module_t *module = (dt_iop_module_t *)m->data;
+    if(module->default_enabled) g_hash_table_add(enabled, module->so);
+  }
+  dt_pthread_mutex_unlock(&_lazy_lock);
+}
+
 void dt_iop_load_modules_so()
 {
+  dt_pthread_mutex_init(&_lazy_lock, NULL);
+  _lazy_enabled = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_hash_table_destroy);
+
   darktable.iop = dt_module_load_modules("/plugins", sizeof(dt_iop_module_so_t), dt_iop_load_module_so,
                                          dt_iop_init_module_so, NULL);
 }
@@ -1423,14 +1521,21 @@ GList *dt_iop_load_modules(dt_develop_t *dev)
   dt_iop_module_t *module;
   dt_iop_module_so_t *module_so;
   dev->iop_instance = 0;
+  GHashTable *wanted = _lazy_wanted_modules(dev);
   GList *iop = darktable.iop;
   while(iop)
   {
     module_so = (dt_iop_module_so_t *)iop->data;
+    if(wanted && !g_hash_table_contains(wanted, module_so))
+    {
+      iop = g_list_next(iop);
+      continue;
+    }
     module = (dt_iop_module_t *)calloc(1, sizeof(dt_iop_module_t));
     if(dt_iop_load_module_by_so(module, module_so, dev))
     {
       free(module);
+      iop = g_list_next(iop);
       continue;
     }
     res = g_list_insert_sorted(res, module, sort_plugins);
@@ -1448,9 +1553,46 @@ GList *dt_iop_load_modules(dt_develop_t *dev)
     module->multi_name[0] = '\0';
     it = g_list_next(it);
   }
+
+  if(wanted)
+    g_hash_table_destroy(wanted);
+  else
+    _lazy_remember(dev, res);
+
   return res;
 }
 
+dt_iop_module_t *dt_iop_get_or_load_module(dt_develop_t *dev, const char *op)
+{
+  for(GList *m = dev->iop; m; m = g_list_next(m))
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)m->data;
+    if(!strcmp(module->op, op)) return module;
+  }
+
+  for(GList *iop = darktable.iop; iop; iop = g_list_next(iop))
+  {
+    dt_iop_module_so_t *module_so = (dt_iop_module_so_t *)iop->data;
+    if(strcmp(module_so->op, op)) continue;
+
+    dt_iop_module_t *module = (dt_iop_module_t *)calloc(1, sizeof(dt_iop_module_t));
+    if(!module) return NULL;
+    if(dt_iop_load_module_by_so(module, module_so, dev))
+    {
+      free(module);
+      return NULL;
+    }
+    module->data = module_so->data;
+    module->so = module_so;
+    dt_iop_reload_defaults(module);
+    module->instance = dev->iop_instance++;
+    module->multi_name[0] = '\0';
+    dev->iop = g_list_insert_sorted(dev->iop, module, sort_plugins);
+    return module;
+  }
+  return NULL;
+}
+
 void dt_iop_cleanup_module(dt_iop_module_t *module)
 {
   module->cleanup(module);
@@ -1475,6 +1617,10 @@ void dt_iop_unload_modules_so()
     free(darktable.iop->data);
     darktable.iop = g_list_delete_link(darktable.iop, darktable.iop);
   }
+
+  g_hash_table_destroy(_lazy_enabled);
+  _lazy_enabled = NULL;
+  dt_pthread_mutex_destroy(&_lazy_lock);
 }
 
 void dt_iop_commit_params(dt_iop_module_t *module, dt_iop_params_t *params,
@@ -94,6 +94,23 @@ typedef enum dt_iop_flags_t
   IOP_FLAGS_NO_MASKS = 1 << 10         // The module doesn't support masks (used with SUPPORT_BLENDING)
 } dt_iop_flags_t;
 
+/** the raw stage modules which only touch one pixel at a time can be run as a single pass over the sensor
+ * data, see fuse_raw() in iop_api.h. they fold their work into these tables, which repeat with the cfa
+ * (bayer filters repeat every 8x2, x-trans every 6x6, both in output coordinates), and the pipe computes
+ *   out = MIN(clip, (in - sub) / div * mul)
+ * which gives the same floats as running them one after the other. */
+#define DT_IOP_FUSED_RAW_ROWS 24
+#define DT_IOP_FUSED_RAW_COLS 6
+
+typedef struct dt_iop_fused_raw_t
+{
+  int x, y; // offset of the first output pixel in the input buffer
+  float sub[DT_IOP_FUSED_RAW_ROWS][DT_IOP_FUSED_RAW_COLS];
+  float div[DT_IOP_FUSED_RAW_ROWS][DT_IOP_FUSED_RAW_COLS];
+  float mul[DT_IOP_FUSED_RAW_ROWS][DT_IOP_FUSED_RAW_COLS];
+  float clip[DT_IOP_FUSED_RAW_ROWS][DT_IOP_FUSED_RAW_COLS];
+} dt_iop_fused_raw_t;
+
 /** status of a module*/
 typedef enum dt_iop_module_state_t
 {
@@ -233,6 +250,10 @@ typedef struct dt_iop_module_so_t
   int (*distort_backtransform)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                                float *points, size_t points_count);
 
+  int (*fuse_raw)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                  struct dt_iop_fused_raw_t *fused, const struct dt_iop_roi_t *const roi_in,
+                  const struct dt_iop_roi_t *const roi_out);
+
   // introspection related callbacks
   gboolean have_introspection;
   dt_introspection_t *(*get_introspection)();
@@ -446,6 +467,11 @@ typedef struct dt_iop_module_t
   int (*distort_backtransform)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                                float *points, size_t points_count);
 
+  /** fold the per pixel work of a raw stage module into one pass, NULL if it can't. */
+  int (*fuse_raw)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                  struct dt_iop_fused_raw_t *fused, const struct dt_iop_roi_t *const roi_in,
+                  const struct dt_iop_roi_t *const roi_out);
+
   /** Key accelerator registration callbacks */
   void (*connect_key_accels)(struct dt_iop_module_t *self);
   void (*original_connect_key_accels)(struct dt_iop_module_t *self);
@@ -466,8 +492,11 @@ void dt_iop_load_modules_so();
 void dt_iop_unload_modules_so();
 /** load a module for a given .so */
 int dt_iop_load_module_by_so(dt_iop_module_t *module, dt_iop_module_so_t *so, struct dt_develop_t *dev);
-/** returns a list of instances referencing stuff loaded in load_modules_so. */
+/** returns a list of instances referencing stuff loaded in load_modules_so. without gui only the modules the
+ * image can use are instantiated, see dt_iop_get_or_load_module(). */
 GList *dt_iop_load_modules(struct dt_develop_t *dev);
+/** returns the first instance of op in dev, instantiating it if dt_iop_load_modules() left it out. */
+dt_iop_module_t *dt_iop_get_or_load_module(struct dt_develop_t *dev, const char *op);
 int dt_iop_load_module(dt_iop_module_t *module, dt_iop_module_so_t *module_so, struct dt_develop_t *dev);
 gint sort_plugins(gconstpointer a, gconstpointer b);
 /** calls module->cleanup and closes the dl connection. */
@@ -1743,6 +1743,83 @@ void dt_iop_clip_and_zoom_demosaic_third_size_xtrans_f(float *out, const float *
   }
 }
 
+int dt_iop_clip_and_zoom_demosaic_binned_size(const dt_iop_roi_t *const roi_out, const uint32_t filters)
+{
+  const float px_footprint = 1.f / roi_out->scale;
+  // the largest whole number of CFA cells which still fits into one output pixel
+  const int cell = (filters == 9u) ? 3 : 2;
+  if(px_footprint >= 2 * cell) return 2 * cell;
+  if(px_footprint >= cell) return cell;
+  return 0;
+}
+
+void dt_iop_clip_and_zoom_demosaic_binned_f(float *out, const float *const in, const dt_iop_roi_t *const roi_out,
+                                            const dt_iop_roi_t *const roi_in, const int32_t out_stride,
+                                            const int32_t in_stride, const uint32_t filters,
+                                            const uint8_t (*const xtrans)[6])
+{
+  const int bin = dt_iop_clip_and_zoom_demosaic_binned_size(roi_out, filters);
+
+  // first pass: collapse every bin x bin block of the mosaic into one rgb pixel, reading the input once, row by
+  // row. the last row and column of blocks are padded so the binned image covers all of roi_in and keeps its
+  // scale. darktable-bench-demosaic compares this with the half/third size path.
+  dt_iop_roi_t roi_bin = *roi_in;
+  roi_bin.x = roi_bin.y = 0;
+  roi_bin.width = bin ? (roi_in->width + bin - 1) / bin : 0;
+  roi_bin.height = bin ? (roi_in->height + bin - 1) / bin : 0;
+  roi_bin.scale = roi_in->scale / MAX(bin, 1);
+
+  float *const binned = (bin && roi_in->width >= bin && roi_in->height >= bin)
+                            ? dt_alloc_align(64, (size_t)4 * roi_bin.width * roi_bin.height * sizeof(float))
+                            : NULL;
+  if(!binned)
+  {
+    // not small enough for binning, roi_in smaller than one block or out of memory: keep the old behaviour
+    if(filters == 9u)
+      dt_iop_clip_and_zoom_demosaic_third_size_xtrans_f(out, in, roi_out, roi_in, out_stride, in_stride, xtrans);
+    else
+      dt_iop_clip_and_zoom_demosaic_half_size_f(out, in, roi_out, roi_in, out_stride, in_stride, filters);
+    return;
+  }
+
+  // the colour of every pixel is taken from the pattern and each channel is averaged over its own count, so a
+  // block doesn't have to start on a cell boundary. all but the padded ones do; those are moved inside the image
+  // and may start on any pixel, and any bin x bin window still has all colours.
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int by = 0; by < roi_bin.height; by++)
+  {
+    float *outb = binned + (size_t)4 * roi_bin.width * by;
+    for(int bx = 0; bx < roi_bin.width; bx++, outb += 4)
+    {
+      float sum[4] = { 0.0f };
+      int num[4] = { 0 };
+      const int j0 = MIN(by * bin, roi_in->height - bin);
+      const int i0 = MIN(bx * bin, roi_in->width - bin);
+      for(int j = j0; j < j0 + bin; j++)
+      {
+        const float *const inrow = in + (size_t)in_stride * j;
+        for(int i = i0; i < i0 + bin; i++)
+        {
+          const int c = (filters == 9u) ? FCxtrans(j, i, roi_in, xtrans) : FC(j, i, filters);
+          sum[c] += inrow[i];
+          num[c]++;
+        }
+      }
+      // cygm/rgbe are not handled by the binning, second green joins the first one
+      sum[1] += sum[3];
+      num[1] += num[3];
+      for(int c = 0; c < 3; c++) outb[c] = num[c] ? sum[c] / num[c] : 0.0f;
+      outb[3] = 0.0f;
+    }
+  }
+
+  // second pass: resample the small rgb image to the requested roi
+  dt_iop_clip_and_zoom_roi(out, binned, roi_out, &roi_bin, out_stride, roi_bin.width);
+  dt_free_align(binned);
+}
+
 void dt_iop_RGB_to_YCbCr(const float *rgb, float *yuv)
 {
   yuv[0] = 0.299 * rgb[0] + 0.587 * rgb[1] + 0.114 * rgb[2];
@@ -91,6 +91,18 @@ void dt_iop_clip_and_zoom_demosaic_third_size_xtrans_f(float *out, const float *
                                                        const int32_t out_stride, const int32_t in_stride,
                                                        const uint8_t (*const xtrans)[6]);
 
+/** downscaling demosaic for preview and thumbnail pipes: bins 2x2/4x4 bayer or 3x3/6x6 x-trans cells into rgb
+ * and resamples the result to roi_out. falls back to the half/third size functions above for scales where a
+ * single cell is larger than an output pixel. */
+void dt_iop_clip_and_zoom_demosaic_binned_f(float *out, const float *const in,
+                                            const struct dt_iop_roi_t *const roi_out,
+                                            const struct dt_iop_roi_t *const roi_in, const int32_t out_stride,
+                                            const int32_t in_stride, const uint32_t filters,
+                                            const uint8_t (*const xtrans)[6]);
+
+/** edge length of the cfa blocks dt_iop_clip_and_zoom_demosaic_binned_f() would use, 0 if it can't bin */
+int dt_iop_clip_and_zoom_demosaic_binned_size(const struct dt_iop_roi_t *const roi_out, const uint32_t filters);
+
 /** as dt_iop_clip_and_zoom, but for rgba 8-bit channels. */
 void dt_iop_clip_and_zoom_8(const uint8_t *i, int32_t ix, int32_t iy, int32_t iw, int32_t ih, int32_t ibw,
                             int32_t ibh, uint8_t *o, int32_t ox, int32_t oy, int32_t ow, int32_t oh,
@@ -22,6 +22,7 @@
 #include "common/histogram.h"
 #include "common/imageio.h"
 #include "common/opencl.h"
+#include "common/threadpool.h"
 #include "control/control.h"
 #include "control/signal.h"
 #include "develop/blend.h"
@@ -61,6 +62,7 @@ typedef enum dt_pixelpipe_picker_source_t
 } dt_pixelpipe_picker_source_t;
 
 #include "develop/pixelpipe_cache.c"
+#include "develop/pixelpipe_pool.c"
 
 static void get_output_format(dt_iop_module_t *module, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece,
                               dt_develop_t *dev, dt_iop_buffer_dsc_t *dsc);
@@ -137,6 +139,7 @@ int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t
   pipe->processed_height = pipe->backbuf_height = pipe->iheight = 0;
   pipe->nodes = NULL;
   pipe->backbuf_size = size;
+  dt_dev_pixelpipe_pool_init(&pipe->pool);
   if(!dt_dev_pixelpipe_cache_init(&(pipe->cache), entries, pipe->backbuf_size)) return 0;
   pipe->cache_obsolete = 0;
   pipe->backbuf = NULL;
@@ -184,6 +187,7 @@ void dt_dev_pixelpipe_cleanup(dt_dev_pixelpipe_t *pipe)
   dt_dev_pixelpipe_cleanup_nodes(pipe);
   // so now it's safe to clean up cache:
   dt_dev_pixelpipe_cache_cleanup(&(pipe->cache));
+  dt_dev_pixelpipe_pool_cleanup(&pipe->pool);
   dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
   dt_pthread_mutex_destroy(&(pipe->backbuf_mutex));
   dt_pthread_mutex_destroy(&(pipe->busy_mutex));
@@ -214,6 +218,8 @@ void dt_dev_pixelpipe_cleanup_nodes(dt_dev_pixelpipe_t *pipe)
   }
   g_list_free(pipe->nodes);
   pipe->nodes = NULL;
+  // the next nodes are likely for another image, with other sizes
+  dt_dev_pixelpipe_pool_trim(&pipe->pool);
   dt_pthread_mutex_unlock(&pipe->busy_mutex);
 }
 
@@ -385,12 +391,35 @@ static void histogram_collect(dt_dev_pixelpipe_iop_t *piece, const void *pixel,
 #ifdef HAVE_OPENCL
 // helper to get per module histogram for OpenCL
 //
-// this algorithm is inefficient as hell when it comes to larger images. it's only acceptable
-// as long as we work on small image sizes like in image preview
+// the bins are collected on the device if possible. otherwise the image gets copied back to the host,
+// which is inefficient as hell when it comes to larger images. it's only acceptable as long as we work
+// on small image sizes like in image preview
 static void histogram_collect_cl(int devid, dt_dev_pixelpipe_iop_t *piece, cl_mem img,
                                  const dt_iop_roi_t *roi, uint32_t **histogram, uint32_t *histogram_max,
                                  float *buffer, size_t bufsize)
 {
+  dt_dev_histogram_collection_params_t histogram_params = piece->histogram_params;
+
+  dt_histogram_roi_t histogram_roi;
+
+  // if the current module does did not specified its own ROI, use the full ROI
+  if(histogram_params.roi == NULL)
+  {
+    histogram_roi = (dt_histogram_roi_t){
+      .width = roi->width, .height = roi->height, .crop_x = 0, .crop_y = 0, .crop_width = 0, .crop_height = 0
+    };
+
+    histogram_params.roi = &histogram_roi;
+  }
+
+  const dt_iop_colorspace_type_t cst = dt_iop_module_colorspace(piece->module);
+
+  if(dt_histogram_helper_cl(devid, &histogram_params, &piece->histogram_stats, cst, img, histogram))
+  {
+    dt_histogram_max_helper(&piece->histogram_stats, cst, histogram, histogram_max);
+    return;
+  }
+
   float *tmpbuf = NULL;
   float *pixel;
 
@@ -409,22 +438,6 @@ static void histogram_collect_cl(int devid, dt_dev_pixelpipe_iop_t *piece, cl_me
     return;
   }
 
-  dt_dev_histogram_collection_params_t histogram_params = piece->histogram_params;
-
-  dt_histogram_roi_t histogram_roi;
-
-  // if the current module does did not specified its own ROI, use the full ROI
-  if(histogram_params.roi == NULL)
-  {
-    histogram_roi = (dt_histogram_roi_t){
-      .width = roi->width, .height = roi->height, .crop_x = 0, .crop_y = 0, .crop_width = 0, .crop_height = 0
-    };
-
-    histogram_params.roi = &histogram_roi;
-  }
-
-  const dt_iop_colorspace_type_t cst = dt_iop_module_colorspace(piece->module);
-
   dt_histogram_helper(&histogram_params, &piece->histogram_stats, cst, pixel, histogram);
   dt_histogram_max_helper(&piece->histogram_stats, cst, histogram, histogram_max);
 
@@ -576,6 +589,244 @@ error:
 #endif
 
 
+// pipes processing right now. they split the cores between their openmp teams and their loops in the pool.
+static int _pipes_running = 0;
+
+// this pipe's share of the cores. updated before every module, so a pipe that started alone gives some of them
+// up when others start, and takes them back when they are done.
+static void _pipe_share_cores()
+{
+#ifdef _OPENMP
+  const int running = MAX(__sync_fetch_and_add(&_pipes_running, 0), 1);
+  omp_set_num_threads(MAX(darktable.num_openmp_threads / running, 1));
+#endif
+}
+
+static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
+                                        void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
+                                        const dt_iop_roi_t *roi_out, GList *modules, GList *pieces, int pos);
+
+#define FUSED_RAW_MAX_MODULES 8
+
+/** a run of raw stage modules which is processed as one pass, see fuse_raw() in iop_api.h */
+typedef struct dt_fused_raw_chain_t
+{
+  int count;
+  dt_iop_module_t *module[FUSED_RAW_MAX_MODULES]; // in pipe order
+  dt_dev_pixelpipe_iop_t *piece[FUSED_RAW_MAX_MODULES];
+  dt_iop_roi_t roi[FUSED_RAW_MAX_MODULES + 1];    // roi[k] is the input of module k, roi[count] the output
+  GList *modules, *pieces;                        // the node in front of the run
+  int pos;
+} dt_fused_raw_chain_t;
+
+// collects the modules ending at the current one which can be fused. returns the number of them, 0 if there
+// are less than two. nothing may look at the buffers in between, so this only happens on cpu, without masks,
+// blending or histograms, and for export and thumbnail pipes. call with busy_mutex held.
+static int _fused_raw_chain(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, const dt_iop_roi_t *roi_out,
+                            GList *modules, GList *pieces, int pos, dt_fused_raw_chain_t *chain)
+{
+  chain->count = 0;
+
+  if(!(pipe->type & (DT_DEV_PIXELPIPE_EXPORT | DT_DEV_PIXELPIPE_THUMBNAIL))) return 0;
+  if(pipe->mask_display != DT_DEV_PIXELPIPE_DISPLAY_NONE) return 0;
+  if(!pipe->image.buf_dsc.filters || pipe->image.buf_dsc.channels != 1) return 0;
+#ifdef HAVE_OPENCL
+  if(dt_opencl_is_inited() && pipe->opencl_enabled && pipe->devid >= 0) return 0;
+#endif
+
+  // walk backwards, n counts from the current module on
+  dt_iop_module_t *module[FUSED_RAW_MAX_MODULES];
+  dt_dev_pixelpipe_iop_t *piece[FUSED_RAW_MAX_MODULES];
+  dt_iop_roi_t roi[FUSED_RAW_MAX_MODULES + 1];
+  GList *front_modules[FUSED_RAW_MAX_MODULES], *front_pieces[FUSED_RAW_MAX_MODULES];
+  int front_pos[FUSED_RAW_MAX_MODULES];
+  int n = 0;
+
+  roi[0] = *roi_out;
+  for(; modules && n < FUSED_RAW_MAX_MODULES;
+      modules = g_list_previous(modules), pieces = g_list_previous(pieces), pos--)
+  {
+    dt_iop_module_t *m = (dt_iop_module_t *)modules->data;
+    dt_dev_pixelpipe_iop_t *p = (dt_dev_pixelpipe_iop_t *)pieces->data;
+    if(!p->enabled || (dev->gui_module && dev->gui_module->operation_tags_filter() & m->operation_tags()))
+      continue;
+
+    if(!m->fuse_raw || (p->request_histogram & DT_REQUEST_ON)
+       || (p->blendop_data
+           && ((dt_develop_blend_params_t *)p->blendop_data)->mask_mode != DEVELOP_MASK_DISABLED)
+       || !m->fuse_raw(m, p, NULL, NULL, NULL))
+      break;
+
+    module[n] = m;
+    piece[n] = p;
+    m->modify_roi_in(m, p, &roi[n], &roi[n + 1]);
+    front_modules[n] = g_list_previous(modules);
+    front_pieces[n] = g_list_previous(pieces);
+    front_pos[n] = pos - 1;
+    n++;
+  }
+
+  // only the first module of the run may crop its input
+  for(int k = 0; k < n - 1; k++)
+    if(memcmp(&roi[k], &roi[k + 1], sizeof(dt_iop_roi_t)))
+    {
+      n = k + 1;
+      break;
+    }
+
+  if(n < 2) return 0;
+
+  chain->count = n;
+  for(int k = 0; k < n; k++)
+  {
+    chain->module[k] = module[n - 1 - k];
+    chain->piece[k] = piece[n - 1 - k];
+  }
+  for(int k = 0; k <= n; k++) chain->roi[k] = roi[n - k];
+  chain->modules = front_modules[n - 1];
+  chain->pieces = front_pieces[n - 1];
+  chain->pos = front_pos[n - 1];
+  return n;
+}
+
+typedef struct _fused_raw_rows_t
+{
+  const dt_iop_fused_raw_t *fused;
+  const void *ivoid;
+  int in_uint16;
+  int in_width;
+  float *out;
+  int out_width;
+} _fused_raw_rows_t;
+
+// out = MIN(clip, (in - sub) / div * mul), row by row so the tables stay in cache.
+static void _fused_raw_rows(const size_t j0, const size_t j1, void *data)
+{
+  const _fused_raw_rows_t *const d = (const _fused_raw_rows_t *)data;
+  const dt_iop_fused_raw_t *const fused = d->fused;
+  const int width = d->out_width;
+
+  for(size_t j = j0; j < j1; j++)
+  {
+    const int r = j % DT_IOP_FUSED_RAW_ROWS;
+    const float *const sub = fused->sub[r];
+    const float *const div = fused->div[r];
+    const float *const mul = fused->mul[r];
+    const float *const clip = fused->clip[r];
+    const size_t pin = (size_t)d->in_width * (j + fused->y) + fused->x;
+    float *const o = d->out + j * width;
+
+    if(d->in_uint16)
+    {
+      const uint16_t *const in = (const uint16_t *)d->ivoid + pin;
+      for(int i = 0, c = 0; i < width; i++, c = (c + 1 == DT_IOP_FUSED_RAW_COLS) ? 0 : c + 1)
+        o[i] = MIN(clip[c], (in[i] - sub[c]) / div[c] * mul[c]);
+    }
+    else
+    {
+      const float *const in = (const float *)d->ivoid + pin;
+      for(int i = 0, c = 0; i < width; i++, c = (c + 1 == DT_IOP_FUSED_RAW_COLS) ? 0 : c + 1)
+        o[i] = MIN(clip[c], (in[i] - sub[c]) / div[c] * mul[c]);
+    }
+  }
+}
+
+static void _fused_raw_process(const dt_iop_fused_raw_t *const fused, const void *const ivoid,
+                               const int in_uint16, const int in_width, float *const out,
+                               const dt_iop_roi_t *const roi_out)
+{
+  _fused_raw_rows_t d = { fused, ivoid, in_uint16, in_width, out, roi_out->width };
+  dt_parallel_for(0, roi_out->height, 0, _fused_raw_rows, &d);
+}
+
+// memcpy() of whole rows between two buffers
+typedef struct _copy_rows_t
+{
+  char *out;
+  const char *in;
+  size_t out_stride, in_stride, bytes;
+} _copy_rows_t;
+
+static void _copy_rows(const size_t j0, const size_t j1, void *data)
+{
+  const _copy_rows_t *const d = (const _copy_rows_t *)data;
+  for(size_t j = j0; j < j1; j++) memcpy(d->out + j * d->out_stride, d->in + j * d->in_stride, d->bytes);
+}
+
+// runs a chain found by _fused_raw_chain() in place of the last module of it. the modules in between don't get
+// cache lines of their own, which is fine for the pipes this is used on.
+static int _process_fused_raw(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
+                              dt_iop_buffer_dsc_t **out_format, const dt_iop_roi_t *roi_out,
+                              const dt_fused_raw_chain_t *chain, const uint64_t hash, const size_t bufsize)
+{
+  void *input = NULL;
+  void *cl_mem_input = NULL;
+  dt_iop_buffer_dsc_t _input_format = { 0 };
+  dt_iop_buffer_dsc_t *input_format = &_input_format;
+
+  if(dt_dev_pixelpipe_process_rec(pipe, dev, &input, &cl_mem_input, &input_format, &chain->roi[0],
+                                  chain->modules, chain->pieces, chain->pos))
+    return 1;
+
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->shutdown)
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 1;
+  }
+
+  dt_times_t start;
+  dt_get_times(&start);
+
+  dt_iop_fused_raw_t fused;
+  fused.x = fused.y = 0;
+  for(int j = 0; j < DT_IOP_FUSED_RAW_ROWS; j++)
+    for(int i = 0; i < DT_IOP_FUSED_RAW_COLS; i++)
+    {
+      fused.sub[j][i] = 0.0f;
+      fused.div[j][i] = 1.0f;
+      fused.mul[j][i] = 1.0f;
+      fused.clip[j][i] = INFINITY;
+    }
+
+  // same sequence of formats as if the modules ran one by one
+  const int in_uint16 = input_format->datatype == TYPE_UINT16;
+  dt_iop_buffer_dsc_t dsc = *input_format;
+  for(int k = 0; k < chain->count; k++)
+  {
+    dt_iop_module_t *module = chain->module[k];
+    dt_dev_pixelpipe_iop_t *piece = chain->piece[k];
+    piece->dsc_out = piece->dsc_in = dsc;
+    module->output_format(module, pipe, piece, &piece->dsc_out);
+    pipe->dsc = piece->dsc_out;
+    module->fuse_raw(module, piece, &fused, &chain->roi[k], &chain->roi[k + 1]);
+    dsc = piece->dsc_out = pipe->dsc;
+  }
+  **out_format = dsc;
+
+  (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format);
+
+  _fused_raw_process(&fused, input, in_uint16, chain->roi[0].width, (float *)*output, roi_out);
+
+  if(darktable.unmuted & DT_DEBUG_PERF)
+  {
+    GString *labels = g_string_new(NULL);
+    for(int k = 0; k < chain->count; k++)
+    {
+      gchar *label = dt_history_item_get_name(chain->module[k]);
+      g_string_append_printf(labels, "%s%s", k ? ", " : "", label);
+      g_free(label);
+    }
+    dt_show_times(&start, "[dev_pixelpipe]", "processed `%s' fused on CPU [%s]", labels->str,
+                  _pipe_type_to_str(pipe->type));
+    g_string_free(labels, TRUE);
+  }
+
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  return 0;
+}
+
+
 // recursive helper for process:
 static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
                                         void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
@@ -670,13 +921,10 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
           const int cp_width = MIN(roi_out->width, pipe->iwidth - in_x);
           const int cp_height = MIN(roi_out->height, pipe->iheight - in_y);
 
-#ifdef _OPENMP
-#pragma omp parallel for schedule(static) default(none) shared(pipe, roi_out, roi_in, output)
-#endif
-          for(int j = 0; j < cp_height; j++)
-            memcpy(((char *)*output) + (size_t)bpp * j * roi_out->width,
-                   ((char *)pipe->input) + (size_t)bpp * (in_x + (in_y + j) * pipe->iwidth),
-                   (size_t)bpp * cp_width);
+          const char *const base = (char *)pipe->input + (size_t)bpp * (in_x + (size_t)in_y * pipe->iwidth);
+          _copy_rows_t rows = { (char *)*output, base, (size_t)bpp * roi_out->width, (size_t)bpp * pipe->iwidth,
+                                (size_t)bpp * cp_width };
+          dt_parallel_for(0, MAX(cp_height, 0), 0, _copy_rows, &rows);
         }
         else
         {
@@ -706,8 +954,14 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
       return 1;
     }
     module->modify_roi_in(module, piece, roi_out, &roi_in);
+
+    // can this and the modules in front of it go in one pass?
+    dt_fused_raw_chain_t chain;
+    const int fused = _fused_raw_chain(pipe, dev, roi_out, modules, pieces, pos, &chain);
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
 
+    if(fused) return _process_fused_raw(pipe, dev, output, out_format, roi_out, &chain, hash, bufsize);
+
     // recurse to get actual data of input buffer
 
     dt_iop_buffer_dsc_t _input_format = { 0 };
@@ -719,6 +973,8 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
                                     g_list_previous(modules), g_list_previous(pieces), pos - 1))
       return 1;
 
+    _pipe_share_cores();
+
     const size_t in_bpp = dt_iop_buffer_dsc_to_bpp(input_format);
 
     piece->dsc_out = piece->dsc_in = *input_format;
@@ -772,22 +1028,14 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
       }
       else
       {
-#ifdef _OPENMP
-#pragma omp parallel for schedule(static) default(none) shared(roi_out, roi_in, output, input)
-#endif
-        for(int j = 0; j < roi_out->height; j++)
-            memcpy(((char *)*output) + (size_t)out_bpp * j * roi_out->width,
-                   ((char *)input) + (size_t)in_bpp * j * roi_in.width,
-                   (size_t)in_bpp * roi_in.width);
+        _copy_rows_t rows = { (char *)*output, (const char *)input, (size_t)out_bpp * roi_out->width,
+                              (size_t)in_bpp * roi_in.width, (size_t)in_bpp * roi_in.width };
+        dt_parallel_for(0, roi_out->height, 0, _copy_rows, &rows);
       }
 #else // don't HAVE_OPENCL
-#ifdef _OPENMP
-#pragma omp parallel for schedule(static) default(none) shared(roi_out, roi_in, output, input)
-#endif
-      for(int j = 0; j < roi_out->height; j++)
-            memcpy(((char *)*output) + (size_t)out_bpp * j * roi_out->width,
-                   ((char *)input) + (size_t)in_bpp * j * roi_in.width,
-                   (size_t)in_bpp * roi_in.width);
+      _copy_rows_t rows = { (char *)*output, (const char *)input, (size_t)out_bpp * roi_out->width,
+                            (size_t)in_bpp * roi_in.width, (size_t)in_bpp * roi_in.width };
+      dt_parallel_for(0, roi_out->height, 0, _copy_rows, &rows);
 #endif
 
       dt_pthread_mutex_unlock(&pipe->busy_mutex);
@@ -2246,6 +2494,14 @@ int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x,
                              float scale)
 {
   pipe->processing = 1;
+  // the darkroom's pipes go first when they share the workers with thumbnails and export
+  const dt_task_priority_t priority = dt_threadpool_set_priority(
+      (pipe->type & (DT_DEV_PIXELPIPE_FULL | DT_DEV_PIXELPIPE_PREVIEW)) ? DT_TASK_INTERACTIVE : DT_TASK_BACKGROUND);
+  const int pipe_thread = dt_alloc_set_pipe_thread(1);
+#ifdef _OPENMP
+  const int omp_threads = omp_get_max_threads();
+#endif
+  __sync_fetch_and_add(&_pipes_running, 1);
   pipe->opencl_enabled = dt_opencl_update_settings(); // update enabled flag and profile from preferences
   pipe->devid = (pipe->opencl_enabled) ? dt_opencl_lock_device(pipe->type)
                                        : -1; // try to get/lock opencl resource
@@ -2337,6 +2593,12 @@ restart:
   // ... and in case of other errors ...
   if(err)
   {
+    __sync_fetch_and_sub(&_pipes_running, 1);
+#ifdef _OPENMP
+    omp_set_num_threads(omp_threads);
+#endif
+    dt_alloc_set_pipe_thread(pipe_thread);
+    dt_threadpool_set_priority(priority);
     pipe->processing = 0;
     return 1;
   }
@@ -2349,7 +2611,15 @@ restart:
   pipe->backbuf_height = height;
   dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
 
+  if(darktable.unmuted & DT_DEBUG_MEMORY) dt_dev_pixelpipe_pool_print(&pipe->pool, _pipe_type_to_str(pipe->type));
+
   // printf("pixelpipe homebrew process end\n");
+  __sync_fetch_and_sub(&_pipes_running, 1);
+#ifdef _OPENMP
+  omp_set_num_threads(omp_threads);
+#endif
+  dt_alloc_set_pipe_thread(pipe_thread);
+  dt_threadpool_set_priority(priority);
   pipe->processing = 0;
   return 0;
 }
@@ -24,6 +24,7 @@
 #include "develop/develop.h"
 #include "develop/imageop.h"
 #include "develop/pixelpipe_cache.h"
+#include "develop/pixelpipe_pool.h"
 
 /**
  * struct used by iop modules to connect to pixelpipe.
@@ -82,6 +83,8 @@ typedef struct dt_dev_pixelpipe_t
   dt_dev_pixelpipe_cache_t cache;
   // set to non-zero in order to obsolete old cache entries on next pixelpipe run
   int cache_obsolete;
+  // scratch memory for the modules, see dt_dev_pixelpipe_pool_alloc()
+  dt_dev_pixelpipe_pool_t pool;
   // input buffer
   float *input;
   // width and height of input buffer
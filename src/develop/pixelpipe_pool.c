@@ -0,0 +1,184 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "develop/pixelpipe_pool.h"
+#include "common/darktable.h"
+#include "develop/tiling.h"
+#include <stdlib.h>
+
+typedef struct _pool_block_t
+{
+  void *mem;
+  size_t size;
+  int used;
+} _pool_block_t;
+
+// a free block is good for a request if it isn't more than half again as large
+#define POOL_SLACK(size) ((size) + (size) / 2)
+
+// bytes in the free blocks of all pools. the pipes share one budget for them, and tiling plans without them.
+static size_t _pool_idle = 0;
+
+// a quarter of what tiling may use. without a limit there, a sixteenth of the physical memory.
+static size_t _pool_budget()
+{
+  static size_t budget = 0;
+  if(!budget)
+  {
+    const size_t limit = (size_t)dt_tiling_host_memory_limit() * 1024 * 1024;
+    const size_t total = dt_get_total_memory() * 1024;
+    budget = limit ? limit / 4 : total ? total / 16 : (size_t)512 * 1024 * 1024;
+  }
+  return budget;
+}
+
+size_t dt_dev_pixelpipe_pool_idle()
+{
+  return __sync_fetch_and_add(&_pool_idle, 0);
+}
+
+void dt_dev_pixelpipe_pool_init(dt_dev_pixelpipe_pool_t *pool)
+{
+  dt_pthread_mutex_init(&pool->lock, NULL);
+  pool->blocks = NULL;
+  pool->held = pool->in_use = pool->peak = 0;
+  pool->requests = pool->reused = 0;
+}
+
+static void _pool_release(dt_dev_pixelpipe_pool_t *pool, GList *l)
+{
+  _pool_block_t *b = (_pool_block_t *)l->data;
+  pool->held -= b->size;
+  if(!b->used) __sync_fetch_and_sub(&_pool_idle, b->size);
+  dt_free_align(b->mem);
+  free(b);
+  pool->blocks = g_list_delete_link(pool->blocks, l);
+}
+
+void dt_dev_pixelpipe_pool_cleanup(dt_dev_pixelpipe_pool_t *pool)
+{
+  // modules are done by now, so whatever is still in use has been leaked by one of them
+  while(pool->blocks) _pool_release(pool, pool->blocks);
+  pool->in_use = 0;
+  dt_pthread_mutex_destroy(&pool->lock);
+}
+
+void *dt_dev_pixelpipe_pool_alloc(dt_dev_pixelpipe_pool_t *pool, const size_t size)
+{
+  dt_pthread_mutex_lock(&pool->lock);
+  pool->requests++;
+
+  // smallest free block that fits
+  _pool_block_t *best = NULL;
+  for(GList *l = pool->blocks; l; l = g_list_next(l))
+  {
+    _pool_block_t *b = (_pool_block_t *)l->data;
+    if(!b->used && b->size >= size && b->size <= POOL_SLACK(size) && (!best || b->size < best->size)) best = b;
+  }
+
+  if(best)
+  {
+    pool->reused++;
+    __sync_fetch_and_sub(&_pool_idle, best->size);
+  }
+  else
+  {
+    void *mem = dt_alloc_align(64, size);
+    best = mem ? (_pool_block_t *)malloc(sizeof(_pool_block_t)) : NULL;
+    if(!best)
+    {
+      dt_free_align(mem);
+      dt_pthread_mutex_unlock(&pool->lock);
+      return NULL;
+    }
+    best->mem = mem;
+    best->size = size;
+    pool->blocks = g_list_prepend(pool->blocks, best);
+    pool->held += size;
+  }
+
+  best->used = 1;
+  pool->in_use += best->size;
+  pool->peak = MAX(pool->peak, pool->in_use);
+  void *mem = best->mem;
+  dt_pthread_mutex_unlock(&pool->lock);
+  return mem;
+}
+
+void dt_dev_pixelpipe_pool_free(dt_dev_pixelpipe_pool_t *pool, void *mem)
+{
+  if(!mem) return;
+
+  dt_pthread_mutex_lock(&pool->lock);
+  GList *l = pool->blocks;
+  while(l && ((_pool_block_t *)l->data)->mem != mem) l = g_list_next(l);
+  if(!l)
+  {
+    dt_pthread_mutex_unlock(&pool->lock);
+    dt_free_align(mem);
+    return;
+  }
+
+  _pool_block_t *b = (_pool_block_t *)l->data;
+  b->used = 0;
+  pool->in_use -= b->size;
+  __sync_fetch_and_add(&_pool_idle, b->size);
+
+  // stay within the budget, dropping our largest free blocks first
+  const size_t budget = _pool_budget();
+  while(dt_dev_pixelpipe_pool_idle() > budget)
+  {
+    GList *largest = NULL;
+    for(GList *k = pool->blocks; k; k = g_list_next(k))
+      if(!((_pool_block_t *)k->data)->used
+         && (!largest || ((_pool_block_t *)k->data)->size > ((_pool_block_t *)largest->data)->size))
+        largest = k;
+    if(!largest) break;
+    _pool_release(pool, largest);
+  }
+  dt_pthread_mutex_unlock(&pool->lock);
+}
+
+void dt_dev_pixelpipe_pool_trim(dt_dev_pixelpipe_pool_t *pool)
+{
+  dt_pthread_mutex_lock(&pool->lock);
+  GList *l = pool->blocks;
+  while(l)
+  {
+    GList *next = g_list_next(l);
+    if(!((_pool_block_t *)l->data)->used) _pool_release(pool, l);
+    l = next;
+  }
+  dt_pthread_mutex_unlock(&pool->lock);
+}
+
+void dt_dev_pixelpipe_pool_print(dt_dev_pixelpipe_pool_t *pool, const char *name)
+{
+  dt_pthread_mutex_lock(&pool->lock);
+  dt_print(DT_DEBUG_MEMORY, "[pixelpipe_pool] [%s] %u blocks, %.1f MB held, %.1f MB peak in use, %" PRIu64
+                            " of %" PRIu64 " requests reused\n",
+           name, g_list_length(pool->blocks), pool->held / (1024.0 * 1024.0), pool->peak / (1024.0 * 1024.0),
+           pool->reused, pool->requests);
+  dt_pthread_mutex_unlock(&pool->lock);
+}
+
+#undef POOL_SLACK
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
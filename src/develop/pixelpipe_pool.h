@@ -0,0 +1,63 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/dtpthread.h"
+#include <glib.h>
+#include <inttypes.h>
+#include <stddef.h>
+
+/**
+ * scratch memory for the modules of one pipe. blocks given back are kept for later requests of about the same
+ * size, also in later runs of the pipe. the free blocks of all pools share a budget of a quarter of the host
+ * memory limit, and tiling takes them off the memory it plans with.
+ */
+typedef struct dt_dev_pixelpipe_pool_t
+{
+  dt_pthread_mutex_t lock;
+  GList *blocks; // free ones and those in use
+  size_t held;   // bytes in all blocks
+  size_t in_use; // bytes handed out right now
+  // profiling:
+  size_t peak; // most bytes handed out at once
+  uint64_t requests;
+  uint64_t reused;
+} dt_dev_pixelpipe_pool_t;
+
+void dt_dev_pixelpipe_pool_init(dt_dev_pixelpipe_pool_t *pool);
+void dt_dev_pixelpipe_pool_cleanup(dt_dev_pixelpipe_pool_t *pool);
+
+/** returns 64 byte aligned memory of at least size bytes, NULL if there is none. */
+void *dt_dev_pixelpipe_pool_alloc(dt_dev_pixelpipe_pool_t *pool, const size_t size);
+
+/** gives mem back to the pool. anything that didn't come from it is freed with dt_free_align(). */
+void dt_dev_pixelpipe_pool_free(dt_dev_pixelpipe_pool_t *pool, void *mem);
+
+/** frees all blocks that are not in use. */
+void dt_dev_pixelpipe_pool_trim(dt_dev_pixelpipe_pool_t *pool);
+
+/** bytes in free blocks of all pools, memory tiling can't count on. */
+size_t dt_dev_pixelpipe_pool_idle();
+
+/** prints size and reuse with -d memory. */
+void dt_dev_pixelpipe_pool_print(dt_dev_pixelpipe_pool_t *pool, const char *name);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
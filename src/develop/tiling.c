@@ -22,6 +22,7 @@
 #include "control/control.h"
 #include "develop/blend.h"
 #include "develop/pixelpipe.h"
+#include "develop/pixelpipe_pool.h"
 
 #include <assert.h>
 #include <math.h>
@@ -612,9 +613,10 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
   /* calculate optimal size of tiles */
   float available = dt_conf_get_float("host_memory_limit") * 1024.0f * 1024.0f;
   assert(available >= 500.0f * 1024.0f * 1024.0f);
-  /* correct for size of ivoid and ovoid which are needed on top of tiling */
+  /* correct for size of ivoid and ovoid which are needed on top of tiling, and for what the pipes keep around */
   available = fmax(available - ((float)roi_out->width * roi_out->height * out_bpp)
-                   - ((float)roi_in->width * roi_in->height * in_bpp) - tiling.overhead,
+                   - ((float)roi_in->width * roi_in->height * in_bpp) - tiling.overhead
+                   - (float)dt_dev_pixelpipe_pool_idle(),
                    0);
 
   /* we ignore the above value if singlebuffer_limit (is defined and) is higher than available/tiling.factor.
@@ -873,9 +875,10 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
   /* calculate optimal size of tiles */
   float available = dt_conf_get_float("host_memory_limit") * 1024.0f * 1024.0f;
   assert(available >= 500.0f * 1024.0f * 1024.0f);
-  /* correct for size of ivoid and ovoid which are needed on top of tiling */
+  /* correct for size of ivoid and ovoid which are needed on top of tiling, and for what the pipes keep around */
   available = fmax(available - ((float)roi_out->width * roi_out->height * out_bpp)
-                   - ((float)roi_in->width * roi_in->height * in_bpp) - tiling.overhead,
+                   - ((float)roi_in->width * roi_in->height * in_bpp) - tiling.overhead
+                   - (float)dt_dev_pixelpipe_pool_idle(),
                    0);
 
   /* we ignore the above value if singlebuffer_limit (is defined and) is higher than available/tiling.factor.
@@ -2055,8 +2058,7 @@ void default_tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpi
   return;
 }
 
-int dt_tiling_piece_fits_host_memory(const size_t width, const size_t height, const unsigned bpp,
-                                     const float factor, const size_t overhead)
+int dt_tiling_host_memory_limit()
 {
   static int host_memory_limit = -1;
 
@@ -2070,7 +2072,15 @@ int dt_tiling_piece_fits_host_memory(const size_t width, const size_t height, co
     dt_conf_set_int("host_memory_limit", host_memory_limit);
   }
 
-  float requirement = factor * width * height * bpp + overhead;
+  return host_memory_limit;
+}
+
+int dt_tiling_piece_fits_host_memory(const size_t width, const size_t height, const unsigned bpp,
+                                     const float factor, const size_t overhead)
+{
+  const int host_memory_limit = dt_tiling_host_memory_limit();
+
+  float requirement = factor * width * height * bpp + overhead + dt_dev_pixelpipe_pool_idle();
 
   if(host_memory_limit == 0 || requirement <= host_memory_limit * 1024.0f * 1024.0f) return TRUE;
 
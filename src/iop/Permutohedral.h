@@ -39,6 +39,18 @@ DAMAGE.
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* atomically add v to *p, for values shared between splatting threads */
+static inline void permutohedral_atomic_add(float *p, const float v)
+{
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
+  *p += v;
+}
 
 /*******************************************************************
  * Hash table implementation for permutohedral lattice             *
@@ -47,40 +59,69 @@ DAMAGE.
  * The key for each point is its spatial location in the (d+1)-    *
  * dimensional space.                                              *
  *                                                                 *
+ * The table is shared by all splatting threads: keys and values   *
+ * live in dense arrays, a slot of the open addressing table is    *
+ * claimed with compare and swap once the key has been written.    *
+ * Growing is not thread safe, inserting stops once the table is   *
+ * half full and the lattice grows it between splatting rounds.    *
+ *                                                                 *
  *******************************************************************/
 template <int KD, int VD> class HashTablePermutohedral
 {
 public:
   /* Constructor
-   *  kd_: the dimensionality of the position vectors on the hyperplane.
-   *  vd_: the dimensionality of the value vectors
+   *  nThreads: the number of threads inserting concurrently. each of them can add up to KD+1
+   *            entries (one splat) after the table reported being full.
    */
-  HashTablePermutohedral()
+  HashTablePermutohedral(int nThreads = 1)
   {
+    margin = (nThreads > 1 ? nThreads : 1) * (KD + 1);
     capacity = 1 << 15;
-    capacity_bits = 0x7fff;
+    while(capacity < 4 * margin) capacity *= 2;
+    capacity_bits = capacity - 1;
     filled = 0;
-    entries = new Entry[capacity];
-    keys = new short[KD * capacity / 2];
-    values = new float[VD * capacity / 2];
-    memset(values, 0, sizeof(float) * VD * capacity / 2);
+    wasted = 0;
+    slots = new int[capacity];
+    memset(slots, 0, sizeof(int) * capacity);
+    keys = new short[KD * entryCapacity()];
+    values = new float[VD * entryCapacity()];
+    memset(values, 0, sizeof(float) * VD * entryCapacity());
   }
 
   ~HashTablePermutohedral()
   {
-    delete[] entries;
+    delete[] slots;
     delete[] keys;
     delete[] values;
   }
 
-  // Returns the number of vectors stored.
-  int size()
+  // Returns the number of entries in the dense arrays. a few of them can be unused, when two threads raced
+  // to insert the same key.
+  int size() const
   {
     return filled;
   }
 
+  // Returns the number of lattice points stored.
+  int points() const
+  {
+    return filled - wasted;
+  }
+
+  // Returns the number of bytes allocated.
+  size_t memoryFootprint() const
+  {
+    return sizeof(int) * capacity + (sizeof(short) * KD + sizeof(float) * VD) * entryCapacity();
+  }
+
+  // Whether inserting has to stop until grow() has been called.
+  bool full() const
+  {
+    return (size_t)__atomic_load_n(&filled, __ATOMIC_RELAXED) >= capacity / 2;
+  }
+
   // Returns a pointer to the keys array.
-  const short *getKeys()
+  const short *getKeys() const
   {
     return keys;
   }
@@ -91,7 +132,7 @@ public:
     return values;
   }
 
-  /* Returns the index into the hash table for a given key.
+  /* Returns the index into the values array for a given key, thread safe as long as no one calls grow().
    *     key: a pointer to the position vector.
    *       h: hash of the position vector.
    *  create: a flag specifying whether an entry should be created,
@@ -99,38 +140,43 @@ public:
    */
   int lookupOffset(const short *key, size_t h, bool create = true)
   {
-
-    // Double hash table size if necessary
-    if(filled >= (capacity / 2) - 1)
-    {
-      grow();
-    }
+    int reserved = -1;
+    h &= capacity_bits;
 
     // Find the entry with the given key
     while(1)
     {
-      Entry e = entries[h];
+      int e = __atomic_load_n(slots + h, __ATOMIC_ACQUIRE);
       // check if the cell is empty
-      if(e.keyIdx == -1)
+      if(e == 0)
       {
         if(!create) return -1; // Return not found.
-        // need to create an entry. Store the given key.
-        for(int i = 0; i < KD; i++) keys[filled * KD + i] = key[i];
-        e.keyIdx = filled * KD;
-        e.valueIdx = filled * VD;
-        entries[h] = e;
-        filled++;
-        return e.valueIdx;
+        // need to create an entry. Store the given key before publishing it.
+        if(reserved < 0)
+        {
+          reserved = __atomic_fetch_add(&filled, 1, __ATOMIC_RELAXED);
+          for(int i = 0; i < KD; i++) keys[reserved * KD + i] = key[i];
+        }
+        int expected = 0;
+        if(__atomic_compare_exchange_n(slots + h, &expected, reserved + 1, false, __ATOMIC_RELEASE,
+                                       __ATOMIC_ACQUIRE))
+          return reserved * VD;
+        // somebody else was faster, check whether it's our key
+        e = expected;
       }
 
       // check if the cell has a matching key
+      const short *k = keys + (size_t)(e - 1) * KD;
       bool match = true;
-      for(int i = 0; i < KD && match; i++) match = keys[e.keyIdx + i] == key[i];
-      if(match) return e.valueIdx;
+      for(int i = 0; i < KD && match; i++) match = k[i] == key[i];
+      if(match)
+      {
+        if(reserved >= 0) __atomic_fetch_add(&wasted, 1, __ATOMIC_RELAXED);
+        return (e - 1) * VD;
+      }
 
       // increment the bucket with wraparound
-      h++;
-      if(h == capacity) h = 0;
+      h = (h + 1) & capacity_bits;
     }
   }
 
@@ -140,8 +186,7 @@ public:
    */
   float *lookup(const short *k, bool create = true)
   {
-    size_t h = hash(k) & capacity_bits;
-    int offset = lookupOffset(k, h, create);
+    int offset = lookupOffset(k, hash(k), create);
     if(offset < 0)
       return NULL;
     else
@@ -149,7 +194,7 @@ public:
   };
 
   /* Hash function used in this implementation. A simple base conversion. */
-  size_t hash(const short *key)
+  size_t hash(const short *key) const
   {
     size_t k = 0;
     for(int i = 0; i < KD; i++)
@@ -160,59 +205,52 @@ public:
     return k;
   }
 
-private:
-  /* Grows the size of the hash table */
+  /* Grows the size of the hash table, must not run concurrently with anything else. offsets stay valid. */
   void grow()
   {
-    size_t oldCapacity = capacity;
+    const size_t oldCapacity = capacity;
     capacity *= 2;
-    capacity_bits = (capacity_bits << 1) | 1;
+    capacity_bits = capacity - 1;
 
     // Migrate the value vectors.
-    float *newValues = new float[VD * capacity / 2];
-    memset(newValues, 0, sizeof(float) * VD * capacity / 2);
+    float *newValues = new float[VD * entryCapacity()];
+    memset(newValues + (size_t)VD * filled, 0, sizeof(float) * VD * (entryCapacity() - filled));
     memcpy(newValues, values, sizeof(float) * VD * filled);
     delete[] values;
     values = newValues;
 
     // Migrate the key vectors.
-    short *newKeys = new short[KD * capacity / 2];
+    short *newKeys = new short[KD * entryCapacity()];
     memcpy(newKeys, keys, sizeof(short) * KD * filled);
     delete[] keys;
     keys = newKeys;
 
-    Entry *newEntries = new Entry[capacity];
-
     // Migrate the table of indices.
+    int *newSlots = new int[capacity];
+    memset(newSlots, 0, sizeof(int) * capacity);
     for(size_t i = 0; i < oldCapacity; i++)
     {
-      if(entries[i].keyIdx == -1) continue;
-      size_t h = hash(keys + entries[i].keyIdx) & capacity_bits;
-      while(newEntries[h].keyIdx != -1)
-      {
-        h++;
-        if(h == capacity) h = 0;
-      }
-      newEntries[h] = entries[i];
+      if(slots[i] == 0) continue;
+      size_t h = hash(keys + (size_t)(slots[i] - 1) * KD) & capacity_bits;
+      while(newSlots[h] != 0) h = (h + 1) & capacity_bits;
+      newSlots[h] = slots[i];
     }
-    delete[] entries;
-    entries = newEntries;
+    delete[] slots;
+    slots = newSlots;
   }
 
-  // Private struct for the hash table entries.
-  struct Entry
+private:
+  // room in the dense arrays: half the slots, plus what the threads may add after full() turned true
+  size_t entryCapacity() const
   {
-    Entry() : keyIdx(-1), valueIdx(-1)
-    {
-    }
-    int keyIdx;
-    int valueIdx;
-  };
+    return capacity / 2 + margin;
+  }
 
   short *keys;
   float *values;
-  Entry *entries;
-  size_t capacity, filled;
+  int *slots; // index into the dense arrays + 1, 0 for empty slots
+  size_t capacity, margin;
+  int filled, wasted;
   unsigned long capacity_bits;
 };
 
@@ -230,7 +268,8 @@ public:
    *    vd_ : dimensionality of value vectors
    * nData_ : number of points in the input
    */
-  PermutohedralLattice(size_t nData_, int nThreads_ = 1) : nData(nData_), nThreads(nThreads_)
+  PermutohedralLattice(size_t nData_, int nThreads_ = 1)
+    : nData(nData_), nThreads(nThreads_), hashTable(nThreads_)
   {
 
     // Allocate storage for various arrays
@@ -270,8 +309,6 @@ public:
       scaleFactorTmp[i] *= (D + 1) * sqrtf(2.0 / 3);
     }
     scaleFactor = scaleFactorTmp;
-
-    hashTables = new HashTablePermutohedral<D, VD>[nThreads];
   }
 
 
@@ -280,12 +317,183 @@ public:
     delete[] scaleFactor;
     delete[] replay;
     delete[] canonical;
-    delete[] hashTables;
   }
 
+  /* Splats a width x height grid of points into the lattice, in parallel. fill(j, i, position, value) has to
+   * write the position and value vectors of the point in row j, column i, whose replay index is
+   * j * width + i. */
+  template <typename Fill> void splat(const int height, const int width, Fill fill)
+  {
+    // next column to splat in each row. the threads stop when the hash table needs to grow, we then grow it
+    // and carry on where they left off.
+    int *next = new int[height];
+    memset(next, 0, sizeof(int) * height);
+
+    do
+    {
+      if(hashTable.full()) hashTable.grow();
+#ifdef _OPENMP
+#pragma omp parallel num_threads(nThreads)
+#endif
+      {
+        SplatCache cache;
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+        for(int j = 0; j < height; j++)
+        {
+          int i = next[j];
+          for(; i < width && !hashTable.full(); i++)
+          {
+            float position[D], value[VD];
+            fill(j, i, position, value);
+            splatPoint(position, value, (size_t)j * width + i, cache);
+          }
+          next[j] = i;
+        }
+        cache.flush(hashTable.getValues());
+      }
+      // the table only fills up, so if it's not full now nobody had to stop early
+    } while(hashTable.full());
+
+    delete[] next;
+  }
+
+  /* Performs slicing out of position vectors. Note that the barycentric weights and the simplex
+   * containing each position vector were calculated and stored in the splatting step.
+   * We may reuse this to accelerate the algorithm. (See pg. 6 in paper.)
+   */
+  void slice(float *col, size_t replay_index)
+  {
+    const float *base = hashTable.getValues();
+    for(int j = 0; j < VD; j++) col[j] = 0;
+    for(int i = 0; i <= D; i++)
+    {
+      ReplayEntry r = replay[replay_index * (D + 1) + i];
+      for(int j = 0; j < VD; j++)
+      {
+        col[j] += r.weight * base[r.offset + j];
+      }
+    }
+  }
+
+  /* Performs a Gaussian blur along each projected axis in the hyperplane. */
+  void blur()
+  {
+    const int size = hashTable.size();
+
+    // Prepare arrays
+    float *newValue = new float[VD * size];
+    float *oldValue = hashTable.getValues();
+    float *const hashTableBase = oldValue;
+
+    // For each of d+1 axes,
+    for(int j = 0; j <= D; j++)
+    {
+      // For each vertex in the lattice, the table isn't modified any more so the lookups are thread safe
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) num_threads(nThreads) shared(j, oldValue, newValue)
+#endif
+      for(int i = 0; i < size; i++) // blur point i in dimension j
+      {
+        const short *key = hashTable.getKeys() + (size_t)i * D; // keys to current vertex
+        short neighbor1[D + 1];
+        short neighbor2[D + 1];
+        for(int k = 0; k < D; k++)
+        {
+          neighbor1[k] = key[k] + 1;
+          neighbor2[k] = key[k] - 1;
+        }
+        neighbor1[j] = key[j] - D;
+        neighbor2[j] = key[j] + D; // keys to the neighbors along the given axis.
+
+        const float *oldVal = oldValue + (size_t)i * VD;
+        float *newVal = newValue + (size_t)i * VD;
+
+        float vm1[VD] = { 0.0f }, vp1[VD] = { 0.0f };
+
+        const int o1 = hashTable.lookupOffset(neighbor1, hashTable.hash(neighbor1), false); // first neighbor
+        if(o1 >= 0)
+          for(int k = 0; k < VD; k++) vm1[k] = oldValue[o1 + k];
+
+        const int o2 = hashTable.lookupOffset(neighbor2, hashTable.hash(neighbor2), false); // second neighbor
+        if(o2 >= 0)
+          for(int k = 0; k < VD; k++) vp1[k] = oldValue[o2 + k];
+
+        // Mix values of the three vertices
+        for(int k = 0; k < VD; k++) newVal[k] = (0.25f * vm1[k] + 0.5f * oldVal[k] + 0.25f * vp1[k]);
+      }
+      float *tmp = newValue;
+      newValue = oldValue;
+      oldValue = tmp;
+      // the freshest data is now in oldValue, and newValue is ready to be written over
+    }
+
+    // depending where we ended up, we may have to copy data
+    if(oldValue != hashTableBase)
+    {
+      memcpy(hashTableBase, oldValue, (size_t)size * VD * sizeof(float));
+      delete[] oldValue;
+    }
+    else
+    {
+      delete[] newValue;
+    }
+  }
+
+  // Returns the number of lattice points.
+  int points() const
+  {
+    return hashTable.points();
+  }
+
+  // Returns the number of bytes allocated by the lattice, not counting the temporary buffer of blur().
+  size_t memoryFootprint() const
+  {
+    return hashTable.memoryFootprint() + sizeof(ReplayEntry) * nData * (D + 1);
+  }
+
+private:
+  /* Per thread write combining buffer for the splatted values. Neighbouring points mostly land on the same
+   * lattice vertices, so summing up locally saves most of the atomic adds to the shared table. */
+  struct SplatCache
+  {
+    enum { SIZE = 64 };
+    int offset[SIZE];
+    float value[SIZE][VD];
+
+    SplatCache()
+    {
+      for(int s = 0; s < SIZE; s++) offset[s] = -1;
+    }
+
+    void add(float *base, const int o, const float weight, const float *v)
+    {
+      const int s = (o / VD) & (SIZE - 1);
+      if(offset[s] != o)
+      {
+        flush(base, s);
+        offset[s] = o;
+        for(int k = 0; k < VD; k++) value[s][k] = 0.0f;
+      }
+      for(int k = 0; k < VD; k++) value[s][k] += weight * v[k];
+    }
+
+    void flush(float *base, const int s)
+    {
+      if(offset[s] < 0) return;
+      for(int k = 0; k < VD; k++) permutohedral_atomic_add(base + offset[s] + k, value[s][k]);
+      offset[s] = -1;
+    }
+
+    void flush(float *base)
+    {
+      for(int s = 0; s < SIZE; s++) flush(base, s);
+    }
+  };
 
   /* Performs splatting with given position and value vectors */
-  void splat(float *position, float *value, size_t replay_index, int thread_index = 0)
+  void splatPoint(const float *position, const float *value, size_t replay_index, SplatCache &cache)
   {
     float elevated[D + 1];
     int greedy[D + 1];
@@ -377,139 +585,19 @@ public:
       // because they sum to zero)
       for(int i = 0; i < D; i++) key[i] = greedy[i] + canonical[remainder * (D + 1) + rank[i]];
 
-      // Retrieve pointer to the value at this vertex.
-      float *val = hashTables[thread_index].lookup(key, true);
+      // Retrieve the offset of the value at this vertex.
+      const int offset = hashTable.lookupOffset(key, hashTable.hash(key), true);
 
       // Accumulate values with barycentric weight.
-      for(int i = 0; i < VD; i++) val[i] += barycentric[remainder] * value[i];
+      cache.add(hashTable.getValues(), offset, barycentric[remainder], value);
 
       // Record this interaction to use later when slicing
-      replay[replay_index * (D + 1) + remainder].table = thread_index;
-      replay[replay_index * (D + 1) + remainder].offset = val - hashTables[thread_index].getValues();
+      replay[replay_index * (D + 1) + remainder].offset = offset;
       replay[replay_index * (D + 1) + remainder].weight = barycentric[remainder];
     }
   }
 
-  /* Merge the multiple threads' hash tables into the totals. */
-  void merge_splat_threads(void)
-  {
-    if(nThreads <= 1) return;
-
-    /* Merge the multiple hash tables into one, creating an offset remap table. */
-    int **offset_remap = new int *[nThreads];
-    for(int i = 1; i < nThreads; i++)
-    {
-      const short *oldKeys = hashTables[i].getKeys();
-      const float *oldVals = hashTables[i].getValues();
-      const int filled = hashTables[i].size();
-      offset_remap[i] = new int[filled];
-      for(int j = 0; j < filled; j++)
-      {
-        float *val = hashTables[0].lookup(oldKeys + j * D, true);
-        const float *oldVal = oldVals + j * VD;
-        for(int k = 0; k < VD; k++) val[k] += oldVal[k];
-        offset_remap[i][j] = val - hashTables[0].getValues();
-      }
-    }
-
-    /* Rewrite the offsets in the replay structure from the above generated table. */
-    for(int i = 0; i < nData * (D + 1); i++)
-      if(replay[i].table > 0) replay[i].offset = offset_remap[replay[i].table][replay[i].offset / VD];
-
-    for(int i = 1; i < nThreads; i++) delete[] offset_remap[i];
-
-    delete[] offset_remap;
-  }
-
-  /* Performs slicing out of position vectors. Note that the barycentric weights and the simplex
-   * containing each position vector were calculated and stored in the splatting step.
-   * We may reuse this to accelerate the algorithm. (See pg. 6 in paper.)
-   */
-  void slice(float *col, size_t replay_index)
-  {
-    float *base = hashTables[0].getValues();
-    for(int j = 0; j < VD; j++) col[j] = 0;
-    for(int i = 0; i <= D; i++)
-    {
-      ReplayEntry r = replay[replay_index * (D + 1) + i];
-      for(int j = 0; j < VD; j++)
-      {
-        col[j] += r.weight * base[r.offset + j];
-      }
-    }
-  }
-
-  /* Performs a Gaussian blur along each projected axis in the hyperplane. */
-  void blur()
-  {
-    // Prepare arrays
-    float *newValue = new float[VD * hashTables[0].size()];
-    float *oldValue = hashTables[0].getValues();
-    float *hashTableBase = oldValue;
-
-    float zero[VD];
-    for(int k = 0; k < VD; k++) zero[k] = 0;
-
-    // For each of d+1 axes,
-    for(int j = 0; j <= D; j++)
-    {
-#ifdef _OPENMP
-#pragma omp parallel for shared(j, oldValue, newValue, hashTableBase, zero)
-#endif
-      // For each vertex in the lattice,
-      for(int i = 0; i < hashTables[0].size(); i++) // blur point i in dimension j
-      {
-        const short *key = hashTables[0].getKeys() + i * (D); // keys to current vertex
-        short neighbor1[D + 1];
-        short neighbor2[D + 1];
-        for(int k = 0; k < D; k++)
-        {
-          neighbor1[k] = key[k] + 1;
-          neighbor2[k] = key[k] - 1;
-        }
-        neighbor1[j] = key[j] - D;
-        neighbor2[j] = key[j] + D; // keys to the neighbors along the given axis.
-
-        float *oldVal = oldValue + i * VD;
-        float *newVal = newValue + i * VD;
-
-        float *vm1, *vp1;
-
-        vm1 = hashTables[0].lookup(neighbor1, false); // look up first neighbor
-        if(vm1)
-          vm1 = vm1 - hashTableBase + oldValue;
-        else
-          vm1 = zero;
-
-        vp1 = hashTables[0].lookup(neighbor2, false); // look up second neighbor
-        if(vp1)
-          vp1 = vp1 - hashTableBase + oldValue;
-        else
-          vp1 = zero;
-
-        // Mix values of the three vertices
-        for(int k = 0; k < VD; k++) newVal[k] = (0.25f * vm1[k] + 0.5f * oldVal[k] + 0.25f * vp1[k]);
-      }
-      float *tmp = newValue;
-      newValue = oldValue;
-      oldValue = tmp;
-      // the freshest data is now in oldValue, and newValue is ready to be written over
-    }
-
-    // depending where we ended up, we may have to copy data
-    if(oldValue != hashTableBase)
-    {
-      memcpy(hashTableBase, oldValue, hashTables[0].size() * VD * sizeof(float));
-      delete[] oldValue;
-    }
-    else
-    {
-      delete[] newValue;
-    }
-  }
-
-private:
-  int nData;
+  size_t nData;
   int nThreads;
   const float *scaleFactor;
   const int *canonical;
@@ -517,12 +605,11 @@ private:
   // slicing is done by replaying splatting (ie storing the sparse matrix)
   struct ReplayEntry
   {
-    int table;
     int offset;
     float weight;
   } *replay;
 
-  HashTablePermutohedral<D, VD> *hashTables;
+  HashTablePermutohedral<D, VD> hashTable;
 };
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
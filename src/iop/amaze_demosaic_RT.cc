@@ -18,17 +18,24 @@
 
 #define __STDC_FORMAT_MACROS
 
+// amaze_demosaic_RT_avx2.cc includes this file again with AMAZE_DEMOSAIC_RT set to another name,
+// to get a copy of the whole algorithm compiled for AVX2.
+#ifndef AMAZE_DEMOSAIC_RT
+#define AMAZE_DEMOSAIC_RT amaze_demosaic_RT
+#endif
+
 extern "C" {
 #include "develop/imageop.h"
 #include "develop/imageop_math.h"
 
 // otherwise the name will be mangled and the linker won't be able to see the function ...
-void amaze_demosaic_RT(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *const in,
+void AMAZE_DEMOSAIC_RT(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *const in,
                        float *out, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
                        const int filters);
 }
 
-#include <algorithm>
+// no inline functions or templates from the c++ library in here: their out of line copies are weak symbols, and
+// the linker could pick the ones from the avx2 build for this one too.
 #include <cmath>
 #include <cstdint>
 #include <cstdlib>
@@ -40,9 +47,9 @@ static __inline float clampnan(const float x, const float m, const float M)
 
   // clamp to [m, M] if x is infinite; return average of m and M if x is NaN; else just return x
 
-  if(std::isinf(x))
-    r = (std::isless(x, m) ? m : (std::isgreater(x, M) ? M : x));
-  else if(std::isnan(x))
+  if(__builtin_isinf(x))
+    r = (__builtin_isless(x, m) ? m : (__builtin_isgreater(x, M) ? M : x));
+  else if(__builtin_isnan(x))
     r = (m + M) / 2.0f;
   else // normal number
     r = x;
@@ -256,7 +263,7 @@ template <typename _Tp> static inline const _Tp intp(const _Tp a, const _Tp b, c
 
 template <typename _Tp> static inline const _Tp LIM(const _Tp a, const _Tp b, const _Tp c)
 {
-  return std::max(b, std::min(a, c));
+  return MAX(b, MIN(a, c));
 }
 
 template <typename _Tp> static inline const _Tp ULIM(const _Tp a, const _Tp b, const _Tp c)
@@ -298,7 +305,7 @@ template <typename _Tp> static inline const _Tp ULIM(const _Tp a, const _Tp b, c
 // {
 
 // SSEFUNCTION void RawImageSource::amaze_demosaic_RT(int winx, int winy, int winw, int winh)
-void amaze_demosaic_RT(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *const in,
+void AMAZE_DEMOSAIC_RT(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *const in,
                        float *out, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
                        const int filters)
 {
@@ -1291,10 +1298,10 @@ void amaze_demosaic_RT(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
           nyendrow++; // because of < condition
           nyendcol++; // because of < condition
           nystartcol -= (nystartcol & 1);
-          nystartrow = std::max(8, nystartrow);
-          nyendrow = std::min(rr1 - 8, nyendrow);
-          nystartcol = std::max(8, nystartcol);
-          nyendcol = std::min(cc1 - 8, nyendcol);
+          nystartrow = MAX(8, nystartrow);
+          nyendrow = MIN(rr1 - 8, nyendrow);
+          nystartcol = MAX(8, nystartcol);
+          nyendcol = MIN(cc1 - 8, nyendcol);
           memset(&nyquist2[4 * tsh], 0, sizeof(char) * (ts - 8) * tsh);
 
 #ifdef __SSE2__
@@ -0,0 +1,27 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// AMaZE, built a second time with -mavx2 (see src/iop/CMakeLists.txt). the vector helpers of the original
+// get VEX encoded and the scalar parts of the tile loops are auto-vectorized to 256 bit. only called from
+// demosaic.c if darktable.codepath.AVX2 is set.
+#define AMAZE_DEMOSAIC_RT amaze_demosaic_RT_avx2
+#include "amaze_demosaic_RT.cc"
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
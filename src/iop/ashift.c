@@ -66,6 +66,11 @@
 #define LSD_DENSITY_TH 0.7                  // LSD: minimal density of region points in rectangle
 #define LSD_N_BINS 1024                     // LSD: number of bins in pseudo-ordering of gradient modulus
 #define LSD_GAMMA 0.45                      // gamma correction to apply on raw images prior to line detection
+#define LSD_TILE_SIZE 384                   // LSD: minimum size of a tile when detecting lines in several threads
+#define LSD_TILE_OVERLAP 32                 // LSD: overlap between neighbouring tiles in pixels
+#define LSD_MERGE_ANGLE 2.0                 // LSD: max angle in degrees between two pieces of a line split by tiles
+#define LSD_PYRAMID_SIZE 2000000            // LSD: images with more pixels get searched at half resolution first
+#define LSD_REFINE_RADIUS 3                 // LSD: distance from a coarse line in which we look for its edge pixels
 #define RANSAC_RUNS 400                     // how many iterations to run in ransac
 #define RANSAC_EPSILON 2                    // starting value for ransac epsilon (in -log10 units)
 #define RANSAC_EPSILON_STEP 1               // step size of epsilon optimization (log10 units)
@@ -77,6 +82,7 @@
 #define NMS_EPSILON 1e-3                    // break criterion for Nelder-Mead simplex
 #define NMS_SCALE 1.0                       // scaling factor for Nelder-Mead simplex
 #define NMS_ITERATIONS 400                  // number of iterations for Nelder-Mead simplex
+#define NMS_PARALLEL_LINES 200              // number of lines from which on Nelder-Mead simplex runs multi-threaded
 #define NMS_CROP_EPSILON 100.0              // break criterion for Nelder-Mead simplex on crop fitting
 #define NMS_CROP_SCALE 0.5                  // scaling factor for Nelder-Mead simplex on crop fitting
 #define NMS_CROP_ITERATIONS 100             // number of iterations for Nelder-Mead simplex on crop fitting
@@ -1259,6 +1265,313 @@ static void gamma_correct(const float *in, float *out, const int width, const in
   }
 }
 
+// run LSD on the region x, y, w, h of a greyscale image with the detection threshold of the whole
+// image and return the lines in image coordinates
+static double *lsd_region(int *count, const double *grey, const int width, const int height, const int x,
+                          const int y, const int w, const int h)
+{
+  double *tile = malloc((size_t)w * h * sizeof(double));
+  if(tile == NULL)
+  {
+    *count = 0;
+    return NULL;
+  }
+
+  for(int j = 0; j < h; j++) memcpy(tile + (size_t)j * w, grey + (size_t)(y + j) * width + x, w * sizeof(double));
+
+  double *lines = LineSegmentDetection(count, tile, w, h, LSD_SCALE, LSD_SIGMA_SCALE, LSD_QUANT, LSD_ANG_TH,
+                                       LSD_LOG_EPS, LSD_DENSITY_TH, LSD_N_BINS, width, height, NULL, NULL, NULL);
+  free(tile);
+
+  for(int n = 0; n < *count; n++)
+  {
+    lines[n * 7 + 0] += x;
+    lines[n * 7 + 1] += y;
+    lines[n * 7 + 2] += x;
+    lines[n * 7 + 3] += y;
+  }
+
+  return lines;
+}
+
+// tiles cut lines which cross their borders into pieces. join pieces from different
+// tiles which are nearly parallel, on top of each other and touch or overlap.
+// lines[7 * n + 6] is set to -DBL_MAX for every line that got merged into another one.
+static void lsd_merge_pieces(double *lines, const int *tile, const int count)
+{
+  int merged;
+  do
+  {
+    merged = 0;
+    for(int a = 0; a < count; a++)
+    {
+      double *la = lines + 7 * a;
+      if(la[6] == -DBL_MAX) continue;
+
+      for(int b = a + 1; b < count; b++)
+      {
+        double *lb = lines + 7 * b;
+        if(lb[6] == -DBL_MAX || tile[a] == tile[b]) continue;
+
+        const double lena = sqrt(SQR(la[2] - la[0]) + SQR(la[3] - la[1]));
+        const double lenb = sqrt(SQR(lb[2] - lb[0]) + SQR(lb[3] - lb[1]));
+        if(lena < 1.0 || lenb < 1.0) continue;
+
+        // unit direction of a and the angle between both lines
+        const double ux = (la[2] - la[0]) / lena, uy = (la[3] - la[1]) / lena;
+        const double cosab = fabs(ux * (lb[2] - lb[0]) + uy * (lb[3] - lb[1])) / lenb;
+        if(cosab < cos(LSD_MERGE_ANGLE * M_PI / 180.0)) continue;
+
+        // both ends of b need to be on a
+        const double tol = fmax(la[4], lb[4]);
+        const double d1 = -uy * (lb[0] - la[0]) + ux * (lb[1] - la[1]);
+        const double d2 = -uy * (lb[2] - la[0]) + ux * (lb[3] - la[1]);
+        if(fabs(d1) > tol || fabs(d2) > tol) continue;
+
+        // position of b's ends along a; the gap between both may not exceed the overlap of the tiles
+        const double t1 = ux * (lb[0] - la[0]) + uy * (lb[1] - la[1]);
+        const double t2 = ux * (lb[2] - la[0]) + uy * (lb[3] - la[1]);
+        const double tmin = fmin(t1, t2), tmax = fmax(t1, t2);
+        if(tmin > lena + LSD_TILE_OVERLAP || tmax < -LSD_TILE_OVERLAP) continue;
+
+        // the joined line runs between the outermost of the four end points
+        double p1[2] = { la[0], la[1] }, p2[2] = { la[2], la[3] };
+        if(tmin < 0.0)
+        {
+          p1[0] = t1 < t2 ? lb[0] : lb[2];
+          p1[1] = t1 < t2 ? lb[1] : lb[3];
+        }
+        if(tmax > lena)
+        {
+          p2[0] = t1 < t2 ? lb[2] : lb[0];
+          p2[1] = t1 < t2 ? lb[3] : lb[1];
+        }
+
+        la[0] = p1[0];
+        la[1] = p1[1];
+        la[2] = p2[0];
+        la[3] = p2[1];
+        la[4] = fmax(la[4], lb[4]);
+        la[5] = (lena * la[5] + lenb * lb[5]) / (lena + lenb);
+        la[6] = fmax(la[6], lb[6]);
+        lb[6] = -DBL_MAX;
+        merged++;
+      }
+    }
+  } while(merged > 0);
+}
+
+// line detection in overlapping tiles, one thread per tile. each tile keeps the lines
+// whose center lies in its core, pieces of lines cut by the tiles are joined afterwards.
+// on small images or with a single thread this is just LineSegmentDetection().
+static double *lsd_tiled(int *count, double *grey, const int width, const int height)
+{
+  const int threads = dt_get_num_threads();
+  const int nx = MAX(1, MIN(threads, width / LSD_TILE_SIZE));
+  const int ny = MAX(1, MIN((threads + nx - 1) / nx, height / LSD_TILE_SIZE));
+  const int tiles = nx * ny;
+
+  if(tiles == 1)
+    return LineSegmentDetection(count, grey, width, height, LSD_SCALE, LSD_SIGMA_SCALE, LSD_QUANT, LSD_ANG_TH,
+                                LSD_LOG_EPS, LSD_DENSITY_TH, LSD_N_BINS, 0, 0, NULL, NULL, NULL);
+
+  double **tile_lines = calloc(tiles, sizeof(double *));
+  int *tile_count = calloc(tiles, sizeof(int));
+  if(tile_lines == NULL || tile_count == NULL)
+  {
+    free(tile_lines);
+    free(tile_count);
+    *count = 0;
+    return NULL;
+  }
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(tile_lines, tile_count, grey) schedule(dynamic)
+#endif
+  for(int t = 0; t < tiles; t++)
+  {
+    // core of the tile
+    const int cx0 = (t % nx) * width / nx;
+    const int cx1 = (t % nx + 1) * width / nx;
+    const int cy0 = (t / nx) * height / ny;
+    const int cy1 = (t / nx + 1) * height / ny;
+
+    // core plus overlap
+    const int x0 = MAX(0, cx0 - LSD_TILE_OVERLAP);
+    const int x1 = MIN(width, cx1 + LSD_TILE_OVERLAP);
+    const int y0 = MAX(0, cy0 - LSD_TILE_OVERLAP);
+    const int y1 = MIN(height, cy1 + LSD_TILE_OVERLAP);
+
+    int n = 0;
+    double *lines = lsd_region(&n, grey, width, height, x0, y0, x1 - x0, y1 - y0);
+
+    // keep the lines centered in the core, the neighbouring tiles see the others
+    int k = 0;
+    for(int l = 0; l < n; l++)
+    {
+      const double mx = 0.5 * (lines[l * 7 + 0] + lines[l * 7 + 2]);
+      const double my = 0.5 * (lines[l * 7 + 1] + lines[l * 7 + 3]);
+      if(mx < cx0 || mx >= cx1 || my < cy0 || my >= cy1) continue;
+      if(k != l) memmove(lines + k * 7, lines + l * 7, 7 * sizeof(double));
+      k++;
+    }
+
+    tile_lines[t] = lines;
+    tile_count[t] = k;
+  }
+
+  int total = 0;
+  for(int t = 0; t < tiles; t++) total += tile_count[t];
+
+  double *lines = malloc((size_t)MAX(total, 1) * 7 * sizeof(double));
+  int *line_tile = malloc((size_t)MAX(total, 1) * sizeof(int));
+  int n = 0;
+  if(lines != NULL && line_tile != NULL)
+  {
+    for(int t = 0; t < tiles; t++)
+    {
+      if(tile_count[t] > 0) memcpy(lines + n * 7, tile_lines[t], (size_t)tile_count[t] * 7 * sizeof(double));
+      for(int l = 0; l < tile_count[t]; l++) line_tile[n + l] = t;
+      n += tile_count[t];
+    }
+
+    lsd_merge_pieces(lines, line_tile, n);
+
+    int k = 0;
+    for(int l = 0; l < n; l++)
+    {
+      if(lines[l * 7 + 6] == -DBL_MAX) continue;
+      if(k != l) memmove(lines + k * 7, lines + l * 7, 7 * sizeof(double));
+      k++;
+    }
+    n = k;
+  }
+
+  for(int t = 0; t < tiles; t++) free(tile_lines[t]);
+  free(tile_lines);
+  free(tile_count);
+  free(line_tile);
+
+  *count = n;
+  return lines;
+}
+
+// refine a line found at half resolution on the full resolution image: fit a line
+// through the pixels close to it whose gradient is perpendicular to it, weighted by
+// gradient magnitude. lines without enough support are left alone.
+static void lsd_refine(double *line, const double *grey, const int width, const int height)
+{
+  const double x1 = line[0], y1 = line[1], x2 = line[2], y2 = line[3];
+  const double len = sqrt(SQR(x2 - x1) + SQR(y2 - y1));
+  if(len < 2.0) return;
+
+  const double ux = (x2 - x1) / len, uy = (y2 - y1) / len;
+  const double radius = LSD_REFINE_RADIUS + 0.5 * line[4];
+  const double rho = LSD_QUANT / sin(LSD_ANG_TH * M_PI / 180.0);
+  const double cos_th = cos(LSD_ANG_TH * M_PI / 180.0);
+
+  const int i0 = MAX(1, (int)floor(fmin(x1, x2) - radius));
+  const int i1 = MIN(width - 2, (int)ceil(fmax(x1, x2) + radius));
+  const int j0 = MAX(1, (int)floor(fmin(y1, y2) - radius));
+  const int j1 = MIN(height - 2, (int)ceil(fmax(y1, y2) + radius));
+
+  double sw = 0.0, sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0, syy = 0.0;
+  int support = 0;
+
+  for(int j = j0; j <= j1; j++)
+    for(int i = i0; i <= i1; i++)
+    {
+      // LSD coordinates have their origin in the center of pixel (0, 0)
+      const double px = i - x1, py = j - y1;
+      const double t = ux * px + uy * py;
+      if(t < 0.0 || t > len || fabs(-uy * px + ux * py) > radius) continue;
+
+      const double *g = grey + (size_t)j * width + i;
+      const double gx = 0.5 * (g[1] - g[-1]);
+      const double gy = 0.5 * (g[width] - g[-width]);
+      const double mag = sqrt(gx * gx + gy * gy);
+      if(mag <= rho || fabs(-uy * gx + ux * gy) < cos_th * mag) continue;
+
+      sw += mag;
+      sx += mag * px;
+      sy += mag * py;
+      sxx += mag * px * px;
+      sxy += mag * px * py;
+      syy += mag * py * py;
+      support++;
+    }
+
+  if(support < 10 || support < 0.5 * len) return;
+
+  // total least squares: the line runs through the weighted centroid along the
+  // principal axis of the weighted covariance
+  const double cx = sx / sw, cy = sy / sw;
+  const double cxx = sxx / sw - cx * cx, cxy = sxy / sw - cx * cy, cyy = syy / sw - cy * cy;
+  const double theta = 0.5 * atan2(2.0 * cxy, cxx - cyy);
+  double dx = cos(theta), dy = sin(theta);
+  if(dx * ux + dy * uy < 0.0)
+  {
+    dx = -dx;
+    dy = -dy;
+  }
+
+  // don't let the fit wander off to some other structure
+  if(dx * ux + dy * uy < cos_th) return;
+
+  // project the old end points onto the new line
+  const double t1 = -cx * dx - cy * dy;
+  const double t2 = (x2 - x1 - cx) * dx + (y2 - y1 - cy) * dy;
+  line[0] = x1 + cx + t1 * dx;
+  line[1] = y1 + cy + t1 * dy;
+  line[2] = x1 + cx + t2 * dx;
+  line[3] = y1 + cy + t2 * dy;
+}
+
+// run the line segment detector on a greyscale image. large images are first searched
+// at half resolution, the lines found there are refined at full resolution. returns
+// lines as 7-tuples like LineSegmentDetection() does.
+static double *lsd_detect(int *count, double *grey, const int width, const int height)
+{
+  if((size_t)width * height <= LSD_PYRAMID_SIZE || width < 4 || height < 4)
+    return lsd_tiled(count, grey, width, height);
+
+  const int hw = width / 2;
+  const int hh = height / 2;
+  double *half = malloc((size_t)hw * hh * sizeof(double));
+  if(half == NULL) return lsd_tiled(count, grey, width, height);
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(half, grey) schedule(static)
+#endif
+  for(int j = 0; j < hh; j++)
+  {
+    const double *in0 = grey + (size_t)2 * j * width;
+    const double *in1 = in0 + width;
+    double *out = half + (size_t)j * hw;
+    for(int i = 0; i < hw; i++)
+      out[i] = 0.25 * (in0[2 * i] + in0[2 * i + 1] + in1[2 * i] + in1[2 * i + 1]);
+  }
+
+  int n = 0;
+  double *lines = lsd_tiled(&n, half, hw, hh);
+  free(half);
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(lines, grey, n) schedule(dynamic)
+#endif
+  for(int l = 0; l < n; l++)
+  {
+    // pixel j at half resolution covers pixels 2j and 2j + 1
+    double *line = lines + l * 7;
+    for(int c = 0; c < 4; c++) line[c] = 2.0 * line[c] + 0.5;
+    line[4] *= 2.0;
+    lsd_refine(line, grey, width, height);
+  }
+
+  *count = n;
+  return lines;
+}
+
 // do actual line_detection based on LSD algorithm and return results according
 // to this module's conventions
 static int line_detect(float *in, const int width, const int height, const int x_off, const int y_off,
@@ -1303,10 +1616,7 @@ static int line_detect(float *in, const int width, const int height, const int x
   // LSD stores the number of found lines in lines_count.
   // it returns structural details as vector 'double lines[7 * lines_count]'
   int lines_count;
-  lsd_lines = LineSegmentDetection(&lines_count, greyscale, width, height,
-                                   LSD_SCALE, LSD_SIGMA_SCALE, LSD_QUANT,
-                                   LSD_ANG_TH, LSD_LOG_EPS, LSD_DENSITY_TH,
-                                   LSD_N_BINS, NULL, NULL, NULL);
+  lsd_lines = lsd_detect(&lines_count, greyscale, width, height);
 
   // we count the lines that we really want to use
   int lct = 0;
@@ -2108,8 +2418,10 @@ static dt_iop_ashift_nmsresult_t nmsfit(dt_iop_module_t *module, dt_iop_ashift_p
     return NMS_NOT_ENOUGH_LINES;
   }
 
-  // start the simplex fit
-  int iter = simplex(model_fitness, params, fit.params_count, NMS_EPSILON, NMS_SCALE, NMS_ITERATIONS, NULL, (void*)&fit);
+  // start the simplex fit; with enough lines model_fitness() is worth spreading over several threads
+  const int parallel = dt_get_num_threads() > 1 && fit.lines_count >= NMS_PARALLEL_LINES;
+  int iter = simplex(model_fitness, params, fit.params_count, NMS_EPSILON, NMS_SCALE, NMS_ITERATIONS, NULL,
+                     (void*)&fit, parallel);
 
   // error case: the fit did not converge
   if(iter >= NMS_ITERATIONS)
@@ -2440,7 +2752,7 @@ static void do_crop(dt_iop_module_t *module, dt_iop_ashift_params_t *p)
 
   // start the simplex fit
   int iter = simplex(crop_fitness, params, pcount, NMS_CROP_EPSILON, NMS_CROP_SCALE, NMS_CROP_ITERATIONS,
-                     crop_constraint, (void*)&cropfit);
+                     crop_constraint, (void*)&cropfit, FALSE);
 
   // in case the fit did not converge -> failed
   if(iter >= NMS_CROP_ITERATIONS) goto failed;
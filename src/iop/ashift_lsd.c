@@ -25,6 +25,10 @@
  *      catch (unlikely) division by zero near line 2035
  *      rename rad1 and rad2 to radius1 and radius2 in reduce_region_radius()
  *        to avoid naming conflict in windows build
+ *      zero and fill the table of inverse values once at load time, so that
+ *        LineSegmentDetection() can run in several threads at once
+ *      add NT_X and NT_Y to LineSegmentDetection() to compute the number of
+ *        tests for a larger image when img is a tile of it
  *
  */
 
@@ -1081,6 +1085,9 @@ __attribute__((constructor)) static void invConstructor()
 {
   if(inv) return;
   inv = malloc(sizeof(double) * TABSIZE);
+  if(inv == NULL) return;
+  inv[0] = 0.0;
+  for(int i = 1; i < TABSIZE; i++) inv[i] = 1.0 / (double) i;
 }
 
 __attribute__((destructor)) static void invDestructor()
@@ -1189,9 +1196,8 @@ static double nfa(int n, int k, double p, double logNT)
          because divisions are expensive.
          p/(1-p) is computed only once and stored in 'p_term'.
        */
-      bin_term = (double) (n-i+1) * ( i<TABSIZE ?
-                   ( inv[i]!=0.0 ? inv[i] : ( inv[i] = 1.0 / (double) i ) ) :
-                   1.0 / (double) i );
+      bin_term = (double) (n-i+1) * ( i<TABSIZE && inv != NULL ?
+                   inv[i] : 1.0 / (double) i );
 
       mult_term = bin_term * p_term;
       term *= mult_term;
@@ -2092,7 +2098,7 @@ double * LineSegmentDetection( int * n_out,
                                double * img, int X, int Y,
                                double scale, double sigma_scale, double quant,
                                double ang_th, double log_eps, double density_th,
-                               int n_bins,
+                               int n_bins, int NT_X, int NT_Y,
                                int ** reg_img, int * reg_x, int * reg_y )
 {
   image_double image;
@@ -2157,8 +2163,13 @@ double * LineSegmentDetection( int * n_out,
      whose logarithm value is
        log10(11) + 5/2 * (log10(X) + log10(Y)).
   */
-  logNT = 5.0 * ( log10( (double) xsize ) + log10( (double) ysize ) ) / 2.0
-          + log10(11.0);
+  if( NT_X > 0 && NT_Y > 0 )  /* img is a tile of a larger image */
+    logNT = 5.0 * ( log10( ceil( (double) NT_X * scale ) )
+                    + log10( ceil( (double) NT_Y * scale ) ) ) / 2.0
+            + log10(11.0);
+  else
+    logNT = 5.0 * ( log10( (double) xsize ) + log10( (double) ysize ) ) / 2.0
+            + log10(11.0);
   min_reg_size = (int) (-logNT/log10(p)); /* minimal number of points in region
                                              that can give a meaningful event */
 
@@ -2292,7 +2303,7 @@ double * lsd_scale_region( int * n_out,
                                modulus.                                       */
 
   return LineSegmentDetection( n_out, img, X, Y, scale, sigma_scale, quant,
-                               ang_th, log_eps, density_th, n_bins,
+                               ang_th, log_eps, density_th, n_bins, 0, 0,
                                reg_img, reg_x, reg_y );
 }
 
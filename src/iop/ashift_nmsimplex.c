@@ -28,6 +28,11 @@
  *      initialize i and j to avoid compiler warnings
  *      comment out printing of status inormation
  *      reformat according to darktable's clang standards
+ *      optionally evaluate objfunc in several threads: the initial vertices,
+ *        the two points of a shrink step and, speculatively, all four points
+ *        an iteration might need (reflection, expansion, outside and inside
+ *        contraction) at once. the path taken through the algorithm and its
+ *        result do not change, objfunc has to be reentrant though.
  */
 
 /*==================================================================================
@@ -78,7 +83,7 @@
 //#include "nmsimplex.h"
 
 static int simplex(double (*objfunc)(double[], void *params), double start[], int n, double EPSILON, double scale,
-                   int maxiter, void (*constrain)(double[], int n), void *params)
+                   int maxiter, void (*constrain)(double[], int n), void *params, int parallel)
 {
 
   int vs; /* vertex with smallest value */
@@ -98,7 +103,9 @@ static int simplex(double (*objfunc)(double[], void *params), double start[], in
   double *vr;    /* reflection - coordinates */
   double *ve;    /* expansion - coordinates */
   double *vc;    /* contraction - coordinates */
+  double *vi;    /* inside contraction - coordinates, only if parallel */
   double *vm;    /* centroid - coordinates */
+  double fs[4];  /* speculative values at vr, ve, vc and vi, only if parallel */
   //double min;
 
   double fsum, favg, s, cent;
@@ -111,6 +118,7 @@ static int simplex(double (*objfunc)(double[], void *params), double start[], in
   vr = (double *)malloc(n * sizeof(double));
   ve = (double *)malloc(n * sizeof(double));
   vc = (double *)malloc(n * sizeof(double));
+  vi = (double *)malloc(n * sizeof(double));
   vm = (double *)malloc(n * sizeof(double));
 
   /* allocate the columns of the arrays */
@@ -150,9 +158,12 @@ static int simplex(double (*objfunc)(double[], void *params), double start[], in
     constrain(v[j], n);
   }
   /* find the initial function values */
-  for(j = 0; j <= n; j++)
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(objfunc, params, v, f, n) if(parallel) schedule(static)
+#endif
+  for(int jj = 0; jj <= n; jj++)
   {
-    f[j] = objfunc(v[j], params);
+    f[jj] = objfunc(v[jj], params);
   }
 
   k = n + 1;
@@ -225,7 +236,38 @@ static int simplex(double (*objfunc)(double[], void *params), double start[], in
     {
       constrain(vr, n);
     }
-    fr = objfunc(vr, params);
+
+    if(parallel)
+    {
+      /* the decisions below only depend on fr: get the other candidates ready
+         and evaluate all of them at once */
+      for(j = 0; j <= n - 1; j++)
+      {
+        ve[j] = vm[j] + NMS_GAMMA * (vr[j] - vm[j]);
+        vc[j] = vm[j] + NMS_BETA * (vr[j] - vm[j]);
+        vi[j] = vm[j] - NMS_BETA * (vm[j] - v[vg][j]);
+      }
+      if(constrain != NULL)
+      {
+        constrain(ve, n);
+        constrain(vc, n);
+        constrain(vi, n);
+      }
+
+      double *const vp[4] = { vr, ve, vc, vi };
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(objfunc, params, fs) schedule(static) num_threads(4)
+#endif
+      for(int p = 0; p < 4; p++)
+      {
+        fs[p] = objfunc(vp[p], params);
+      }
+      fr = fs[0];
+    }
+    else
+    {
+      fr = objfunc(vr, params);
+    }
     k++;
 
     if(fr < f[vh] && fr >= f[vs])
@@ -240,16 +282,23 @@ static int simplex(double (*objfunc)(double[], void *params), double start[], in
     /* investigate a step further in this direction */
     if(fr < f[vs])
     {
-      for(j = 0; j <= n - 1; j++)
+      if(parallel)
       {
-        /*ve[j] = NMS_GAMMA*vr[j] + (1-NMS_GAMMA)*vm[j];*/
-        ve[j] = vm[j] + NMS_GAMMA * (vr[j] - vm[j]);
+        fe = fs[1];
       }
-      if(constrain != NULL)
+      else
       {
-        constrain(ve, n);
+        for(j = 0; j <= n - 1; j++)
+        {
+          /*ve[j] = NMS_GAMMA*vr[j] + (1-NMS_GAMMA)*vm[j];*/
+          ve[j] = vm[j] + NMS_GAMMA * (vr[j] - vm[j]);
+        }
+        if(constrain != NULL)
+        {
+          constrain(ve, n);
+        }
+        fe = objfunc(ve, params);
       }
-      fe = objfunc(ve, params);
       k++;
 
       /* by making fe < fr as opposed to fe < f[vs],
@@ -280,31 +329,46 @@ static int simplex(double (*objfunc)(double[], void *params), double start[], in
       if(fr < f[vg] && fr >= f[vh])
       {
         /* perform outside contraction */
-        for(j = 0; j <= n - 1; j++)
+        if(parallel)
         {
-          /*vc[j] = NMS_BETA*v[vg][j] + (1-NMS_BETA)*vm[j];*/
-          vc[j] = vm[j] + NMS_BETA * (vr[j] - vm[j]);
+          fc = fs[2];
         }
-        if(constrain != NULL)
+        else
         {
-          constrain(vc, n);
+          for(j = 0; j <= n - 1; j++)
+          {
+            /*vc[j] = NMS_BETA*v[vg][j] + (1-NMS_BETA)*vm[j];*/
+            vc[j] = vm[j] + NMS_BETA * (vr[j] - vm[j]);
+          }
+          if(constrain != NULL)
+          {
+            constrain(vc, n);
+          }
+          fc = objfunc(vc, params);
         }
-        fc = objfunc(vc, params);
         k++;
       }
       else
       {
         /* perform inside contraction */
-        for(j = 0; j <= n - 1; j++)
+        if(parallel)
         {
-          /*vc[j] = NMS_BETA*v[vg][j] + (1-NMS_BETA)*vm[j];*/
-          vc[j] = vm[j] - NMS_BETA * (vm[j] - v[vg][j]);
+          memcpy(vc, vi, n * sizeof(double));
+          fc = fs[3];
         }
-        if(constrain != NULL)
+        else
         {
-          constrain(vc, n);
+          for(j = 0; j <= n - 1; j++)
+          {
+            /*vc[j] = NMS_BETA*v[vg][j] + (1-NMS_BETA)*vm[j];*/
+            vc[j] = vm[j] - NMS_BETA * (vm[j] - v[vg][j]);
+          }
+          if(constrain != NULL)
+          {
+            constrain(vc, n);
+          }
+          fc = objfunc(vc, params);
         }
-        fc = objfunc(vc, params);
         k++;
       }
 
@@ -338,14 +402,20 @@ static int simplex(double (*objfunc)(double[], void *params), double start[], in
         {
           constrain(v[vg], n);
         }
-        f[vg] = objfunc(v[vg], params);
-        k++;
         if(constrain != NULL)
         {
           constrain(v[vh], n);
         }
-        f[vh] = objfunc(v[vh], params);
-        k++;
+        const int vp[2] = { vg, vh };
+        const int vpcount = vg == vh ? 1 : 2;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(objfunc, params, v, f) if(parallel) schedule(static) num_threads(2)
+#endif
+        for(int p = 0; p < vpcount; p++)
+        {
+          f[vp[p]] = objfunc(v[vp[p]], params);
+        }
+        k += vpcount;
       }
     }
 #if 0
@@ -407,6 +477,7 @@ static int simplex(double (*objfunc)(double[], void *params), double start[], in
   free(vr);
   free(ve);
   free(vc);
+  free(vi);
   free(vm);
   for(i = 0; i <= n; i++)
   {
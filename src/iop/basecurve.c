@@ -20,6 +20,7 @@
 #endif
 #include "bauhaus/bauhaus.h"
 #include "common/debug.h"
+#include "common/locallaplacian.h"
 #include "common/opencl.h"
 #include "control/control.h"
 #include "develop/develop.h"
@@ -338,14 +339,14 @@ static void set_presets(dt_iop_module_so_t *self, const basecurve_preset_t *pres
 void init_presets(dt_iop_module_so_t *self)
 {
   // sql begin
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "BEGIN", NULL, NULL, NULL);
+  dt_database_start_transaction(darktable.db);
 
   set_presets(self, basecurve_presets, basecurve_presets_cnt, NULL);
   int force_autoapply = dt_conf_get_bool("plugins/darkroom/basecurve/auto_apply_percamera_presets");
   set_presets(self, basecurve_camera_presets, basecurve_camera_presets_cnt, &force_autoapply);
 
   // sql commit
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+  dt_database_release_transaction(darktable.db);
 }
 
 static float exposure_increment(float stops, int e, float fusion, float bias)
@@ -796,7 +797,7 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
   {
     const int rad = MIN(roi_in->width, ceilf(256 * roi_in->scale / piece->iscale));
 
-    tiling->factor = 6.666f;                 // in + out + col[] + comb[] + 2*tmp
+    tiling->factor = 4.666f;                 // in + out + col[] + comb[]
     tiling->maxbuf = 1.0f;
     tiling->overhead = 0;
     tiling->xalign = 1;
@@ -816,7 +817,9 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
 }
 
 
-static inline void apply_ev_and_curve(
+// push by some ev, apply the base curve and compute the weights of well exposedness and saturation, in one go.
+// local contrast is the third part of the weight, it's handled in laplacian form later.
+static inline void apply_ev_curve_and_features(
     const float *const in,
     float *const out,
     const int width,
@@ -842,133 +845,18 @@ static inline void apply_ev_and_curve(
         outp[i] = dt_iop_eval_exp(unbounded_coeffs, f);
       else outp[i] = 1.0f;
     }
-  }
-}
 
-static inline void compute_features(
-    float *const col,
-    const int wd,
-    const int ht)
-{
-  // features are product of
-  // 1) well exposedness
-  // 2) saturation
-  // 3) local contrast (handled in laplacian form later)
-#ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(static) collapse(2)
-#endif
-  for(int j=0;j<ht;j++) for(int i=0;i<wd;i++)
-  {
-    const size_t x = 4ul*(wd*j+i);
-    const float max = MAX(col[x], MAX(col[x+1], col[x+2]));
-    const float min = MIN(col[x], MIN(col[x+1], col[x+2]));
+    const float max = MAX(outp[0], MAX(outp[1], outp[2]));
+    const float min = MIN(outp[0], MIN(outp[1], outp[2]));
     const float sat = .1f + .1f*(max-min)/MAX(1e-4, max);
-    col[x+3] = sat;
 
     const float c = 0.54f;
-    float v = fabsf(col[x]-c);
-    v = MAX(fabsf(col[x+1]-c), v);
-    v = MAX(fabsf(col[x+2]-c), v);
+    float v = fabsf(outp[0]-c);
+    v = MAX(fabsf(outp[1]-c), v);
+    v = MAX(fabsf(outp[2]-c), v);
     const float var = 0.5;
     const float exp = .2f + dt_fast_expf(-v*v/(var*var));
-    col[x+3] *= exp;
-  }
-}
-
-static inline void gauss_blur(
-    const float *const input,
-    float *const output,
-    const size_t wd,
-    const size_t ht)
-{
-  const float w[5] = {1./16., 4./16., 6./16., 4./16., 1./16.};
-  float *tmp = dt_alloc_align(64, (size_t)wd*ht*4*sizeof(float));
-  memset(tmp, 0, 4*wd*ht*sizeof(float));
-#ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(static) shared(tmp)
-#endif
-  for(int j=0;j<ht;j++)
-  { // horizontal pass
-    // left borders
-    for(int i=0;i<2;i++) for(int c=0;c<4;c++)
-      for(int ii=-2;ii<=2;ii++)
-        tmp[4*(j*wd+i)+c] += input[4*(j*wd+MAX(-i-ii,i+ii))+c] * w[ii+2];
-    // most pixels
-    for(int i=2;i<wd-2;i++) for(int c=0;c<4;c++)
-      for(int ii=-2;ii<=2;ii++)
-        tmp[4*(j*wd+i)+c] += input[4*(j*wd+i+ii)+c] * w[ii+2];
-    // right borders
-    for(int i=wd-2;i<wd;i++) for(int c=0;c<4;c++)
-      for(int ii=-2;ii<=2;ii++)
-        tmp[4*(j*wd+i)+c] += input[4*(j*wd+MIN(i+ii, wd-(i+ii-wd+1) ))+c] * w[ii+2];
-  }
-  memset(output, 0, 4*wd*ht*sizeof(float));
-#ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(static) shared(tmp)
-#endif
-  for(int i=0;i<wd;i++)
-  { // vertical pass
-    for(int j=0;j<2;j++) for(int c=0;c<4;c++)
-      for(int jj=-2;jj<=2;jj++)
-        output[4*(j*wd+i)+c] += tmp[4*(MAX(-j-jj,j+jj)*wd+i)+c] * w[jj+2];
-    for(int j=2;j<ht-2;j++) for(int c=0;c<4;c++)
-      for(int jj=-2;jj<=2;jj++)
-        output[4*(j*wd+i)+c] += tmp[4*((j+jj)*wd+i)+c] * w[jj+2];
-    for(int j=ht-2;j<ht;j++) for(int c=0;c<4;c++)
-      for(int jj=-2;jj<=2;jj++)
-        output[4*(j*wd+i)+c] += tmp[4*(MIN(j+jj, ht-(j+jj-ht+1))*wd+i)+c] * w[jj+2];
-  }
-  dt_free_align(tmp);
-}
-
-static inline void gauss_expand(
-    const float *const input, // coarse input
-    float *const fine,        // upsampled, blurry output
-    const size_t wd,          // fine res
-    const size_t ht)
-{
-  const size_t cw = (wd-1)/2+1;
-  // fill numbers in even pixels, zero odd ones
-  memset(fine, 0, 4*wd*ht*sizeof(float));
-#ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(static) collapse(2)
-#endif
-  for(int j=0;j<ht;j+=2)
-    for(int i=0;i<wd;i+=2)
-      for(int c=0;c<4;c++)
-        fine[4*(j*wd+i)+c] = 4.0f * input[4*(j/2*cw + i/2)+c];
-
-  // convolve with same kernel weights mul by 4:
-  gauss_blur(fine, fine, wd, ht);
-}
-
-// XXX FIXME: we'll need to pad up the image to get a good boundary condition!
-// XXX FIXME: downsampling will not result in an energy conserving pattern (every 4 pixels one sample)
-// XXX FIXME: neither will a mirror boundary condition (mirrors in subsampled values at random density)
-// TODO: copy laplacian code from local laplacian filters, it's faster.
-static inline void gauss_reduce(
-    const float *const input, // fine input buffer
-    float *const coarse,      // coarse scale, blurred input buf
-    float *const detail,      // detail/laplacian, fine scale, or 0
-    const size_t wd,
-    const size_t ht)
-{
-  // blur, store only coarse res
-  const size_t cw = (wd-1)/2+1, ch = (ht-1)/2+1;
-
-  float *blurred = dt_alloc_align(64, (size_t)wd*ht*4*sizeof(float));
-  gauss_blur(input, blurred, wd, ht);
-  for(size_t j=0;j<ch;j++) for(size_t i=0;i<cw;i++)
-    for(int c=0;c<4;c++) coarse[4*(j*cw+i)+c] = blurred[4*(2*j*wd+2*i)+c];
-  dt_free_align(blurred);
-
-  if(detail)
-  {
-    // compute laplacian/details: expand coarse buffer into detail
-    // buffer subtract expanded buffer from input in place
-    gauss_expand(coarse, detail, wd, ht);
-    for(size_t k=0;k<wd*ht*4;k++)
-      detail[k] = input[k] - detail[k];
+    outp[3] = sat * exp;
   }
 }
 
@@ -983,20 +871,20 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   // are we doing exposure fusion?
   if(d->exposure_fusion)
   {
-    // allocate temporary buffer for wavelet transform + blending
+    // dimensions and offsets of the pyramid levels
     const int wd = roi_in->width, ht = roi_in->height;
     int num_levels = 8;
-    float **col  = malloc(num_levels * sizeof(float*));
-    float **comb = malloc(num_levels * sizeof(float*));
+    int lw[8], lh[8];
+    size_t loff[8];
     int w = wd, h = ht;
+    size_t size = 0;
     const int rad = MIN(wd, ceilf(256 * roi_in->scale / piece->iscale));
     int step = 1;
     for(int k=0;k<num_levels;k++)
     {
+      lw[k] = w; lh[k] = h; loff[k] = size;
+      size += 4ul*w*h;
       // coarsest step is some % of image width.
-      col[k]  = dt_alloc_align(64, sizeof(float)*4ul*w*h);
-      comb[k] = dt_alloc_align(64, sizeof(float)*4ul*w*h);
-      memset(comb[k], 0, sizeof(float)*4*w*h);
       w = (w-1)/2+1; h = (h-1)/2+1;
       step *= 2;
       if(step > rad || w < 4 || h < 4)
@@ -1006,124 +894,138 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       }
     }
 
+    // one buffer for the pyramid of the current exposure and the blended output pyramid. it comes from the
+    // pipe's pool, so a later run of the pipe gets it back without allocating, and goes back at the end.
+    dt_dev_pixelpipe_pool_t *const pool = &piece->pipe->pool;
+    float *const buf = dt_dev_pixelpipe_pool_alloc(pool, sizeof(float)*2*size);
+    if(!buf)
+    {
+      memcpy(ovoid, ivoid, sizeof(float)*4ul*wd*ht);
+      return;
+    }
+    float *col[8], *comb[8];
+    for(int k=0;k<num_levels;k++)
+    {
+      col[k]  = buf + loff[k];
+      comb[k] = buf + size + loff[k];
+    }
+    memset(comb[0], 0, sizeof(float)*size);
+
     for(int e=0;e<d->exposure_fusion+1;e++)
     { // for every exposure fusion image:
-      // push by some ev, apply base curve:
-      apply_ev_and_curve(in, col[0], wd, ht,
-                         exposure_increment(d->exposure_stops, e, d->exposure_fusion, d->exposure_bias), d->table,
-                         d->unbounded_coeffs);
-
-      // compute features
-      compute_features(col[0], wd, ht);
-
-      // create gaussian pyramid of colour buffer
-      w = wd; h = ht;
-      gauss_reduce(col[0], col[1], out, w, h);
+      // push by some ev, apply base curve and compute the first two features in one pass
+      apply_ev_curve_and_features(in, col[0], wd, ht,
+                                  exposure_increment(d->exposure_stops, e, d->exposure_fusion, d->exposure_bias),
+                                  d->table, d->unbounded_coeffs);
+
+      if(num_levels == 1)
+      { // too small for a pyramid, just blend the images
+        float *const c0 = col[0], *const b0 = comb[0];
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(col) schedule(static)
+#pragma omp parallel for default(none) schedule(static)
 #endif
-      for(size_t k=0;k<4ul*wd*ht;k+=4)
-        col[0][k+3] *= .1f + sqrtf(out[k]*out[k] + out[k+1]*out[k+1] + out[k+2]*out[k+2]);
+        for(size_t x=0;x<4ul*wd*ht;x+=4)
+        {
+          for(int c=0;c<3;c++) b0[x+c] += c0[x+3] * c0[x+c];
+          b0[x+3] += c0[x+3];
+        }
+        continue;
+      }
 
-// #define DEBUG_VIS2
-#ifdef DEBUG_VIS2 // transform weights in channels
-      for(size_t k=0;k<4ul*w*h;k+=4)
-        col[0][k+e] = col[0][k+3];
-#endif
+      // finest laplacian, abuse output buffer as temporary memory:
+      local_laplacian_reduce4(col[0], col[1], wd, ht);
+      local_laplacian_expand4(col[1], out, wd, ht);
 
-// #define DEBUG_VIS
-#ifdef DEBUG_VIS // DEBUG visualise weight buffer
-      for(size_t k=0;k<4ul*w*h;k+=4)
-        comb[0][k+e] = col[0][k+3];
-      continue;
+      // multiply in local contrast as the last feature and blend the finest level into the output pyramid
+      {
+        float *const c0 = col[0], *const b0 = comb[0];
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
 #endif
+        for(size_t x=0;x<4ul*wd*ht;x+=4)
+        {
+          const float l[3] = { c0[x] - out[x], c0[x+1] - out[x+1], c0[x+2] - out[x+2] };
+          const float weight = c0[x+3] * (.1f + sqrtf(l[0]*l[0] + l[1]*l[1] + l[2]*l[2]));
+          c0[x+3] = weight;
+          for(int c=0;c<3;c++) b0[x+c] += weight * l[c];
+          b0[x+3] += weight;
+        }
+      }
 
+      // create gaussian pyramid of colour buffer. colours of the coarser levels don't depend on the weights,
+      // but the weights themselves changed, so level 1 has to be computed again.
       for(int k=1;k<num_levels;k++)
-      {
-        gauss_reduce(col[k-1], col[k], 0, w, h);
-        w = (w-1)/2+1; h = (h-1)/2+1;
-      }
+        local_laplacian_reduce4(col[k-1], col[k], lw[k-1], lh[k-1]);
 
       // update pyramid coarse to fine
-      for(int k=num_levels-1;k>=0;k--)
+      for(int k=num_levels-1;k>0;k--)
       {
-        w = wd; h = ht;
-        for(int i=0;i<k;i++) { w = (w-1)/2+1; h = (h-1)/2+1; }
-        // abuse output buffer as temporary memory:
-        if(k!=num_levels-1)
-          gauss_expand(col[k+1], out, w, h);
+        w = lw[k]; h = lh[k];
+        float *const ck = col[k], *const bk = comb[k];
+        if(k == num_levels-1)
+        { // blend gaussian base
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(col,comb,w,h,num_levels,k) schedule(static)
+#pragma omp parallel for default(none) shared(w, h) schedule(static)
 #endif
-        for(int j=0;j<h;j++) for(int i=0;i<w;i++)
-        {
-          const size_t x = 4ul*(w*j+i);
-          // blend images into output pyramid
-          if(k == num_levels-1) // blend gaussian base
-#ifdef DEBUG_VIS2
-            ;
-#else
-            for(int c=0;c<3;c++)
-              comb[k][x+c] += col[k][x+3] * col[k][x+c];
+          for(size_t x=0;x<4ul*w*h;x+=4)
+          {
+            for(int c=0;c<3;c++) bk[x+c] += ck[x+3] * ck[x+c];
+            bk[x+3] += ck[x+3];
+          }
+        }
+        else
+        { // laplacian
+          local_laplacian_expand4(col[k+1], out, w, h);
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(w, h) schedule(static)
 #endif
-          else // laplacian
-            for(int c=0;c<3;c++) comb[k][x+c] +=
-              col[k][x+3] * (col[k][x+c] - out[x+c]);
-          comb[k][x+3] += col[k][x+3];
+          for(size_t x=0;x<4ul*w*h;x+=4)
+          {
+            for(int c=0;c<3;c++) bk[x+c] += ck[x+3] * (ck[x+c] - out[x+c]);
+            bk[x+3] += ck[x+3];
+          }
         }
       }
     }
 
-#ifndef DEBUG_VIS // DEBUG: switch off when visualising weight buf
     // normalise and reconstruct output pyramid buffer coarse to fine
     for(int k=num_levels-1;k>=0;k--)
     {
-      w = wd; h = ht;
-      for(int i=0;i<k;i++) { w = (w-1)/2+1; h = (h-1)/2+1;}
+      w = lw[k]; h = lh[k];
+      float *const bk = comb[k];
 
       // normalise both gaussian base and laplacians:
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(comb,w,h,k) schedule(static)
+#pragma omp parallel for default(none) shared(w, h) schedule(static)
 #endif
       for(size_t i=0;i<(size_t)4*w*h;i+=4)
-        if(comb[k][i+3] > 1e-8f)
-          for(int c=0;c<3;c++) comb[k][i+c] /= comb[k][i+3];
+        if(bk[i+3] > 1e-8f)
+          for(int c=0;c<3;c++) bk[i+c] /= bk[i+3];
 
       if(k < num_levels-1)
       { // reconstruct output image
-        gauss_expand(comb[k+1], out, w, h);
+        local_laplacian_expand4(comb[k+1], out, w, h);
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(comb,w,h,k) schedule(static)
+#pragma omp parallel for default(none) shared(w, h) schedule(static)
 #endif
-        for(int j=0;j<h;j++) for(int i=0;i<w;i++)
-        {
-          const size_t x = 4ul*(w*j+i);
-          for(int c=0;c<3;c++) comb[k][x+c] += out[x+c];
-        }
+        for(size_t x=0;x<4ul*w*h;x+=4)
+          for(int c=0;c<3;c++) bk[x+c] += out[x+c];
       }
     }
-#endif
 
     // copy output buffer
+    const float *const b0 = comb[0];
 #ifdef _OPENMP
-#pragma omp parallel for default(none) shared(comb) schedule(static)
+#pragma omp parallel for default(none) schedule(static)
 #endif
     for(size_t k=0;k<4ul*wd*ht;k+=4)
     {
-      out[k+0] = comb[0][k+0];
-      out[k+1] = comb[0][k+1];
-      out[k+2] = comb[0][k+2];
+      out[k+0] = b0[k+0];
+      out[k+1] = b0[k+1];
+      out[k+2] = b0[k+2];
       out[k+3] = in[k+3]; // pass on 4th channel
     }
-
-    // free temp buffers
-    for(int k=0;k<num_levels;k++)
-    {
-      dt_free_align(col[k]);
-      dt_free_align(comb[k]);
-    }
-    free(col);
-    free(comb);
+    dt_dev_pixelpipe_pool_free(pool, buf);
     return;
   }
 
@@ -203,25 +203,22 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     for(int k = 0; k < 5; k++) sigma[k] = 1.0f / sigma[k];
     PermutohedralLattice<5, 4> lattice((size_t)roi_in->width * roi_in->height, omp_get_max_threads());
 
-// splat into the lattice
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif
-    for(int j = 0; j < roi_in->height; j++)
-    {
-      const float *in = (const float *)ivoid + (size_t)j * roi_in->width * ch;
-      const int thread = omp_get_thread_num();
-      size_t index = (size_t)j * roi_in->width;
-      for(int i = 0; i < roi_in->width; i++, index++)
-      {
-        float pos[5] = { i * sigma[0], j * sigma[1], in[0] * sigma[2], in[1] * sigma[3], in[2] * sigma[4] };
-        float val[4] = { in[0], in[1], in[2], 1.0 };
-        lattice.splat(pos, val, index, thread);
-        in += ch;
-      }
-    }
-
-    lattice.merge_splat_threads();
+    // splat into the lattice
+    lattice.splat(roi_in->height, roi_in->width, [&](const int j, const int i, float *pos, float *val) {
+      const float *in = (const float *)ivoid + ((size_t)j * roi_in->width + i) * ch;
+      pos[0] = i * sigma[0];
+      pos[1] = j * sigma[1];
+      pos[2] = in[0] * sigma[2];
+      pos[3] = in[1] * sigma[3];
+      pos[4] = in[2] * sigma[4];
+      val[0] = in[0];
+      val[1] = in[1];
+      val[2] = in[2];
+      val[3] = 1.0f;
+    });
+
+    dt_print(DT_DEBUG_MEMORY, "[bilateral] lattice with %d points uses %.1f MB\n", lattice.points(),
+             lattice.memoryFootprint() / (1024.0 * 1024.0));
 
     // blur the lattice
     lattice.blur();
@@ -19,6 +19,7 @@
 #include "config.h"
 #endif
 #include "common/darktable.h"
+#include "control/conf.h"
 #include "develop/imageop.h"
 #include "develop/imageop_math.h"
 #include "gui/gtk.h"
@@ -42,12 +43,41 @@ typedef struct dt_iop_cacorrect_gui_data_t
 {
 } dt_iop_cacorrect_gui_data_t;
 
+#define CA_FIT_CACHE_SIZE 8
+
+// the polynomial fit of the block shifts, see CA_correct(). only valid for the region and
+// camera/lens/focal length it was measured on.
+typedef struct dt_iop_cacorrect_fit_t
+{
+  char lens[128];
+  float focal_length;
+  uint32_t filters;
+  int x, y, width, height;
+  float scale;
+
+  int polyord;
+  double fitparams[2][2][16];
+  uint64_t age;
+} dt_iop_cacorrect_fit_t;
+
 typedef struct dt_iop_cacorrect_data_t
 {
+  // work space of the last run, kept as long as the size of the input doesn't change
+  int width, height;
+  float *Gtmp;
+  float *RawDataTmp;
+  char *buffer1;
+  // per thread tile buffers. each thread allocates and first touches its own one.
+  int nthreads;
+  char **tilebuf;
 } dt_iop_cacorrect_data_t;
 
 typedef struct dt_iop_cacorrect_global_data_t
 {
+  // fits of earlier images, used when plugins/darkroom/cacorrect/reuse_fit is set
+  dt_pthread_mutex_t lock;
+  uint64_t clock;
+  dt_iop_cacorrect_fit_t fit[CA_FIT_CACHE_SIZE];
 } dt_iop_cacorrect_global_data_t;
 
 // this returns a translatable name
@@ -290,6 +320,80 @@ static gboolean LinEqSolve(int nDim, double *pfMatr, double *pfVect, double *pfS
 // end of linear equation solver
 //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 
+// look for a fit matching the one in key and copy its parameters over.
+static gboolean ca_fit_lookup(dt_iop_cacorrect_global_data_t *gd, dt_iop_cacorrect_fit_t *key)
+{
+  gboolean found = FALSE;
+  dt_pthread_mutex_lock(&gd->lock);
+  for(int k = 0; k < CA_FIT_CACHE_SIZE; k++)
+  {
+    dt_iop_cacorrect_fit_t *fit = gd->fit + k;
+    if(fit->polyord > 0 && !strcmp(fit->lens, key->lens) && fit->focal_length == key->focal_length
+       && fit->filters == key->filters && fit->x == key->x && fit->y == key->y && fit->width == key->width
+       && fit->height == key->height && fit->scale == key->scale)
+    {
+      fit->age = ++gd->clock;
+      key->polyord = fit->polyord;
+      memcpy(key->fitparams, fit->fitparams, sizeof(key->fitparams));
+      found = TRUE;
+      break;
+    }
+  }
+  dt_pthread_mutex_unlock(&gd->lock);
+  return found;
+}
+
+// remember a fit, replacing the one used least recently.
+static void ca_fit_store(dt_iop_cacorrect_global_data_t *gd, const dt_iop_cacorrect_fit_t *fit)
+{
+  dt_pthread_mutex_lock(&gd->lock);
+  int oldest = 0;
+  for(int k = 1; k < CA_FIT_CACHE_SIZE; k++)
+    if(gd->fit[k].age < gd->fit[oldest].age) oldest = k;
+  gd->fit[oldest] = *fit;
+  gd->fit[oldest].age = ++gd->clock;
+  dt_pthread_mutex_unlock(&gd->lock);
+}
+
+// (re)allocate the work space of CA_correct() in the pipe's data if the image size changed.
+static gboolean ca_alloc_buffers(dt_iop_cacorrect_data_t *d, const int width, const int height,
+                                 const size_t buffer1size)
+{
+  if(d->Gtmp && d->width == width && d->height == height) return TRUE;
+
+  dt_free_align(d->Gtmp);
+  dt_free_align(d->RawDataTmp);
+  dt_free_align(d->buffer1);
+  d->Gtmp = dt_alloc_align(64, (size_t)height * width * sizeof(float));
+  d->RawDataTmp = dt_alloc_align(64, (size_t)height * width * sizeof(float) / 2 + 4);
+  d->buffer1 = dt_alloc_align(64, buffer1size);
+
+  if(!d->Gtmp || !d->RawDataTmp || !d->buffer1)
+  {
+    dt_free_align(d->Gtmp);
+    dt_free_align(d->RawDataTmp);
+    dt_free_align(d->buffer1);
+    d->Gtmp = d->RawDataTmp = NULL;
+    d->buffer1 = NULL;
+    d->width = d->height = 0;
+    return FALSE;
+  }
+
+  d->width = width;
+  d->height = height;
+  return TRUE;
+}
+
+static void ca_free_buffers(dt_iop_cacorrect_data_t *d)
+{
+  dt_free_align(d->Gtmp);
+  dt_free_align(d->RawDataTmp);
+  dt_free_align(d->buffer1);
+  for(int k = 0; k < d->nthreads; k++) free(d->tilebuf[k]);
+  free(d->tilebuf);
+  memset(d, 0, sizeof(dt_iop_cacorrect_data_t));
+}
+
 static inline void pixSort(float *a, float *b)
 {
   if(*a > *b)
@@ -304,10 +408,12 @@ static inline void pixSort(float *a, float *b)
 static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *const in2,
                        float *out, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
+  dt_iop_cacorrect_data_t *d = (dt_iop_cacorrect_data_t *)piece->data;
+  dt_iop_cacorrect_global_data_t *gd = (dt_iop_cacorrect_global_data_t *)self->data;
   const int width = roi_in->width;
   const int height = roi_in->height;
   const uint32_t filters = piece->pipe->dsc.filters;
-  memcpy(out, in2, width * height * sizeof(float));
+  memcpy(out, in2, (size_t)width * height * sizeof(float));
   const float *const in = out;
   const double cared = 0, cablue = 0;
   const double caautostrength = 4;
@@ -336,13 +442,6 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
   //   }
 
   const gboolean autoCA = (cared == 0 && cablue == 0);
-  // local variables
-  //   const int width = W, height = H;
-  // temporary array to store simple interpolation of G
-  float *Gtmp = (float(*))calloc((height) * (width), sizeof *Gtmp);
-
-  // temporary array to avoid race conflicts, only every second pixel needs to be saved here
-  float *RawDataTmp = (float *)malloc(height * width * sizeof(float) / 2 + 4);
 
   float blockave[2][2] = { { 0, 0 }, { 0, 0 } }, blocksqave[2][2] = { { 0, 0 }, { 0, 0 } },
         blockdenom[2][2] = { { 0, 0 }, { 0, 0 } }, blockvar[2][2];
@@ -358,7 +457,31 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
   const int vblsz = ceil((float)(height + border2) / (ts - border2) + 2 + vz1);
   const int hblsz = ceil((float)(width + border2) / (ts - border2) + 2 + hz1);
 
-  char *buffer1 = (char *)calloc(vblsz * hblsz * (2 * 2 + 1), sizeof(float));
+  // local variables
+  //   const int width = W, height = H;
+  const size_t buffer1size = (size_t)vblsz * hblsz * (2 * 2 + 1) * sizeof(float);
+  if(!ca_alloc_buffers(d, width, height, buffer1size)) return;
+
+  // temporary array to store simple interpolation of G
+  float *Gtmp = d->Gtmp;
+  memset(Gtmp, 0, (size_t)height * width * sizeof(float));
+
+  // temporary array to avoid race conflicts, only every second pixel needs to be saved here
+  float *RawDataTmp = d->RawDataTmp;
+
+  char *buffer1 = d->buffer1;
+  memset(buffer1, 0, buffer1size);
+
+  // tile buffers of the threads
+  const int nthreads = dt_get_num_threads();
+  if(d->nthreads < nthreads)
+  {
+    char **tilebuf = realloc(d->tilebuf, nthreads * sizeof(char *));
+    if(!tilebuf) return;
+    for(int k = d->nthreads; k < nthreads; k++) tilebuf[k] = NULL;
+    d->tilebuf = tilebuf;
+    d->nthreads = nthreads;
+  }
 
   // block CA shift values and weight assigned to block
   float *blockwt = (float *)buffer1;
@@ -369,6 +492,26 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
   // order of 2d polynomial fit (polyord), and numpar=polyord^2
   int polyord = 4, numpar = 16;
 
+  // the same lens at the same focal length gives the same fit, if the user is fine with that
+  // we only measure it once and skip the estimation on the following images.
+  const gboolean reuse_fit = autoCA && dt_conf_get_bool("plugins/darkroom/cacorrect/reuse_fit")
+                             && piece->pipe->image.exif_lens[0] != '\0';
+  dt_iop_cacorrect_fit_t fit = { .focal_length = piece->pipe->image.exif_focal_length,
+                                 .filters = filters,
+                                 .x = roi_in->x,
+                                 .y = roi_in->y,
+                                 .width = width,
+                                 .height = height,
+                                 .scale = roi_in->scale };
+  g_strlcpy(fit.lens, piece->pipe->image.exif_lens, sizeof(fit.lens));
+  const gboolean have_fit = reuse_fit && ca_fit_lookup(gd, &fit);
+  if(have_fit)
+  {
+    polyord = fit.polyord;
+    numpar = polyord * polyord;
+    memcpy(fitparams, fit.fitparams, sizeof(fitparams));
+  }
+
   const float eps = 1e-5f, eps2 = 1e-10f; // tolerance to avoid dividing by zero
 
 #ifdef _OPENMP
@@ -395,7 +538,13 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
 
     // assign working space
     const int buffersize = 3 * sizeof(float) * ts * ts + 6 * sizeof(float) * ts * tsh + 8 * 64 + 63;
-    char *buffer = (char *)malloc(buffersize);
+    const int thread = dt_get_thread_num();
+    char *buffer = thread < nthreads ? d->tilebuf[thread] : NULL;
+    if(!buffer)
+    {
+      buffer = (char *)malloc(buffersize);
+      if(thread < nthreads) d->tilebuf[thread] = buffer;
+    }
     char *data = (char *)(((uintptr_t)buffer + (uintptr_t)63) / 64 * 64);
 
     // shift the beginning of all arrays but the first by 64 bytes to avoid cache miss conflicts on CPUs which
@@ -615,6 +764,9 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
               }
             }
           }
+
+          // with a fit from an earlier image we're done with this tile
+          if(have_fit) continue;
 //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 #ifdef __SSE2__
           vfloat zd25v = F2V(0.25f);
@@ -888,6 +1040,7 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
 #ifdef _OPENMP
 #pragma omp single
 #endif
+      if(!have_fit)
       {
         for(int dir = 0; dir < 2; dir++)
           for(int c = 0; c < 2; c++)
@@ -1005,36 +1158,35 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
 
                 numblox[c]++;
 
-                for(int dir = 0; dir < 2; dir++)
+                // powers of the block position, up to the degree of the products of two monomials
+                double powVblock[7], powHblock[7];
+                powVblock[0] = powHblock[0] = 1.0;
+                for(int i = 1; i < 2 * polyord - 1; i++)
                 {
-                  double powVblockInit = 1.0;
-                  for(int i = 0; i < polyord; i++)
+                  powVblock[i] = powVblock[i - 1] * vblock;
+                  powHblock[i] = powHblock[i - 1] * hblock;
+                }
+
+                const float wt = blockwt[vblock * hblsz + hblock];
+
+                // the matrix doesn't depend on the direction, it's copied for dir = 1 below
+                for(int i = 0; i < polyord; i++)
+                  for(int j = 0; j < polyord; j++)
                   {
-                    double powHblockInit = 1.0;
-                    for(int j = 0; j < polyord; j++)
-                    {
-                      double powVblock = powVblockInit;
-                      for(int m = 0; m < polyord; m++)
+                    for(int m = 0; m < polyord; m++)
+                      for(int n = 0; n < polyord; n++)
                       {
-                        double powHblock = powHblockInit;
-                        for(int n = 0; n < polyord; n++)
-                        {
-                          polymat[c][dir][numpar * (polyord * i + j) + (polyord * m + n)]
-                              += powVblock * powHblock * blockwt[vblock * hblsz + hblock];
-                          powHblock *= hblock;
-                        }
-                        powVblock *= vblock;
+                        polymat[c][0][numpar * (polyord * i + j) + (polyord * m + n)]
+                            += powVblock[i + m] * powHblock[j + n] * wt;
                       }
-                      shiftmat[c][dir][(polyord * i + j)]
-                          += powVblockInit * powHblockInit * bstemp[dir] * blockwt[vblock * hblsz + hblock];
-                      powHblockInit *= hblock;
-                    }
-                    powVblockInit *= vblock;
+                    for(int dir = 0; dir < 2; dir++)
+                      shiftmat[c][dir][(polyord * i + j)] += powVblock[i] * powHblock[j] * bstemp[dir] * wt;
                   } // monomials
-                }   // dir
               }     // c
             }       // blocks
 
+          for(int c = 0; c < 2; c++) memcpy(polymat[c][1], polymat[c][0], sizeof(polymat[c][1]));
+
           numblox[1] = MIN(numblox[0], numblox[1]);
 
           // if too few data points, restrict the order of the fit to linear
@@ -1065,6 +1217,13 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
                   processpasstwo = FALSE;
                 }
               }
+
+          if(processpasstwo && reuse_fit)
+          {
+            fit.polyord = polyord;
+            memcpy(fit.fitparams, fitparams, sizeof(fitparams));
+            ca_fit_store(gd, &fit);
+          }
         }
 
         // fitparams[polyord*i+j] gives the coefficients of (vblock^i hblock^j) in a polynomial fit for i,j<=4
@@ -1459,14 +1618,10 @@ static void CA_correct(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
         }
     }
 
-    // clean up
-    free(buffer);
+    // clean up, unless the buffer went to the pipe's data
+    if(thread >= nthreads) free(buffer);
   }
 
-  free(Gtmp);
-  free(buffer1);
-  free(RawDataTmp);
-
   //   if(plistener)
   //   {
   //     plistener->setProgress(1.0);
@@ -1509,8 +1664,6 @@ end:
 /** init, cleanup, commit to pipeline */
 void init(dt_iop_module_t *module)
 {
-  // we don't need global data:
-  module->data = NULL; // malloc(sizeof(dt_iop_cacorrect_global_data_t));
   module->params = calloc(1, sizeof(dt_iop_cacorrect_params_t));
   module->default_params = calloc(1, sizeof(dt_iop_cacorrect_params_t));
   // our module is disabled by default
@@ -1527,7 +1680,21 @@ void cleanup(dt_iop_module_t *module)
 {
   free(module->params);
   module->params = NULL;
-  free(module->data); // just to be sure
+}
+
+void init_global(dt_iop_module_so_t *module)
+{
+  dt_iop_cacorrect_global_data_t *gd
+      = (dt_iop_cacorrect_global_data_t *)calloc(1, sizeof(dt_iop_cacorrect_global_data_t));
+  dt_pthread_mutex_init(&gd->lock, NULL);
+  module->data = gd;
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_cacorrect_global_data_t *gd = (dt_iop_cacorrect_global_data_t *)module->data;
+  dt_pthread_mutex_destroy(&gd->lock);
+  free(module->data);
   module->data = NULL;
 }
 
@@ -1543,12 +1710,13 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *params, dt_dev
 
 void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
-  piece->data = malloc(sizeof(dt_iop_cacorrect_data_t));
+  piece->data = calloc(1, sizeof(dt_iop_cacorrect_data_t));
   self->commit_params(self, self->default_params, pipe, piece);
 }
 
 void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
+  ca_free_buffers((dt_iop_cacorrect_data_t *)piece->data);
   free(piece->data);
   piece->data = NULL;
 }
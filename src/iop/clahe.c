@@ -33,32 +33,53 @@
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
-
-#define CLIP(x) ((x < 0) ? 0.0 : (x > 1.0) ? 1.0 : x)
+#if defined(__SSE2__)
+#include <xmmintrin.h>
+#endif
 
 #define ROUND_POSISTIVE(f) ((unsigned int)((f)+0.5))
 
-DT_MODULE(1)
+#define BINS (256)
+
+// smallest tile of the tiled mode, keeps the number of mappings bounded for small radii
+#define MIN_TILE (8)
+
+DT_MODULE(2)
+
+typedef enum dt_iop_rlce_mode_t
+{
+  DT_IOP_RLCE_SLIDING = 0, // histogram of a window around every pixel, the original algorithm
+  DT_IOP_RLCE_TILED = 1    // classic clahe, one histogram per tile and bilinear interpolation in between
+} dt_iop_rlce_mode_t;
 
 typedef struct dt_iop_rlce_params_t
 {
   double radius;
   double slope;
+  dt_iop_rlce_mode_t mode;
 } dt_iop_rlce_params_t;
 
 typedef struct dt_iop_rlce_gui_data_t
 {
   GtkBox *vbox1, *vbox2;
-  GtkWidget *label1, *label2;
+  GtkWidget *label1, *label2, *label3;
   GtkWidget *scale1, *scale2; // radie pixels, slope
+  GtkWidget *mode;
 } dt_iop_rlce_gui_data_t;
 
 typedef struct dt_iop_rlce_data_t
 {
   double radius;
   double slope;
+  dt_iop_rlce_mode_t mode;
 } dt_iop_rlce_data_t;
 
+typedef struct dt_iop_rlce_global_data_t
+{
+  int kernel_clahe_histogram;
+  int kernel_clahe_apply;
+} dt_iop_rlce_global_data_t;
+
 const char *name()
 {
   return _("local contrast");
@@ -74,46 +95,134 @@ int flags()
   return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_DEPRECATED;
 }
 
-void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
-             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+int legacy_params(dt_iop_module_t *self, const void *const old_params, const int old_version, void *new_params,
+                  const int new_version)
 {
-  dt_iop_rlce_data_t *data = (dt_iop_rlce_data_t *)piece->data;
-  const int ch = piece->colors;
+  if(old_version == 1 && new_version == 2)
+  {
+    typedef struct dt_iop_rlce_params_v1_t
+    {
+      double radius;
+      double slope;
+    } dt_iop_rlce_params_v1_t;
 
-  // PASS1: Get a luminance map of image...
-  float *luminance = (float *)malloc(((size_t)roi_out->width * roi_out->height) * sizeof(float));
-// double lsmax=0.0,lsmin=1.0;
+    const dt_iop_rlce_params_v1_t *o = old_params;
+    dt_iop_rlce_params_t *n = new_params;
+
+    n->radius = o->radius;
+    n->slope = o->slope;
+    n->mode = DT_IOP_RLCE_SLIDING; // it produces the same results as the old version
+
+    return 0;
+  }
+  return 1;
+}
+
+// luminance (max + min) / 2 of the clipped rgb values
+static void luminance_map(float *const luminance, const float *const in, const int width, const int height,
+                          const int ch)
+{
 #ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(static) shared(luminance)
+#pragma omp parallel for default(none) schedule(static)
 #endif
-  for(int j = 0; j < roi_out->height; j++)
+  for(int j = 0; j < height; j++)
   {
-    float *in = (float *)ivoid + (size_t)j * roi_out->width * ch;
-    float *lm = luminance + (size_t)j * roi_out->width;
-    for(int i = 0; i < roi_out->width; i++)
+    const float *inp = in + (size_t)j * width * ch;
+    float *lm = luminance + (size_t)j * width;
+    int i = 0;
+#if defined(__SSE2__)
+    if(ch == 4)
     {
-      double pmax = CLIP(fmax(in[0], fmax(in[1], in[2]))); // Max value in RGB set
-      double pmin = CLIP(fmin(in[0], fmin(in[1], in[2]))); // Min value in RGB set
-      *lm = (pmax + pmin) / 2.0;                           // Pixel luminocity
-      in += ch;
-      lm++;
+      // four pixels at a time, transposed to one vector per channel
+      const __m128 zero = _mm_setzero_ps();
+      const __m128 one = _mm_set1_ps(1.0f);
+      const __m128 half = _mm_set1_ps(0.5f);
+      for(; i + 4 <= width; i += 4, inp += 16, lm += 4)
+      {
+        __m128 r = _mm_loadu_ps(inp), g = _mm_loadu_ps(inp + 4), b = _mm_loadu_ps(inp + 8),
+               a = _mm_loadu_ps(inp + 12);
+        _MM_TRANSPOSE4_PS(r, g, b, a);
+        const __m128 pmax = _mm_min_ps(_mm_max_ps(_mm_max_ps(r, _mm_max_ps(g, b)), zero), one);
+        const __m128 pmin = _mm_min_ps(_mm_max_ps(_mm_min_ps(r, _mm_min_ps(g, b)), zero), one);
+        _mm_storeu_ps(lm, _mm_mul_ps(_mm_add_ps(pmax, pmin), half));
+      }
+    }
+#endif
+    for(; i < width; i++, inp += ch, lm++)
+    {
+      const float pmax = CLAMPS(fmaxf(inp[0], fmaxf(inp[1], inp[2])), 0.0f, 1.0f); // Max value in RGB set
+      const float pmin = CLAMPS(fminf(inp[0], fminf(inp[1], inp[2])), 0.0f, 1.0f); // Min value in RGB set
+      *lm = (pmax + pmin) * 0.5f;                                                   // Pixel luminocity
     }
   }
+}
 
+/* clip histogram and redistribute clipped entries */
+static void clip_histogram(int *const clippedhist, const int *const hist, const int limit)
+{
+  memcpy(clippedhist, hist, (BINS + 1) * sizeof(int));
+  int ce = 0, ceb = 0;
+  do
+  {
+    ceb = ce;
+    ce = 0;
+    for(int b = 0; b <= BINS; b++)
+    {
+      int d = clippedhist[b] - limit;
+      if(d > 0)
+      {
+        ce += d;
+        clippedhist[b] = limit;
+      }
+    }
 
-  // Params
-  const int rad = data->radius * roi_in->scale / piece->iscale;
+    int d = (ce / (float)(BINS + 1));
+    int m = ce % (BINS + 1);
+    for(int b = 0; b <= BINS; b++) clippedhist[b] += d;
 
-#define BINS (256)
+    if(m != 0)
+    {
+      int s = BINS / (float)m;
+      for(int b = 0; b <= BINS; b += s) ++clippedhist[b];
+    }
+  } while(ce != ceb);
+}
 
-  const float slope = data->slope;
+/* normalized cdf of the clipped histogram for every bin, same as the per pixel lookup of the sliding mode */
+static void build_mapping(float *const map, const int *const clippedhist)
+{
+  unsigned int hMin = BINS;
+  for(int b = 0; b < hMin; b++)
+    if(clippedhist[b] != 0) hMin = b;
+
+  int cdfMax = 0;
+  for(int b = hMin; b <= BINS; b++) cdfMax += clippedhist[b];
+  const int cdfMin = clippedhist[hMin];
 
+  int cdf = 0;
+  for(int b = 0; b <= BINS; b++)
+  {
+    if(b >= hMin) cdf += clippedhist[b];
+    // flat tiles keep their luminance
+    map[b] = cdfMax > cdfMin ? (cdf - cdfMin) / (float)(cdfMax - cdfMin) : b / (float)BINS;
+  }
+}
+
+static void process_sliding(dt_dev_pixelpipe_pool_t *pool, const float *const luminance, const void *const ivoid,
+                            void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
+                            const int ch, const int rad, const float slope)
+{
   const size_t destbuf_size = roi_out->width;
-  float *const dest_buf = malloc(destbuf_size * sizeof(float) * dt_get_num_threads());
+  float *const dest_buf = dt_dev_pixelpipe_pool_alloc(pool, destbuf_size * sizeof(float) * dt_get_num_threads());
+  if(!dest_buf)
+  {
+    memcpy(ovoid, ivoid, sizeof(float) * ch * roi_out->width * roi_out->height);
+    return;
+  }
 
 // CLAHE
 #ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(static) shared(luminance)
+#pragma omp parallel for default(none) schedule(static)
 #endif
   for(int j = 0; j < roi_out->height; j++)
   {
@@ -167,33 +276,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
           ++hist[ROUND_POSISTIVE(luminance[(size_t)yi * roi_in->width + xMax1] * (float)BINS)];
       }
 
-      /* clip histogram and redistribute clipped entries */
-      memcpy(clippedhist, hist, (BINS + 1) * sizeof(int));
-      int ce = 0, ceb = 0;
-      do
-      {
-        ceb = ce;
-        ce = 0;
-        for(int b = 0; b <= BINS; b++)
-        {
-          int d = clippedhist[b] - limit;
-          if(d > 0)
-          {
-            ce += d;
-            clippedhist[b] = limit;
-          }
-        }
-
-        int d = (ce / (float)(BINS + 1));
-        int m = ce % (BINS + 1);
-        for(int b = 0; b <= BINS; b++) clippedhist[b] += d;
-
-        if(m != 0)
-        {
-          int s = BINS / (float)m;
-          for(int b = 0; b <= BINS; b += s) ++clippedhist[b];
-        }
-      } while(ce != ceb);
+      clip_histogram(clippedhist, hist, limit);
 
       /* build cdf of clipped histogram */
       unsigned int hMin = BINS;
@@ -228,12 +311,238 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     }
   }
 
-  free(dest_buf);
+  dt_dev_pixelpipe_pool_free(pool, dest_buf);
+}
+
+static inline int tile_size(const int rad)
+{
+  // the tiles cover the same area as the window of the sliding mode
+  return MAX(2 * rad + 1, MIN_TILE);
+}
+
+// the tile grid starts at the image origin, not at the one of the roi. that keeps the tiles and their mappings
+// in place when panning and zooming and across the tiles the pipe splits large images into. this is where the
+// grid starts before the first pixel of the buffer.
+static inline int tile_offset(const int pos, const int tile)
+{
+  return ((pos % tile) + tile) % tile;
+}
+
+/* classic clahe: one clipped histogram per tile, and every pixel interpolates bilinearly between the
+ * mappings of the four closest tile centers. the cost per pixel doesn't depend on the radius. returns FALSE
+ * without touching ovoid if there's no memory for the mappings. */
+static gboolean process_tiled(dt_dev_pixelpipe_pool_t *pool, const float *const luminance, const void *const ivoid,
+                          void *const ovoid, const dt_iop_roi_t *const roi_out, const int ch, const int rad,
+                          const float slope)
+{
+  const int width = roi_out->width;
+  const int height = roi_out->height;
+  const int tile = tile_size(rad);
+  const int ox = tile_offset(roi_out->x, tile);
+  const int oy = tile_offset(roi_out->y, tile);
+  const int nx = (width + ox + tile - 1) / tile;
+  const int ny = (height + oy + tile - 1) / tile;
+  float *const map = dt_dev_pixelpipe_pool_alloc(pool, sizeof(float) * (BINS + 1) * nx * ny);
+  int *const x0 = malloc(sizeof(int) * 2 * width);
+  float *const wx = malloc(sizeof(float) * width);
+  const gboolean ok = map && x0 && wx;
+  if(!ok) goto error;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int t = 0; t < nx * ny; t++)
+  {
+    const int tx = t % nx, ty = t / nx;
+    const int xMin = MAX(tx * tile - ox, 0), xMax = MIN((tx + 1) * tile - ox, width);
+    const int yMin = MAX(ty * tile - oy, 0), yMax = MIN((ty + 1) * tile - oy, height);
+    int hist[BINS + 1];
+    int clippedhist[BINS + 1];
+    memset(hist, 0, (BINS + 1) * sizeof(int));
+    for(int yi = yMin; yi < yMax; yi++)
+      for(int xi = xMin; xi < xMax; xi++)
+        ++hist[ROUND_POSISTIVE(luminance[(size_t)yi * width + xi] * (float)BINS)];
+    const int n = (xMax - xMin) * (yMax - yMin);
+    const int limit = (int)(slope * n / BINS + 0.5f);
+    clip_histogram(clippedhist, hist, limit);
+    build_mapping(map + (size_t)t * (BINS + 1), clippedhist);
+  }
+
+  // horizontal interpolation weights are the same for every row
+  for(int i = 0; i < width; i++)
+  {
+    const float fx = CLAMPS((i + ox + 0.5f) / tile - 0.5f, 0.0f, (float)(nx - 1));
+    x0[2 * i] = (int)fx;
+    x0[2 * i + 1] = MIN(x0[2 * i] + 1, nx - 1);
+    wx[i] = fx - x0[2 * i];
+  }
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int j = 0; j < height; j++)
+  {
+    const float fy = CLAMPS((j + oy + 0.5f) / tile - 0.5f, 0.0f, (float)(ny - 1));
+    const int y0 = (int)fy, y1 = MIN(y0 + 1, ny - 1);
+    const float wy = fy - y0;
+    const float *const m0 = map + (size_t)y0 * nx * (BINS + 1);
+    const float *const m1 = map + (size_t)y1 * nx * (BINS + 1);
+    const float *in = (const float *)ivoid + (size_t)j * width * ch;
+    float *out = (float *)ovoid + (size_t)j * width * ch;
+    const float *lm = luminance + (size_t)j * width;
+    for(int i = 0; i < width; i++, in += ch, out += ch)
+    {
+      const int v = ROUND_POSISTIVE(lm[i] * (float)BINS);
+      const size_t a = (size_t)x0[2 * i] * (BINS + 1) + v, b = (size_t)x0[2 * i + 1] * (BINS + 1) + v;
+      const float top = m0[a] + wx[i] * (m0[b] - m0[a]);
+      const float bottom = m1[a] + wx[i] * (m1[b] - m1[a]);
+      float H, S, L;
+      rgb2hsl(in, &H, &S, &L);
+      hsl2rgb(out, H, S, top + wy * (bottom - top));
+    }
+  }
+
+error:
+  dt_dev_pixelpipe_pool_free(pool, map);
+  free(x0);
+  free(wx);
+  return ok;
+}
+
+void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
+             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_rlce_data_t *data = (dt_iop_rlce_data_t *)piece->data;
+  dt_dev_pixelpipe_pool_t *pool = &piece->pipe->pool;
+  const int ch = piece->colors;
+
+  // PASS1: Get a luminance map of image...
+  float *luminance
+      = (float *)dt_dev_pixelpipe_pool_alloc(pool, ((size_t)roi_out->width * roi_out->height) * sizeof(float));
+  if(!luminance)
+  {
+    memcpy(ovoid, ivoid, sizeof(float) * ch * roi_out->width * roi_out->height);
+    return;
+  }
+  luminance_map(luminance, (const float *)ivoid, roi_out->width, roi_out->height, ch);
+
+  // Params
+  const int rad = data->radius * roi_in->scale / piece->iscale;
+  const float slope = data->slope;
+
+  // the sliding window needs much less memory than the tile mappings
+  if(data->mode != DT_IOP_RLCE_TILED || !process_tiled(pool, luminance, ivoid, ovoid, roi_out, ch, rad, slope))
+    process_sliding(pool, luminance, ivoid, ovoid, roi_in, roi_out, ch, rad, slope);
 
   // Cleanup
-  free(luminance);
+  dt_dev_pixelpipe_pool_free(pool, luminance);
+}
+
+#ifdef HAVE_OPENCL
+int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_rlce_data_t *d = (dt_iop_rlce_data_t *)piece->data;
+  dt_iop_rlce_global_data_t *gd = (dt_iop_rlce_global_data_t *)self->data;
+
+  // only the tiled mode has a device implementation
+  if(d->mode != DT_IOP_RLCE_TILED) return FALSE;
+
+  cl_int err = -999;
+  cl_mem dev_map = NULL;
+
+  const int devid = piece->pipe->devid;
+  const int width = roi_out->width;
+  const int height = roi_out->height;
+  const int rad = d->radius * roi_in->scale / piece->iscale;
+  const float slope = d->slope;
+  const int tile = tile_size(rad);
+  const int ox = tile_offset(roi_out->x, tile);
+  const int oy = tile_offset(roi_out->y, tile);
+  const int nx = (width + ox + tile - 1) / tile;
+  const int ny = (height + oy + tile - 1) / tile;
+
+  // one work group per tile, with the histogram in local memory
+  dt_opencl_local_buffer_t locopt
+    = (dt_opencl_local_buffer_t){ .xoffset = 0, .xfactor = 1, .yoffset = 0, .yfactor = 1,
+                                  .cellsize = 0, .overhead = 2 * (BINS + 1) * sizeof(int),
+                                  .sizex = 256, .sizey = 1 };
+  if(!dt_opencl_local_buffer_opt(devid, gd->kernel_clahe_histogram, &locopt)) goto error;
+
+  dev_map = dt_opencl_alloc_device_buffer(devid, sizeof(float) * (BINS + 1) * nx * ny);
+  if(dev_map == NULL) goto error;
+
+  size_t sizes[3] = { (size_t)nx * ny * locopt.sizex, 1, 1 };
+  size_t local[3] = { locopt.sizex, 1, 1 };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_histogram, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_histogram, 1, sizeof(cl_mem), (void *)&dev_map);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_histogram, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_histogram, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_histogram, 4, sizeof(int), (void *)&tile);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_histogram, 5, sizeof(int), (void *)&nx);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_histogram, 6, sizeof(int), (void *)&ox);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_histogram, 7, sizeof(int), (void *)&oy);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_histogram, 8, sizeof(float), (void *)&slope);
+  err = dt_opencl_enqueue_kernel_2d_with_local(devid, gd->kernel_clahe_histogram, sizes, local);
+  if(err != CL_SUCCESS) goto error;
+
+  sizes[0] = ROUNDUPWD(width);
+  sizes[1] = ROUNDUPHT(height);
+  sizes[2] = 1;
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 1, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 2, sizeof(cl_mem), (void *)&dev_map);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 3, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 4, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 5, sizeof(int), (void *)&tile);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 6, sizeof(int), (void *)&nx);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 7, sizeof(int), (void *)&ny);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 8, sizeof(int), (void *)&ox);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 9, sizeof(int), (void *)&oy);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_clahe_apply, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_release_mem_object(dev_map);
+  return TRUE;
+
+error:
+  dt_opencl_release_mem_object(dev_map);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_clahe] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
+void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                     const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out,
+                     struct dt_develop_tiling_t *tiling)
+{
+  dt_iop_rlce_data_t *d = (dt_iop_rlce_data_t *)piece->data;
+  const int rad = d->radius * roi_in->scale / piece->iscale;
+
+  tiling->factor = 2.25f; // in + out + luminance
+  tiling->maxbuf = 1.0f;
+  tiling->overhead = 0;
+  tiling->overlap = d->mode == DT_IOP_RLCE_TILED ? 2 * tile_size(rad) : rad;
+  tiling->xalign = 1;
+  tiling->yalign = 1;
+}
+
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 24; // clahe.cl, from programs.conf
+  dt_iop_rlce_global_data_t *gd = (dt_iop_rlce_global_data_t *)malloc(sizeof(dt_iop_rlce_global_data_t));
+  module->data = gd;
+  gd->kernel_clahe_histogram = dt_opencl_create_kernel(program, "clahe_histogram");
+  gd->kernel_clahe_apply = dt_opencl_create_kernel(program, "clahe_apply");
+}
 
-#undef BINS
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_rlce_global_data_t *gd = (dt_iop_rlce_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_clahe_histogram);
+  dt_opencl_free_kernel(gd->kernel_clahe_apply);
+  free(module->data);
+  module->data = NULL;
 }
 
 static void radius_callback(GtkWidget *slider, gpointer user_data)
@@ -254,6 +563,15 @@ static void slope_callback(GtkWidget *slider, gpointer user_data)
   dt_dev_add_history_item(darktable.develop, self, TRUE);
 }
 
+static void mode_callback(GtkWidget *combo, gpointer user_data)
+{
+  dt_iop_module_t *self = (dt_iop_module_t *)user_data;
+  if(self->dt->gui->reset) return;
+  dt_iop_rlce_params_t *p = (dt_iop_rlce_params_t *)self->params;
+  p->mode = dt_bauhaus_combobox_get(combo);
+  dt_dev_add_history_item(darktable.develop, self, TRUE);
+}
+
 
 
 void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pixelpipe_t *pipe,
@@ -264,6 +582,7 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
 
   d->radius = p->radius;
   d->slope = p->slope;
+  d->mode = p->mode;
 }
 
 void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
@@ -285,6 +604,7 @@ void gui_update(struct dt_iop_module_t *self)
   dt_iop_rlce_params_t *p = (dt_iop_rlce_params_t *)module->params;
   dt_bauhaus_slider_set(g->scale1, p->radius);
   dt_bauhaus_slider_set(g->scale2, p->slope);
+  dt_bauhaus_combobox_set(g->mode, p->mode);
 }
 
 void init(dt_iop_module_t *module)
@@ -295,7 +615,7 @@ void init(dt_iop_module_t *module)
   module->priority = 897; // module order created by iop_dependencies.py, do not edit!
   module->params_size = sizeof(dt_iop_rlce_params_t);
   module->gui_data = NULL;
-  dt_iop_rlce_params_t tmp = (dt_iop_rlce_params_t){ 64, 1.25 };
+  dt_iop_rlce_params_t tmp = (dt_iop_rlce_params_t){ 64, 1.25, DT_IOP_RLCE_SLIDING };
   memcpy(module->params, &tmp, sizeof(dt_iop_rlce_params_t));
   memcpy(module->default_params, &tmp, sizeof(dt_iop_rlce_params_t));
 }
@@ -322,6 +642,8 @@ void gui_init(struct dt_iop_module_t *self)
   gtk_box_pack_start(GTK_BOX(g->vbox1), g->label1, TRUE, TRUE, 0);
   g->label2 = dtgtk_reset_label_new(_("amount"), self, &p->slope, sizeof(float));
   gtk_box_pack_start(GTK_BOX(g->vbox1), g->label2, TRUE, TRUE, 0);
+  g->label3 = dtgtk_reset_label_new(_("mode"), self, &p->mode, sizeof(p->mode));
+  gtk_box_pack_start(GTK_BOX(g->vbox1), g->label3, TRUE, TRUE, 0);
 
   g->scale1 = dt_bauhaus_slider_new_with_range(NULL, 0.0, 256.0, 1.0,
                                                p->radius, 0);
@@ -331,11 +653,20 @@ void gui_init(struct dt_iop_module_t *self)
 
   gtk_box_pack_start(GTK_BOX(g->vbox2), GTK_WIDGET(g->scale1), TRUE, TRUE, 0);
   gtk_box_pack_start(GTK_BOX(g->vbox2), GTK_WIDGET(g->scale2), TRUE, TRUE, 0);
+
+  g->mode = dt_bauhaus_combobox_new(self);
+  dt_bauhaus_combobox_add(g->mode, _("sliding window"));
+  dt_bauhaus_combobox_add(g->mode, _("tiles"));
+  dt_bauhaus_combobox_set(g->mode, p->mode);
+  gtk_box_pack_start(GTK_BOX(g->vbox2), g->mode, TRUE, TRUE, 0);
   gtk_widget_set_tooltip_text(GTK_WIDGET(g->scale1), _("size of features to preserve"));
   gtk_widget_set_tooltip_text(GTK_WIDGET(g->scale2), _("strength of the effect"));
+  gtk_widget_set_tooltip_text(g->mode, _("sliding window evaluates a histogram around every pixel, tiles "
+                                         "interpolates between per tile histograms and is much faster"));
 
   g_signal_connect(G_OBJECT(g->scale1), "value-changed", G_CALLBACK(radius_callback), self);
   g_signal_connect(G_OBJECT(g->scale2), "value-changed", G_CALLBACK(slope_callback), self);
+  g_signal_connect(G_OBJECT(g->mode), "value-changed", G_CALLBACK(mode_callback), self);
 }
 
 void gui_cleanup(struct dt_iop_module_t *self)
@@ -19,6 +19,7 @@
 #include "common/colorspaces.h"
 #include "common/opencl.h"
 #include "common/exif.h"
+#include "control/conf.h"
 #include "control/control.h"
 #include "develop/develop.h"
 #include "develop/imageop.h"
@@ -38,6 +39,9 @@
 
 #include <gtk/gtk.h>
 #include <inttypes.h>
+#if defined(__SSE2__)
+#include <xmmintrin.h>
+#endif
 
 DT_MODULE_INTROSPECTION(2, dt_iop_colorchecker_params_t)
 
@@ -94,6 +98,12 @@ typedef struct dt_iop_colorchecker_gui_data_t
   int absolute_target; // 0: show relative offsets in sliders, 1: show absolute Lab values
 } dt_iop_colorchecker_gui_data_t;
 
+// splines through more patches than the classic color checker has are baked into a 3d lut covering this
+// Lab box, see commit_params(). pixels outside of it still get the spline evaluated directly.
+#define LUT_MIN_PATCHES 25
+static const float lut_min[3] = { 0.0f, -128.0f, -128.0f };
+static const float lut_max[3] = { 100.0f, 128.0f, 128.0f };
+
 typedef struct dt_iop_colorchecker_data_t
 {
   int32_t num_patches;
@@ -101,11 +111,15 @@ typedef struct dt_iop_colorchecker_data_t
   float coeff_L[MAX_PATCHES+4];
   float coeff_a[MAX_PATCHES+4];
   float coeff_b[MAX_PATCHES+4];
+  int lut_size;    // nodes per axis, 0 if there's no lut
+  float *lut;      // lut_size^3 nodes, L major, 4 floats each
+  dt_iop_colorchecker_params_t lut_params; // the lut was baked from these
 } dt_iop_colorchecker_data_t;
 
 typedef struct dt_iop_colorchecker_global_data_t
 {
   int kernel_colorchecker;
+  int kernel_colorchecker_lut;
 } dt_iop_colorchecker_global_data_t;
 
 const char *name()
@@ -372,6 +386,109 @@ static inline float kernel(const float *x, const float *y)
   return r2*fastlog(MAX(1e-8f,r2));
 }
 
+static inline void evaluate_spline(const dt_iop_colorchecker_data_t *const data, const float *const in,
+                                   float *const out)
+{
+  out[0] = data->coeff_L[data->num_patches];
+  out[1] = data->coeff_a[data->num_patches];
+  out[2] = data->coeff_b[data->num_patches];
+  // polynomial part:
+  out[0] += data->coeff_L[data->num_patches+1] * in[0] +
+            data->coeff_L[data->num_patches+2] * in[1] +
+            data->coeff_L[data->num_patches+3] * in[2];
+  out[1] += data->coeff_a[data->num_patches+1] * in[0] +
+            data->coeff_a[data->num_patches+2] * in[1] +
+            data->coeff_a[data->num_patches+3] * in[2];
+  out[2] += data->coeff_b[data->num_patches+1] * in[0] +
+            data->coeff_b[data->num_patches+2] * in[1] +
+            data->coeff_b[data->num_patches+3] * in[2];
+#if defined(_OPENMP) && defined(OPENMP_SIMD_) // <== nice try, i don't think this does anything here
+#pragma omp SIMD()
+#endif
+  for(int k=0;k<data->num_patches;k++)
+  { // rbf from thin plate spline
+    const float phi = kernel(in, data->source_Lab + 3*k);
+    out[0] += data->coeff_L[k] * phi;
+    out[1] += data->coeff_a[k] * phi;
+    out[2] += data->coeff_b[k] * phi;
+  }
+}
+
+// finds the tetrahedron of the lut cube around in, which has corners c000, c000 + *v1, c000 + *v2 and c111.
+// returns the offset of c000 and the barycentric weights of the four corners, or -1 if in is outside the lut.
+static inline ptrdiff_t lut_tetrahedron(const dt_iop_colorchecker_data_t *const data, const float *const in,
+                                        ptrdiff_t *const v1, ptrdiff_t *const v2, float *const w)
+{
+  const int n = data->lut_size;
+  int c[3];
+  float f[3];
+  for(int k = 0; k < 3; k++)
+  {
+    const float x = (in[k] - lut_min[k]) * ((n - 1) / (lut_max[k] - lut_min[k]));
+    if(!(x >= 0.0f && x <= n - 1)) return -1; // and nan
+    c[k] = MIN((int)x, n - 2);
+    f[k] = x - c[k];
+  }
+  const ptrdiff_t sL = 4 * n * n, sa = 4 * n, sb = 4;
+
+  // the six tetrahedra sharing the diagonal from c000 to c111, picked by the order of the fractions
+  float f1, f2, f3;
+  if(f[0] >= f[1])
+  {
+    if(f[1] >= f[2])
+    {
+      *v1 = sL, *v2 = sL + sa;
+      f1 = f[0], f2 = f[1], f3 = f[2];
+    }
+    else if(f[0] >= f[2])
+    {
+      *v1 = sL, *v2 = sL + sb;
+      f1 = f[0], f2 = f[2], f3 = f[1];
+    }
+    else
+    {
+      *v1 = sb, *v2 = sL + sb;
+      f1 = f[2], f2 = f[0], f3 = f[1];
+    }
+  }
+  else
+  {
+    if(f[2] > f[1])
+    {
+      *v1 = sb, *v2 = sa + sb;
+      f1 = f[2], f2 = f[1], f3 = f[0];
+    }
+    else if(f[2] > f[0])
+    {
+      *v1 = sa, *v2 = sa + sb;
+      f1 = f[1], f2 = f[2], f3 = f[0];
+    }
+    else
+    {
+      *v1 = sa, *v2 = sL + sa;
+      f1 = f[1], f2 = f[0], f3 = f[2];
+    }
+  }
+  w[0] = 1.0f - f1;
+  w[1] = f1 - f2;
+  w[2] = f2 - f3;
+  w[3] = f3;
+  return c[0] * sL + c[1] * sa + c[2] * sb;
+}
+
+static inline int lut_lookup(const dt_iop_colorchecker_data_t *const data, const float *const in,
+                             float *const out)
+{
+  ptrdiff_t v1, v2;
+  float w[4];
+  const ptrdiff_t c = lut_tetrahedron(data, in, &v1, &v2, w);
+  if(c < 0) return 0;
+  const float *const c000 = data->lut + c;
+  const ptrdiff_t v3 = 4 * (data->lut_size * data->lut_size + data->lut_size + 1);
+  for(int k = 0; k < 3; k++) out[k] = w[0] * c000[k] + w[1] * c000[v1 + k] + w[2] * c000[v2 + k] + w[3] * c000[v3 + k];
+  return 1;
+}
+
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
              void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
@@ -386,79 +503,50 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     {
       const float *in = ((float *)ivoid) + (size_t)ch * (j * roi_in->width + i);
       float *out = ((float *)ovoid) + (size_t)ch * (j * roi_in->width + i);
-      out[0] = data->coeff_L[data->num_patches];
-      out[1] = data->coeff_a[data->num_patches];
-      out[2] = data->coeff_b[data->num_patches];
-      // polynomial part:
-      out[0] += data->coeff_L[data->num_patches+1] * in[0] +
-                data->coeff_L[data->num_patches+2] * in[1] +
-                data->coeff_L[data->num_patches+3] * in[2];
-      out[1] += data->coeff_a[data->num_patches+1] * in[0] +
-                data->coeff_a[data->num_patches+2] * in[1] +
-                data->coeff_a[data->num_patches+3] * in[2];
-      out[2] += data->coeff_b[data->num_patches+1] * in[0] +
-                data->coeff_b[data->num_patches+2] * in[1] +
-                data->coeff_b[data->num_patches+3] * in[2];
-#if defined(_OPENMP) && defined(OPENMP_SIMD_) // <== nice try, i don't think this does anything here
-#pragma omp SIMD()
-#endif
-      for(int k=0;k<data->num_patches;k++)
-      { // rbf from thin plate spline
-        const float phi = kernel(in, data->source_Lab + 3*k);
-        out[0] += data->coeff_L[k] * phi;
-        out[1] += data->coeff_a[k] * phi;
-        out[2] += data->coeff_b[k] * phi;
-      }
+      if(!data->lut || !lut_lookup(data, in, out)) evaluate_spline(data, in, out);
     }
   }
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
 }
 
-#if 0 // TODO:
+#if defined(__SSE2__)
 void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
-             void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+                  void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
   const dt_iop_colorchecker_data_t *const data = (dt_iop_colorchecker_data_t *)piece->data;
-  const int ch = piece->colors;
-  // TODO: swizzle this so we can eval the distance of one point
-  // TODO: to four patches at the same time
-  v4sf source_Lab[data->num_patches];
-  for(int i=0;i<data->num_patches;i++)
-    source_Lab[i] = _mm_set_ps(1.0,
-        data->source_Lab[3*i+0],
-        data->source_Lab[3*i+1],
-        data->source_Lab[3*i+2]);
+  if(!data->lut || piece->colors != 4)
+  {
+    process(self, piece, ivoid, ovoid, roi_in, roi_out);
+    return;
+  }
+
+  const ptrdiff_t v3 = 4 * (data->lut_size * data->lut_size + data->lut_size + 1);
 #ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(static) collapse(2)
+#pragma omp parallel for default(none) schedule(static)
 #endif
-  for(int j=0;j<roi_out->height;j++)
+  for(int j = 0; j < roi_out->height; j++)
   {
-    for(int i=0;i<roi_out->width;i++)
+    const float *in = ((float *)ivoid) + (size_t)4 * j * roi_in->width;
+    float *out = ((float *)ovoid) + (size_t)4 * j * roi_in->width;
+    for(int i = 0; i < roi_out->width; i++, in += 4, out += 4)
     {
-      const float *in = ((float *)ivoid) + (size_t)ch * (j * roi_in->width + i);
-      float *out = ((float *)ovoid) + (size_t)ch * (j * roi_in->width + i);
-      // TODO: do this part in SSE (maybe need to store coeff_L in _mm128 on data struct)
-      out[0] = data->coeff_L[data->num_patches];
-      out[1] = data->coeff_a[data->num_patches];
-      out[2] = data->coeff_b[data->num_patches];
-      // polynomial part:
-      out[0] += data->coeff_L[data->num_patches+1] * in[0] +
-                data->coeff_L[data->num_patches+2] * in[1] +
-                data->coeff_L[data->num_patches+3] * in[2];
-      out[1] += data->coeff_a[data->num_patches+1] * in[0] +
-                data->coeff_a[data->num_patches+2] * in[1] +
-                data->coeff_a[data->num_patches+3] * in[2];
-      out[2] += data->coeff_b[data->num_patches+1] * in[0] +
-                data->coeff_b[data->num_patches+2] * in[1] +
-                data->coeff_b[data->num_patches+3] * in[2];
-      for(int k=0;k<data->num_patches;k+=4)
-      { // rbf from thin plate spline
-        const v4sf phi = kerneldist4(in, source_Lab[k]);
-        // TODO: add up 4x output channels
-        out[0] += data->coeff_L[k] * phi[0];
-        out[1] += data->coeff_a[k] * phi[0];
-        out[2] += data->coeff_b[k] * phi[0];
+      ptrdiff_t v1, v2;
+      float w[4];
+      const ptrdiff_t c = lut_tetrahedron(data, in, &v1, &v2, w);
+      if(c < 0)
+      {
+        evaluate_spline(data, in, out);
+        continue;
       }
+      // lut nodes are 16 byte aligned, w of the result is dropped below
+      const float *const c000 = data->lut + c;
+      const __m128 o = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(w[0]), _mm_load_ps(c000)),
+                                             _mm_mul_ps(_mm_set1_ps(w[1]), _mm_load_ps(c000 + v1))),
+                                  _mm_add_ps(_mm_mul_ps(_mm_set1_ps(w[2]), _mm_load_ps(c000 + v2)),
+                                             _mm_mul_ps(_mm_set1_ps(w[3]), _mm_load_ps(c000 + v3))));
+      const float alpha = in[3];
+      _mm_store_ps(out, o);
+      out[3] = alpha;
     }
   }
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
@@ -479,6 +567,7 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
 
   cl_int err = -999;
   cl_mem dev_params = NULL;
+  cl_mem dev_lut = NULL;
 
   const size_t params_size = (size_t)(4 * (2 * num_patches + 4)) * sizeof(float);
   float *params = malloc(params_size);
@@ -505,6 +594,31 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
   if(dev_params == NULL) goto error;
 
   size_t sizes[3] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+
+  if(d->lut)
+  {
+    const int lut_size = d->lut_size;
+    dev_lut = dt_opencl_copy_host_to_device_constant(devid, sizeof(float) * 4 * lut_size * lut_size * lut_size,
+                                                     d->lut);
+    if(dev_lut == NULL) goto error;
+
+    dt_opencl_set_kernel_arg(devid, gd->kernel_colorchecker_lut, 0, sizeof(cl_mem), (void *)&dev_in);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_colorchecker_lut, 1, sizeof(cl_mem), (void *)&dev_out);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_colorchecker_lut, 2, sizeof(int), (void *)&width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_colorchecker_lut, 3, sizeof(int), (void *)&height);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_colorchecker_lut, 4, sizeof(int), (void *)&num_patches);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_colorchecker_lut, 5, sizeof(cl_mem), (void *)&dev_params);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_colorchecker_lut, 6, sizeof(cl_mem), (void *)&dev_lut);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_colorchecker_lut, 7, sizeof(int), (void *)&lut_size);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_colorchecker_lut, sizes);
+    if(err != CL_SUCCESS) goto error;
+
+    dt_opencl_release_mem_object(dev_lut);
+    dt_opencl_release_mem_object(dev_params);
+    free(params);
+    return TRUE;
+  }
+
   dt_opencl_set_kernel_arg(devid, gd->kernel_colorchecker, 0, sizeof(cl_mem), (void *)&dev_in);
   dt_opencl_set_kernel_arg(devid, gd->kernel_colorchecker, 1, sizeof(cl_mem), (void *)&dev_out);
   dt_opencl_set_kernel_arg(devid, gd->kernel_colorchecker, 2, sizeof(int), (void *)&width);
@@ -520,12 +634,82 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
 
 error:
   free(params);
+  dt_opencl_release_mem_object(dev_lut);
   dt_opencl_release_mem_object(dev_params);
   dt_print(DT_DEBUG_OPENCL, "[opencl_colorchecker] couldn't enqueue kernel! %d\n", err);
   return FALSE;
 }
 #endif
 
+// evaluating the spline costs a kernel per patch and pixel. with many patches, sample it once on a grid
+// and interpolate tetrahedrally instead.
+static void bake_lut(dt_iop_colorchecker_data_t *d, const dt_iop_colorchecker_params_t *p)
+{
+  const int size = d->num_patches >= LUT_MIN_PATCHES ? dt_conf_get_int("plugins/darkroom/colorchecker/lut_size") : 0;
+  const int n = size < 2 ? 0 : MIN(size, 129);
+
+  if(n == 0)
+  {
+    dt_free_align(d->lut);
+    d->lut = NULL;
+    d->lut_size = 0;
+    return;
+  }
+
+  // commit_params() runs for all sorts of reasons, keep the lut if the spline didn't change
+  if(d->lut && d->lut_size == n && !memcmp(&d->lut_params, p, sizeof(dt_iop_colorchecker_params_t))) return;
+
+  if(d->lut_size != n)
+  {
+    dt_free_align(d->lut);
+    d->lut = dt_alloc_align(64, sizeof(float) * 4 * n * n * n);
+    d->lut_size = d->lut ? n : 0;
+    if(!d->lut) return;
+  }
+  memcpy(&d->lut_params, p, sizeof(dt_iop_colorchecker_params_t));
+
+  const double start = dt_get_wtime();
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(d) schedule(static)
+#endif
+  for(int i = 0; i < n; i++)
+    for(int j = 0; j < n; j++)
+      for(int k = 0; k < n; k++)
+      {
+        const float Lab[3] = { lut_min[0] + i * (lut_max[0] - lut_min[0]) / (n - 1),
+                               lut_min[1] + j * (lut_max[1] - lut_min[1]) / (n - 1),
+                               lut_min[2] + k * (lut_max[2] - lut_min[2]) / (n - 1) };
+        float *node = d->lut + 4 * (((size_t)i * n + j) * n + k);
+        evaluate_spline(d, Lab, node);
+        node[3] = 0.0f;
+      }
+
+  if(darktable.unmuted & DT_DEBUG_PERF)
+  {
+    // interpolation errors are largest in the middle of the cells
+    float max_dE = 0.0f;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) shared(d) schedule(static) reduction(max : max_dE)
+#endif
+    for(int i = 0; i < n - 1; i++)
+      for(int j = 0; j < n - 1; j++)
+        for(int k = 0; k < n - 1; k++)
+        {
+          const float Lab[3] = { lut_min[0] + (i + 0.5f) * (lut_max[0] - lut_min[0]) / (n - 1),
+                                 lut_min[1] + (j + 0.5f) * (lut_max[1] - lut_min[1]) / (n - 1),
+                                 lut_min[2] + (k + 0.5f) * (lut_max[2] - lut_min[2]) / (n - 1) };
+          float direct[3], baked[3];
+          evaluate_spline(d, Lab, direct);
+          lut_lookup(d, Lab, baked);
+          const float dE = sqrtf((direct[0] - baked[0]) * (direct[0] - baked[0])
+                                 + (direct[1] - baked[1]) * (direct[1] - baked[1])
+                                 + (direct[2] - baked[2]) * (direct[2] - baked[2]));
+          max_dE = MAX(max_dE, dE);
+        }
+    dt_print(DT_DEBUG_PERF, "[colorchecker] baked %d patches into a %d^3 lut in %.3f secs, max dE %.3f\n",
+             d->num_patches, n, dt_get_wtime() - start, max_dE);
+  }
+}
 
 void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pixelpipe_t *pipe,
                    dt_dev_pixelpipe_iop_t *piece)
@@ -735,16 +919,20 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
     free(A);
   }
   }
+
+  bake_lut(d, p);
 }
 
 void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
-  piece->data = malloc(sizeof(dt_iop_colorchecker_data_t));
+  piece->data = calloc(1, sizeof(dt_iop_colorchecker_data_t));
   self->commit_params(self, self->default_params, pipe, piece);
 }
 
 void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
+  dt_iop_colorchecker_data_t *d = (dt_iop_colorchecker_data_t *)piece->data;
+  dt_free_align(d->lut);
   free(piece->data);
   piece->data = NULL;
 }
@@ -829,12 +1017,14 @@ void init_global(dt_iop_module_so_t *module)
 
   const int program = 8; // extended.cl, from programs.conf
   gd->kernel_colorchecker = dt_opencl_create_kernel(program, "colorchecker");
+  gd->kernel_colorchecker_lut = dt_opencl_create_kernel(program, "colorchecker_lut");
 }
 
 void cleanup_global(dt_iop_module_so_t *module)
 {
   dt_iop_colorchecker_global_data_t *gd = (dt_iop_colorchecker_global_data_t *)module->data;
   dt_opencl_free_kernel(gd->kernel_colorchecker);
+  dt_opencl_free_kernel(gd->kernel_colorchecker_lut);
   free(module->data);
   module->data = NULL;
 }
@@ -76,7 +76,9 @@ typedef enum dt_iop_demosaic_qual_flags_t
   DEMOSAIC_FULL_SCALE              = 1 << 0,
   DEMOSAIC_ONLY_VNG_LINEAR         = 1 << 1,
   DEMOSAIC_XTRANS_FULL             = 1 << 2,
-  DEMOSAIC_MEDIUM_QUAL             = 1 << 3
+  DEMOSAIC_MEDIUM_QUAL             = 1 << 3,
+  // when not doing full scale, bin whole cfa cells straight into the output roi
+  DEMOSAIC_BINNED                  = 1 << 4
 } dt_iop_demosaic_qual_flags_t;
 
 typedef struct dt_iop_demosaic_params_t
@@ -154,6 +156,15 @@ void amaze_demosaic_RT(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pie
                        float *out, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
                        const uint32_t filters);
 
+#ifdef HAVE_AVX2_CODEPATHS
+// runtime dispatched variants, compiled with -mavx2 in their own translation units
+void amaze_demosaic_RT_avx2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *const in,
+                            float *out, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
+                            const uint32_t filters);
+void demosaic_ppg_green_avx2(float *const out, const float *const in, const dt_iop_roi_t *const roi_out,
+                             const dt_iop_roi_t *const roi_in, const uint32_t filters);
+#endif
+
 const char *name()
 {
   return _("demosaic");
@@ -505,8 +516,10 @@ static void green_equilibration_favg(float *out, const float *const in, const in
 // xtrans_interpolate adapted from dcraw 9.20
 
 #define SQR(x) ((x) * (x))
-// tile size, optimized to keep data in L2 cache
-#define TS 122
+// tile size, optimized to keep data in L2 cache. the per-thread scratch is (ndir * 4 + 3) TSxTS float planes,
+// which is ~700k for 1-pass and ~1.3M for 3-pass at TS == 96 (it was 1.1M/2.1M at the former TS == 122).
+// a multiple of 8 also keeps every tile row aligned to the 32 byte vector width.
+#define TS 96
 
 /** Lookup for allhex[], making sure that row/col aren't negative **/
 static inline const short *const hexmap(const int row, const int col,
@@ -544,8 +557,9 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
   const int height = roi_out->height;
   const int ndir = 4 << (passes > 1);
 
+  // every thread only ever touches its own slice, so pages get first touched (and placed) by their user
   const size_t buffer_size = (size_t)TS * TS * (ndir * 4 + 3) * sizeof(float);
-  char *const all_buffers = (char *)dt_alloc_align(16, dt_get_num_threads() * buffer_size);
+  char *const all_buffers = (char *)dt_alloc_align(64, dt_get_num_threads() * buffer_size);
   if(!all_buffers)
   {
     printf("[demosaic] not able to allocate Markesteijn buffers\n");
@@ -2365,6 +2379,90 @@ static void vng_interpolate(float *out, const float *const in,
     for(int i = 0; i < height * width; i++) out[i * 4 + 1] = (out[i * 4 + 1] + out[i * 4 + 3]) / 2.0f;
 }
 
+/** first PPG pass: interpolate green for red/blue sites, copy the sensor value into its own channel */
+static void demosaic_ppg_green(float *const out, const float *const input, const dt_iop_roi_t *const roi_out,
+                               const dt_iop_roi_t *const roi_in, const uint32_t filters)
+{
+  const int offx = 3, offy = 3, offX = 3, offY = 3;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int j = offy; j < roi_out->height - offY; j++)
+  {
+    float *buf = out + (size_t)4 * roi_out->width * j + 4 * offx;
+    const float *buf_in = input + (size_t)roi_in->width * (j + roi_out->y) + offx + roi_out->x;
+    for(int i = offx; i < roi_out->width - offX; i++)
+    {
+      const int c = FC(j, i, filters);
+#if defined(__SSE__)
+      // prefetch what we need soon (load to cpu caches)
+      _mm_prefetch((char *)buf_in + 256, _MM_HINT_NTA); // TODO: try HINT_T0-3
+      _mm_prefetch((char *)buf_in + roi_in->width + 256, _MM_HINT_NTA);
+      _mm_prefetch((char *)buf_in + 2 * roi_in->width + 256, _MM_HINT_NTA);
+      _mm_prefetch((char *)buf_in + 3 * roi_in->width + 256, _MM_HINT_NTA);
+      _mm_prefetch((char *)buf_in - roi_in->width + 256, _MM_HINT_NTA);
+      _mm_prefetch((char *)buf_in - 2 * roi_in->width + 256, _MM_HINT_NTA);
+      _mm_prefetch((char *)buf_in - 3 * roi_in->width + 256, _MM_HINT_NTA);
+#endif
+
+#if defined(__SSE__)
+      __m128 col = _mm_load_ps(buf);
+      float *color = (float *)&col;
+#else
+      float color[4] = { buf[0], buf[1], buf[2], buf[3] };
+#endif
+      const float pc = buf_in[0];
+      // if(__builtin_expect(c == 0 || c == 2, 1))
+      if(c == 0 || c == 2)
+      {
+        color[c] = pc;
+        // get stuff (hopefully from cache)
+        const float pym = buf_in[-roi_in->width * 1];
+        const float pym2 = buf_in[-roi_in->width * 2];
+        const float pym3 = buf_in[-roi_in->width * 3];
+        const float pyM = buf_in[+roi_in->width * 1];
+        const float pyM2 = buf_in[+roi_in->width * 2];
+        const float pyM3 = buf_in[+roi_in->width * 3];
+        const float pxm = buf_in[-1];
+        const float pxm2 = buf_in[-2];
+        const float pxm3 = buf_in[-3];
+        const float pxM = buf_in[+1];
+        const float pxM2 = buf_in[+2];
+        const float pxM3 = buf_in[+3];
+
+        const float guessx = (pxm + pc + pxM) * 2.0f - pxM2 - pxm2;
+        const float diffx = (fabsf(pxm2 - pc) + fabsf(pxM2 - pc) + fabsf(pxm - pxM)) * 3.0f
+                            + (fabsf(pxM3 - pxM) + fabsf(pxm3 - pxm)) * 2.0f;
+        const float guessy = (pym + pc + pyM) * 2.0f - pyM2 - pym2;
+        const float diffy = (fabsf(pym2 - pc) + fabsf(pyM2 - pc) + fabsf(pym - pyM)) * 3.0f
+                            + (fabsf(pyM3 - pyM) + fabsf(pym3 - pym)) * 2.0f;
+        if(diffx > diffy)
+        {
+          // use guessy
+          const float m = fminf(pym, pyM);
+          const float M = fmaxf(pym, pyM);
+          color[1] = fmaxf(fminf(guessy * .25f, M), m);
+        }
+        else
+        {
+          const float m = fminf(pxm, pxM);
+          const float M = fmaxf(pxm, pxM);
+          color[1] = fmaxf(fminf(guessx * .25f, M), m);
+        }
+      }
+      else
+        color[1] = pc;
+
+      // write using MOVNTPS (write combine omitting caches)
+      // _mm_stream_ps(buf, col);
+      memcpy(buf, color, 4 * sizeof(float));
+      buf += 4;
+      buf_in++;
+    }
+  }
+}
+
 /** 1:1 demosaic from in to out, in is full buf, out is translated/cropped (scale == 1.0!) */
 static void passthrough_monochrome(float *out, const float *const in, dt_iop_roi_t *const roi_out,
                                    const dt_iop_roi_t *const roi_in)
@@ -2441,83 +2539,15 @@ static void demosaic_ppg(float *const out, const float *const in, const dt_iop_r
     pre_median(med_in, in, roi_in, filters, 1, thrs);
     input = med_in;
   }
-// for all pixels: interpolate green into float array, or copy color.
-#ifdef _OPENMP
-#pragma omp parallel for default(none) shared(input) schedule(static)
-#endif
-  for(int j = offy; j < roi_out->height - offY; j++)
-  {
-    float *buf = out + (size_t)4 * roi_out->width * j + 4 * offx;
-    const float *buf_in = input + (size_t)roi_in->width * (j + roi_out->y) + offx + roi_out->x;
-    for(int i = offx; i < roi_out->width - offX; i++)
-    {
-      const int c = FC(j, i, filters);
-#if defined(__SSE__)
-      // prefetch what we need soon (load to cpu caches)
-      _mm_prefetch((char *)buf_in + 256, _MM_HINT_NTA); // TODO: try HINT_T0-3
-      _mm_prefetch((char *)buf_in + roi_in->width + 256, _MM_HINT_NTA);
-      _mm_prefetch((char *)buf_in + 2 * roi_in->width + 256, _MM_HINT_NTA);
-      _mm_prefetch((char *)buf_in + 3 * roi_in->width + 256, _MM_HINT_NTA);
-      _mm_prefetch((char *)buf_in - roi_in->width + 256, _MM_HINT_NTA);
-      _mm_prefetch((char *)buf_in - 2 * roi_in->width + 256, _MM_HINT_NTA);
-      _mm_prefetch((char *)buf_in - 3 * roi_in->width + 256, _MM_HINT_NTA);
-#endif
 
-#if defined(__SSE__)
-      __m128 col = _mm_load_ps(buf);
-      float *color = (float *)&col;
-#else
-      float color[4] = { buf[0], buf[1], buf[2], buf[3] };
+  // for all pixels: interpolate green into float array, or copy color.
+#ifdef HAVE_AVX2_CODEPATHS
+  if(darktable.codepath.AVX2)
+    demosaic_ppg_green_avx2(out, input, roi_out, roi_in, filters);
+  else
 #endif
-      const float pc = buf_in[0];
-      // if(__builtin_expect(c == 0 || c == 2, 1))
-      if(c == 0 || c == 2)
-      {
-        color[c] = pc;
-        // get stuff (hopefully from cache)
-        const float pym = buf_in[-roi_in->width * 1];
-        const float pym2 = buf_in[-roi_in->width * 2];
-        const float pym3 = buf_in[-roi_in->width * 3];
-        const float pyM = buf_in[+roi_in->width * 1];
-        const float pyM2 = buf_in[+roi_in->width * 2];
-        const float pyM3 = buf_in[+roi_in->width * 3];
-        const float pxm = buf_in[-1];
-        const float pxm2 = buf_in[-2];
-        const float pxm3 = buf_in[-3];
-        const float pxM = buf_in[+1];
-        const float pxM2 = buf_in[+2];
-        const float pxM3 = buf_in[+3];
-
-        const float guessx = (pxm + pc + pxM) * 2.0f - pxM2 - pxm2;
-        const float diffx = (fabsf(pxm2 - pc) + fabsf(pxM2 - pc) + fabsf(pxm - pxM)) * 3.0f
-                            + (fabsf(pxM3 - pxM) + fabsf(pxm3 - pxm)) * 2.0f;
-        const float guessy = (pym + pc + pyM) * 2.0f - pyM2 - pym2;
-        const float diffy = (fabsf(pym2 - pc) + fabsf(pyM2 - pc) + fabsf(pym - pyM)) * 3.0f
-                            + (fabsf(pyM3 - pyM) + fabsf(pym3 - pym)) * 2.0f;
-        if(diffx > diffy)
-        {
-          // use guessy
-          const float m = fminf(pym, pyM);
-          const float M = fmaxf(pym, pyM);
-          color[1] = fmaxf(fminf(guessy * .25f, M), m);
-        }
-        else
-        {
-          const float m = fminf(pxm, pxM);
-          const float M = fmaxf(pxm, pxM);
-          color[1] = fmaxf(fminf(guessx * .25f, M), m);
-        }
-      }
-      else
-        color[1] = pc;
+    demosaic_ppg_green(out, input, roi_out, roi_in, filters);
 
-      // write using MOVNTPS (write combine omitting caches)
-      // _mm_stream_ps(buf, col);
-      memcpy(buf, color, 4 * sizeof(float));
-      buf += 4;
-      buf_in++;
-    }
-  }
 // SFENCE (make sure stuff is stored now)
 // _mm_sfence();
 
@@ -2718,6 +2748,12 @@ static int demosaic_qual_flags(const dt_dev_pixelpipe_iop_t *const piece,
       {
         flags |= DEMOSAIC_FULL_SCALE | DEMOSAIC_XTRANS_FULL;
       }
+      else
+        flags |= DEMOSAIC_BINNED;
+      break;
+    case DT_DEV_PIXELPIPE_PREVIEW:
+      // navigation and thumbnails only need the downscaled result
+      flags |= DEMOSAIC_BINNED;
       break;
     default: // make C not complain about missing enum members
       break;
@@ -2847,6 +2883,10 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       else if(demosaicing_method != DT_IOP_DEMOSAIC_AMAZE)
         demosaic_ppg(tmp, in, &roo, &roi, piece->pipe->dsc.filters,
                      data->median_thrs); // wanted ppg or zoomed out a lot and quality is limited to 1
+#ifdef HAVE_AVX2_CODEPATHS
+      else if(darktable.codepath.AVX2)
+        amaze_demosaic_RT_avx2(self, piece, in, tmp, &roi, &roo, piece->pipe->dsc.filters);
+#endif
       else
         amaze_demosaic_RT(self, piece, in, tmp, &roi, &roo, piece->pipe->dsc.filters);
 
@@ -2864,6 +2904,9 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   {
     if(demosaicing_method == DT_IOP_DEMOSAIC_PASSTHROUGH_MONOCHROME)
       dt_iop_clip_and_zoom_demosaic_passthrough_monochrome_f((float *)o, pixels, &roo, &roi, roo.width, roi.width);
+    else if(qual_flags & DEMOSAIC_BINNED)
+      dt_iop_clip_and_zoom_demosaic_binned_f((float *)o, pixels, &roo, &roi, roo.width, roi.width,
+                                             piece->pipe->dsc.filters, xtrans);
     else // sample half-size raw (Bayer) or 1/3-size raw (X-Trans)
         if(piece->pipe->dsc.filters == 9u)
       dt_iop_clip_and_zoom_demosaic_third_size_xtrans_f((float *)o, pixels, &roo, &roi, roo.width, roi.width,
@@ -0,0 +1,168 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// this file is compiled with -mavx2. nothing in here may be called unless
+// darktable.codepath.AVX2 is set, see demosaic_ppg() in demosaic.c.
+
+#include "develop/imageop.h"
+#include "develop/imageop_math.h"
+
+#include <immintrin.h>
+#include <math.h>
+
+void demosaic_ppg_green_avx2(float *const out, const float *const in, const dt_iop_roi_t *const roi_out,
+                             const dt_iop_roi_t *const roi_in, const uint32_t filters);
+
+static inline __m256 _mm256_abs_ps(const __m256 x)
+{
+  return _mm256_and_ps(x, _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff)));
+}
+
+// scalar fallback for the few pixels at the right border that do not fill a whole vector.
+// has to stay in sync with demosaic_ppg_green() in demosaic.c
+static inline float ppg_green_pixel(const float *const buf_in, const int w)
+{
+  const float pc = buf_in[0];
+  const float pym = buf_in[-w * 1];
+  const float pym2 = buf_in[-w * 2];
+  const float pym3 = buf_in[-w * 3];
+  const float pyM = buf_in[+w * 1];
+  const float pyM2 = buf_in[+w * 2];
+  const float pyM3 = buf_in[+w * 3];
+  const float pxm = buf_in[-1];
+  const float pxm2 = buf_in[-2];
+  const float pxm3 = buf_in[-3];
+  const float pxM = buf_in[+1];
+  const float pxM2 = buf_in[+2];
+  const float pxM3 = buf_in[+3];
+
+  const float guessx = (pxm + pc + pxM) * 2.0f - pxM2 - pxm2;
+  const float diffx = (fabsf(pxm2 - pc) + fabsf(pxM2 - pc) + fabsf(pxm - pxM)) * 3.0f
+                      + (fabsf(pxM3 - pxM) + fabsf(pxm3 - pxm)) * 2.0f;
+  const float guessy = (pym + pc + pyM) * 2.0f - pyM2 - pym2;
+  const float diffy = (fabsf(pym2 - pc) + fabsf(pyM2 - pc) + fabsf(pym - pyM)) * 3.0f
+                      + (fabsf(pyM3 - pyM) + fabsf(pym3 - pym)) * 2.0f;
+  if(diffx > diffy)
+    return fmaxf(fminf(guessy * .25f, fmaxf(pym, pyM)), fminf(pym, pyM));
+  else
+    return fmaxf(fminf(guessx * .25f, fmaxf(pxm, pxM)), fminf(pxm, pxM));
+}
+
+/** first PPG pass, eight pixels of a row at a time. the bayer pattern repeats every second column, so the
+ * per lane red/blue mask only depends on the row. */
+void demosaic_ppg_green_avx2(float *const out, const float *const in, const dt_iop_roi_t *const roi_out,
+                             const dt_iop_roi_t *const roi_in, const uint32_t filters)
+{
+  const int offx = 3, offy = 3, offX = 3, offY = 3;
+  const size_t w = roi_in->width;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int j = offy; j < roi_out->height - offY; j++)
+  {
+    float *const buf = out + (size_t)4 * roi_out->width * j;
+    const float *const buf_in = in + w * (j + roi_out->y) + roi_out->x;
+
+    // colors of the two sites in this row, starting at offx
+    const int c[2] = { FC(j, offx, filters), FC(j, offx + 1, filters) };
+    const int rb[2] = { c[0] == 0 || c[0] == 2, c[1] == 0 || c[1] == 2 };
+    const __m256 rbmask = _mm256_castsi256_ps(
+        _mm256_setr_epi32(-rb[0], -rb[1], -rb[0], -rb[1], -rb[0], -rb[1], -rb[0], -rb[1]));
+    const __m256 two = _mm256_set1_ps(2.0f);
+    const __m256 three = _mm256_set1_ps(3.0f);
+    const __m256 quarter = _mm256_set1_ps(.25f);
+
+    int i = offx;
+    for(; i + 8 <= roi_out->width - offX; i += 8)
+    {
+      const float *const p = buf_in + i;
+      const __m256 pc = _mm256_loadu_ps(p);
+      const __m256 pym = _mm256_loadu_ps(p - w * 1);
+      const __m256 pym2 = _mm256_loadu_ps(p - w * 2);
+      const __m256 pym3 = _mm256_loadu_ps(p - w * 3);
+      const __m256 pyM = _mm256_loadu_ps(p + w * 1);
+      const __m256 pyM2 = _mm256_loadu_ps(p + w * 2);
+      const __m256 pyM3 = _mm256_loadu_ps(p + w * 3);
+      const __m256 pxm = _mm256_loadu_ps(p - 1);
+      const __m256 pxm2 = _mm256_loadu_ps(p - 2);
+      const __m256 pxm3 = _mm256_loadu_ps(p - 3);
+      const __m256 pxM = _mm256_loadu_ps(p + 1);
+      const __m256 pxM2 = _mm256_loadu_ps(p + 2);
+      const __m256 pxM3 = _mm256_loadu_ps(p + 3);
+
+      const __m256 guessx = _mm256_sub_ps(
+          _mm256_sub_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(pxm, pc), pxM), two), pxM2), pxm2);
+      const __m256 diffx = _mm256_add_ps(
+          _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_abs_ps(_mm256_sub_ps(pxm2, pc)),
+                                                    _mm256_abs_ps(_mm256_sub_ps(pxM2, pc))),
+                                      _mm256_abs_ps(_mm256_sub_ps(pxm, pxM))),
+                        three),
+          _mm256_mul_ps(_mm256_add_ps(_mm256_abs_ps(_mm256_sub_ps(pxM3, pxM)),
+                                      _mm256_abs_ps(_mm256_sub_ps(pxm3, pxm))),
+                        two));
+      const __m256 guessy = _mm256_sub_ps(
+          _mm256_sub_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(pym, pc), pyM), two), pyM2), pym2);
+      const __m256 diffy = _mm256_add_ps(
+          _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_abs_ps(_mm256_sub_ps(pym2, pc)),
+                                                    _mm256_abs_ps(_mm256_sub_ps(pyM2, pc))),
+                                      _mm256_abs_ps(_mm256_sub_ps(pym, pyM))),
+                        three),
+          _mm256_mul_ps(_mm256_add_ps(_mm256_abs_ps(_mm256_sub_ps(pyM3, pyM)),
+                                      _mm256_abs_ps(_mm256_sub_ps(pym3, pym))),
+                        two));
+
+      const __m256 gx = _mm256_max_ps(_mm256_min_ps(_mm256_mul_ps(guessx, quarter), _mm256_max_ps(pxm, pxM)),
+                                      _mm256_min_ps(pxm, pxM));
+      const __m256 gy = _mm256_max_ps(_mm256_min_ps(_mm256_mul_ps(guessy, quarter), _mm256_max_ps(pym, pyM)),
+                                      _mm256_min_ps(pym, pyM));
+      // diffx > diffy: use the vertical guess
+      const __m256 ginterp = _mm256_blendv_ps(gx, gy, _mm256_cmp_ps(diffx, diffy, _CMP_GT_OQ));
+      // green sites keep their own value
+      const __m256 green = _mm256_blendv_ps(pc, ginterp, rbmask);
+
+      float g[8] __attribute__((aligned(32)));
+      float v[8] __attribute__((aligned(32)));
+      _mm256_store_ps(g, green);
+      _mm256_store_ps(v, pc);
+      // scatter into the 4-channel output, leaving the other channels alone
+      float *o = buf + (size_t)4 * i;
+      for(int k = 0; k < 8; k++, o += 4)
+      {
+        if(rb[k & 1]) o[c[k & 1]] = v[k];
+        o[1] = g[k];
+      }
+    }
+    for(; i < roi_out->width - offX; i++)
+    {
+      const int k = (i - offx) & 1;
+      float *o = buf + (size_t)4 * i;
+      if(rb[k])
+      {
+        o[c[k]] = buf_in[i];
+        o[1] = ppg_green_pixel(buf_in + i, w);
+      }
+      else
+        o[1] = buf_in[i];
+    }
+  }
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -874,8 +874,8 @@ static void process_wavelets(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
   float *tmp = NULL;
   float *buf1 = NULL, *buf2 = NULL;
   for(int k = 0; k < max_scale; k++)
-    buf[k] = dt_alloc_align(64, (size_t)4 * sizeof(float) * npixels);
-  tmp = dt_alloc_align(64, (size_t)4 * sizeof(float) * npixels);
+    buf[k] = dt_dev_pixelpipe_pool_alloc(&piece->pipe->pool, (size_t)4 * sizeof(float) * npixels);
+  tmp = dt_dev_pixelpipe_pool_alloc(&piece->pipe->pool, (size_t)4 * sizeof(float) * npixels);
 
   const float wb[3] = { // twice as many samples in green channel:
                         2.0f * piece->pipe->dsc.processed_maximum[0] * d->strength * (in_scale * in_scale),
@@ -1004,8 +1004,8 @@ static void process_wavelets(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
 
   backtransform((float *)ovoid, width, height, aa, bb);
 
-  for(int k = 0; k < max_scale; k++) dt_free_align(buf[k]);
-  dt_free_align(tmp);
+  for(int k = 0; k < max_scale; k++) dt_dev_pixelpipe_pool_free(&piece->pipe->pool, buf[k]);
+  dt_dev_pixelpipe_pool_free(&piece->pipe->pool, tmp);
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, width, height);
 
@@ -1030,10 +1030,12 @@ static void process_nlmeans(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t
 
   // P == 0 : this will degenerate to a (fast) bilateral filter.
 
-  float *Sa = dt_alloc_align(64, (size_t)sizeof(float) * roi_out->width * dt_get_num_threads());
+  float *Sa = dt_dev_pixelpipe_pool_alloc(&piece->pipe->pool,
+                                          (size_t)sizeof(float) * roi_out->width * dt_get_num_threads());
   // we want to sum up weights in col[3], so need to init to 0:
   memset(ovoid, 0x0, (size_t)sizeof(float) * roi_out->width * roi_out->height * 4);
-  float *in = dt_alloc_align(64, (size_t)4 * sizeof(float) * roi_in->width * roi_in->height);
+  float *in = dt_dev_pixelpipe_pool_alloc(&piece->pipe->pool,
+                                          (size_t)4 * sizeof(float) * roi_in->width * roi_in->height);
 
   const float wb[3] = { piece->pipe->dsc.processed_maximum[0] * d->strength * (scale * scale),
                         piece->pipe->dsc.processed_maximum[1] * d->strength * (scale * scale),
@@ -1154,8 +1156,8 @@ static void process_nlmeans(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t
   }
 
   // free shared tmp memory:
-  dt_free_align(Sa);
-  dt_free_align(in);
+  dt_dev_pixelpipe_pool_free(&piece->pipe->pool, Sa);
+  dt_dev_pixelpipe_pool_free(&piece->pipe->pool, in);
   backtransform((float *)ovoid, roi_in->width, roi_in->height, aa, bb);
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
@@ -1178,10 +1180,12 @@ static void process_nlmeans_sse(struct dt_iop_module_t *self, dt_dev_pixelpipe_i
 
   // P == 0 : this will degenerate to a (fast) bilateral filter.
 
-  float *Sa = dt_alloc_align(64, (size_t)sizeof(float) * roi_out->width * dt_get_num_threads());
+  float *Sa = dt_dev_pixelpipe_pool_alloc(&piece->pipe->pool,
+                                          (size_t)sizeof(float) * roi_out->width * dt_get_num_threads());
   // we want to sum up weights in col[3], so need to init to 0:
   memset(ovoid, 0x0, (size_t)sizeof(float) * roi_out->width * roi_out->height * 4);
-  float *in = dt_alloc_align(64, (size_t)4 * sizeof(float) * roi_in->width * roi_in->height);
+  float *in = dt_dev_pixelpipe_pool_alloc(&piece->pipe->pool,
+                                          (size_t)4 * sizeof(float) * roi_in->width * roi_in->height);
 
   const float wb[3] = { piece->pipe->dsc.processed_maximum[0] * d->strength * (scale * scale),
                         piece->pipe->dsc.processed_maximum[1] * d->strength * (scale * scale),
@@ -1351,8 +1355,8 @@ static void process_nlmeans_sse(struct dt_iop_module_t *self, dt_dev_pixelpipe_i
     }
   }
   // free shared tmp memory:
-  dt_free_align(Sa);
-  dt_free_align(in);
+  dt_dev_pixelpipe_pool_free(&piece->pipe->pool, Sa);
+  dt_dev_pixelpipe_pool_free(&piece->pipe->pool, in);
   backtransform((float *)ovoid, roi_in->width, roi_in->height, aa, bb);
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
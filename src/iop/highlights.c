@@ -925,6 +925,28 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
 }
 
+int fuse_raw(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, dt_iop_fused_raw_t *fused,
+             const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  const dt_iop_highlights_data_t *const data = (dt_iop_highlights_data_t *)piece->data;
+
+  // only clipping is per pixel, the reconstructing modes look at the neighbours.
+  if(!fused) return data->mode == DT_IOP_HIGHLIGHTS_CLIP;
+
+  const float clip
+      = data->clip * fminf(piece->pipe->dsc.processed_maximum[0],
+                           fminf(piece->pipe->dsc.processed_maximum[1], piece->pipe->dsc.processed_maximum[2]));
+
+  for(int j = 0; j < DT_IOP_FUSED_RAW_ROWS; j++)
+    for(int i = 0; i < DT_IOP_FUSED_RAW_COLS; i++) fused->clip[j][i] = MIN(clip, fused->clip[j][i]);
+
+  const float m = fmaxf(fmaxf(piece->pipe->dsc.processed_maximum[0], piece->pipe->dsc.processed_maximum[1]),
+                        piece->pipe->dsc.processed_maximum[2]);
+  for(int k = 0; k < 3; k++) piece->pipe->dsc.processed_maximum[k] = m;
+
+  return 1;
+}
+
 static void clip_callback(GtkWidget *slider, dt_iop_module_t *self)
 {
   if(self->dt->gui->reset) return;
@@ -192,6 +192,13 @@ int distort_transform(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_
 int distort_backtransform(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, float *points,
                           size_t points_count);
 
+/** optional, for raw stage modules which work on one pixel at a time. with fused == NULL just tell whether the
+ * current parameters allow it. otherwise fold the work into fused (see dt_iop_fused_raw_t) and do the same to
+ * piece->pipe->dsc as process() would. the pipe then runs a chain of such modules as one pass over the mosaic
+ * data, on cpu, if nothing needs to see the buffers in between. */
+int fuse_raw(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, struct dt_iop_fused_raw_t *fused,
+             const struct dt_iop_roi_t *const roi_in, const struct dt_iop_roi_t *const roi_out);
+
 
 // introspection related callbacks, will be auto-implemented if DT_MODULE_INTROSPECTION() is used,
 int introspection_init(struct dt_iop_module_so_t *self, int api_version);
@@ -241,6 +241,17 @@ typedef struct {
   int warp_kernel;
 } dt_iop_liquify_global_data_t;
 
+// pipe data: the params plus the distortion map of the last run of process(), which is only updated where the
+// warps changed.
+
+typedef struct {
+  dt_iop_liquify_params_t params;
+  float complex *map;               ///< cached distortion map, or NULL
+  cairo_rectangle_int_t map_extent; ///< extent of the cached map
+  dt_liquify_warp_t *warps;         ///< the warps the cached map was built from, sorted with _warp_cmp()
+  int warp_count;
+} dt_iop_liquify_data_t;
+
 typedef struct {
   dt_pthread_mutex_t lock;
   dt_iop_liquify_params_t params;
@@ -936,14 +947,16 @@ static void build_round_stamp (float complex **pstamp,
   resulting vector field to the global distortion map @a global_map.
 
   The global distortion map is a map of relative pixel displacements
-  encompassing all our paths.
+  encompassing all our paths.  Only the part of the map inside @a clip
+  is touched.
 */
 
 static void add_to_global_distortion_map (float complex *global_map,
                                           const cairo_rectangle_int_t *global_map_extent,
                                           const dt_liquify_warp_t *warp,
                                           const float complex *stamp,
-                                          const cairo_rectangle_int_t *stamp_extent)
+                                          const cairo_rectangle_int_t *stamp_extent,
+                                          const cairo_rectangle_int_t *clip)
 {
   cairo_rectangle_int_t mmext = *stamp_extent;
   mmext.x += (int) round (creal (warp->point));
@@ -951,11 +964,12 @@ static void add_to_global_distortion_map (float complex *global_map,
   cairo_rectangle_int_t cmmext = mmext;
   cairo_region_t *mmreg = cairo_region_create_rectangle (&mmext);
   cairo_region_intersect_rectangle (mmreg, global_map_extent);
+  cairo_region_intersect_rectangle (mmreg, clip);
   cairo_region_get_extents (mmreg, &cmmext);
-  free (mmreg);
+  cairo_region_destroy (mmreg);
 
   #ifdef _OPENMP
-  #pragma omp parallel for schedule (static) default (shared)
+  #pragma omp parallel for schedule (static) default (shared) if (cmmext.width * cmmext.height > 4096)
   #endif
 
   for (int y = cmmext.y; y < cmmext.y + cmmext.height; y++)
@@ -1058,107 +1072,180 @@ static void _get_map_extent (const dt_iop_roi_t *roi_out,
   cairo_region_destroy (roi_out_region);
 }
 
-static float complex *create_global_distortion_map (const cairo_rectangle_int_t *map_extent,
-                                                    GList *interpolated,
-                                                    gboolean inverted)
+// the rectangle add_to_global_distortion_map() writes to for this warp.
+
+static void _stamp_rect (cairo_rectangle_int_t *r, const dt_liquify_warp_t *warp)
+{
+  const int iradius = round (cabs (warp->radius - warp->point));
+  r->x = (int) round (creal (warp->point)) - iradius;
+  r->y = (int) round (cimag (warp->point)) - iradius;
+  r->width = r->height = 2 * iradius + 1;
+}
+
+static int _warp_cmp (const void *a, const void *b)
 {
-  // allocate distortion map big enough to contain all paths
-  const int mapsize = map_extent->width * map_extent->height;
-  float complex * map = dt_alloc_align (16, mapsize * sizeof (float complex));
-  memset (map, 0, mapsize * sizeof (float complex));
+  return memcmp (a, b, sizeof (dt_liquify_warp_t));
+}
 
-  // build map
-  for (GList *i = interpolated; i != NULL; i = i->next)
+// forget the cached map, the next build computes all of it
+static void _drop_distortion_map (dt_iop_liquify_data_t *d)
+{
+  dt_free_align (d->map);
+  d->map = NULL;
+  free (d->warps);
+  d->warps = NULL;
+  d->warp_count = 0;
+  memset (&d->map_extent, 0, sizeof (cairo_rectangle_int_t));
+}
+
+/*
+  Returns the distortion map for roi_out, which stays owned by the
+  pipe data.  NULL if there is nothing to distort, or no memory for
+  the map.
+
+  Dragging a node only moves the few stamps of the paths next to it,
+  so instead of starting from scratch every time we keep the map of the
+  last run together with the warps it was built from.  Only the area of
+  the stamps which appeared or vanished since then (and whatever is new
+  in the extent) is cleared and rebuilt from the stamps overlapping it.
+*/
+
+static const float complex *build_global_distortion_map (struct dt_iop_module_t *module,
+                                                         const dt_dev_pixelpipe_iop_t *piece,
+                                                         const dt_iop_roi_t *roi_in,
+                                                         const dt_iop_roi_t *roi_out,
+                                                         cairo_rectangle_int_t *map_extent)
+{
+  dt_iop_liquify_data_t *d = (dt_iop_liquify_data_t *) piece->data;
+
+  // copy params
+  dt_iop_liquify_params_t copy_params;
+  memcpy(&copy_params, &d->params, sizeof(dt_iop_liquify_params_t));
+
+  distort_paths_raw_to_piece (module, piece->pipe, roi_in->scale, &copy_params);
+
+  GList *interpolated = interpolate_paths (&copy_params);
+
+  _get_map_extent (roi_out, interpolated, map_extent);
+
+  if (map_extent->width == 0 || map_extent->height == 0)
   {
-    const dt_liquify_warp_t *warp = ((dt_liquify_warp_t *) i->data);
-    float complex *stamp = NULL;
-    cairo_rectangle_int_t r;
-    build_round_stamp (&stamp, &r, warp);
-    add_to_global_distortion_map (map, map_extent, warp, stamp, &r);
-    free ((void *) stamp);
+    g_list_free_full (interpolated, free);
+    return NULL;
   }
 
-  if (inverted)
+  // sorted copy of the warps, so we can find the ones that differ from the last run
+  const int warp_count = g_list_length (interpolated);
+  dt_liquify_warp_t *warps = malloc (sizeof (dt_liquify_warp_t) * MAX (warp_count, 1));
+  if (warps == NULL)
   {
-    float complex * const imap = dt_alloc_align (16, mapsize * sizeof (float complex));
-    memset (imap, 0, mapsize * sizeof (float complex));
+    g_list_free_full (interpolated, free);
+    _drop_distortion_map (d);
+    return NULL;
+  }
+  int n = 0;
+  for (GList *i = interpolated; i != NULL; i = i->next)
+    warps[n++] = *((dt_liquify_warp_t *) i->data);
+  qsort (warps, warp_count, sizeof (dt_liquify_warp_t), _warp_cmp);
 
-    // copy map into imap (inverted map).
-    // imap [ n + dx(map[n]) , n + dy(map[n]) ] = -map[n]
+  cairo_region_t *dirty = cairo_region_create_rectangle (map_extent);
 
-    #ifdef _OPENMP
-    #pragma omp parallel for schedule (static) default (shared)
-    #endif
+  if (d->map == NULL)
+  {
+    d->map = dt_alloc_align (16, sizeof (float complex) * map_extent->width * map_extent->height);
+    if (d->map == NULL) goto error;
+  }
+  else
+  {
+    // whatever the old map didn't cover has to be computed
+    cairo_region_subtract_rectangle (dirty, &d->map_extent);
 
-    for (int y = 0; y <  map_extent->height; y++)
+    // and so does the area of every stamp that was added or removed
+    cairo_region_t *changed = cairo_region_create ();
+    int i = 0, j = 0;
+    while (i < d->warp_count || j < warp_count)
     {
-      const float complex *row = map + y * map_extent->width;
-      for (int x = 0; x < map_extent->width; x++)
+      const int c = i == d->warp_count ? 1 : j == warp_count ? -1 : _warp_cmp (d->warps + i, warps + j);
+      cairo_rectangle_int_t r;
+      if (c == 0)
       {
-        const float complex d = *(row + x);
-        // compute new position (nx,ny) given the displacement d
-        const int nx = x + (int)creal(d);
-        const int ny = y + (int)cimag(d);
-
-        // if the point falls into the extent, set it
-        if (nx>0 && nx<map_extent->width && ny>0 && ny<map_extent->height)
-          imap[nx + ny * map_extent->width] = -d;
+        i++;
+        j++;
+        continue;
       }
+      _stamp_rect (&r, c < 0 ? d->warps + i++ : warps + j++);
+      cairo_region_union_rectangle (changed, &r);
     }
+    cairo_region_intersect_rectangle (changed, map_extent);
+    cairo_region_union (dirty, changed);
+    cairo_region_destroy (changed);
 
-    dt_free_align ((void *) map);
-
-    // now just do a pass to avoid gap with a displacement of zero, note that we do not need high
-    // precision here as the inverted distortion mask is only used to compute a final displacement
-    // of points.
-
-    #ifdef _OPENMP
-    #pragma omp parallel for schedule (dynamic) default (shared)
-    #endif
-
-    for (int y = 0; y <  map_extent->height; y++)
+    if (memcmp (&d->map_extent, map_extent, sizeof (cairo_rectangle_int_t)))
     {
-      float complex *row = imap + y * map_extent->width;
-      float complex last[2] = { 0, 0 };
-      for (int x = 0; x < map_extent->width / 2 + 1; x++)
-      {
-        float complex *cl = row + x;
-        float complex *cr = row + map_extent->width - x;
-        if (x!=0)
-        {
-          if (*cl == 0) *cl = last[0];
-          if (*cr == 0) *cr = last[1];
-        }
-        last[0] = *cl; last[1] = *cr;
-      }
+      // move the still valid part over to a map of the new extent
+      float complex *map = dt_alloc_align (16, sizeof (float complex) * map_extent->width * map_extent->height);
+      if (map == NULL) goto error;
+      const cairo_rectangle_int_t *o = &d->map_extent;
+      const int x0 = MAX (o->x, map_extent->x), x1 = MIN (o->x + o->width, map_extent->x + map_extent->width);
+      const int y0 = MAX (o->y, map_extent->y), y1 = MIN (o->y + o->height, map_extent->y + map_extent->height);
+
+      for (int y = y0; y < y1 && x0 < x1; y++)
+        memcpy (map + (size_t) (y - map_extent->y) * map_extent->width + x0 - map_extent->x,
+                d->map + (size_t) (y - o->y) * o->width + x0 - o->x,
+                sizeof (float complex) * (x1 - x0));
+
+      dt_free_align (d->map);
+      d->map = map;
     }
-
-    map = imap;
   }
 
-  return map;
-}
+  // rebuild the dirty part from all stamps touching it, in the same order as a full build
+  const int dirty_count = cairo_region_num_rectangles (dirty);
+  for (int k = 0; k < dirty_count; k++)
+  {
+    cairo_rectangle_int_t r;
+    cairo_region_get_rectangle (dirty, k, &r);
+    for (int y = r.y; y < r.y + r.height; y++)
+      memset (d->map + (size_t) (y - map_extent->y) * map_extent->width + r.x - map_extent->x, 0,
+              sizeof (float complex) * r.width);
+  }
 
-static float complex *build_global_distortion_map (struct dt_iop_module_t *module,
-                                                   const dt_dev_pixelpipe_iop_t *piece,
-                                                   const dt_iop_roi_t *roi_in,
-                                                   const dt_iop_roi_t *roi_out,
-                                                   cairo_rectangle_int_t *map_extent)
-{
-  // copy params
-  dt_iop_liquify_params_t copy_params;
-  memcpy(&copy_params, (dt_iop_liquify_params_t *)piece->data, sizeof(dt_iop_liquify_params_t));
+  for (GList *i = interpolated; i != NULL && dirty_count; i = i->next)
+  {
+    const dt_liquify_warp_t *warp = ((dt_liquify_warp_t *) i->data);
+    cairo_rectangle_int_t r;
+    _stamp_rect (&r, warp);
+    if (cairo_region_contains_rectangle (dirty, &r) == CAIRO_REGION_OVERLAP_OUT)
+      continue;
 
-  distort_paths_raw_to_piece (module, piece->pipe, roi_in->scale, &copy_params);
+    float complex *stamp = NULL;
+    build_round_stamp (&stamp, &r, warp);
+    for (int k = 0; k < dirty_count; k++)
+    {
+      cairo_rectangle_int_t clip;
+      cairo_region_get_rectangle (dirty, k, &clip);
+      add_to_global_distortion_map (d->map, map_extent, warp, stamp, &r, &clip);
+    }
+    free ((void *) stamp);
+  }
 
-  GList *interpolated = interpolate_paths (&copy_params);
+  cairo_region_destroy (dirty);
+  g_list_free_full (interpolated, free);
 
-  _get_map_extent (roi_out, interpolated, map_extent);
+  free (d->warps);
+  d->warps = warps;
+  d->warp_count = warp_count;
+  d->map_extent = *map_extent;
 
-  float complex *map = create_global_distortion_map(map_extent, interpolated, FALSE);
+  return d->map;
 
+error:
+  // out of memory: the image is left undistorted, and the next run starts over
+  cairo_region_destroy (dirty);
   g_list_free_full (interpolated, free);
-  return map;
+  free (warps);
+  _drop_distortion_map (d);
+  return NULL;
 }
 
 // 1st pass: how large would the output be, given this input roi?
@@ -1186,7 +1273,7 @@ void modify_roi_in (struct dt_iop_module_t *module,
 
   // copy params
   dt_iop_liquify_params_t copy_params;
-  memcpy(&copy_params, (dt_iop_liquify_params_t*)piece->data, sizeof(dt_iop_liquify_params_t));
+  memcpy(&copy_params, &((dt_iop_liquify_data_t *)piece->data)->params, sizeof(dt_iop_liquify_params_t));
 
   distort_paths_raw_to_piece (module, piece->pipe, roi_in->scale, &copy_params);
 
@@ -1227,67 +1314,145 @@ void modify_roi_in (struct dt_iop_module_t *module,
   g_list_free_full (interpolated, free);
 }
 
-static int _distort_xtransform(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, float *points, size_t points_count, gboolean inverted)
-{
-  const float scale = piece->iscale;
+/*
+  distort_transform() and distort_backtransform() only need the
+  displacement at a handful of points (mask and guide corners), so
+  instead of rendering the stamps into a map we evaluate the ones
+  covering each point directly.  The values are exactly those
+  build_round_stamp() and add_to_global_distortion_map() would put
+  into the map at that pixel.
+*/
 
-  // compute the extent of all points (all computations are done in RAW coordinate)
-  float xmin=FLT_MAX, xmax=FLT_MIN, ymin=FLT_MAX, ymax=FLT_MIN;
+typedef struct {
+  int cx, cy;                 ///< center pixel of the stamp
+  int iradius;
+  int table_size;
+  const float *lookup_table;
+  float complex strength;
+  float abs_strength;
+  dt_liquify_warp_type_enum_t type;
+} dt_liquify_sparse_warp_t;
 
-  for(size_t i = 0; i < points_count * 2; i += 2)
+static dt_liquify_sparse_warp_t *_sparse_warps_new (GList *interpolated, int *count)
+{
+  *count = g_list_length (interpolated);
+  dt_liquify_sparse_warp_t *sw = malloc (sizeof (dt_liquify_sparse_warp_t) * MAX (*count, 1));
+  dt_liquify_sparse_warp_t *w = sw;
+
+  for (GList *i = interpolated; i != NULL; i = i->next, w++)
   {
-    const float x = points[i] * scale;
-    const float y = points[i + 1] * scale;
-    xmin = fmin (xmin, x);
-    xmax = fmax (xmax, x);
-    ymin = fmin (ymin, y);
-    ymax = fmax (ymax, y);
+    const dt_liquify_warp_t *warp = ((dt_liquify_warp_t *) i->data);
+    w->iradius = round (cabs (warp->radius - warp->point));
+    w->cx = (int) round (creal (warp->point));
+    w->cy = (int) round (cimag (warp->point));
+    w->table_size = w->iradius * LOOKUP_OVERSAMPLE;
+    w->lookup_table = build_lookup_table (w->table_size, warp->control1, warp->control2);
+    // see build_round_stamp ()
+    w->strength = 0.5 * (warp->strength - warp->point);
+    w->strength = (warp->status & DT_LIQUIFY_STATUS_INTERPOLATED) ?
+      (w->strength * STAMP_RELOCATION) : w->strength;
+    w->abs_strength = cabs (w->strength);
+    w->type = warp->type;
   }
+  return sw;
+}
+
+static void _sparse_warps_free (dt_liquify_sparse_warp_t *sw, const int count)
+{
+  for (int k = 0; k < count; k++)
+    dt_free_align ((void *) sw[k].lookup_table);
+  free (sw);
+}
+
+// the value of the global distortion map at pixel (x, y)
 
-  cairo_rectangle_int_t extent = { .x = (int)(xmin - .5), .y = (int)(ymin - .5),
-                                   .width = (int)(xmax - xmin + 2.5), .height = (int)(ymax - ymin + 2.5) };
+static float complex _sparse_map_at (const dt_liquify_sparse_warp_t *sw, const int count, const int x, const int y)
+{
+  float complex d = 0.0f;
 
-  if (extent.width != 0 && extent.height != 0)
+  for (int k = 0; k < count; k++)
   {
-    // create the distortion map for this extent
+    const dt_liquify_sparse_warp_t *w = sw + k;
+    const int dx = x - w->cx;
+    const int dy = y - w->cy;
+    if (abs (dx) > w->iradius || abs (dy) > w->iradius)
+      continue;
+
+    const float dist = hypotf (MAX (abs (dx), abs (dy)), MIN (abs (dx), abs (dy)));
+    const int idist = round (dist * LOOKUP_OVERSAMPLE);
+    if (idist >= w->table_size)
+      continue;
 
-    GList *interpolated = interpolate_paths ((dt_iop_liquify_params_t *)piece->data);
+    const float abs_lookup = w->abs_strength * w->lookup_table[idist] / w->iradius;
 
-    // we need to adjust the extent to be the union enclosing all the points (currently in extent) and
-    // the warps that are in (possibly partly) in this same region.
+    switch (w->type)
+    {
+    case DT_LIQUIFY_WARP_TYPE_RADIAL_GROW:
+      d -= abs_lookup * (dx + dy * I);
+      break;
 
-    dt_iop_roi_t roi_in = { .x = extent.x, .y = extent.y, .width = extent.width, .height = extent.height };
-    _get_map_extent (&roi_in, interpolated, &extent);
+    case DT_LIQUIFY_WARP_TYPE_RADIAL_SHRINK:
+      d -= -abs_lookup * (dx + dy * I);
+      break;
 
-    float complex *map = create_global_distortion_map (&extent, interpolated, inverted);
-    g_list_free_full (interpolated, free);
+    default:
+      d -= w->strength * w->lookup_table[idist];
+      break;
+    }
+  }
+  return d;
+}
+
+static int _distort_xtransform(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, float *points, size_t points_count, gboolean inverted)
+{
+  // all computations are done in RAW coordinates
+  const float scale = piece->iscale;
+  const dt_iop_liquify_data_t *d = (dt_iop_liquify_data_t *) piece->data;
+
+  GList *interpolated = interpolate_paths ((dt_iop_liquify_params_t *) &d->params);
+  int count = 0;
+  dt_liquify_sparse_warp_t *sw = _sparse_warps_new (interpolated, &count);
+  g_list_free_full (interpolated, free);
 
-    if (map == NULL) return 0;
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule (static) default (shared) if (points_count > 1000)
+  #endif
 
-    const int map_size =  extent.width * extent.height;
-    const int x_last = extent.x + extent.width;
-    const int y_last = extent.y + extent.height;
+  for(size_t i = 0; i < points_count; i++)
+  {
+    float *px = &points[i*2];
+    float *py = &points[i*2+1];
+    const float x = *px * scale;
+    const float y = *py * scale;
 
-    // apply distortion to all points (this is a simple displacement given by a vector at this same point in the map)
-    for(size_t i = 0; i < points_count; i++)
+    if (!inverted)
     {
-      float *px = &points[i*2];
-      float *py = &points[i*2+1];
-      const float x = *px * scale;
-      const float y = *py * scale;
-      const int map_offset = ((int)(x - 0.5) - extent.x) + ((int)(y - 0.5) - extent.y) * extent.width;
-
-      if (x >= extent.x && x < x_last && y >= extent.y && y < y_last && map_offset >= 0 && map_offset < map_size)
+      // backtransform: the map says where each output pixel is sampled from
+      const float complex dist = _sparse_map_at (sw, count, (int)(x - 0.5), (int)(y - 0.5)) / scale;
+      *px += creal(dist);
+      *py += cimag(dist);
+    }
+    else
+    {
+      // transform: find q with q + map(q) = p.  the displacement is
+      // smooth and small against the radius, so a few fixed point
+      // steps settle on the pixel.
+      float qx = x, qy = y;
+      for (int it = 0; it < 10; it++)
       {
-        const float complex dist = map[map_offset] / scale;
-        *px += creal(dist);
-        *py += cimag(dist);
+        const int ix = (int)(qx - 0.5), iy = (int)(qy - 0.5);
+        const float complex dist = _sparse_map_at (sw, count, ix, iy);
+        qx = x - creal(dist);
+        qy = y - cimag(dist);
+        if ((int)(qx - 0.5) == ix && (int)(qy - 0.5) == iy)
+          break;
       }
+      *px = qx / scale;
+      *py = qy / scale;
     }
-
-    dt_free_align ((void *) map);
   }
 
+  _sparse_warps_free (sw, count);
   return 1;
 }
 
@@ -1324,16 +1489,13 @@ void process(struct dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, cons
   // 2. build the distortion map
 
   cairo_rectangle_int_t map_extent;
-  float complex *map = build_global_distortion_map (module, piece, roi_in, roi_out, &map_extent);
+  const float complex *map = build_global_distortion_map (module, piece, roi_in, roi_out, &map_extent);
   if (map == NULL)
     return;
 
   // 3. apply the map
 
-  if (map_extent.width != 0 && map_extent.height != 0)
-    apply_global_distortion_map (module, piece, in, out, roi_in, roi_out, map, &map_extent);
-
-  dt_free_align ((void *) map);
+  apply_global_distortion_map (module, piece, in, out, roi_in, roi_out, map, &map_extent);
 }
 
 #ifdef HAVE_OPENCL
@@ -1500,10 +1662,7 @@ int process_cl (struct dt_iop_module_t *module,
 
   // 3. apply the map
 
-  if (map_extent.width != 0 && map_extent.height != 0)
-    err = apply_global_distortion_map_cl (module, piece, dev_in, dev_out, roi_in, roi_out, map, &map_extent);
-
-  dt_free_align ((void *) map);
+  err = apply_global_distortion_map_cl (module, piece, dev_in, dev_out, roi_in, roi_out, map, &map_extent);
   if (err != CL_SUCCESS) goto error;
 
   return TRUE;
@@ -1554,12 +1713,15 @@ void cleanup (dt_iop_module_t *module)
 
 void init_pipe (struct dt_iop_module_t *module, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
-  piece->data = malloc (module->params_size);
+  piece->data = calloc (1, sizeof (dt_iop_liquify_data_t));
   module->commit_params (module, module->default_params, pipe, piece);
 }
 
 void cleanup_pipe (struct dt_iop_module_t *module, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
+  dt_iop_liquify_data_t *d = (dt_iop_liquify_data_t *) piece->data;
+  dt_free_align (d->map);
+  free (d->warps);
   free (piece->data);
   piece->data = NULL;
 }
@@ -1571,7 +1733,8 @@ void commit_params (struct dt_iop_module_t *module,
                     dt_dev_pixelpipe_t *pipe,
                     dt_dev_pixelpipe_iop_t *piece)
 {
-  memcpy (piece->data, params, module->params_size);
+  dt_iop_liquify_data_t *d = (dt_iop_liquify_data_t *) piece->data;
+  memcpy (&d->params, params, module->params_size);
 }
 
 // calculate the dot product of 2 vectors.
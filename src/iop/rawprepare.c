@@ -113,7 +113,7 @@ int groups()
 
 void init_presets(dt_iop_module_so_t *self)
 {
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "BEGIN", NULL, NULL, NULL);
+  dt_database_start_transaction(darktable.db);
 
   dt_gui_presets_add_generic(_("passthrough"), self->op, self->version(),
                              &(dt_iop_rawprepare_params_t){.crop.array = { 0, 0, 0, 0 },
@@ -124,7 +124,7 @@ void init_presets(dt_iop_module_so_t *self)
                                                            .raw_white_point = UINT16_MAX },
                              sizeof(dt_iop_rawprepare_params_t), 1);
 
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+  dt_database_release_transaction(darktable.db);
 }
 
 void init_key_accels(dt_iop_module_so_t *self)
@@ -371,6 +371,34 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = 1.0f;
 }
 
+int fuse_raw(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, dt_iop_fused_raw_t *fused,
+             const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  // the pipe only asks for mosaic data, where this is the crop plus the black/white scaling of process().
+  if(!fused) return 1;
+
+  const dt_iop_rawprepare_data_t *const d = (dt_iop_rawprepare_data_t *)piece->data;
+
+  const int csx = compute_proper_crop(piece, roi_in, d->x), csy = compute_proper_crop(piece, roi_in, d->y);
+
+  fused->x = csx;
+  fused->y = csy;
+  for(int j = 0; j < DT_IOP_FUSED_RAW_ROWS; j++)
+    for(int i = 0; i < DT_IOP_FUSED_RAW_COLS; i++)
+    {
+      const int id = BL(roi_out, d, j, i);
+      fused->sub[j][i] = d->sub[id];
+      fused->div[j][i] = d->div[id];
+    }
+
+  piece->pipe->dsc.filters = dt_rawspeed_crop_dcraw_filters(self->dev->image_storage.buf_dsc.filters, csx, csy);
+  adjust_xtrans_filters(piece->pipe, csx, csy);
+
+  for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = 1.0f;
+
+  return 1;
+}
+
 #if defined(__SSE2__)
 void process_sse2(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
                   void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
@@ -166,7 +166,11 @@ typedef struct dt_iop_retouch_gui_data_t
   GtkWidget *sl_mask_opacity; // draw mask opacity
 } dt_iop_retouch_gui_data_t;
 
-typedef struct dt_iop_retouch_params_t dt_iop_retouch_data_t;
+typedef struct dt_iop_retouch_data_t
+{
+  dt_iop_retouch_params_t params; // must be first, piece->data is used as params
+  dt_dwt_cache_t *dwt_cache;      // scales of the last decomposed input, interactive pipes only
+} dt_iop_retouch_data_t;
 
 typedef struct dt_iop_retouch_global_data_t
 {
@@ -2454,17 +2458,24 @@ void gui_focus(struct dt_iop_module_t *self, gboolean in)
 void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *params, dt_dev_pixelpipe_t *pipe,
                    dt_dev_pixelpipe_iop_t *piece)
 {
-  memcpy(piece->data, params, sizeof(dt_iop_retouch_params_t));
+  dt_iop_retouch_data_t *d = (dt_iop_retouch_data_t *)piece->data;
+  memcpy(&d->params, params, sizeof(dt_iop_retouch_params_t));
 }
 
 void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
-  piece->data = malloc(sizeof(dt_iop_retouch_data_t));
+  dt_iop_retouch_data_t *d = (dt_iop_retouch_data_t *)calloc(1, sizeof(dt_iop_retouch_data_t));
+  piece->data = d;
+  // the darkroom pipes run again and again on the same input while forms are edited
+  if(pipe->type == DT_DEV_PIXELPIPE_FULL || pipe->type == DT_DEV_PIXELPIPE_PREVIEW)
+    d->dwt_cache = dt_dwt_cache_new();
   self->commit_params(self, self->default_params, pipe, piece);
 }
 
 void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
+  dt_iop_retouch_data_t *d = (dt_iop_retouch_data_t *)piece->data;
+  dt_dwt_cache_free(d->dwt_cache);
   free(piece->data);
   piece->data = NULL;
 }
@@ -4198,6 +4209,26 @@ static void rt_process_forms(float *layer, dwt_params_t *const wt_p, const int s
   }
 }
 
+// key of the dwt cache: what the image looks like once rt_process_forms() is done with scale 0
+static uint64_t rt_dwt_cache_hash(dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *const roi_in,
+                                  const retouch_user_data_t *const usr_data)
+{
+  const dt_iop_retouch_params_t *p = (dt_iop_retouch_params_t *)piece->data;
+
+  // the input buffer as the pipe cache knows it
+  uint64_t hash = dt_dev_pixelpipe_cache_hash(piece->pipe->image.id, roi_in, piece->pipe,
+                                              g_list_index(piece->pipe->nodes, piece));
+
+  // shapes on scale 0 change the image itself, so they are part of the key
+  int forms_on_image = 0;
+  for(int i = 0; i < RETOUCH_NO_FORMS && !forms_on_image; i++)
+    forms_on_image = (p->rt_forms[i].formid != 0 && p->rt_forms[i].scale == 0);
+  if(forms_on_image) hash = ((hash << 5) + hash) ^ piece->hash;
+
+  hash = ((hash << 5) + hash) ^ (usr_data->mask_display | (usr_data->suppress_mask << 1));
+  return hash;
+}
+
 static void process_internal(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
                              void *const ovoid, const dt_iop_roi_t *const roi_in,
                              const dt_iop_roi_t *const roi_out, const int use_sse)
@@ -4238,6 +4269,7 @@ static void process_internal(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
                       (!display_wavelet_scale) ? 0 : p->curr_scale, p->merge_from_scale, &usr_data,
                       roi_in->scale / piece->iscale, use_sse);
   if(dwt_p == NULL) goto cleanup;
+  dwt_p->cache = ((dt_iop_retouch_data_t *)piece->data)->dwt_cache;
 
   // check if this module should expose mask.
   if(piece->pipe->type == DT_DEV_PIXELPIPE_FULL && g && g->mask_display && self->dev->gui_attached
@@ -4264,6 +4296,8 @@ static void process_internal(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
     if(g) g->first_scale_visible = dt_dwt_first_scale_visible(dwt_p);
   }
 
+  if(dwt_p->cache) dwt_p->cache_hash = rt_dwt_cache_hash(piece, roi_in, &usr_data);
+
   // decompose it
   dwt_decompose(dwt_p, rt_process_forms);
 
@@ -504,6 +504,31 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   }
 }
 
+int fuse_raw(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, dt_iop_fused_raw_t *fused,
+             const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  // the mosaiced paths of process() scale each photosite by the coefficient of its colour.
+  if(!fused) return 1;
+
+  const uint32_t filters = piece->pipe->dsc.filters;
+  const uint8_t(*const xtrans)[6] = (const uint8_t(*const)[6])piece->pipe->dsc.xtrans;
+  const dt_iop_temperature_data_t *const d = (dt_iop_temperature_data_t *)piece->data;
+
+  for(int j = 0; j < DT_IOP_FUSED_RAW_ROWS; j++)
+    for(int i = 0; i < DT_IOP_FUSED_RAW_COLS; i++)
+      fused->mul[j][i] *= (filters == 9u) ? d->coeffs[FCxtrans(j, i, roi_out, xtrans)]
+                                          : d->coeffs[FC(j + roi_out->y, i + roi_out->x, filters)];
+
+  piece->pipe->dsc.temperature.enabled = 1;
+  for(int k = 0; k < 4; k++)
+  {
+    piece->pipe->dsc.temperature.coeffs[k] = d->coeffs[k];
+    piece->pipe->dsc.processed_maximum[k] = d->coeffs[k] * piece->pipe->dsc.processed_maximum[k];
+  }
+
+  return 1;
+}
+
 #if defined(__SSE__)
 void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
                   void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
@@ -120,28 +120,19 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 
   PermutohedralLattice<3, 2> lattice(size, omp_get_max_threads());
 
-// Build I=log(L)
-// and splat into the lattice
-#ifdef _OPENMP
-#pragma omp parallel for shared(lattice)
-#endif
-  for(int j = 0; j < height; j++)
-  {
-    size_t index = (size_t)j * width;
-    const int thread = omp_get_thread_num();
-    const float *in = (const float *)ivoid + (size_t)j * width * ch;
-    for(int i = 0; i < width; i++, index++, in += ch)
-    {
-      float L = 0.2126 * in[0] + 0.7152 * in[1] + 0.0722 * in[2];
-      if(L <= 0.0) L = 1e-6;
-      L = logf(L);
-      float pos[3] = { i * inv_sigma_s, j * inv_sigma_s, L * inv_sigma_r };
-      float val[2] = { L, 1.0 };
-      lattice.splat(pos, val, index, thread);
-    }
-  }
-
-  lattice.merge_splat_threads();
+  // Build I=log(L)
+  // and splat into the lattice
+  lattice.splat(height, width, [&](const int j, const int i, float *pos, float *val) {
+    const float *in = (const float *)ivoid + ((size_t)j * width + i) * ch;
+    float L = 0.2126 * in[0] + 0.7152 * in[1] + 0.0722 * in[2];
+    if(L <= 0.0) L = 1e-6;
+    L = logf(L);
+    pos[0] = i * inv_sigma_s;
+    pos[1] = j * inv_sigma_s;
+    pos[2] = L * inv_sigma_r;
+    val[0] = L;
+    val[1] = 1.0;
+  });
 
   // blur the lattice
   lattice.blur();
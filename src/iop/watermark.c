@@ -28,11 +28,15 @@
 #include "gui/gtk.h"
 #include "iop/iop_api.h"
 #include <assert.h>
+#include <float.h>
 #include <gtk/gtk.h>
 #include <inttypes.h>
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include <librsvg/rsvg.h>
 // ugh, ugly hack. why do people break stuff all the time?
@@ -95,6 +99,35 @@ typedef struct dt_iop_watermark_data_t
   char font[64];
 } dt_iop_watermark_data_t;
 
+/* a watermark rasterized into its own bounding box, cairo ARGB32 with premultiplied alpha. it's shared between
+ * the cache and the pipes compositing it, the last one to drop its reference frees it. */
+typedef struct dt_iop_watermark_raster_t
+{
+  int refs;
+  int width, height, stride;
+  // what it was rendered for: scale and rotation of the svg, its center and the sub pixel part of its position
+  float scale, angle, cx, cy, fx, fy;
+  guint8 *data;
+} dt_iop_watermark_raster_t;
+
+typedef struct dt_iop_watermark_cache_entry_t
+{
+  gchar *svgdoc; // the svg after variable substitution, covers changes to the file and to the image metadata
+  RsvgDimensionData dimension;
+  dt_iop_watermark_raster_t *raster;
+  uint64_t used;
+} dt_iop_watermark_cache_entry_t;
+
+// enough for preview, full and export pipe to not push out each other's watermark
+#define WATERMARK_CACHE_SIZE 3
+
+typedef struct dt_iop_watermark_global_data_t
+{
+  dt_pthread_mutex_t lock;
+  uint64_t clock;
+  dt_iop_watermark_cache_entry_t cache[WATERMARK_CACHE_SIZE];
+} dt_iop_watermark_global_data_t;
+
 typedef struct dt_iop_watermark_gui_data_t
 {
   GtkWidget *watermarks;                             // watermark
@@ -798,10 +831,151 @@ static gchar *_watermark_get_svgdoc(dt_iop_module_t *self, dt_iop_watermark_data
   return svgdoc;
 }
 
+static void _raster_unref(dt_iop_watermark_raster_t *r)
+{
+  if(r && g_atomic_int_dec_and_test(&r->refs))
+  {
+    g_free(r->data);
+    free(r);
+  }
+}
+
+static RsvgHandle *_watermark_parse_svg(const gchar *svgdoc)
+{
+  GError *error = NULL;
+  RsvgHandle *svg = rsvg_handle_new_from_data((const guint8 *)svgdoc, strlen(svgdoc), &error);
+  if(!svg || error)
+  {
+    fprintf(stderr, "[watermark] error processing svg file: %s\n", error ? error->message : "unknown error");
+    if(error) g_error_free(error);
+    if(svg) g_object_unref(svg);
+    return NULL;
+  }
+  return svg;
+}
+
+/* rasterize the svg into a width x height surface, such that svg coordinate p ends up at pixel
+ * (ox, oy) + R(angle) * (scale * p - (cx, cy)). has to be called with darktable.plugin_threadsafe held,
+ * rsvg (or some part of cairo which is used underneath) isn't thread safe, for example when handling fonts.
+ * NULL if there's no memory for the surface, the image is left without watermark then. */
+static dt_iop_watermark_raster_t *_watermark_render(RsvgHandle *svg, const float scale, const float angle,
+                                                    const float cx, const float cy, const float ox,
+                                                    const float oy, const int width, const int height)
+{
+  dt_iop_watermark_raster_t *r = (dt_iop_watermark_raster_t *)calloc(1, sizeof(dt_iop_watermark_raster_t));
+  if(!r) return NULL;
+  r->refs = 1;
+  r->width = width;
+  r->height = height;
+  r->stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, width);
+  r->data = (guint8 *)g_try_malloc0_n(height, r->stride);
+  if(!r->data)
+  {
+    _raster_unref(r);
+    return NULL;
+  }
+
+  cairo_surface_t *surface
+      = cairo_image_surface_create_for_data(r->data, CAIRO_FORMAT_ARGB32, width, height, r->stride);
+  if(cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS)
+  {
+    //   fprintf(stderr,"Cairo surface error: %s\n",cairo_status_to_string(cairo_surface_status(surface)));
+    cairo_surface_destroy(surface);
+    _raster_unref(r);
+    return NULL;
+  }
+
+  cairo_t *cr = cairo_create(surface);
+  cairo_translate(cr, ox, oy);
+  cairo_rotate(cr, angle);
+  cairo_translate(cr, -cx, -cy);
+  cairo_scale(cr, scale, scale);
+
+  /* render svg into surface*/
+  rsvg_handle_render_cairo(svg, cr);
+
+  cairo_destroy(cr);
+
+  /* ensure that all operations on surface finishing up */
+  cairo_surface_flush(surface);
+  cairo_surface_destroy(surface);
+
+  return r;
+}
+
+/* out = (1 - opacity * alpha) * in + opacity * color, with the raster placed at (x0, y0) of the roi. the raster
+ * is premultiplied, so the color doesn't need another multiplication with alpha. */
+static void _watermark_composite(const float *const in, float *const out, const int width, const int height,
+                                 const int ch, const dt_iop_watermark_raster_t *const r, const int x0,
+                                 const int y0, const float opacity)
+{
+  const int xa = CLAMP(x0, 0, width), xb = CLAMP(x0 + r->width, 0, width);
+  const float k = opacity / 255.0f;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int j = 0; j < height; j++)
+  {
+    const float *inp = in + (size_t)ch * width * j;
+    float *outp = out + (size_t)ch * width * j;
+    const int y = j - y0;
+
+    if(y < 0 || y >= r->height || xa >= xb)
+    {
+      memcpy(outp, inp, sizeof(float) * ch * width);
+      continue;
+    }
+
+    memcpy(outp, inp, sizeof(float) * ch * xa);
+    memcpy(outp + (size_t)ch * xb, inp + (size_t)ch * xb, sizeof(float) * ch * (width - xb));
+
+    // cairo's ARGB32 is b, g, r, a in memory
+    const guint8 *sd = r->data + (size_t)r->stride * y + 4 * (xa - x0);
+    inp += (size_t)ch * xa;
+    outp += (size_t)ch * xa;
+
+#if defined(__SSE2__)
+    if(ch == 4)
+    {
+      // last lane is zero to pass the alpha channel of the input through
+      const __m128 kv = _mm_set_ps(0.0f, k, k, k);
+      const __m128i zero = _mm_setzero_si128();
+      for(int i = xa; i < xb; i++, sd += 4, inp += 4, outp += 4)
+      {
+        const __m128 vin = _mm_load_ps(inp);
+        if(sd[3] == 0)
+        {
+          _mm_store_ps(outp, vin);
+          continue;
+        }
+        int px;
+        memcpy(&px, sd, sizeof(px));
+        __m128 s = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(px), zero), zero));
+        s = _mm_shuffle_ps(s, s, _MM_SHUFFLE(3, 0, 1, 2));
+        const __m128 a = _mm_shuffle_ps(s, s, _MM_SHUFFLE(3, 3, 3, 3));
+        _mm_store_ps(outp, _mm_add_ps(vin, _mm_mul_ps(kv, _mm_sub_ps(s, _mm_mul_ps(a, vin)))));
+      }
+      continue;
+    }
+#endif
+
+    for(int i = xa; i < xb; i++, sd += 4, inp += ch, outp += ch)
+    {
+      const float alpha = sd[3] * k;
+      outp[0] = (1.0f - alpha) * inp[0] + k * sd[2];
+      outp[1] = (1.0f - alpha) * inp[1] + k * sd[1];
+      outp[2] = (1.0f - alpha) * inp[2] + k * sd[0];
+      outp[3] = inp[3];
+    }
+  }
+}
+
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
              void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
   dt_iop_watermark_data_t *data = (dt_iop_watermark_data_t *)piece->data;
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)self->data;
   float *in = (float *)ivoid;
   float *out = (float *)ovoid;
   const int ch = piece->colors;
@@ -815,45 +989,38 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     return;
   }
 
-  /* setup stride for performance */
-  int stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, roi_out->width);
-
-  /* create cairo memory surface */
-  guint8 *image = (guint8 *)g_malloc0_n(roi_out->height, stride);
-  cairo_surface_t *surface = cairo_image_surface_create_for_data(image, CAIRO_FORMAT_ARGB32, roi_out->width,
-                                                                 roi_out->height, stride);
-  if(cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS)
-  {
-    //   fprintf(stderr,"Cairo surface error: %s\n",cairo_status_to_string(cairo_surface_status(surface)));
-    g_free(image);
-    memcpy(ovoid, ivoid, (size_t)sizeof(float) * ch * roi_out->width * roi_out->height);
-    return;
-  }
-
-  /* create cairo context and setup transformation/scale */
-  cairo_t *cr = cairo_create(surface);
-
-  // rsvg (or some part of cairo which is used underneath) isn't thread safe, for example when handling fonts
-  dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
+  /* get the dimension of svg, parsing it only if we haven't seen this document before */
+  RsvgDimensionData dimension;
+  RsvgHandle *svg = NULL;
+  gboolean known = FALSE;
+  dt_pthread_mutex_lock(&gd->lock);
+  for(int k = 0; k < WATERMARK_CACHE_SIZE && !known; k++)
+    if(gd->cache[k].svgdoc && !strcmp(gd->cache[k].svgdoc, svgdoc))
+    {
+      dimension = gd->cache[k].dimension;
+      known = TRUE;
+    }
+  dt_pthread_mutex_unlock(&gd->lock);
 
-  /* create the rsvghandle from parsed svg data */
-  GError *error = NULL;
-  RsvgHandle *svg = rsvg_handle_new_from_data((const guint8 *)svgdoc, strlen(svgdoc), &error);
-  g_free(svgdoc);
-  if(!svg || error)
+  if(!known)
   {
-    g_free(image);
-    memcpy(ovoid, ivoid, (size_t)sizeof(float) * ch * roi_out->width * roi_out->height);
+    dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
+    svg = _watermark_parse_svg(svgdoc);
+    if(svg) rsvg_handle_get_dimensions(svg, &dimension);
     dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
-    fprintf(stderr, "[watermark] error processing svg file: %s\n", error->message);
-    g_error_free(error);
-    return;
+    if(svg && (dimension.width <= 0 || dimension.height <= 0))
+    {
+      g_object_unref(svg);
+      svg = NULL;
+    }
+    if(!svg)
+    {
+      g_free(svgdoc);
+      memcpy(ovoid, ivoid, (size_t)sizeof(float) * ch * roi_out->width * roi_out->height);
+      return;
+    }
   }
 
-  /* get the dimension of svg */
-  RsvgDimensionData dimension;
-  rsvg_handle_get_dimensions(svg, &dimension);
-
   //  width/height of current (possibly cropped) image
   const float iw = piece->buf_in.width;
   const float ih = piece->buf_in.height;
@@ -956,65 +1123,117 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   else if(data->alignment == 2 || data->alignment == 5 || data->alignment == 8)
     tx = iw - svg_width - bX;
 
-  // translate to position
-  cairo_translate(cr, -roi_in->x, -roi_in->y);
-
   // add translation for the given value in GUI (xoffset,yoffset)
   tx += data->xoffset * wbase;
   ty += data->yoffset * hbase;
 
-  cairo_translate(cr, tx * roi_out->scale, ty * roi_out->scale);
-
   // compute the center of the svg to rotate from the center
-  float cX = svg_width / 2.0 * roi_out->scale;
-  float cY = svg_height / 2.0 * roi_out->scale;
+  const float cX = svg_width / 2.0 * roi_out->scale;
+  const float cY = svg_height / 2.0 * roi_out->scale;
+
+  // svg coordinate p ends up at (oX, oY) + R(angle) * (scale * p - (cX, cY)) in the roi
+  const float oX = tx * roi_out->scale - roi_in->x + cX;
+  const float oY = ty * roi_out->scale - roi_in->y + cY;
+
+  // bounding box of the rotated watermark relative to (oX, oY). we render it on its own, with only the sub
+  // pixel part of the position baked in, so the raster can be reused wherever it lands on the image.
+  const float ca = cos(angle), sa = sin(angle);
+  const float W = dimension.width * scale, H = dimension.height * scale;
+  const float qx[4] = { -cX, W - cX, -cX, W - cX }, qy[4] = { -cY, -cY, H - cY, H - cY };
+  float xmin = FLT_MAX, xmax = -FLT_MAX, ymin = FLT_MAX, ymax = -FLT_MAX;
+  for(int k = 0; k < 4; k++)
+  {
+    const float x = ca * qx[k] - sa * qy[k], y = sa * qx[k] + ca * qy[k];
+    xmin = fminf(xmin, x);
+    xmax = fmaxf(xmax, x);
+    ymin = fminf(ymin, y);
+    ymax = fmaxf(ymax, y);
+  }
+  const float fX = oX - floorf(oX), fY = oY - floorf(oY);
+  // one pixel of margin for the antialiased edges
+  const int lX = (int)floorf(xmin + fX) - 1, lY = (int)floorf(ymin + fY) - 1;
+  const int rw = (int)ceilf(xmax + fX) + 1 - lX, rh = (int)ceilf(ymax + fY) + 1 - lY;
 
-  cairo_translate(cr, cX, cY);
-  cairo_rotate(cr, angle);
-  cairo_translate(cr, -cX, -cY);
+  dt_iop_watermark_raster_t *raster = NULL;
+  int x0 = 0, y0 = 0;
 
-  // now set proper scale for the watermark itself
-  cairo_scale(cr, scale, scale);
+  // a watermark much larger than the roi (zoomed in darkroom) is cheaper to render clipped to the roi every time
+  const gboolean cacheable = (size_t)rw * rh <= (size_t)4 * roi_out->width * roi_out->height;
 
-  /* render svg into surface*/
-  rsvg_handle_render_cairo(svg, cr);
+  if(cacheable)
+  {
+    x0 = (int)floorf(oX) + lX;
+    y0 = (int)floorf(oY) + lY;
 
-  // no more non-thread safe rsvg usage
-  dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+    dt_pthread_mutex_lock(&gd->lock);
+    for(int k = 0; k < WATERMARK_CACHE_SIZE; k++)
+    {
+      const dt_iop_watermark_cache_entry_t *e = gd->cache + k;
+      const dt_iop_watermark_raster_t *r = e->raster;
+      if(r && r->width == rw && r->height == rh && r->scale == scale && r->angle == (float)angle && r->cx == cX
+         && r->cy == cY && r->fx == fX && r->fy == fY && !strcmp(e->svgdoc, svgdoc))
+      {
+        raster = e->raster;
+        g_atomic_int_inc(&raster->refs);
+        gd->cache[k].used = ++gd->clock;
+        break;
+      }
+    }
+    dt_pthread_mutex_unlock(&gd->lock);
+  }
 
-  cairo_destroy(cr);
+  if(!raster)
+  {
+    dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
+    if(!svg) svg = _watermark_parse_svg(svgdoc);
+    if(svg)
+    {
+      if(cacheable)
+        raster = _watermark_render(svg, scale, angle, cX, cY, fX - lX, fY - lY, rw, rh);
+      else
+        raster = _watermark_render(svg, scale, angle, cX, cY, oX, oY, roi_out->width, roi_out->height);
+    }
+    // no more non-thread safe rsvg usage
+    dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
 
-  /* ensure that all operations on surface finishing up */
-  cairo_surface_flush(surface);
+    if(raster && cacheable)
+    {
+      raster->scale = scale;
+      raster->angle = angle;
+      raster->cx = cX;
+      raster->cy = cY;
+      raster->fx = fX;
+      raster->fy = fY;
+
+      // replace the least recently used entry
+      dt_pthread_mutex_lock(&gd->lock);
+      dt_iop_watermark_cache_entry_t *e = gd->cache;
+      for(int k = 1; k < WATERMARK_CACHE_SIZE; k++)
+        if(gd->cache[k].used < e->used) e = gd->cache + k;
+      g_free(e->svgdoc);
+      _raster_unref(e->raster);
+      e->svgdoc = g_strdup(svgdoc);
+      e->dimension = dimension;
+      e->raster = raster;
+      e->used = ++gd->clock;
+      g_atomic_int_inc(&raster->refs);
+      dt_pthread_mutex_unlock(&gd->lock);
+    }
+  }
+
+  g_free(svgdoc);
+  if(svg) g_object_unref(svg);
+
+  if(!raster)
+  {
+    memcpy(ovoid, ivoid, (size_t)sizeof(float) * ch * roi_out->width * roi_out->height);
+    return;
+  }
 
   /* render surface on output */
-  guint8 *sd = image;
-  float opacity = data->opacity / 100.0;
-  /*
-  #ifdef _OPENMP
-    #pragma omp parallel for default(none) shared(in, out,sd,opacity) schedule(static)
-  #endif
-  */
-  for(int j = 0; j < roi_out->height; j++)
-    for(int i = 0; i < roi_out->width; i++)
-    {
-      float alpha = (sd[3] / 255.0) * opacity;
-      /* svg uses a premultiplied alpha, so only use opacity for the blending */
-      out[0] = ((1.0 - alpha) * in[0]) + (opacity * (sd[2] / 255.0));
-      out[1] = ((1.0 - alpha) * in[1]) + (opacity * (sd[1] / 255.0));
-      out[2] = ((1.0 - alpha) * in[2]) + (opacity * (sd[0] / 255.0));
-      out[3] = in[3];
-
-      out += ch;
-      in += ch;
-      sd += 4;
-    }
-
-
-  /* clean up */
-  cairo_surface_destroy(surface);
-  g_object_unref(svg);
-  g_free(image);
+  _watermark_composite(in, out, roi_out->width, roi_out->height, ch, raster, x0, y0, data->opacity / 100.0);
+
+  _raster_unref(raster);
 }
 
 static void watermark_callback(GtkWidget *tb, gpointer user_data)
@@ -1280,6 +1499,27 @@ void gui_update(struct dt_iop_module_t *self)
   gtk_font_button_set_font_name(GTK_FONT_BUTTON(g->fontsel), p->font);
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  dt_iop_watermark_global_data_t *gd
+      = (dt_iop_watermark_global_data_t *)calloc(1, sizeof(dt_iop_watermark_global_data_t));
+  dt_pthread_mutex_init(&gd->lock, NULL);
+  module->data = gd;
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)module->data;
+  for(int k = 0; k < WATERMARK_CACHE_SIZE; k++)
+  {
+    g_free(gd->cache[k].svgdoc);
+    _raster_unref(gd->cache[k].raster);
+  }
+  dt_pthread_mutex_destroy(&gd->lock);
+  free(module->data);
+  module->data = NULL;
+}
+
 void init(dt_iop_module_t *module)
 {
   module->params = calloc(1, sizeof(dt_iop_watermark_params_t));
@@ -0,0 +1,92 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "tests/bench.h"
+#include "common/darktable.h"
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// darktable keeps pointers into it until dt_cleanup()
+static char **m_arg = NULL;
+
+static void usage(const char *progname)
+{
+  fprintf(stderr, "usage: %s [--width <w>] [--height <h>] [--runs <n>] [--core <darktable options>]\n", progname);
+}
+
+void dt_bench_init(int argc, char *arg[], const char *name, int *width, int *height, int *runs,
+                   const int min_size)
+{
+  int k;
+  for(k = 1; k < argc; k++)
+  {
+    if(!strcmp(arg[k], "--width") && argc > k + 1)
+      *width = atoi(arg[++k]);
+    else if(!strcmp(arg[k], "--height") && argc > k + 1)
+      *height = atoi(arg[++k]);
+    else if(!strcmp(arg[k], "--runs") && argc > k + 1)
+      *runs = MAX(1, atoi(arg[++k]));
+    else if(!strcmp(arg[k], "--core"))
+    {
+      k++;
+      break;
+    }
+    else
+    {
+      usage(arg[0]);
+      exit(1);
+    }
+  }
+  if(*width < min_size || *height < min_size)
+  {
+    usage(arg[0]);
+    exit(1);
+  }
+
+  int m_argc = 0;
+  m_arg = malloc((5 + argc - k + 1) * sizeof(char *));
+  m_arg[m_argc++] = (char *)name;
+  m_arg[m_argc++] = "--library";
+  m_arg[m_argc++] = ":memory:";
+  m_arg[m_argc++] = "--conf";
+  m_arg[m_argc++] = "write_sidecar_files=FALSE";
+  for(; k < argc; k++) m_arg[m_argc++] = arg[k];
+  m_arg[m_argc] = NULL;
+
+  // init dt without gui and without data.db:
+  if(dt_init(m_argc, m_arg, FALSE, FALSE, NULL))
+  {
+    free(m_arg);
+    m_arg = NULL;
+    exit(1);
+  }
+}
+
+void dt_bench_cleanup()
+{
+  dt_cleanup();
+  free(m_arg);
+  m_arg = NULL;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,36 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+// command line and setup shared by the darktable-bench-* programs:
+//
+// usage: <name> [--width <w>] [--height <h>] [--runs <n>] [--core <darktable options>]
+
+/** parses the options into width, height and runs, which hold the defaults when called. exits with the usage
+ * for unknown options or an image smaller than min_size in either direction. then starts darktable without gui
+ * on an in-memory library, with the options after --core, and exits if that fails. */
+void dt_bench_init(int argc, char *arg[], const char *name, int *width, int *height, int *runs,
+                   const int min_size);
+
+/** shuts darktable down again. */
+void dt_bench_cleanup();
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,237 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// benchmark for the demosaic iop: runs every algorithm on synthetic bayer and x-trans mosaics through the
+// real module (including codepath dispatch) and prints the wall time per run. also times the downscaling of the
+// preview and thumbnail pipes, with the per pixel footprint and with binned cfa cells.
+//
+// usage: darktable-bench-demosaic [--width <w>] [--height <h>] [--runs <n>] [--core <darktable options>]
+
+#include "common/darktable.h"
+#include "common/introspection.h"
+#include "control/conf.h"
+#include "develop/develop.h"
+#include "develop/imageop.h"
+#include "develop/imageop_math.h"
+#include "develop/pixelpipe.h"
+#include "tests/bench.h"
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct bench_method_t
+{
+  const char *name; // name of the dt_iop_demosaic_method_t member
+  gboolean xtrans;
+} bench_method_t;
+
+static const bench_method_t methods[] = {
+  { "DT_IOP_DEMOSAIC_PPG", FALSE },         { "DT_IOP_DEMOSAIC_AMAZE", FALSE },
+  { "DT_IOP_DEMOSAIC_VNG4", FALSE },        { "DT_IOP_DEMOSAIC_VNG", TRUE },
+  { "DT_IOP_DEMOSAIC_MARKESTEIJN", TRUE },  { "DT_IOP_DEMOSAIC_MARKESTEIJN_3", TRUE },
+  { "DT_IOP_DEMOSAIC_FDC", TRUE },          { NULL, FALSE }
+};
+
+// fuji x-trans pattern as stored by rawspeed, and RGGB
+static const uint8_t xtrans_pattern[6][6] = { { 1, 1, 0, 1, 1, 2 }, { 1, 1, 2, 1, 1, 0 }, { 2, 0, 1, 0, 2, 1 },
+                                              { 1, 1, 2, 1, 1, 0 }, { 1, 1, 0, 1, 1, 2 }, { 0, 2, 1, 2, 0, 1 } };
+static const uint32_t bayer_filters = 0x94949494u;
+
+// smooth gradients plus some hard edges and noise, so the direction-sensitive algorithms do real work
+static float *make_mosaic(const int width, const int height, const gboolean xtrans)
+{
+  float *buf = dt_alloc_align(64, sizeof(float) * width * height);
+  if(!buf) return NULL;
+  unsigned int seed = 42;
+  for(int j = 0; j < height; j++)
+    for(int i = 0; i < width; i++)
+    {
+      const int c = xtrans ? xtrans_pattern[j % 6][i % 6] : (bayer_filters >> (((j << 1 & 14) + (i & 1)) << 1) & 3);
+      const float base = ((i / 64 + j / 64) & 1) ? 0.7f : 0.2f;
+      const float grad = 0.25f * i / width + 0.05f * c;
+      buf[(size_t)j * width + i] = base + grad + 0.01f * (rand_r(&seed) / (float)RAND_MAX);
+    }
+  return buf;
+}
+
+static int method_value(dt_iop_module_t *module, const char *name)
+{
+  dt_introspection_field_t *f = module->get_f("demosaicing_method");
+  if(!f || f->header.type != DT_INTROSPECTION_TYPE_ENUM) return -1;
+  for(dt_introspection_type_enum_tuple_t *iter = f->Enum.values; iter->name; iter++)
+    if(!strcmp(iter->name, name)) return iter->value;
+  return -1;
+}
+
+// the downscaling the preview and thumbnail pipes do instead of a full demosaic, binned if binned is set
+static double run_downscale(const float *in, float *out, const int width, const int height, const float scale,
+                            const gboolean xtrans, const gboolean binned, const int runs)
+{
+  const dt_iop_roi_t roi_in = { 0, 0, width, height, 1.0f };
+  const dt_iop_roi_t roi_out = { 0, 0, (int)(width * scale), (int)(height * scale), scale };
+  const uint32_t filters = xtrans ? 9u : bayer_filters;
+  double best = 1e30;
+  for(int r = 0; r < runs; r++)
+  {
+    const double start = dt_get_wtime();
+    if(binned)
+      dt_iop_clip_and_zoom_demosaic_binned_f(out, in, &roi_out, &roi_in, roi_out.width, width, filters,
+                                             xtrans_pattern);
+    else if(xtrans)
+      dt_iop_clip_and_zoom_demosaic_third_size_xtrans_f(out, in, &roi_out, &roi_in, roi_out.width, width,
+                                                        xtrans_pattern);
+    else
+      dt_iop_clip_and_zoom_demosaic_half_size_f(out, in, &roi_out, &roi_in, roi_out.width, width, filters);
+    const double t = dt_get_wtime() - start;
+    if(t < best) best = t;
+  }
+  return best;
+}
+
+static double run(dt_iop_module_t *module, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece,
+                  const float *in, float *out, const int width, const int height, const int runs)
+{
+  const dt_iop_roi_t roi = { 0, 0, width, height, 1.0f };
+  double best = 1e30;
+  for(int r = 0; r < runs; r++)
+  {
+    const double start = dt_get_wtime();
+    module->process(module, piece, in, out, &roi, &roi);
+    const double t = dt_get_wtime() - start;
+    if(t < best) best = t;
+  }
+  return best;
+}
+
+int main(int argc, char *arg[])
+{
+  int width = 6000, height = 4000, runs = 3;
+
+  // markesteijn and amaze need some room for their borders
+  dt_bench_init(argc, arg, "darktable-bench-demosaic", &width, &height, &runs, 64);
+
+  dt_iop_module_so_t *so = NULL;
+  for(GList *iter = darktable.iop; iter; iter = g_list_next(iter))
+    if(!strcmp(((dt_iop_module_so_t *)iter->data)->op, "demosaic")) so = (dt_iop_module_so_t *)iter->data;
+  if(!so)
+  {
+    fprintf(stderr, "[bench_demosaic] demosaic module not found\n");
+    dt_bench_cleanup();
+    exit(1);
+  }
+
+  dt_develop_t *dev = calloc(1, sizeof(dt_develop_t));
+  dev->image_storage.flags = DT_IMAGE_RAW;
+  dev->image_storage.exif_iso = 100.0f;
+  dt_iop_module_t *module = calloc(1, sizeof(dt_iop_module_t));
+  if(dt_iop_load_module(module, so, dev))
+  {
+    fprintf(stderr, "[bench_demosaic] could not load demosaic module\n");
+    free(module);
+    free(dev);
+    dt_bench_cleanup();
+    exit(1);
+  }
+
+  float *bayer = make_mosaic(width, height, FALSE);
+  float *xtrans = make_mosaic(width, height, TRUE);
+  float *out = dt_alloc_align(64, sizeof(float) * 4 * width * height);
+  if(!bayer || !xtrans || !out)
+  {
+    fprintf(stderr, "[bench_demosaic] could not allocate %dx%d buffers\n", width, height);
+    dt_free_align(bayer);
+    dt_free_align(xtrans);
+    dt_free_align(out);
+    dt_iop_cleanup_module(module);
+    free(module);
+    free(dev);
+    dt_bench_cleanup();
+    exit(1);
+  }
+
+  dt_dev_pixelpipe_t pipe;
+  memset(&pipe, 0, sizeof(pipe));
+  pipe.type = DT_DEV_PIXELPIPE_EXPORT;
+  pipe.image.flags = DT_IMAGE_RAW;
+  pipe.image.width = pipe.iwidth = width;
+  pipe.image.height = pipe.iheight = height;
+  memcpy(pipe.dsc.xtrans, xtrans_pattern, sizeof(xtrans_pattern));
+
+  dt_dev_pixelpipe_iop_t piece;
+  memset(&piece, 0, sizeof(piece));
+  piece.module = module;
+  piece.pipe = &pipe;
+  piece.enabled = 1;
+  module->init_pipe(module, &pipe, &piece);
+
+  const dt_codepath_t codepath = darktable.codepath;
+  printf("demosaic benchmark, %dx%d pixels, best of %d runs, %d threads\n", width, height, runs,
+         dt_get_num_threads());
+  printf("%-32s %12s %12s\n", "method", "default [s]", "avx2 [s]");
+
+  for(const bench_method_t *m = methods; m->name; m++)
+  {
+    const int value = method_value(module, m->name);
+    if(value < 0) continue;
+    *(int *)module->get_p(module->params, "demosaicing_method") = value;
+    pipe.dsc.filters = m->xtrans ? 9u : bayer_filters;
+    module->commit_params(module, module->params, &pipe, &piece);
+
+    const float *in = m->xtrans ? xtrans : bayer;
+    darktable.codepath.AVX2 = 0;
+    const double t_plain = run(module, &pipe, &piece, in, out, width, height, runs);
+    darktable.codepath = codepath;
+    if(codepath.AVX2)
+    {
+      const double t_avx2 = run(module, &pipe, &piece, in, out, width, height, runs);
+      printf("%-32s %12.3f %12.3f\n", m->name, t_plain, t_avx2);
+    }
+    else
+      printf("%-32s %12.3f %12s\n", m->name, t_plain, "n/a");
+  }
+
+  printf("\n%-32s %12s %12s\n", "downscale", "footprint [s]", "binned [s]");
+  for(int k = 0; k < 2; k++)
+    for(float scale = 0.25f; scale >= 0.0625f; scale /= 2.0f)
+    {
+      const gboolean is_xtrans = k == 1;
+      const float *in = is_xtrans ? xtrans : bayer;
+      const double t_footprint = run_downscale(in, out, width, height, scale, is_xtrans, FALSE, runs);
+      const double t_binned = run_downscale(in, out, width, height, scale, is_xtrans, TRUE, runs);
+      char name[64];
+      snprintf(name, sizeof(name), "%s 1/%d", is_xtrans ? "x-trans" : "bayer", (int)(1.0f / scale));
+      printf("%-32s %12.3f %12.3f\n", name, t_footprint, t_binned);
+    }
+
+  module->cleanup_pipe(module, &pipe, &piece);
+  dt_iop_cleanup_module(module);
+  free(module);
+  free(dev);
+  dt_free_align(bayer);
+  dt_free_align(xtrans);
+  dt_free_align(out);
+
+  dt_bench_cleanup();
+  return 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,157 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// benchmark for the placement of large buffers (memory/large_buffers): fills a full resolution buffer from one
+// thread, like a loader would, and then streams over it the way modules do, rows split over the threads with
+// schedule(static). prints the bandwidth of every cpu socket, which shows how much of the traffic has to cross
+// to the other one.
+//
+// usage: darktable-bench-memory [--width <w>] [--height <h>] [--runs <n>] [--core <darktable options>]
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "common/darktable.h"
+#include "control/conf.h"
+#include "tests/bench.h"
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#define MAX_SOCKETS 16
+
+static const char *modes[] = { "default", "huge pages", "huge pages, first touch", NULL };
+
+// the socket the calling thread runs on
+static int socket_of_thread()
+{
+#ifdef __linux__
+  const int cpu = sched_getcpu();
+  if(cpu < 0) return 0;
+  char path[128];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+  FILE *f = g_fopen(path, "r");
+  if(!f) return 0;
+  int socket = 0;
+  if(fscanf(f, "%d", &socket) != 1) socket = 0;
+  fclose(f);
+  return CLAMP(socket, 0, MAX_SOCKETS - 1);
+#else
+  return 0;
+#endif
+}
+
+// out = 2 * in + 1 over rows of 4 floats per pixel, returns the wall time. bytes[s] gets what the threads on
+// socket s moved.
+static double stream(float *const out, const float *const in, const int width, const int height,
+                     double *const bytes)
+{
+  const double start = dt_get_wtime();
+#ifdef _OPENMP
+#pragma omp parallel default(none)
+#endif
+  {
+    const int socket = socket_of_thread();
+    size_t moved = 0;
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+    for(int j = 0; j < height; j++)
+    {
+      const float *const i = in + (size_t)4 * width * j;
+      float *const o = out + (size_t)4 * width * j;
+      for(size_t k = 0; k < (size_t)4 * width; k++) o[k] = 2.0f * i[k] + 1.0f;
+      moved += (size_t)2 * 4 * width * sizeof(float);
+    }
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
+    bytes[socket] += moved;
+  }
+  return dt_get_wtime() - start;
+}
+
+int main(int argc, char *arg[])
+{
+  int width = 6000, height = 4000, runs = 5;
+
+  dt_bench_init(argc, arg, "darktable-bench-memory", &width, &height, &runs, 256);
+
+  const size_t size = sizeof(float) * 4 * width * height;
+  const dt_alloc_mode_t alloc_mode = darktable.alloc_mode;
+
+  printf("memory benchmark, %dx%d pixels (%.0f MB per buffer), best of %d runs, %d threads\n", width, height,
+         size / (1024.0 * 1024.0), runs, dt_get_num_threads());
+  printf("%-24s %12s %12s  %s\n", "mode", "alloc [ms]", "total GB/s", "GB/s per socket");
+
+  for(int m = 0; modes[m]; m++)
+  {
+    darktable.alloc_mode = (dt_alloc_mode_t)m;
+
+    const double start = dt_get_wtime();
+    float *in = dt_alloc_align(64, size);
+    float *out = dt_alloc_align(64, size);
+    const double alloc = dt_get_wtime() - start;
+    if(!in || !out)
+    {
+      fprintf(stderr, "[bench_memory] could not allocate %dx%d buffers\n", width, height);
+      exit(1);
+    }
+
+    // one thread fills both, like a loader or a memcpy from the cache
+    for(size_t i = 0; i < size / sizeof(float); i++) in[i] = (i & 255) / 255.0f;
+    memset(out, 0, size);
+
+    double best = 1e30;
+    double best_bytes[MAX_SOCKETS] = { 0 };
+    for(int r = 0; r < runs; r++)
+    {
+      double bytes[MAX_SOCKETS] = { 0 };
+      const double t = stream(out, in, width, height, bytes);
+      if(t < best)
+      {
+        best = t;
+        memcpy(best_bytes, bytes, sizeof(bytes));
+      }
+    }
+
+    double total = 0.0;
+    for(int s = 0; s < MAX_SOCKETS; s++) total += best_bytes[s];
+    printf("%-24s %12.1f %12.2f ", modes[m], 1000.0 * alloc, total / best / 1e9);
+    for(int s = 0; s < MAX_SOCKETS; s++)
+      if(best_bytes[s] > 0.0) printf(" [%d] %.2f", s, best_bytes[s] / best / 1e9);
+    printf("\n");
+
+    dt_free_align(in);
+    dt_free_align(out);
+  }
+
+  darktable.alloc_mode = alloc_mode;
+  dt_bench_cleanup();
+  return 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,180 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2018 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// benchmark for dt_interpolation_resample(): scales a synthetic image by the factors the darkroom and the
+// exporter typically ask for, with every interpolator and codepath. the first run includes building the
+// resampling plans, the following ones hit the plan cache.
+//
+// usage: darktable-bench-resample [--width <w>] [--height <h>] [--runs <n>] [--core <darktable options>]
+
+#include "common/darktable.h"
+#include "common/interpolation.h"
+#include "control/conf.h"
+#include "tests/bench.h"
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct bench_case_t
+{
+  const char *name;
+  int out_width; // the scale is derived from this, 0 means use scale
+  float scale;
+  int crop_width; // crop the output (zoomed in darkroom view), 0 for no crop
+  int crop_height;
+} bench_case_t;
+
+static const bench_case_t cases[] = {
+  { "thumbnail 256px", 256, 0.0f, 0, 0 },
+  { "darkroom preview 720px", 720, 0.0f, 0, 0 },
+  { "darkroom fit 1920px", 1920, 0.0f, 0, 0 },
+  { "export 2048px", 2048, 0.0f, 0, 0 },
+  { "export 50%", 0, 0.5f, 0, 0 },
+  { "export 2/3", 0, 2.0f / 3.0f, 0, 0 },
+  { "darkroom 200% 1920x1080", 0, 2.0f, 1920, 1080 },
+  { NULL, 0, 0.0f, 0, 0 }
+};
+
+static const char *interpolators[] = { "bilinear", "bicubic", "lanczos2", "lanczos3", NULL };
+
+static float *make_image(const int width, const int height)
+{
+  float *buf = dt_alloc_align(64, sizeof(float) * 4 * width * height);
+  if(!buf) return NULL;
+  unsigned int seed = 42;
+  for(int j = 0; j < height; j++)
+    for(int i = 0; i < width; i++)
+    {
+      float *p = buf + (size_t)4 * (j * width + i);
+      const float base = ((i / 64 + j / 64) & 1) ? 0.7f : 0.2f;
+      for(int c = 0; c < 3; c++) p[c] = base + 0.1f * c * i / width + 0.01f * (rand_r(&seed) / (float)RAND_MAX);
+      p[3] = 0.0f;
+    }
+  return buf;
+}
+
+// returns the time of the first run in *first and the best of the others
+static double run(const struct dt_interpolation *itor, float *out, const dt_iop_roi_t *const roi_out,
+                  const float *in, const dt_iop_roi_t *const roi_in, const int runs, double *first)
+{
+  double best = 1e30;
+  for(int r = 0; r < runs + 1; r++)
+  {
+    const double start = dt_get_wtime();
+    dt_interpolation_resample(itor, out, roi_out, roi_out->width * 4 * sizeof(float), in, roi_in,
+                              roi_in->width * 4 * sizeof(float));
+    const double t = dt_get_wtime() - start;
+    if(r == 0)
+      *first = t;
+    else if(t < best)
+      best = t;
+  }
+  // start the next configuration with an empty plan cache again
+  dt_interpolation_cleanup_plan_cache();
+  return best;
+}
+
+int main(int argc, char *arg[])
+{
+  int width = 6000, height = 4000, runs = 5;
+
+  dt_bench_init(argc, arg, "darktable-bench-resample", &width, &height, &runs, 256);
+
+  const dt_iop_roi_t roi_in = { 0, 0, width, height, 1.0f };
+  float *in = make_image(width, height);
+  // no case scales up without cropping
+  float *out = dt_alloc_align(64, sizeof(float) * 4 * MAX((size_t)width * height, (size_t)1920 * 1080));
+  if(!in || !out)
+  {
+    fprintf(stderr, "[bench_resample] could not allocate %dx%d buffers\n", width, height);
+    dt_free_align(in);
+    dt_free_align(out);
+    dt_bench_cleanup();
+    exit(1);
+  }
+
+  const dt_codepath_t codepath = darktable.codepath;
+  gchar *pref = dt_conf_get_string("plugins/lighttable/export/pixel_interpolator");
+
+  printf("resampling benchmark, %dx%d pixels, first and best of %d runs, %d threads\n", width, height, runs,
+         dt_get_num_threads());
+  printf("%-26s %-9s %-6s %12s %12s\n", "case", "itor", "path", "first [ms]", "best [ms]");
+
+  for(const bench_case_t *c = cases; c->name; c++)
+  {
+    const float scale = c->out_width ? c->out_width / (float)width : c->scale;
+    dt_iop_roi_t roi_out = { 0, 0, (int)(width * scale), (int)(height * scale), scale };
+    if(c->crop_width)
+    {
+      // centered crop of the zoomed image, like the darkroom main view
+      const int w = MIN(roi_out.width, c->crop_width);
+      const int h = MIN(roi_out.height, c->crop_height);
+      roi_out.x = (roi_out.width - w) / 2;
+      roi_out.y = (roi_out.height - h) / 2;
+      roi_out.width = w;
+      roi_out.height = h;
+    }
+
+    for(const char **name = interpolators; *name; name++)
+    {
+      // bicubic can't be asked for by type, it aliases DT_INTERPOLATION_USERPREF
+      dt_conf_set_string("plugins/lighttable/export/pixel_interpolator", *name);
+      const struct dt_interpolation *itor = dt_interpolation_new(DT_INTERPOLATION_USERPREF);
+
+      for(int path = 0; path < 3; path++)
+      {
+        darktable.codepath = codepath;
+        if(path == 0)
+        {
+          darktable.codepath.OPENMP_SIMD = 1;
+        }
+        else if(path == 1)
+        {
+          if(!codepath.SSE2) continue;
+          darktable.codepath.OPENMP_SIMD = 0;
+          darktable.codepath.AVX2 = 0;
+        }
+        else
+        {
+          if(!codepath.AVX2) continue;
+          darktable.codepath.OPENMP_SIMD = 0;
+        }
+
+        double first = 0.0;
+        const double best = run(itor, out, &roi_out, in, &roi_in, runs, &first);
+        printf("%-26s %-9s %-6s %12.2f %12.2f\n", c->name, itor->name,
+               path == 0 ? "plain" : path == 1 ? "sse2" : "avx2", 1000.0 * first, 1000.0 * best);
+      }
+    }
+  }
+
+  darktable.codepath = codepath;
+  dt_conf_set_string("plugins/lighttable/export/pixel_interpolator", pref ? pref : "lanczos3");
+  g_free(pref);
+  dt_free_align(in);
+  dt_free_align(out);
+
+  dt_bench_cleanup();
+  return 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;